@@ -152,6 +152,7 @@ struct http {
 	txt			*hd;
 	unsigned char		*hdf;
 #define HDF_FILTER		(1 << 0)	/* Filtered by Connection */
+#define HDF_HASH_SHIFT		1		/* Name hash, 0 = unknown */
 
 	/* NB: ->nhd and below zeroed/initialized by http_Teardown */
 	uint16_t		nhd;		/* Next free hd */
@@ -321,6 +322,9 @@ struct boc {
 	enum boc_state_e	state;
 	uint8_t			*vary;
 	uint64_t		len_so_far;
+
+	/* Requests waiting for this object, under the objhead mtx */
+	VTAILQ_HEAD(, req)	waitinglist;
 };
 
 /* Object core structure ---------------------------------------------
@@ -369,13 +373,15 @@ struct objcore {
 	float			grace;
 	float			keep;
 
-	uint8_t			flags;
+	uint16_t		flags;
 
 	uint8_t			exp_flags;
 
 	uint16_t		oa_present;
+	uint16_t		retired;	// hot refs not yet released
 
 	unsigned		timer_idx;	// XXX 4Gobj limit
+	float			lru_touch;	// deferred LRU_Touch()
 	double			last_lru;
 	VTAILQ_ENTRY(objcore)	hsh_list;
 	VTAILQ_ENTRY(objcore)	lru_list;
@@ -486,8 +492,9 @@ struct req {
 
 	struct objcore		*body_oc;
 
-	/* The busy objhead we sleep on */
+	/* The busy objcore we sleep on, and its objhead */
 	struct objhead		*hash_objhead;
+	struct objcore		*hash_objcore;
 
 	/* Built Vary string */
 	uint8_t			*vary_b;
@@ -510,6 +517,7 @@ struct req {
 	double			t_first;	/* First timestamp logged */
 	double			t_prev;		/* Previous timestamp logged */
 	double			t_req;		/* Headers complete */
+	double			t_wake;		/* Off the waiting list */
 
 	struct http_conn	htc[1];
 	struct vfp_ctx		*vfc;
@@ -681,6 +689,8 @@ void http_ForceField(struct http *to, unsigned n, const char *t);
 void HTTP_Setup(struct http *, struct ws *, struct vsl_log *, enum VSL_tag_e);
 void http_Teardown(struct http *ht);
 int http_GetHdr(const struct http *hp, const char *hdr, const char **ptr);
+int http_GetHdrHash(const struct http *hp, const char *hdr, unsigned hash,
+    const char **ptr);
 int http_GetHdrToken(const struct http *hp, const char *hdr,
     const char *token, const char **pb, const char **pe);
 int http_GetHdrField(const struct http *hp, const char *hdr,
@@ -694,6 +704,7 @@ const char *http_GetMethod(const struct http *hp);
 int http_HdrIs(const struct http *hp, const char *hdr, const char *val);
 void http_CopyHome(const struct http *hp);
 void http_Unset(struct http *hp, const char *hdr);
+void http_UnsetHash(struct http *hp, const char *hdr, unsigned hash);
 unsigned http_CountHdr(const struct http *hp, const char *hdr);
 void http_CollectHdr(struct http *hp, const char *hdr);
 void http_CollectHdrSep(struct http *hp, const char *hdr, const char *sep);
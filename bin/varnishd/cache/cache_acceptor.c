@@ -144,6 +144,10 @@ vca_periodic(double t0)
 	now = VTIM_real();
 	VSC_C_main->uptime = (uint64_t)(now - t0);
 
+	/* Fold the per-thread counter shards into the shared counters */
+	VRT_VSC_Shards_Summ(VSC_S_main);
+	VSC_C_main->summs++;
+
 	VTIM_postel = FEATURE(FEATURE_HTTP_DATE_POSTEL);
 }
 
@@ -510,7 +514,6 @@ vca_accept_task(struct worker *wrk, void *arg)
 				break;
 			}
 			wrk->stats->sess_fail++;
-			(void)Pool_TrySumstat(wrk);
 			continue;
 		}
 
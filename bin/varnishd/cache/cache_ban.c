@@ -76,11 +76,19 @@ ban_alloc(void)
 void
 BAN_Free(struct ban *b)
 {
+	unsigned u;
 
 	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
 	AZ(b->refcount);
 	assert(VTAILQ_EMPTY(&b->objcore));
 
+	if (b->code != NULL) {
+		CHECK_OBJ(b->code, BAN_CODE_MAGIC);
+		for (u = 0; u < b->code->ntest; u++)
+			if (b->code->test[u].re != NULL)
+				VRE_free(&b->code->test[u].re);
+		FREE_OBJ(b->code);
+	}
 	if (b->spec != NULL)
 		free(b->spec);
 	FREE_OBJ(b);
@@ -213,6 +221,71 @@ ban_iter(const uint8_t **bs, struct ban_test *bt)
 		bt->arg2_spec = ban_get_lump(bs);
 }
 
+/*--------------------------------------------------------------------
+ * Compile the tests of a ban spec into b->code
+ */
+
+uint32_t
+ban_hash(const char *s)
+{
+	uint32_t h = 0x811c9dc5;
+
+	for (; *s != '\0'; s++) {
+		h ^= (uint8_t)*s;
+		h *= 0x01000193;
+	}
+	return (h);
+}
+
+int
+ban_compile(struct ban *b)
+{
+	struct ban_test bt;
+	struct ban_code_test *ct;
+	struct ban_code *bc;
+	const uint8_t *bs, *be;
+	const char *error;
+	unsigned n = 0;
+	int erroroffset;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	AN(b->spec);
+	AZ(b->code);
+
+	be = b->spec + ban_len(b->spec);
+	for (bs = b->spec + BANS_HEAD_LEN; bs < be; n++)
+		ban_iter(&bs, &bt);
+
+	bc = calloc(1, sizeof *bc + n * sizeof *bc->test);
+	if (bc == NULL)
+		return (-1);
+	bc->magic = BAN_CODE_MAGIC;
+	bc->ntest = n;
+
+	ct = bc->test;
+	for (bs = b->spec + BANS_HEAD_LEN; bs < be; ct++) {
+		ban_iter(&bs, &bt);
+		ct->oper = bt.oper;
+		ct->arg1 = bt.arg1;
+		ct->arg1_spec = bt.arg1_spec;
+		if (bt.arg1 == BANS_ARG_OBJSTATUS)
+			ct->arg1_spec = H__Status;
+		ct->arg2 = bt.arg2;
+		ct->arg2_spec = bt.arg2_spec;
+		if (bt.oper == BANS_OPER_EQ || bt.oper == BANS_OPER_NEQ)
+			ct->arg2_hash = ban_hash(bt.arg2);
+		/* If VRE fails us, ban_match() runs the stored pattern */
+		if (bt.oper == BANS_OPER_MATCH || bt.oper == BANS_OPER_NMATCH)
+			ct->re = VRE_compile(bt.arg2, 0, &error, &erroroffset);
+	}
+	assert(ct == bc->test + n);
+
+	bc->eqidx = n == 1 && bc->test[0].arg1 == BANS_ARG_OBJHTTP &&
+	    bc->test[0].oper == BANS_OPER_EQ;
+	b->code = bc;
+	return (0);
+}
+
 /*--------------------------------------------------------------------
  * A new object is created, grab a reference to the newest ban
  */
@@ -238,15 +311,24 @@ BAN_NewObjCore(struct objcore *oc)
 void
 BAN_DestroyObj(struct objcore *oc)
 {
+	struct ban *b;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	Lck_Lock(&ban_mtx);
-	CHECK_OBJ_ORNULL(oc->ban, BAN_MAGIC);
-	if (oc->ban != NULL) {
-		assert(oc->ban->refcount > 0);
-		oc->ban->refcount--;
-		VTAILQ_REMOVE(&oc->ban->objcore, oc, ban_list);
+	b = oc->ban;
+	CHECK_OBJ_ORNULL(b, BAN_MAGIC);
+	if (b != NULL) {
+		assert(b->refcount > 0);
+		b->refcount--;
+		VTAILQ_REMOVE(&b->objcore, oc, ban_list);
 		oc->ban = NULL;
+		/*
+		 * Objects can outlive the lurker pass which killed them,
+		 * tell it when the last one holding up the tail is gone.
+		 */
+		if (b->refcount == 0 && b != VTAILQ_FIRST(&ban_head) &&
+		    b == VTAILQ_LAST(&ban_head, banhead_s))
+			ban_kick_lurker();
 	}
 	Lck_Unlock(&ban_mtx);
 }
@@ -386,6 +468,7 @@ ban_reload(const uint8_t *ban, unsigned len)
 	b2->spec = malloc(len);
 	AN(b2->spec);
 	memcpy(b2->spec, ban, len);
+	AZ(ban_compile(b2));
 	if (ban[BANS_FLAGS] & BANS_FLAG_REQ) {
 		VSC_C_main->bans_req++;
 		b2->flags |= BANS_FLAG_REQ;
@@ -453,63 +536,133 @@ BAN_Time(const struct ban *b)
 }
 
 /*--------------------------------------------------------------------
- * Evaluate ban-spec
+ * Evaluate bans against an object
  */
 
+void
+ban_eval_init(struct ban_eval *be, struct worker *wrk, struct objcore *oc,
+    const struct http *reqhttp)
+{
+
+	INIT_OBJ(be, BAN_EVAL_MAGIC);
+	be->wrk = wrk;
+	be->oc = oc;
+	be->reqhttp = reqhttp;
+}
+
 int
-ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
-    const struct http *reqhttp, unsigned *tests)
+ban_hdr_eq(const char *spec1, const char *spec2)
 {
-	struct ban_test bt;
-	const uint8_t *be;
-	const char *p;
+
+	return (spec1 == spec2 || (spec1[0] == spec2[0] &&
+	    !strncasecmp(spec1 + 1, spec2 + 1, spec1[0])));
+}
+
+/*
+ * Look up an object header, or :status, remembering it for the next
+ * ban testing the same header.  If hash is not NULL, the value must
+ * be non-NULL for it to be filled in.
+ */
+
+const char *
+ban_eval_hdr(struct ban_eval *be, const char *spec, uint32_t *hash)
+{
+	const char *val;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(be, BAN_EVAL_MAGIC);
+	for (u = 0; u < be->nhdr; u++)
+		if (ban_hdr_eq(be->hdr[u].spec, spec))
+			break;
+	if (u == be->nhdr) {
+		val = HTTP_GetHdrPack(be->wrk, be->oc, spec);
+		if (u == BAN_EVAL_NHDR) {
+			if (hash != NULL && val != NULL)
+				*hash = ban_hash(val);
+			return (val);
+		}
+		be->hdr[u].spec = spec;
+		be->hdr[u].val = val;
+		be->hdr[u].hashed = 0;
+		be->nhdr++;
+	}
+	if (hash != NULL && be->hdr[u].val != NULL) {
+		if (!be->hdr[u].hashed) {
+			be->hdr[u].hash = ban_hash(be->hdr[u].val);
+			be->hdr[u].hashed = 1;
+		}
+		*hash = be->hdr[u].hash;
+	}
+	return (be->hdr[u].val);
+}
+
+static int
+ban_match(const struct ban_code_test *ct, const char *arg1)
+{
+
+	if (ct->re != NULL)
+		return (VRE_exec(ct->re, arg1, strlen(arg1), 0, 0,
+		    NULL, 0, NULL) >= 0);
+	return (pcre_exec(ct->arg2_spec, NULL, arg1, strlen(arg1),
+	    0, 0, NULL, 0) >= 0);
+}
+
+int
+ban_evaluate(struct ban_eval *be, const struct ban *b, unsigned *tests)
+{
+	const struct ban_code_test *ct, *cte;
 	const char *arg1;
+	uint32_t h = 0, *hp;
 
-	be = bs + ban_len(bs);
-	bs += BANS_HEAD_LEN;
-	while (bs < be) {
+	CHECK_OBJ_NOTNULL(be, BAN_EVAL_MAGIC);
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	CHECK_OBJ_NOTNULL(b->code, BAN_CODE_MAGIC);
+
+	cte = b->code->test + b->code->ntest;
+	for (ct = b->code->test; ct < cte; ct++) {
 		(*tests)++;
-		ban_iter(&bs, &bt);
 		arg1 = NULL;
-		switch (bt.arg1) {
+		hp = NULL;
+		if (ct->oper == BANS_OPER_EQ || ct->oper == BANS_OPER_NEQ)
+			hp = &h;
+		switch (ct->arg1) {
 		case BANS_ARG_URL:
-			AN(reqhttp);
-			arg1 = reqhttp->hd[HTTP_HDR_URL].b;
+			AN(be->reqhttp);
+			arg1 = be->reqhttp->hd[HTTP_HDR_URL].b;
+			hp = NULL;
 			break;
 		case BANS_ARG_REQHTTP:
-			AN(reqhttp);
-			(void)http_GetHdr(reqhttp, bt.arg1_spec, &p);
-			arg1 = p;
+			AN(be->reqhttp);
+			(void)http_GetHdr(be->reqhttp, ct->arg1_spec, &arg1);
+			hp = NULL;
 			break;
 		case BANS_ARG_OBJHTTP:
-			arg1 = HTTP_GetHdrPack(wrk, oc, bt.arg1_spec);
-			break;
 		case BANS_ARG_OBJSTATUS:
-			arg1 = HTTP_GetHdrPack(wrk, oc, H__Status);
+			arg1 = ban_eval_hdr(be, ct->arg1_spec, hp);
 			break;
 		default:
 			WRONG("Wrong BAN_ARG code");
 		}
 
-		switch (bt.oper) {
+		switch (ct->oper) {
 		case BANS_OPER_EQ:
-			if (arg1 == NULL || strcmp(arg1, bt.arg2))
+			if (arg1 == NULL ||
+			    (hp != NULL && h != ct->arg2_hash) ||
+			    strcmp(arg1, ct->arg2))
 				return (0);
 			break;
 		case BANS_OPER_NEQ:
-			if (arg1 != NULL && !strcmp(arg1, bt.arg2))
+			if (arg1 != NULL &&
+			    (hp == NULL || h == ct->arg2_hash) &&
+			    !strcmp(arg1, ct->arg2))
 				return (0);
 			break;
 		case BANS_OPER_MATCH:
-			if (arg1 == NULL ||
-			    pcre_exec(bt.arg2_spec, NULL, arg1, strlen(arg1),
-			    0, 0, NULL, 0) < 0)
+			if (arg1 == NULL || !ban_match(ct, arg1))
 				return (0);
 			break;
 		case BANS_OPER_NMATCH:
-			if (arg1 != NULL &&
-			    pcre_exec(bt.arg2_spec, NULL, arg1, strlen(arg1),
-			    0, 0, NULL, 0) >= 0)
+			if (arg1 != NULL && ban_match(ct, arg1))
 				return (0);
 			break;
 		default:
@@ -519,6 +672,20 @@ ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
 	return (1);
 }
 
+/*--------------------------------------------------------------------
+ * Unlocked check if an object has already been tested against all bans.
+ * Used by the lockless hit path, which must take the long way through
+ * BAN_CheckObject() if this fails.
+ */
+
+int
+BAN_Fresh(const struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	return (oc->ban != NULL && oc->ban == ban_start);
+}
+
 /*--------------------------------------------------------------------
  * Check an object against all applicable bans
  *
@@ -535,6 +702,7 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	struct ban *b;
 	struct vsl_log *vsl;
 	struct ban *b0, *bn;
+	struct ban_eval be;
 	unsigned tests;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -575,11 +743,12 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	 * inspect the list past that ban.
 	 */
 	tests = 0;
+	ban_eval_init(&be, wrk, oc, req->http);
 	for (b = b0; b != bn; b = VTAILQ_NEXT(b, list)) {
 		CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
 		if (b->flags & BANS_FLAG_COMPLETED)
 			continue;
-		if (ban_evaluate(wrk, b->spec, oc, req->http, &tests))
+		if (ban_evaluate(&be, b, &tests))
 			break;
 	}
 
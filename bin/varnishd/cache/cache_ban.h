@@ -84,6 +84,52 @@
 #define BANS_ARG_OBJHTTP	0x1a
 #define BANS_ARG_OBJSTATUS	0x1b
 
+/*--------------------------------------------------------------------
+ * The tests of a ban, compiled once when the ban is created: regular
+ * expressions are compiled through VRE (and thus JIT'ed if available)
+ * and string operands are hashed.  The pointers point into the spec.
+ */
+
+struct ban_code_test {
+	uint8_t			oper;
+	uint8_t			arg1;
+	const char		*arg1_spec;
+	const char		*arg2;
+	uint32_t		arg2_hash;
+	const void		*arg2_spec;
+	vre_t			*re;
+};
+
+struct ban_code {
+	unsigned		magic;
+#define BAN_CODE_MAGIC		0x0a4b3f27
+	unsigned		ntest;
+	unsigned		eqidx;		/* Lone obj.http.X == test */
+	struct ban_code_test	test[];
+};
+
+/*--------------------------------------------------------------------
+ * Evaluation state for one object, caching the object's headers
+ * across the tests of many bans.
+ */
+
+#define BAN_EVAL_NHDR		8
+
+struct ban_eval {
+	unsigned		magic;
+#define BAN_EVAL_MAGIC		0x4c9e12a0
+	unsigned		nhdr;
+	struct worker		*wrk;
+	struct objcore		*oc;
+	const struct http	*reqhttp;
+	struct {
+		const char	*spec;
+		const char	*val;
+		uint32_t	hash;
+		unsigned	hashed;
+	}			hdr[BAN_EVAL_NHDR];
+};
+
 /*--------------------------------------------------------------------*/
 
 struct ban {
@@ -92,10 +138,12 @@ struct ban {
 	unsigned		flags;		/* BANS_FLAG_* */
 	VTAILQ_ENTRY(ban)	list;
 	VTAILQ_ENTRY(ban)	l_list;
+	struct ban		*l_hnext;	/* lurker index */
 	int64_t			refcount;
 
 	VTAILQ_HEAD(,objcore)	objcore;
 	uint8_t			*spec;
+	struct ban_code		*code;
 };
 
 VTAILQ_HEAD(banhead_s,ban);
@@ -114,8 +162,14 @@ unsigned ban_len(const uint8_t *banspec);
 void ban_info_new(const uint8_t *ban, unsigned len);
 void ban_info_drop(const uint8_t *ban, unsigned len);
 
-int ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
-    const struct http *reqhttp, unsigned *tests);
+int ban_compile(struct ban *b);
+uint32_t ban_hash(const char *s);
+int ban_hdr_eq(const char *spec1, const char *spec2);
+void ban_eval_init(struct ban_eval *be, struct worker *wrk,
+    struct objcore *oc, const struct http *reqhttp);
+const char *ban_eval_hdr(struct ban_eval *be, const char *spec,
+    uint32_t *hash);
+int ban_evaluate(struct ban_eval *be, const struct ban *b, unsigned *tests);
 double ban_time(const uint8_t *banspec);
 int ban_equal(const uint8_t *bs1, const uint8_t *bs2);
 void BAN_Free(struct ban *b);
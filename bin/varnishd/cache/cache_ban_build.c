@@ -283,6 +283,11 @@ BAN_Commit(struct ban_proto *bp)
 	ln += BANS_HEAD_LEN;
 	vbe32enc(b->spec + BANS_LENGTH, ln);
 
+	if (ban_compile(b)) {
+		BAN_Free(b);
+		return (ban_error(bp, ban_build_err_no_mem));
+	}
+
 	Lck_Lock(&ban_mtx);
 	if (ban_shutdown) {
 		/* We could have raced a shutdown */
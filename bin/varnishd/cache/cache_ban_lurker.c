@@ -30,6 +30,8 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "cache_varnishd.h"
 
 #include "cache_ban.h"
@@ -175,7 +177,7 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 				 * dismantled under our feet - grab a ref
 				 */
 				AZ(oc->flags & OC_F_BUSY);
-				oc->refcnt += 1;
+				(void)OC_REFCNT_ADD(oc, 1);
 				VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
 				VTAILQ_INSERT_TAIL(&bt->objcore, oc, ban_list);
 				Lck_Unlock(&oh->mtx);
@@ -197,12 +199,123 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 	return (oc);
 }
 
+/*--------------------------------------------------------------------
+ * Bans which are a lone "obj.http.X == value" test, typically tag
+ * bans, are not evaluated one by one against each object.  Instead
+ * they go in a hash index on the value, and the lurker checks them
+ * all with one probe per distinct header name.
+ */
+
+static struct ban_idx {
+	unsigned		nban;
+	unsigned		nbucket;	/* power of two */
+	struct ban		**bucket;
+	unsigned		nspec;
+	unsigned		sspec;
+	const char		**spec;
+} ban_idx;
+
+static void
+ban_idx_reset(void)
+{
+
+	if (ban_idx.bucket != NULL)
+		memset(ban_idx.bucket, 0,
+		    ban_idx.nbucket * sizeof *ban_idx.bucket);
+	ban_idx.nban = 0;
+	ban_idx.nspec = 0;
+}
+
+static void
+ban_idx_link(struct ban *b)
+{
+	struct ban **bp;
+
+	bp = &ban_idx.bucket[b->code->test[0].arg2_hash &
+	    (ban_idx.nbucket - 1)];
+	b->l_hnext = *bp;
+	*bp = b;
+}
+
+static void
+ban_idx_insert(struct ban *b)
+{
+	struct ban **ob, *bb, *bn;
+	const char *spec;
+	unsigned u, on;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	CHECK_OBJ_NOTNULL(b->code, BAN_CODE_MAGIC);
+	AN(b->code->eqidx);
+
+	if (ban_idx.nban >= ban_idx.nbucket) {
+		ob = ban_idx.bucket;
+		on = ban_idx.nbucket;
+		ban_idx.nbucket = on == 0 ? 64 : on * 2;
+		ban_idx.bucket = calloc(ban_idx.nbucket,
+		    sizeof *ban_idx.bucket);
+		AN(ban_idx.bucket);
+		for (u = 0; u < on; u++) {
+			for (bb = ob[u]; bb != NULL; bb = bn) {
+				bn = bb->l_hnext;
+				ban_idx_link(bb);
+			}
+		}
+		free(ob);
+	}
+	ban_idx_link(b);
+	ban_idx.nban++;
+
+	spec = b->code->test[0].arg1_spec;
+	for (u = 0; u < ban_idx.nspec; u++)
+		if (ban_hdr_eq(ban_idx.spec[u], spec))
+			return;
+	if (ban_idx.nspec == ban_idx.sspec) {
+		ban_idx.sspec += 8;
+		ban_idx.spec = realloc(ban_idx.spec,
+		    ban_idx.sspec * sizeof *ban_idx.spec);
+		AN(ban_idx.spec);
+	}
+	ban_idx.spec[ban_idx.nspec++] = spec;
+}
+
+static struct ban *
+ban_idx_probe(struct ban_eval *be)
+{
+	const struct ban_code_test *ct;
+	struct ban *b;
+	const char *val;
+	uint32_t h;
+	unsigned u;
+
+	for (u = 0; u < ban_idx.nspec; u++) {
+		VSC_C_main->bans_lurker_tested++;
+		VSC_C_main->bans_lurker_tests_tested++;
+		val = ban_eval_hdr(be, ban_idx.spec[u], &h);
+		if (val == NULL)
+			continue;
+		b = ban_idx.bucket[h & (ban_idx.nbucket - 1)];
+		for (; b != NULL; b = b->l_hnext) {
+			ct = &b->code->test[0];
+			if (ct->arg2_hash == h &&
+			    !(b->flags & BANS_FLAG_COMPLETED) &&
+			    ban_hdr_eq(ct->arg1_spec, ban_idx.spec[u]) &&
+			    !strcmp(val, ct->arg2))
+				return (b);
+		}
+	}
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
 static void
 ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
     struct banhead_s *obans, struct ban *bd, int kill)
 {
 	struct ban *bl, *bln;
 	struct objcore *oc;
+	struct ban_eval be;
 	unsigned tests;
 	int i;
 
@@ -227,48 +340,55 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 		oc = ban_lurker_getfirst(vsl, bt);
 		if (oc == NULL)
 			return;
-		i = 0;
-		VTAILQ_FOREACH_REVERSE_SAFE(bl, obans, banhead_s, l_list, bln) {
-			if (oc->ban != bt) {
-				/*
-				 * HSH_Lookup() grabbed this oc, killed
-				 * it or tested it to top.  We're done.
-				 */
-				break;
-			}
-			if (bl->flags & BANS_FLAG_COMPLETED) {
-				/* Ban was overtaken by new (dup) ban */
-				VTAILQ_REMOVE(obans, bl, l_list);
-				continue;
-			}
-			if (kill == 1)
-				i = 1;
-			else {
+		ban_eval_init(&be, wrk, oc, NULL);
+		bl = NULL;
+		if (!kill && oc->ban == bt)
+			bl = ban_idx_probe(&be);
+		if (bl == NULL) {
+			VTAILQ_FOREACH_REVERSE_SAFE(bl, obans, banhead_s,
+			    l_list, bln) {
+				if (oc->ban != bt) {
+					/*
+					 * HSH_Lookup() grabbed this oc,
+					 * killed it or tested it to top.
+					 * We're done.
+					 */
+					bl = NULL;
+					break;
+				}
+				if (bl->flags & BANS_FLAG_COMPLETED) {
+					/* Ban was overtaken by new (dup) ban */
+					VTAILQ_REMOVE(obans, bl, l_list);
+					continue;
+				}
+				if (kill == 1)
+					break;
+				if (bl->code->eqidx)
+					continue;	/* Tested by the probe */
 				AZ(bl->flags & BANS_FLAG_REQ);
 				tests = 0;
-				i = ban_evaluate(wrk, bl->spec, oc, NULL,
-				    &tests);
+				i = ban_evaluate(&be, bl, &tests);
 				VSC_C_main->bans_lurker_tested++;
 				VSC_C_main->bans_lurker_tests_tested += tests;
-			}
-			if (i) {
-				if (kill) {
-					VSLb(vsl, SLT_ExpBan,
-					    "%u killed for lurker cutoff",
-					    ObjGetXID(wrk, oc));
-					VSC_C_main->
-					    bans_lurker_obj_killed_cutoff++;
-				} else {
-					VSLb(vsl, SLT_ExpBan,
-					    "%u banned by lurker",
-					    ObjGetXID(wrk, oc));
-					VSC_C_main->bans_lurker_obj_killed++;
-				}
-				HSH_Kill(oc);
-				break;
+				if (i)
+					break;
 			}
 		}
-		if (i == 0 && oc->ban == bt) {
+		i = 0;
+		if (bl != NULL) {
+			if (kill) {
+				VSLb(vsl, SLT_ExpBan,
+				    "%u killed for lurker cutoff",
+				    ObjGetXID(wrk, oc));
+				VSC_C_main->bans_lurker_obj_killed_cutoff++;
+			} else {
+				VSLb(vsl, SLT_ExpBan,
+				    "%u banned by lurker",
+				    ObjGetXID(wrk, oc));
+				VSC_C_main->bans_lurker_obj_killed++;
+			}
+			HSH_Kill(oc);
+		} else if (oc->ban == bt) {
 			Lck_Lock(&ban_mtx);
 			if (oc->ban == bt) {
 				bt->refcount--;
@@ -282,7 +402,7 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			if (i)
 				ObjSendEvent(wrk, oc, OEV_BANCHG);
 		}
-		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		(void)HSH_DerefObjCore(wrk, &oc);
 	}
 }
 
@@ -318,6 +438,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 	d = VTIM_real() - cache_param->ban_lurker_age;
 	bd = NULL;
 	VTAILQ_INIT(&obans);
+	ban_idx_reset();
 	for (; b != NULL; b = VTAILQ_NEXT(b, list)) {
 		if (bd != NULL && bd != b)
 			ban_lurker_test_ban(wrk, vsl, b, &obans, bd,
@@ -334,6 +455,8 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 		n = ban_time(b->spec) - d;
 		if (n < 0) {
 			VTAILQ_INSERT_TAIL(&obans, b, l_list);
+			if (b->code->eqidx)
+				ban_idx_insert(b);
 			if (bd == NULL)
 				bd = b;
 		} else if (n < dt) {
@@ -383,7 +506,6 @@ ban_lurker(struct worker *wrk, void *priv)
 		d += VTIM_real();
 		Lck_Lock(&ban_mtx);
 		if (gen == ban_generation) {
-			Pool_Sumstat(wrk);
 			(void)Lck_CondWait(&ban_lurker_cond, &ban_mtx, d);
 			ban_batch = 0;
 		}
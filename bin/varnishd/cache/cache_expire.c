@@ -28,18 +28,48 @@
  *
  * LRU and object timer handling.
  *
+ * Objects are partitioned over exp_threads expiry threads, each of which
+ * owns an inbox and a timer structure, either a binary heap or a timing
+ * wheel.
+ *
  */
 
 #include "config.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
 #include "cache_objhead.h"
 
 #include "binary_heap.h"
+#include "timing_wheel.h"
 #include "vtim.h"
 
+/* Both timer structures use zero for "not in the timer" */
+#define EXP_NOIDX			BINHEAP_NOIDX
+#define EXP_WHEEL_HZ			128.
+
+struct exp_priv;
+
+typedef void exp_timer_init_f(struct exp_priv *, double now);
+typedef void exp_timer_insert_f(struct exp_priv *, struct objcore *);
+typedef void exp_timer_delete_f(struct exp_priv *, struct objcore *);
+typedef void exp_timer_move_f(struct exp_priv *, struct objcore *,
+    double when);
+typedef struct objcore *exp_timer_due_f(struct exp_priv *, double now);
+typedef double exp_timer_next_f(const struct exp_priv *, double now);
+
+struct exp_timer {
+	const char			*name;
+	exp_timer_init_f		*init;
+	exp_timer_insert_f		*insert;
+	exp_timer_delete_f		*delete;
+	exp_timer_move_f		*move;
+	exp_timer_due_f			*due;
+	exp_timer_next_f		*next;
+};
+
 struct exp_priv {
 	unsigned			magic;
 #define EXP_PRIV_MAGIC			0x9db22482
@@ -47,14 +77,34 @@ struct exp_priv {
 	struct lock			mtx;
 	VSTAILQ_HEAD(,objcore)		inbox;
 	pthread_cond_t			condvar;
+	uint64_t			n_mailed;
 
 	/* owned by exp thread */
+	const struct exp_timer		*timer;
 	struct worker			*wrk;
 	struct vsl_log			vsl;
 	struct binheap			*heap;
+	struct twheel			*wheel;
 };
 
-static struct exp_priv *exphdl;
+static struct exp_priv **exphdl;
+static unsigned nexphdl;
+
+/*--------------------------------------------------------------------
+ * Find the expiry partition an objcore belongs to
+ */
+
+static struct exp_priv *
+exp_part(const struct objcore *oc)
+{
+	uint64_t u;
+
+	if (nexphdl == 1)
+		return (exphdl[0]);
+	u = (uintptr_t)oc >> 4;
+	u *= 0x9e3779b97f4a7c15ULL;
+	return (exphdl[(u >> 32) % nexphdl]);
+}
 
 /*--------------------------------------------------------------------
  * Calculate an objects effective ttl time, taking req.ttl into account
@@ -81,25 +131,29 @@ EXP_Ttl(const struct req *req, const struct objcore *oc)
 static void
 exp_mail_it(struct objcore *oc, uint8_t cmds)
 {
+	struct exp_priv *ep;
+
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
 
-	Lck_Lock(&exphdl->mtx);
+	ep = exp_part(oc);
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
+	Lck_Lock(&ep->mtx);
 	if ((cmds | oc->exp_flags) & OC_EF_REFD) {
 		if (!(oc->exp_flags & OC_EF_POSTED)) {
 			if (cmds & OC_EF_REMOVE)
-				VSTAILQ_INSERT_HEAD(&exphdl->inbox,
+				VSTAILQ_INSERT_HEAD(&ep->inbox,
 				    oc, exp_list);
 			else
-				VSTAILQ_INSERT_TAIL(&exphdl->inbox,
+				VSTAILQ_INSERT_TAIL(&ep->inbox,
 				    oc, exp_list);
 		}
 		oc->exp_flags |= cmds | OC_EF_POSTED;
 		AN(oc->exp_flags & OC_EF_REFD);
-		VSC_C_main->exp_mailed++;
-		AZ(pthread_cond_signal(&exphdl->condvar));
+		ep->n_mailed++;
+		AZ(pthread_cond_signal(&ep->condvar));
 	}
-	Lck_Unlock(&exphdl->mtx);
+	Lck_Unlock(&ep->mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -185,19 +239,22 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags)
 
 	if (flags & OC_EF_REMOVE) {
 		if (!(flags & OC_EF_INSERT)) {
-			assert(oc->timer_idx != BINHEAP_NOIDX);
-			binheap_delete(ep->heap, oc->timer_idx);
+			assert(oc->timer_idx != EXP_NOIDX);
+			ep->timer->delete(ep, oc);
 		}
-		assert(oc->timer_idx == BINHEAP_NOIDX);
+		assert(oc->timer_idx == EXP_NOIDX);
 		assert(oc->refcnt > 0);
 		AZ(oc->exp_flags);
 		ObjSendEvent(ep->wrk, oc, OEV_EXPIRE);
-		(void)HSH_DerefObjCore(ep->wrk, &oc, 0);
+		(void)HSH_DerefObjCore(ep->wrk, &oc);
 		return;
 	}
 
 	if (flags & OC_EF_MOVE) {
-		oc->timer_when = EXP_WHEN(oc);
+		if (flags & OC_EF_INSERT)
+			oc->timer_when = EXP_WHEN(oc);
+		else
+			ep->timer->move(ep, oc, EXP_WHEN(oc));
 		ObjSendEvent(ep->wrk, oc, OEV_TTLCHG);
 	}
 
@@ -211,20 +268,18 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags)
 	 */
 
 	if (flags & OC_EF_INSERT) {
-		assert(oc->timer_idx == BINHEAP_NOIDX);
-		binheap_insert(exphdl->heap, oc);
-		assert(oc->timer_idx != BINHEAP_NOIDX);
+		assert(oc->timer_idx == EXP_NOIDX);
+		ep->timer->insert(ep, oc);
+		assert(oc->timer_idx != EXP_NOIDX);
 	} else if (flags & OC_EF_MOVE) {
-		assert(oc->timer_idx != BINHEAP_NOIDX);
-		binheap_reorder(exphdl->heap, oc->timer_idx);
-		assert(oc->timer_idx != BINHEAP_NOIDX);
+		assert(oc->timer_idx != EXP_NOIDX);
 	} else {
 		WRONG("Objcore state wrong in inbox");
 	}
 }
 
 /*--------------------------------------------------------------------
- * Expire stuff from the binheap
+ * Expire stuff from the timer
  */
 
 static double
@@ -234,19 +289,16 @@ exp_expire(struct exp_priv *ep, double now)
 
 	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 
-	oc = binheap_root(ep->heap);
+	oc = ep->timer->due(ep, now);
 	if (oc == NULL)
-		return (now + 355./113.);
+		return (ep->timer->next(ep, now));
 	VSLb(&ep->vsl, SLT_ExpKill, "EXP_expire p=%p e=%.9f f=0x%x", oc,
 	    oc->timer_when - now, oc->flags);
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	assert(oc->timer_when <= now);
 
-	/* Ready ? */
-	if (oc->timer_when > now)
-		return (oc->timer_when);
-
-	VSC_C_main->n_expired++;
+	ep->wrk->stats->n_expired++;
 
 	Lck_Lock(&ep->mtx);
 	if (oc->exp_flags & OC_EF_POSTED) {
@@ -260,23 +312,22 @@ exp_expire(struct exp_priv *ep, double now)
 		if (!(oc->flags & OC_F_DYING))
 			HSH_Kill(oc);
 
-		/* Remove from binheap */
-		assert(oc->timer_idx != BINHEAP_NOIDX);
-		binheap_delete(ep->heap, oc->timer_idx);
-		assert(oc->timer_idx == BINHEAP_NOIDX);
+		/* Remove from timer */
+		assert(oc->timer_idx != EXP_NOIDX);
+		ep->timer->delete(ep, oc);
+		assert(oc->timer_idx == EXP_NOIDX);
 
 		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 		VSLb(&ep->vsl, SLT_ExpKill, "EXP_Expired x=%u t=%.0f",
 		    ObjGetXID(ep->wrk, oc), EXP_Ttl(NULL, oc) - now);
 		ObjSendEvent(ep->wrk, oc, OEV_EXPIRE);
-		(void)HSH_DerefObjCore(ep->wrk, &oc, 0);
+		(void)HSH_DerefObjCore(ep->wrk, &oc);
 	}
 	return (0);
 }
 
 /*--------------------------------------------------------------------
- * This thread monitors the root of the binary heap and whenever an
- * object expires, accounting also for graceability, it is killed.
+ * Binary heap timer
  */
 
 static int v_matchproto_(binheap_cmp_t)
@@ -300,6 +351,156 @@ object_update(void *priv, void *p, unsigned u)
 	oc->timer_idx = u;
 }
 
+static void v_matchproto_(exp_timer_init_f)
+exp_heap_init(struct exp_priv *ep, double now)
+{
+
+	(void)now;
+	ep->heap = binheap_new(NULL, object_cmp, object_update);
+	AN(ep->heap);
+}
+
+static void v_matchproto_(exp_timer_insert_f)
+exp_heap_insert(struct exp_priv *ep, struct objcore *oc)
+{
+
+	binheap_insert(ep->heap, oc);
+}
+
+static void v_matchproto_(exp_timer_delete_f)
+exp_heap_delete(struct exp_priv *ep, struct objcore *oc)
+{
+
+	binheap_delete(ep->heap, oc->timer_idx);
+}
+
+static void v_matchproto_(exp_timer_move_f)
+exp_heap_move(struct exp_priv *ep, struct objcore *oc, double when)
+{
+
+	oc->timer_when = when;
+	binheap_reorder(ep->heap, oc->timer_idx);
+}
+
+static struct objcore * v_matchproto_(exp_timer_due_f)
+exp_heap_due(struct exp_priv *ep, double now)
+{
+	struct objcore *oc;
+
+	oc = binheap_root(ep->heap);
+	CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
+	if (oc == NULL || oc->timer_when > now)
+		return (NULL);
+	return (oc);
+}
+
+static double v_matchproto_(exp_timer_next_f)
+exp_heap_next(const struct exp_priv *ep, double now)
+{
+	struct objcore *oc;
+
+	oc = binheap_root(ep->heap);
+	CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
+	if (oc == NULL)
+		return (now + 355./113.);
+	return (oc->timer_when);
+}
+
+static const struct exp_timer exp_heap = {
+	.name =		"binheap",
+	.init =		exp_heap_init,
+	.insert =	exp_heap_insert,
+	.delete =	exp_heap_delete,
+	.move =		exp_heap_move,
+	.due =		exp_heap_due,
+	.next =		exp_heap_next,
+};
+
+/*--------------------------------------------------------------------
+ * Timing wheel timer
+ *
+ * The wheel finds an object by its timer_when, so a move is a delete
+ * followed by an insert.
+ */
+
+static double v_matchproto_(twheel_when_t)
+object_when(void *priv, const void *p)
+{
+	const struct objcore *oc;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(oc, p, OBJCORE_MAGIC);
+	return (oc->timer_when);
+}
+
+static void v_matchproto_(exp_timer_init_f)
+exp_wheel_init(struct exp_priv *ep, double now)
+{
+
+	ep->wheel = twheel_new(NULL, object_when, object_update,
+	    now, EXP_WHEEL_HZ);
+	AN(ep->wheel);
+}
+
+static void v_matchproto_(exp_timer_insert_f)
+exp_wheel_insert(struct exp_priv *ep, struct objcore *oc)
+{
+
+	twheel_insert(ep->wheel, oc);
+}
+
+static void v_matchproto_(exp_timer_delete_f)
+exp_wheel_delete(struct exp_priv *ep, struct objcore *oc)
+{
+
+	twheel_delete(ep->wheel, oc, oc->timer_idx);
+}
+
+static void v_matchproto_(exp_timer_move_f)
+exp_wheel_move(struct exp_priv *ep, struct objcore *oc, double when)
+{
+
+	twheel_delete(ep->wheel, oc, oc->timer_idx);
+	oc->timer_when = when;
+	twheel_insert(ep->wheel, oc);
+}
+
+static struct objcore * v_matchproto_(exp_timer_due_f)
+exp_wheel_due(struct exp_priv *ep, double now)
+{
+	struct objcore *oc;
+
+	oc = twheel_root(ep->wheel, now);
+	CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
+	return (oc);
+}
+
+static double v_matchproto_(exp_timer_next_f)
+exp_wheel_next(const struct exp_priv *ep, double now)
+{
+	double t;
+
+	t = twheel_next(ep->wheel);
+	if (isnan(t))
+		return (now + 355./113.);
+	return (t);
+}
+
+static const struct exp_timer exp_wheel = {
+	.name =		"wheel",
+	.init =		exp_wheel_init,
+	.insert =	exp_wheel_insert,
+	.delete =	exp_wheel_delete,
+	.move =		exp_wheel_move,
+	.due =		exp_wheel_due,
+	.next =		exp_wheel_next,
+};
+
+/*--------------------------------------------------------------------
+ * This thread monitors the timer and whenever an object expires,
+ * accounting also for graceability, it is killed.
+ */
+
 static void * v_matchproto_(bgthread_t)
 exp_thread(struct worker *wrk, void *priv)
 {
@@ -311,17 +512,18 @@ exp_thread(struct worker *wrk, void *priv)
 	CAST_OBJ_NOTNULL(ep, priv, EXP_PRIV_MAGIC);
 	ep->wrk = wrk;
 	VSL_Setup(&ep->vsl, NULL, 0);
-	ep->heap = binheap_new(NULL, object_cmp, object_update);
-	AN(ep->heap);
+	ep->timer->init(ep, VTIM_real());
 	while (1) {
 
 		Lck_Lock(&ep->mtx);
+		wrk->stats->exp_mailed += ep->n_mailed;
+		ep->n_mailed = 0;
 		oc = VSTAILQ_FIRST(&ep->inbox);
 		CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
 		if (oc != NULL) {
 			assert(oc->refcnt >= 1);
 			VSTAILQ_REMOVE(&ep->inbox, oc, objcore, exp_list);
-			VSC_C_main->exp_received++;
+			wrk->stats->exp_received++;
 			tnext = 0;
 			flags = oc->exp_flags;
 			if (flags & OC_EF_REMOVE)
@@ -330,7 +532,6 @@ exp_thread(struct worker *wrk, void *priv)
 				oc->exp_flags &= OC_EF_REFD;
 		} else if (tnext > t) {
 			VSL_Flush(&ep->vsl, 0);
-			Pool_Sumstat(wrk);
 			(void)Lck_CondWait(&ep->condvar, &ep->mtx, tnext);
 		}
 		Lck_Unlock(&ep->mtx);
@@ -352,13 +553,22 @@ EXP_Init(void)
 {
 	struct exp_priv *ep;
 	pthread_t pt;
-
-	ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
-	AN(ep);
-
-	Lck_New(&ep->mtx, lck_exp);
-	AZ(pthread_cond_init(&ep->condvar, NULL));
-	VSTAILQ_INIT(&ep->inbox);
-	exphdl = ep;
-	WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
+	unsigned u;
+
+	nexphdl = cache_param->exp_threads;
+	assert(nexphdl > 0);
+	exphdl = calloc(nexphdl, sizeof *exphdl);
+	AN(exphdl);
+	for (u = 0; u < nexphdl; u++) {
+		ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
+		AN(ep);
+
+		Lck_New(&ep->mtx, lck_exp);
+		AZ(pthread_cond_init(&ep->condvar, NULL));
+		VSTAILQ_INIT(&ep->inbox);
+		ep->timer = cache_param->exp_wheel ? &exp_wheel : &exp_heap;
+		exphdl[u] = ep;
+	}
+	for (u = 0; u < nexphdl; u++)
+		WRK_BgThread(&pt, "cache-exp", exp_thread, exphdl[u]);
 }
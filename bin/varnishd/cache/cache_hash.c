@@ -74,8 +74,7 @@ struct rush {
 static const struct hash_slinger *hash;
 static struct objhead *private_oh;
 
-static void hsh_rush1(const struct worker *, struct objhead *,
-    struct rush *, int);
+static void hsh_rush1(const struct worker *, struct boc *, struct rush *);
 static void hsh_rush2(struct worker *, struct rush *);
 
 /*---------------------------------------------------------------------*/
@@ -89,7 +88,6 @@ hsh_newobjhead(void)
 	XXXAN(oh);
 	oh->refcnt = 1;
 	VTAILQ_INIT(&oh->objcs);
-	VTAILQ_INIT(&oh->waitinglist);
 	Lck_New(&oh->mtx, lck_objhdr);
 	return (oh);
 }
@@ -163,8 +161,9 @@ HSH_DeleteObjHead(const struct worker *wrk, struct objhead *oh)
 {
 
 	AZ(oh->refcnt);
+	AZ(oh->hot);
+	AZ(oh->vidx);
 	assert(VTAILQ_EMPTY(&oh->objcs));
-	assert(VTAILQ_EMPTY(&oh->waitinglist));
 	Lck_Delete(&oh->mtx);
 	wrk->stats->n_objecthead--;
 	FREE_OBJ(oh);
@@ -291,8 +290,8 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	/* Mark object busy and insert (precreated) objcore in
 	   objecthead. The new object inherits our objhead reference. */
 	oc->objhead = oh;
-	VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
-	oc->refcnt++;				// For EXP_Insert
+	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	(void)OC_REFCNT_ADD(oc, 1);		// For EXP_Insert
 	Lck_Unlock(&oh->mtx);
 
 	BAN_RefBan(oc, ban);
@@ -305,8 +304,8 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
 	oc->flags &= ~OC_F_BUSY;
-	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
+	if (oc->boc != NULL)
+		hsh_rush1(wrk, oc->boc, &rush);
 	Lck_Unlock(&oh->mtx);
 	hsh_rush2(wrk, &rush);
 }
@@ -329,10 +328,392 @@ hsh_insert_busyobj(struct worker *wrk, struct objhead *oh)
 	AN(oc->flags & OC_F_BUSY);
 	oc->refcnt = 1;		/* Owned by busyobj */
 	oc->objhead = oh;
-	VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
+	/* In front of the indexed objcores, if any */
+	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	return (oc);
+}
+
+/*---------------------------------------------------------------------
+ * The Vary index
+ *
+ * When objects with Vary pile up on an objhead, checking each of them
+ * against the request gets expensive.  Unbusied objcores with Vary are
+ * therefore entered in a per objhead index, sorted by the VRY_Hash()
+ * of their Vary matching string, and kept at the tail of oh->objcs
+ * marked with OC_F_VARYIDX.  HSH_Lookup() walks oh->objcs up to the
+ * first indexed objcore, and then only looks at the indexed objcores
+ * whose hash matches what VRY_Hash() makes of the request for each set
+ * of headers ("spec") in use on the objhead.  The first hit of the walk
+ * and of each spec is the newest of its kind, and the newest of those
+ * by t_origin wins, as it would on a plain walk of oh->objcs.
+ *
+ * Objcores with a spec beyond the first HSH_VIDX_NSPEC are not indexed
+ * and are found by walking oh->objcs as before.
+ */
+
+#define HSH_VIDX_NSPEC		4
+
+struct hsh_vidx_ent {
+	uint32_t		hash;
+	unsigned		spec;
+	struct objcore		*oc;
+};
+
+struct hsh_vidx {
+	unsigned		magic;
+#define HSH_VIDX_MAGIC		0x7a1dc9e5
+	unsigned		n;
+	unsigned		l;
+	struct hsh_vidx_ent	*ent;
+	uint8_t			*spec[HSH_VIDX_NSPEC];
+	unsigned		nspec[HSH_VIDX_NSPEC];
+};
+
+/* First entry with a hash not below h */
+
+static unsigned
+hsh_vidx_find(const struct hsh_vidx *vi, uint32_t h)
+{
+	unsigned lo = 0, hi, m;
+
+	hi = vi->n;
+	while (lo < hi) {
+		m = lo + (hi - lo) / 2;
+		if (vi->ent[m].hash < h)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+	return (lo);
+}
+
+static int
+hsh_vidx_insert(struct objhead *oh, struct objcore *oc, const uint8_t *vary,
+    ssize_t lvary, uint32_t h)
+{
+	struct hsh_vidx *vi;
+	struct hsh_vidx_ent *e;
+	unsigned u, s;
+
+	Lck_AssertHeld(&oh->mtx);
+	AZ(oc->flags & OC_F_VARYIDX);
+	assert(lvary > 0);
+
+	vi = oh->vidx;
+	if (vi == NULL) {
+		ALLOC_OBJ(vi, HSH_VIDX_MAGIC);
+		if (vi == NULL)
+			return (0);
+		oh->vidx = vi;
+	}
+	CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+
+	for (s = 0; s < HSH_VIDX_NSPEC; s++)
+		if (vi->spec[s] != NULL && VRY_SameHeaders(vi->spec[s], vary))
+			break;
+	if (s == HSH_VIDX_NSPEC) {
+		for (s = 0; s < HSH_VIDX_NSPEC; s++)
+			if (vi->spec[s] == NULL)
+				break;
+		if (s == HSH_VIDX_NSPEC)
+			return (0);
+		vi->spec[s] = malloc(lvary);
+		if (vi->spec[s] == NULL)
+			return (0);
+		memcpy(vi->spec[s], vary, lvary);
+	}
+
+	if (vi->n == vi->l) {
+		u = vi->l ? vi->l * 2 : 8;
+		e = realloc(vi->ent, u * sizeof *e);
+		if (e == NULL) {
+			if (vi->nspec[s] == 0) {
+				free(vi->spec[s]);
+				vi->spec[s] = NULL;
+			}
+			return (0);
+		}
+		vi->ent = e;
+		vi->l = u;
+	}
+
+	/* Newest first among equal hashes */
+	u = hsh_vidx_find(vi, h);
+	memmove(vi->ent + u + 1, vi->ent + u, (vi->n - u) * sizeof *vi->ent);
+	vi->ent[u].hash = h;
+	vi->ent[u].spec = s;
+	vi->ent[u].oc = oc;
+	vi->n++;
+	vi->nspec[s]++;
+	oc->flags |= OC_F_VARYIDX;
+	return (1);
+}
+
+static void
+hsh_vidx_remove(struct objhead *oh, struct objcore *oc)
+{
+	struct hsh_vidx *vi;
+	unsigned u, s;
+
+	Lck_AssertHeld(&oh->mtx);
+	if (!(oc->flags & OC_F_VARYIDX))
+		return;
+	oc->flags &= ~OC_F_VARYIDX;
+	vi = oh->vidx;
+	CHECK_OBJ_NOTNULL(vi, HSH_VIDX_MAGIC);
+	for (u = 0; u < vi->n; u++)
+		if (vi->ent[u].oc == oc)
+			break;
+	assert(u < vi->n);
+	s = vi->ent[u].spec;
+	vi->n--;
+	memmove(vi->ent + u, vi->ent + u + 1, (vi->n - u) * sizeof *vi->ent);
+	assert(vi->nspec[s] > 0);
+	if (--vi->nspec[s] == 0) {
+		free(vi->spec[s]);
+		vi->spec[s] = NULL;
+	}
+	if (vi->n == 0) {
+		free(vi->ent);
+		FREE_OBJ(vi);
+		oh->vidx = NULL;
+	}
+}
+
+/*---------------------------------------------------------------------
+ * The hot objcore of an objhead
+ *
+ * The first plain hit on an objcore without Vary makes it the objhead's
+ * hot objcore, and hashers which have a hit method can then hand it out
+ * with nothing but an atomic increment of its refcount.  The hot ref is
+ * dropped through the hasher's retire method, which defers it until no
+ * lockless reader can still be looking at oh->hot, and is counted in
+ * oc->retired until the hasher hands it to HSH_DerefRetired().
+ */
+
+static struct objcore *
+hsh_unhot(struct objhead *oh, const struct objcore *oc)
+{
+	struct objcore *hot;
+
+	Lck_AssertHeld(&oh->mtx);
+	hot = oh->hot;
+	if (hot == NULL || (oc != NULL && hot != oc))
+		return (NULL);
+#ifdef HAVE_ATOMIC_BUILTINS
+	__atomic_store_n(&oh->hot, NULL, __ATOMIC_RELEASE);
+	assert(__atomic_add_fetch(&hot->retired, 1, __ATOMIC_SEQ_CST) > 0);
+#endif
+	return (hot);
+}
+
+static void
+hsh_sethot(struct objhead *oh, struct objcore *oc, struct objcore **retire)
+{
+
+	Lck_AssertHeld(&oh->mtx);
+	AN(retire);
+	if (hash->retire == NULL || oh->hot == oc)
+		return;
+	AZ(*retire);
+	*retire = hsh_unhot(oh, NULL);
+	(void)OC_REFCNT_ADD(oc, 1);
+#ifdef HAVE_ATOMIC_BUILTINS
+	__atomic_store_n(&oh->hot, oc, __ATOMIC_RELEASE);
+#endif
+}
+
+static void
+hsh_retire(struct objcore *oc)
+{
+
+	if (oc == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(hash->retire);
+	hash->retire(oc);
+}
+
+/*
+ * Called by the hasher, once the retired hot ref can be dropped.
+ */
+
+int
+HSH_DerefRetired(struct worker *wrk, struct objcore **ocp)
+{
+	struct objcore *oc;
+
+	TAKE_OBJ_NOTNULL(oc, ocp, OBJCORE_MAGIC);
+#ifdef HAVE_ATOMIC_BUILTINS
+	assert(__atomic_sub_fetch(&oc->retired, 1, __ATOMIC_SEQ_CST) !=
+	    UINT16_MAX);
+#endif
+	return (HSH_DerefObjCore(wrk, &oc));
+}
+
+/*
+ * Called by the hasher, with the objhead protected from reclamation.
+ */
+
+struct objcore *
+HSH_RefHot(struct objhead *oh)
+{
+	struct objcore *oc = NULL;
+
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+#ifdef HAVE_ATOMIC_BUILTINS
+	oc = __atomic_load_n(&oh->hot, __ATOMIC_ACQUIRE);
+	if (oc == NULL)
+		return (NULL);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	assert(OC_REFCNT_ADD(oc, 1) > 1);
+#endif
 	return (oc);
 }
 
+/*
+ * Check the objcore we got from the hasher's hit method.  Anything out
+ * of the ordinary is left for HSH_Lookup() to deal with under the lock.
+ */
+
+static int
+hsh_hothit(struct worker *wrk, struct req *req, struct objcore **ocp)
+{
+	struct objcore *oc;
+	unsigned flags = OC_F_DYING;
+
+	TAKE_OBJ_NOTNULL(oc, ocp, OBJCORE_MAGIC);
+#ifdef HAVE_ATOMIC_BUILTINS
+	/* Pairs with the fence in HSH_Snipe() */
+	flags = __atomic_load_n(&oc->flags, __ATOMIC_SEQ_CST);
+#endif
+	if (!(flags & (OC_F_BUSY | OC_F_DYING | OC_F_FAILED | OC_F_HFP |
+	    OC_F_PASS)) && BAN_Fresh(oc) && EXP_Ttl(req, oc) >= req->t_req) {
+#ifdef HAVE_ATOMIC_BUILTINS
+		if (oc->hits < LONG_MAX)
+			(void)__atomic_add_fetch(&oc->hits, 1,
+			    __ATOMIC_RELAXED);
+#endif
+		*ocp = oc;
+		return (1);
+	}
+	(void)HSH_DerefObjCore(wrk, &oc);
+	return (0);
+}
+
+/*---------------------------------------------------------------------
+ * Look at one objcore on behalf of HSH_Lookup()
+ *
+ * Returns non-zero if the objcore is valid for the request.
+ */
+
+struct hsh_scan {
+	struct objcore		*busy_oc;
+	struct objcore		*exp_oc;
+	double			exp_t_origin;
+	const uint8_t		*vary;
+};
+
+static int
+hsh_scan(struct worker *wrk, struct req *req, struct objhead *oh,
+    struct objcore *oc, struct hsh_scan *sc)
+{
+
+	/* Must be at least our own ref + the objcore we examine */
+	assert(oh->refcnt > 1);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	assert(oc->objhead == oh);
+	assert(oc->refcnt > 0);
+
+	if (oc->flags & OC_F_DYING)
+		return (0);
+	if (oc->flags & OC_F_FAILED)
+		return (0);
+
+	if (oc->boc != NULL && oc->boc->state < BOS_STREAM) {
+		CHECK_OBJ_ORNULL(oc->boc, BOC_MAGIC);
+
+		if (req->hash_ignore_busy)
+			return (0);
+
+		if (oc->boc->vary != NULL &&
+		    !VRY_Match(req, oc->boc->vary))
+			return (0);
+
+		if (sc->busy_oc == NULL)
+			sc->busy_oc = oc;
+		return (0);
+	}
+
+	if (oc->ttl <= 0.)
+		return (0);
+
+	if (BAN_CheckObject(wrk, oc, req)) {
+		oc->flags |= OC_F_DYING;
+		hsh_vidx_remove(oh, oc);
+		hsh_retire(hsh_unhot(oh, oc));
+		EXP_Remove(oc);
+		return (0);
+	}
+
+	sc->vary = NULL;
+	if (ObjHasAttr(wrk, oc, OA_VARY)) {
+		sc->vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+		AN(sc->vary);
+		if (!VRY_Match(req, sc->vary))
+			return (0);
+	}
+
+	if (EXP_Ttl(req, oc) >= req->t_req)
+		return (1);
+
+	if (EXP_Ttl(NULL, oc) < req->t_req && /* ignore req.ttl */
+	    oc->t_origin > sc->exp_t_origin) {
+		/* record the newest object */
+		sc->exp_oc = oc;
+		sc->exp_t_origin = oc->t_origin;
+	}
+	return (0);
+}
+
+static struct objcore *
+hsh_scan_vidx(struct worker *wrk, struct req *req, struct objhead *oh,
+    struct hsh_scan *sc)
+{
+	struct hsh_vidx *vi;
+	struct objcore *oc, *best = NULL;
+	const uint8_t *vary = NULL;
+	unsigned s, u;
+	uint32_t h;
+
+	for (s = 0; s < HSH_VIDX_NSPEC; s++) {
+		/* Killing objects may shrink or free the index */
+		vi = oh->vidx;
+		if (vi == NULL)
+			break;
+		CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+		if (vi->spec[s] == NULL)
+			continue;
+		h = VRY_Hash(req->http, vi->spec[s]);
+		u = hsh_vidx_find(vi, h);
+		while (oh->vidx == vi && u < vi->n && vi->ent[u].hash == h) {
+			oc = vi->ent[u].oc;
+			if (hsh_scan(wrk, req, oh, oc, sc)) {
+				if (best == NULL ||
+				    oc->t_origin > best->t_origin) {
+					best = oc;
+					vary = sc->vary;
+				}
+				break;
+			}
+			if (oh->vidx == vi && u < vi->n && vi->ent[u].oc == oc)
+				u++;
+		}
+	}
+	sc->vary = vary;
+	return (best);
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -342,12 +723,14 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 {
 	struct worker *wrk;
 	struct objhead *oh;
-	struct objcore *oc;
+	struct objcore *oc, *oc2;
 	struct objcore *exp_oc;
-	double exp_t_origin;
-	int busy_found;
-	enum lookup_e retval;
+	struct objcore *busy_oc;
+	struct objcore *woc = NULL;
+	struct objcore *retire = NULL;
+	struct hsh_scan sc;
 	const uint8_t *vary;
+	enum lookup_e retval;
 
 	AN(ocp);
 	*ocp = NULL;
@@ -364,13 +747,24 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	if (DO_DEBUG(DBG_HASHEDGE))
 		hsh_testmagic(req->digest);
 
+	if (hash->hit != NULL && req->hash_objhead == NULL &&
+	    !always_insert) {
+		oc = hash->hit(wrk, req->digest);
+		if (oc != NULL && hsh_hothit(wrk, req, &oc)) {
+			*ocp = oc;
+			return (HSH_HIT);
+		}
+	}
+
 	if (req->hash_objhead != NULL) {
 		/*
 		 * This req came off the waiting list, and brings an
-		 * oh refcnt with it.
+		 * oh refcnt and a ref on the objcore it waited for
+		 * with it.
 		 */
 		CHECK_OBJ_NOTNULL(req->hash_objhead, OBJHEAD_MAGIC);
 		oh = req->hash_objhead;
+		TAKE_OBJ_NOTNULL(woc, &req->hash_objcore, OBJCORE_MAGIC);
 		Lck_Lock(&oh->mtx);
 		req->hash_objhead = NULL;
 	} else {
@@ -382,6 +776,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	Lck_AssertHeld(&oh->mtx);
 
 	if (always_insert) {
+		AZ(woc);
 		/* XXX: should we do predictive Vary in this case ? */
 		/* Insert new objcore in objecthead and release mutex */
 		*bocp = hsh_insert_busyobj(wrk, oh);
@@ -391,84 +786,73 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	}
 
 	assert(oh->refcnt > 0);
-	busy_found = 0;
-	exp_oc = NULL;
-	exp_t_origin = 0.0;
-	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
-		/* Must be at least our own ref + the objcore we examine */
-		assert(oh->refcnt > 1);
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		assert(oc->objhead == oh);
-		assert(oc->refcnt > 0);
-
-		if (oc->flags & OC_F_DYING)
-			continue;
-		if (oc->flags & OC_F_FAILED)
-			continue;
-
-		if (oc->boc != NULL && oc->boc->state < BOS_STREAM) {
-			CHECK_OBJ_ORNULL(oc->boc, BOC_MAGIC);
-
-			if (req->hash_ignore_busy)
-				continue;
-
-			if (oc->boc->vary != NULL &&
-			    !VRY_Match(req, oc->boc->vary))
-				continue;
-
-			busy_found = 1;
-			continue;
-		}
-
-		if (oc->ttl <= 0.)
-			continue;
-
-		if (BAN_CheckObject(wrk, oc, req)) {
-			oc->flags |= OC_F_DYING;
-			EXP_Remove(oc);
-			continue;
+	memset(&sc, 0, sizeof sc);
+	if (woc != NULL && !hsh_scan(wrk, req, oh, woc, &sc)) {
+		/* Not good for us after all, fall back to a full lookup */
+		Lck_Unlock(&oh->mtx);
+		(void)HSH_DerefObjCore(wrk, &woc);
+		Lck_Lock(&oh->mtx);
+		memset(&sc, 0, sizeof sc);
+	}
+	if (woc != NULL) {
+		/* Skip the lookup, the objcore we waited for is good */
+		oc = woc;
+	} else {
+		oc = VTAILQ_FIRST(&oh->objcs);
+		while (oc != NULL && !(oc->flags & OC_F_VARYIDX)) {
+			if (hsh_scan(wrk, req, oh, oc, &sc))
+				break;
+			oc = VTAILQ_NEXT(oc, hsh_list);
 		}
-
-		if (ObjHasAttr(wrk, oc, OA_VARY)) {
-			vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
-			AN(vary);
-			if (!VRY_Match(req, vary))
-				continue;
+		if (oc != NULL && (oc->flags & OC_F_VARYIDX))
+			oc = NULL;
+		if (oh->vidx != NULL) {
+			vary = sc.vary;
+			oc2 = hsh_scan_vidx(wrk, req, oh, &sc);
+			if (oc2 != NULL &&
+			    (oc == NULL || oc2->t_origin > oc->t_origin))
+				oc = oc2;
+			else
+				sc.vary = vary;
 		}
+	}
+	busy_oc = sc.busy_oc;
+	exp_oc = sc.exp_oc;
 
-		if (EXP_Ttl(req, oc) >= req->t_req) {
-			/* If still valid, use it */
-			assert(oh->refcnt > 1);
-			assert(oc->objhead == oh);
-			if (oc->flags & OC_F_HFP) {
-				wrk->stats->cache_hitpass++;
-				VSLb(req->vsl, SLT_HitPass, "%u %.6f",
-				    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
-				oc = NULL;
-			} else if (oc->flags & OC_F_PASS) {
-				wrk->stats->cache_hitmiss++;
-				VSLb(req->vsl, SLT_HitMiss, "%u %.6f",
-				    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
-				oc = NULL;
-				*bocp = hsh_insert_busyobj(wrk, oh);
-			} else {
-				oc->refcnt++;
-				if (oc->hits < LONG_MAX)
-					oc->hits++;
-			}
-			Lck_Unlock(&oh->mtx);
-			if (oc == NULL)
-				return (HSH_MISS);
-			assert(HSH_DerefObjHead(wrk, &oh));
-			*ocp = oc;
-			return (HSH_HIT);
-		}
-		if (EXP_Ttl(NULL, oc) < req->t_req && /* ignore req.ttl */
-		    oc->t_origin > exp_t_origin) {
-			/* record the newest object */
-			exp_oc = oc;
-			exp_t_origin = oc->t_origin;
+	if (oc != NULL) {
+		/* Valid, use it */
+		assert(oh->refcnt > 1);
+		assert(oc->objhead == oh);
+		if (oc->flags & OC_F_HFP) {
+			wrk->stats->cache_hitpass++;
+			VSLb(req->vsl, SLT_HitPass, "%u %.6f",
+			    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
+			oc = NULL;
+		} else if (oc->flags & OC_F_PASS) {
+			wrk->stats->cache_hitmiss++;
+			VSLb(req->vsl, SLT_HitMiss, "%u %.6f",
+			    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
+			oc = NULL;
+			*bocp = hsh_insert_busyobj(wrk, oh);
+		} else {
+			if (oc == woc)
+				woc = NULL;	/* Our ref goes to the req */
+			else
+				(void)OC_REFCNT_ADD(oc, 1);
+			if (oc->hits < LONG_MAX)
+				oc->hits++;
+			if (sc.vary == NULL)
+				hsh_sethot(oh, oc, &retire);
 		}
+		Lck_Unlock(&oh->mtx);
+		hsh_retire(retire);
+		if (woc != NULL)
+			(void)HSH_DerefObjCore(wrk, &woc);
+		if (oc == NULL)
+			return (HSH_MISS);
+		assert(HSH_DerefObjHead(wrk, &oh));
+		*ocp = oc;
+		return (HSH_HIT);
 	}
 
 	if (exp_oc != NULL && exp_oc->flags & OC_F_PASS) {
@@ -476,15 +860,15 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		VSLb(req->vsl, SLT_HitMiss, "%u %.6f", ObjGetXID(wrk, exp_oc),
 		    EXP_Dttl(req, exp_oc));
 		exp_oc = NULL;
-		busy_found = 0;
+		busy_oc = NULL;
 	}
 
 	if (exp_oc != NULL) {
 		assert(oh->refcnt > 1);
 		assert(exp_oc->objhead == oh);
-		exp_oc->refcnt++;
+		(void)OC_REFCNT_ADD(exp_oc, 1);
 
-		if (!busy_found) {
+		if (busy_oc == NULL) {
 			*bocp = hsh_insert_busyobj(wrk, oh);
 			retval = HSH_EXPBUSY;
 		} else {
@@ -500,7 +884,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		return (retval);
 	}
 
-	if (!busy_found) {
+	if (busy_oc == NULL) {
 		/* Insert objcore in objecthead and release mutex */
 		*bocp = hsh_insert_busyobj(wrk, oh);
 		/* NB: no deref of objhead, new object inherits reference */
@@ -508,21 +892,29 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		return (HSH_MISS);
 	}
 
-	/* There are one or more busy objects, wait for them */
+	/*
+	 * There are one or more busy objects, wait for the first one.
+	 * We hold a reference on it, so that when it is ready we can
+	 * go straight to it instead of doing the lookup over again.
+	 */
 
 	AZ(req->hash_ignore_busy);
+	CHECK_OBJ_NOTNULL(busy_oc->boc, BOC_MAGIC);
 
-	VTAILQ_INSERT_TAIL(&oh->waitinglist, req, w_list);
+	(void)OC_REFCNT_ADD(busy_oc, 1);
+	VTAILQ_INSERT_TAIL(&busy_oc->boc->waitinglist, req, w_list);
 	if (DO_DEBUG(DBG_WAITINGLIST))
-		VSLb(req->vsl, SLT_Debug, "on waiting list <%p>", oh);
+		VSLb(req->vsl, SLT_Debug, "on waiting list <%p>", busy_oc);
 
 	wrk->stats->busy_sleep++;
+	wrk->stats->busy_waiting++;
 	/*
 	 * The objhead reference transfers to the sess, we get it
 	 * back when the sess comes off the waiting list and
 	 * calls us again
 	 */
 	req->hash_objhead = oh;
+	req->hash_objcore = busy_oc;
 	req->wrk = NULL;
 	req->waitinglist = 1;
 	Lck_Unlock(&oh->mtx);
@@ -530,37 +922,35 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 }
 
 /*---------------------------------------------------------------------
- * Pick the req's we are going to rush from the waiting list
+ * Take all the req's waiting for a busy objcore off its waiting list.
+ * Each of them holds a reference on the objcore, so they can all go
+ * for it at once without looking it up again.
  */
 
 static void
-hsh_rush1(const struct worker *wrk, struct objhead *oh, struct rush *r, int max)
+hsh_rush1(const struct worker *wrk, struct boc *boc, struct rush *r)
 {
-	unsigned u;
 	struct req *req;
-
-	if (max == 0)
-		return;
-	if (max == HSH_RUSH_POLICY)
-		max = cache_param->rush_exponent;
-	assert(max > 0);
+	unsigned n = 0;
+	double now = NAN;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	CHECK_OBJ_NOTNULL(boc, BOC_MAGIC);
 	CHECK_OBJ_NOTNULL(r, RUSH_MAGIC);
 	VTAILQ_INIT(&r->reqs);
-	Lck_AssertHeld(&oh->mtx);
-	for (u = 0; u < max; u++) {
-		req = VTAILQ_FIRST(&oh->waitinglist);
-		if (req == NULL)
-			break;
+	while (!VTAILQ_EMPTY(&boc->waitinglist)) {
+		req = VTAILQ_FIRST(&boc->waitinglist);
 		CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-		wrk->stats->busy_wakeup++;
 		AZ(req->wrk);
-		VTAILQ_REMOVE(&oh->waitinglist, req, w_list);
+		if (n++ == 0)
+			now = VTIM_real();
+		VTAILQ_REMOVE(&boc->waitinglist, req, w_list);
 		VTAILQ_INSERT_TAIL(&r->reqs, req, w_list);
 		req->waitinglist = 0;
+		req->t_wake = now;
 	}
+	wrk->stats->busy_wakeup += n;
+	wrk->stats->busy_waiting -= n;
 }
 
 /*---------------------------------------------------------------------
@@ -653,7 +1043,7 @@ double keep)
 				more = 1;
 				break;
 			}
-			oc->refcnt++;
+			(void)OC_REFCNT_ADD(oc, 1);
 			spc -= sizeof *ocp;
 			ocp[nobj++] = oc;
 			oc->flags |= OC_F_PURGED;
@@ -664,7 +1054,7 @@ double keep)
 			oc = ocp[n];
 			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 			EXP_Rearm(oc, now, ttl, grace, keep);
-			(void)HSH_DerefObjCore(wrk, &oc, 0);
+			(void)HSH_DerefObjCore(wrk, &oc);
 		}
 		n_tot += nobj;
 	} while (more);
@@ -698,6 +1088,38 @@ HSH_Fail(struct objcore *oc)
 	Lck_Unlock(&oh->mtx);
 }
 
+/*---------------------------------------------------------------------
+ * Drop a busy objcore we will never fetch.  Whoever waits for it holds
+ * a reference, so it must be failed and its waiting list woken up, or
+ * they would sleep on it forever.
+ */
+
+int
+HSH_Withdraw(struct worker *wrk, struct objcore **ocp)
+{
+	struct objcore *oc;
+	struct objhead *oh;
+	struct rush rush;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(ocp);
+	oc = *ocp;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	oh = oc->objhead;
+	CHECK_OBJ(oh, OBJHEAD_MAGIC);
+	INIT_OBJ(&rush, RUSH_MAGIC);
+
+	Lck_Lock(&oh->mtx);
+	AN(oc->flags & OC_F_BUSY);
+	CHECK_OBJ_NOTNULL(oc->boc, BOC_MAGIC);
+	assert(oc->boc->state < BOS_STREAM);
+	oc->flags |= OC_F_FAILED;
+	hsh_rush1(wrk, oc->boc, &rush);
+	Lck_Unlock(&oh->mtx);
+	hsh_rush2(wrk, &rush);
+	return (HSH_DerefObjCore(wrk, ocp));
+}
+
 /*---------------------------------------------------------------------
  * Abandon a fetch we will not need
  */
@@ -724,13 +1146,15 @@ void
 HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 {
 	struct objhead *oh;
-	struct rush rush;
+	struct objcore *retire;
+	const uint8_t *vary = NULL;
+	ssize_t lvary = 0;
+	uint32_t h = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	oh = oc->objhead;
 	CHECK_OBJ(oh, OBJHEAD_MAGIC);
-	INIT_OBJ(&rush, RUSH_MAGIC);
 
 	AN(oc->stobj->stevedore);
 	AN(oc->flags & OC_F_BUSY);
@@ -740,6 +1164,11 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 	if (!(oc->flags & OC_F_PRIVATE)) {
 		BAN_NewObjCore(oc);
 		AN(oc->ban);
+		if (ObjHasAttr(wrk, oc, OA_VARY)) {
+			vary = ObjGetAttr(wrk, oc, OA_VARY, &lvary);
+			AN(vary);
+			h = VRY_Hash(NULL, vary);
+		}
 	}
 
 	/* XXX: pretouch neighbors on oh->objcs to prevent page-on under mtx */
@@ -747,17 +1176,20 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 	assert(oh->refcnt > 0);
 	assert(oc->refcnt > 0);
 	if (!(oc->flags & OC_F_PRIVATE))
-		oc->refcnt++;			// For EXP_Insert
+		(void)OC_REFCNT_ADD(oc, 1);	// For EXP_Insert
 	/* XXX: strictly speaking, we should sort in Date: order. */
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
-	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	if (vary != NULL && hsh_vidx_insert(oh, oc, vary, lvary, h))
+		VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
+	else
+		VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
 	oc->flags &= ~OC_F_BUSY;
-	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
+	/* The new object takes precedence over the hot one */
+	retire = hsh_unhot(oh, NULL);
 	Lck_Unlock(&oh->mtx);
+	hsh_retire(retire);
 	if (!(oc->flags & OC_F_PRIVATE))
 		EXP_Insert(wrk, oc);
-	hsh_rush2(wrk, &rush);
 }
 
 /*====================================================================
@@ -769,13 +1201,17 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 void
 HSH_Kill(struct objcore *oc)
 {
+	struct objcore *retire;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 
 	Lck_Lock(&oc->objhead->mtx);
 	oc->flags |= OC_F_DYING;
+	hsh_vidx_remove(oc->objhead, oc);
+	retire = hsh_unhot(oc->objhead, oc);
 	Lck_Unlock(&oc->objhead->mtx);
+	hsh_retire(retire);
 	EXP_Remove(oc);
 }
 
@@ -783,25 +1219,51 @@ HSH_Kill(struct objcore *oc)
  * HSH_Snipe()
  *
  * If objcore is idle, gain a ref and mark it dead.
+ *
+ * The refs held by the objhead's hot pointer and by the hasher for
+ * retired hot pointers do not count as uses, but a lockless hit can
+ * gain a ref through the hot pointer at any time.  oc->retired drops
+ * before the retired ref does, so we never overestimate the idle refs.  We set
+ * OC_F_DYING before looking at the refcount for the last time, and
+ * hsh_hothit() looks at the flags after gaining its ref, so one of us
+ * always sees the other.
  */
 
 int
 HSH_Snipe(const struct worker *wrk, struct objcore *oc)
 {
-	int retval = 0;
+	struct objhead *oh;
+	struct objcore *retire = NULL;
+	int retval = 0, idle;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	oh = oc->objhead;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 
-	if (oc->refcnt == 1 && !Lck_Trylock(&oc->objhead->mtx)) {
-		if (oc->refcnt == 1 && !(oc->flags & OC_F_DYING)) {
+	idle = 1 + (oh->hot == oc) + oc->retired;
+	if (oc->refcnt == idle && !Lck_Trylock(&oh->mtx)) {
+		idle = 1 + (oh->hot == oc) + oc->retired;
+		if (oc->refcnt == idle && !(oc->flags & OC_F_DYING)) {
 			oc->flags |= OC_F_DYING;
-			oc->refcnt++;
-			retval = 1;
+#ifdef HAVE_ATOMIC_BUILTINS
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&oc->refcnt, __ATOMIC_SEQ_CST) !=
+			    idle) {
+				oc->flags &= ~OC_F_DYING;
+				idle = 0;
+			}
+#endif
+			if (idle) {
+				(void)OC_REFCNT_ADD(oc, 1);
+				hsh_vidx_remove(oh, oc);
+				retire = hsh_unhot(oh, oc);
+				retval = 1;
+			}
 		}
-		Lck_Unlock(&oc->objhead->mtx);
+		Lck_Unlock(&oh->mtx);
 	}
+	hsh_retire(retire);
 	if (retval)
 		EXP_Remove(oc);
 	return (retval);
@@ -822,7 +1284,7 @@ HSH_Ref(struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	Lck_Lock(&oh->mtx);
 	assert(oc->refcnt > 0);
-	oc->refcnt++;
+	(void)OC_REFCNT_ADD(oc, 1);
 	Lck_Unlock(&oh->mtx);
 }
 
@@ -860,21 +1322,53 @@ void
 HSH_DerefBoc(struct worker *wrk, struct objcore *oc)
 {
 	struct boc *boc;
+	struct rush rush;
 	unsigned r;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	boc = oc->boc;
 	CHECK_OBJ_NOTNULL(boc, BOC_MAGIC);
+	INIT_OBJ(&rush, RUSH_MAGIC);
 	Lck_Lock(&oc->objhead->mtx);
 	assert(oc->refcnt > 0);
 	assert(boc->refcount > 0);
 	r = --boc->refcount;
-	if (r == 0)
+	if (r == 0) {
+		/* Nobody must be left waiting for a boc which is gone */
+		hsh_rush1(wrk, boc, &rush);
 		oc->boc = NULL;
+	}
 	Lck_Unlock(&oc->objhead->mtx);
-	if (r == 0)
+	if (r == 0) {
+		hsh_rush2(wrk, &rush);
 		ObjBocDone(wrk, oc, &boc);
+	}
+}
+
+/*---------------------------------------------------------------------
+ * Wake up everybody waiting for a busy objcore, called when its state
+ * changes such that they can use it or have to look elsewhere.
+ */
+
+void
+HSH_RushBoc(struct worker *wrk, const struct objcore *oc)
+{
+	struct objhead *oh;
+	struct rush rush;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	oh = oc->objhead;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	if (oh == private_oh || oc->boc == NULL)
+		return;
+	INIT_OBJ(&rush, RUSH_MAGIC);
+	Lck_Lock(&oh->mtx);
+	CHECK_OBJ_NOTNULL(oc->boc, BOC_MAGIC);
+	hsh_rush1(wrk, oc->boc, &rush);
+	Lck_Unlock(&oh->mtx);
+	hsh_rush2(wrk, &rush);
 }
 
 /*--------------------------------------------------------------------
@@ -884,11 +1378,10 @@ HSH_DerefBoc(struct worker *wrk, struct objcore *oc)
  */
 
 int
-HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
+HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp)
 {
 	struct objcore *oc;
 	struct objhead *oh;
-	struct rush rush;
 	unsigned r;
 
 	AN(ocp);
@@ -898,20 +1391,18 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
-	INIT_OBJ(&rush, RUSH_MAGIC);
 
 	oh = oc->objhead;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 
 	Lck_Lock(&oh->mtx);
 	assert(oh->refcnt > 0);
-	r = --oc->refcnt;
-	if (!r)
+	r = OC_REFCNT_ADD(oc, -1);
+	if (!r) {
+		hsh_vidx_remove(oh, oc);
 		VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
-	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, rushmax);
+	}
 	Lck_Unlock(&oh->mtx);
-	hsh_rush2(wrk, &rush);
 	if (r != 0)
 		return (r);
 
@@ -934,15 +1425,12 @@ int
 HSH_DerefObjHead(struct worker *wrk, struct objhead **poh)
 {
 	struct objhead *oh;
-	struct rush rush;
 	int r;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	TAKE_OBJ_NOTNULL(oh, poh, OBJHEAD_MAGIC);
-	INIT_OBJ(&rush, RUSH_MAGIC);
 
 	if (oh == private_oh) {
-		assert(VTAILQ_EMPTY(&oh->waitinglist));
 		Lck_Lock(&oh->mtx);
 		assert(oh->refcnt > 1);
 		oh->refcnt--;
@@ -950,23 +1438,6 @@ HSH_DerefObjHead(struct worker *wrk, struct objhead **poh)
 		return(1);
 	}
 
-	/*
-	 * Make absolutely certain that we do not let the final ref
-	 * disappear until the waitinglist is empty.
-	 * This is necessary because the req's on the waiting list do
-	 * not hold any ref on the objhead of their own, and we cannot
-	 * just make the hold the same ref's as objcore, that would
-	 * confuse hashers.
-	 */
-	Lck_Lock(&oh->mtx);
-	while (oh->refcnt == 1 && !VTAILQ_EMPTY(&oh->waitinglist)) {
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_ALL);
-		Lck_Unlock(&oh->mtx);
-		hsh_rush2(wrk, &rush);
-		Lck_Lock(&oh->mtx);
-	}
-	Lck_Unlock(&oh->mtx);
-
 	assert(oh->refcnt > 0);
 	r = hash->deref(oh);
 	if (!r)
@@ -280,14 +280,42 @@ http_IsHdr(const txt *hh, const char *hdr)
 	return (!strncasecmp(hdr, hh->b, l));
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * The hash of each header's name is kept in the upper bits of its hdf[]
+ * byte, so lookups can skip non-matching headers without touching their
+ * text.  Whoever changes hd[u] also resets or moves hdf[u], and a zero
+ * hash is computed on first use.
+ */
 
 static unsigned
-http_findhdr(const struct http *hp, unsigned l, const char *hdr)
+http_hdrhash(const struct http *hp, unsigned u)
+{
+	const char *p;
+	unsigned h;
+
+	h = hp->hdf[u] >> HDF_HASH_SHIFT;
+	if (h == 0) {
+		Tcheck(hp->hd[u]);
+		p = memchr(hp->hd[u].b, ':', Tlen(hp->hd[u]));
+		if (p == NULL)
+			p = hp->hd[u].e;
+		h = vct_hdrhash(hp->hd[u].b, pdiff(hp->hd[u].b, p));
+		hp->hdf[u] |= h << HDF_HASH_SHIFT;
+	}
+	return (h);
+}
+
+static unsigned
+http_findhdr(const struct http *hp, unsigned l, const char *hdr, unsigned h)
 {
 	unsigned u;
 
+	if (h == 0)
+		h = vct_hdrhash(hdr, l);
+	assert(h <= VCT_HDRHASH_MAX);
 	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		if (http_hdrhash(hp, u) != h)
+			continue;
 		Tcheck(hp->hd[u]);
 		if (hp->hd[u].e < hp->hd[u].b + l + 1)
 			continue;
@@ -308,13 +336,14 @@ unsigned
 http_CountHdr(const struct http *hp, const char *hdr)
 {
 	unsigned retval = 0;
-	unsigned u;
+	unsigned u, h;
 
 	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
 
+	h = vct_hdrhash(hdr + 1, hdr[0] - 1);
 	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
-		if (http_IsHdr(&hp->hd[u], hdr))
+		if (http_hdrhash(hp, u) == h && http_IsHdr(&hp->hd[u], hdr))
 			retval++;
 	}
 	return (retval);
@@ -341,7 +370,7 @@ http_CollectHdr(struct http *hp, const char *hdr)
 void
 http_CollectHdrSep(struct http *hp, const char *hdr, const char *sep)
 {
-	unsigned u, l, lsep, ml, f, x, d;
+	unsigned u, l, lsep, ml, f, x, d, h;
 	char *b = NULL, *e = NULL;
 	const char *v;
 
@@ -356,13 +385,14 @@ http_CollectHdrSep(struct http *hp, const char *hdr, const char *sep)
 	l = hdr[0];
 	assert(l == strlen(hdr + 1));
 	assert(hdr[l] == ':');
-	f = http_findhdr(hp, l - 1, hdr + 1);
+	h = vct_hdrhash(hdr + 1, l - 1);
+	f = http_findhdr(hp, l - 1, hdr + 1, h);
 	if (f == 0)
 		return;
 
 	for (d = u = f + 1; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
-		if (!http_IsHdr(&hp->hd[u], hdr)) {
+		if (http_hdrhash(hp, u) != h || !http_IsHdr(&hp->hd[u], hdr)) {
 			if (d != u) {
 				hp->hd[d] = hp->hd[u];
 				hp->hdf[d] = hp->hdf[u];
@@ -424,6 +454,18 @@ http_CollectHdrSep(struct http *hp, const char *hdr, const char *sep)
 
 int
 http_GetHdr(const struct http *hp, const char *hdr, const char **ptr)
+{
+
+	return (http_GetHdrHash(hp, hdr, 0, ptr));
+}
+
+/*
+ * As http_GetHdr(), with the name's vct_hdrhash() precomputed, or zero.
+ */
+
+int
+http_GetHdrHash(const struct http *hp, const char *hdr, unsigned hash,
+    const char **ptr)
 {
 	unsigned u, l;
 	const char *p;
@@ -432,7 +474,7 @@ http_GetHdr(const struct http *hp, const char *hdr, const char **ptr)
 	assert(l == strlen(hdr + 1));
 	assert(hdr[l] == ':');
 	hdr++;
-	u = http_findhdr(hp, l - 1, hdr);
+	u = http_findhdr(hp, l - 1, hdr, hash);
 	if (u == 0) {
 		if (ptr != NULL)
 			*ptr = NULL;
@@ -728,7 +770,7 @@ http_DoConnection(struct http *hp)
 #include "tbl/http_headers.h"
 /*lint -restore */
 
-		v = http_findhdr(hp, u, b);
+		v = http_findhdr(hp, u, b, 0);
 		if (v > 0)
 			hp->hdf[v] |= HDF_FILTER;
 	}
@@ -947,6 +989,7 @@ HTTP_Decode(struct http *to, const uint8_t *fm)
 			to->hd[to->nhd].b = (const void*)fm;
 			fm = (const void*)strchr((const void*)fm, '\0');
 			to->hd[to->nhd].e = (const void*)fm;
+			to->hdf[to->nhd] = 0;
 			fm++;
 			http_VSLH(to, to->nhd);
 		}
@@ -1075,7 +1118,7 @@ HTTP_Merge(struct worker *wrk, struct objcore *oc, struct http *to)
 	while (*ptr != '\0') {
 		p = strchr(ptr, ':');
 		AN(p);
-		u = http_findhdr(to, p - ptr, ptr);
+		u = http_findhdr(to, p - ptr, ptr, 0);
 		if (u == 0 || u >= nhd_before_merge)
 			http_SetHeader(to, ptr);
 		ptr = strchr(ptr, '\0') + 1;
@@ -1104,7 +1147,7 @@ http_filterfields(struct http *to, const struct http *fm, unsigned how)
 #include "tbl/http_headers.h"
 		assert (to->nhd < to->shd);
 		to->hd[to->nhd] = fm->hd[u];
-		to->hdf[to->nhd] = 0;
+		to->hdf[to->nhd] = fm->hdf[u] & ~HDF_FILTER;
 		http_VSLH(to, to->nhd);
 		to->nhd++;
 	}
@@ -1249,12 +1292,22 @@ http_TimeHeader(struct http *to, const char *fmt, double now)
 
 void
 http_Unset(struct http *hp, const char *hdr)
+{
+
+	http_UnsetHash(hp, hdr, 0);
+}
+
+void
+http_UnsetHash(struct http *hp, const char *hdr, unsigned hash)
 {
 	uint16_t u, v;
 
+	if (hash == 0)
+		hash = vct_hdrhash(hdr + 1, hdr[0] - 1);
 	for (v = u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
-		if (http_IsHdr(&hp->hd[u], hdr)) {
+		if (http_hdrhash(hp, u) == hash &&
+		    http_IsHdr(&hp->hd[u], hdr)) {
 			http_VSLH_del(hp, u);
 			continue;
 		}
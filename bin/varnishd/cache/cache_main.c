@@ -346,7 +346,6 @@ child_main(int sigmagic, size_t altstksz)
 	VBE_InitCfg();
 	Pool_Init();
 	V1P_Init();
-	V2D_Init();
 
 	EXP_Init();
 	HSH_Init(heritage.hash);
@@ -85,6 +85,7 @@
 
 #include "cache_varnishd.h"
 #include "cache_obj.h"
+#include "cache_objhead.h"
 #include "vend.h"
 #include "storage/storage.h"
 
@@ -108,6 +109,7 @@ obj_newboc(void)
 	Lck_New(&boc->mtx, lck_busyobj);
 	AZ(pthread_cond_init(&boc->cond, NULL));
 	boc->refcount = 1;
+	VTAILQ_INIT(&boc->waitinglist);
 	return (boc);
 }
 
@@ -119,6 +121,7 @@ obj_deleteboc(struct boc **p)
 	AN(p);
 	boc = *p;
 	*p = NULL;
+	assert(VTAILQ_EMPTY(&boc->waitinglist));
 	Lck_Delete(&boc->mtx);
 	AZ(pthread_cond_destroy(&boc->cond));
 	if (boc->vary != NULL)
@@ -283,6 +286,10 @@ ObjSetState(struct worker *wrk, const struct objcore *oc,
 	oc->boc->state = next;
 	AZ(pthread_cond_broadcast(&oc->boc->cond));
 	Lck_Unlock(&oc->boc->mtx);
+
+	/* Past this point the waiting list has no reason to wait */
+	if (next >= BOS_STREAM)
+		HSH_RushBoc(wrk, oc);
 }
 
 /*====================================================================
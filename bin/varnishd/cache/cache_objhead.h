@@ -29,6 +29,7 @@
  */
 
 struct hash_slinger;
+struct hsh_vidx;
 
 struct objhead {
 	unsigned		magic;
@@ -38,7 +39,17 @@ struct objhead {
 	struct lock		mtx;
 	VTAILQ_HEAD(,objcore)	objcs;
 	uint8_t			digest[DIGEST_LEN];
-	VTAILQ_HEAD(, req)	waitinglist;
+
+	/*
+	 * An objcore which recently was a plain hit, holding a ref of
+	 * its own.  Hashers with a lockless hit method hand this out
+	 * without taking mtx, so it is only cleared under mtx and its
+	 * ref is dropped through the hasher's retire method.
+	 */
+	struct objcore		*hot;
+
+	/* Index of the objcores with Vary, see cache_hash.c */
+	struct hsh_vidx		*vidx;
 
 	/*----------------------------------------------------
 	 * The fields below are for the sole private use of
@@ -54,6 +65,17 @@ struct objhead {
 #define hoh_head _u.n.u_n_hoh_head
 };
 
+/*
+ * The lockless hit path gains references on oc->refcnt without holding
+ * oh->mtx, so all changes to it must be atomic.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#  define OC_REFCNT_ADD(oc, n)	\
+	__atomic_add_fetch(&(oc)->refcnt, (n), __ATOMIC_SEQ_CST)
+#else
+#  define OC_REFCNT_ADD(oc, n)	((oc)->refcnt += (n))
+#endif
+
 void HSH_Fail(struct objcore *);
 void HSH_Kill(struct objcore *);
 void HSH_Insert(struct worker *, const void *hash, struct objcore *,
@@ -65,15 +87,17 @@ void HSH_DerefBoc(struct worker *wrk, struct objcore *);
 void HSH_DeleteObjHead(const struct worker *, struct objhead *);
 int HSH_DerefObjHead(struct worker *, struct objhead **);
 
-int HSH_DerefObjCore(struct worker *, struct objcore **, int rushmax);
-#define HSH_RUSH_POLICY -1
-#define HSH_RUSH_ALL	INT_MAX
+int HSH_DerefObjCore(struct worker *, struct objcore **);
+void HSH_RushBoc(struct worker *, const struct objcore *);
 
 enum lookup_e HSH_Lookup(struct req *, struct objcore **, struct objcore **,
     int always_insert);
 void HSH_Ref(struct objcore *o);
+struct objcore *HSH_RefHot(struct objhead *);
+int HSH_DerefRetired(struct worker *, struct objcore **);
 void HSH_AddString(struct req *, void *ctx, const char *str);
 unsigned HSH_Purge(struct worker *, struct objhead *, double ttl, double grace,
     double keep);
 struct objcore *HSH_Private(const struct worker *wrk);
 void HSH_Abandon(struct objcore *oc);
+int HSH_Withdraw(struct worker *, struct objcore **);
@@ -46,39 +46,6 @@ static struct lock		wstat_mtx;
 struct lock			pool_mtx;
 static VTAILQ_HEAD(,pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
 
-/*--------------------------------------------------------------------
- * Summing of stats into global stats counters
- */
-
-static void
-pool_sumstat(const struct VSC_main *src)
-{
-
-	Lck_AssertHeld(&wstat_mtx);
-	VSC_main_Summ(VSC_C_main, src);
-}
-
-void
-Pool_Sumstat(const struct worker *wrk)
-{
-
-	Lck_Lock(&wstat_mtx);
-	pool_sumstat(wrk->stats);
-	Lck_Unlock(&wstat_mtx);
-	memset(wrk->stats, 0, sizeof *wrk->stats);
-}
-
-int
-Pool_TrySumstat(const struct worker *wrk)
-{
-	if (Lck_Trylock(&wstat_mtx))
-		return (0);
-	pool_sumstat(wrk->stats);
-	Lck_Unlock(&wstat_mtx);
-	memset(wrk->stats, 0, sizeof *wrk->stats);
-	return (1);
-}
-
 /*--------------------------------------------------------------------
  * Facility for scheduling a task on any convenient pool.
  */
@@ -114,27 +81,6 @@ Pool_PurgeStat(unsigned nobj)
 	Lck_Unlock(&wstat_mtx);
 }
 
-/*--------------------------------------------------------------------
- * Special function to summ stats
- */
-
-void v_matchproto_(task_func_t)
-pool_stat_summ(struct worker *wrk, void *priv)
-{
-	struct VSC_main *src;
-
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	CHECK_OBJ_NOTNULL(wrk->pool, POOL_MAGIC);
-	AN(priv);
-	src = priv;
-	Lck_Lock(&wstat_mtx);
-	pool_sumstat(src);
-	Lck_Unlock(&wstat_mtx);
-	memset(src, 0, sizeof *src);
-	AZ(wrk->pool->b_stat);
-	wrk->pool->b_stat = src;
-}
-
 /*--------------------------------------------------------------------
  * Add a thread pool
  */
@@ -148,10 +94,6 @@ pool_mkpool(unsigned pool_no)
 	ALLOC_OBJ(pp, POOL_MAGIC);
 	if (pp == NULL)
 		return (NULL);
-	pp->a_stat = calloc(1, sizeof *pp->a_stat);
-	AN(pp->a_stat);
-	pp->b_stat = calloc(1, sizeof *pp->b_stat);
-	AN(pp->b_stat);
 	Lck_New(&pp->mtx, lck_wq);
 
 	VTAILQ_INIT(&pp->idle_queue);
@@ -232,8 +174,6 @@ pool_poolherder(void *priv)
 			VTAILQ_REMOVE(&pools, ppx, list);
 			AZ(pthread_join(ppx->herder_thr, &rvp));
 			AZ(pthread_cond_destroy(&ppx->herder_cond));
-			free(ppx->a_stat);
-			free(ppx->b_stat);
 			SES_DestroyPool(ppx);
 			FREE_OBJ(ppx);
 			VSC_C_main->pools--;
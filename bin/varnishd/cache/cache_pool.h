@@ -53,8 +53,6 @@ struct pool {
 	uintmax_t			sdropped;
 	uintmax_t			rdropped;
 	uintmax_t			nqueued;
-	struct VSC_main			*a_stat;
-	struct VSC_main			*b_stat;
 
 	struct mempool			*mpl_req;
 	struct mempool			*mpl_sess;
@@ -62,7 +60,6 @@ struct pool {
 };
 
 void *pool_herder(void*);
-task_func_t pool_stat_summ;
 extern struct lock			pool_mtx;
 void VCA_NewPool(struct pool *);
 void VCA_DestroyPool(struct pool *);
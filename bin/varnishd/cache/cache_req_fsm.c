@@ -103,6 +103,22 @@ cnt_transport(struct worker *wrk, struct req *req)
 	return (REQ_FSM_MORE);
 }
 
+/*--------------------------------------------------------------------
+ * Log a timestamp and add the time since the start of the request to
+ * a histogram counter.
+ */
+
+static void
+cnt_ts_hist(struct worker *wrk, struct req *req, const char *event,
+    uint64_t *hist)
+{
+	double now;
+
+	now = W_TIM_real(wrk);
+	VSLb_ts_req(req, event, now);
+	VRT_VSC_Hist(hist, now - req->t_first);
+}
+
 /*--------------------------------------------------------------------
  * Deliver an object to client
  */
@@ -125,7 +141,7 @@ cnt_deliver(struct worker *wrk, struct req *req)
 	HTTP_Setup(req->resp, req->ws, req->vsl, SLT_RespMethod);
 	if (HTTP_Decode(req->resp,
 	    ObjGetAttr(req->wrk, req->objcore, OA_HEADERS, NULL))) {
-		(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
+		(void)HSH_DerefObjCore(wrk, &req->objcore);
 		req->err_code = 500;
 		req->req_step = R_STP_SYNTH;
 		return (REQ_FSM_MORE);
@@ -159,12 +175,12 @@ cnt_deliver(struct worker *wrk, struct req *req)
 		RFC2616_Weaken_Etag(req->resp);
 
 	VCL_deliver_method(req->vcl, wrk, req, NULL, NULL);
-	VSLb_ts_req(req, "Process", W_TIM_real(wrk));
+	cnt_ts_hist(wrk, req, "Process", wrk->stats->req_process);
 
 	assert(req->restarts <= cache_param->max_restarts);
 
 	if (wrk->handling != VCL_RET_DELIVER) {
-		(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
+		(void)HSH_DerefObjCore(wrk, &req->objcore);
 		http_Teardown(req->resp);
 
 		switch (wrk->handling) {
@@ -241,6 +257,7 @@ cnt_synth(struct worker *wrk, struct req *req)
 
 	now = W_TIM_real(wrk);
 	VSLb_ts_req(req, "Process", now);
+	VRT_VSC_Hist(wrk->stats->req_process, now - req->t_first);
 
 	if (req->err_code < 100)
 		req->err_code = 501;
@@ -271,7 +288,7 @@ cnt_synth(struct worker *wrk, struct req *req)
 	if (wrk->handling == VCL_RET_FAIL) {
 		VSB_destroy(&synth_body);
 		req->doclose = SC_VCL_FAILURE;
-		VSLb_ts_req(req, "Resp", W_TIM_real(wrk));
+		cnt_ts_hist(wrk, req, "Resp", wrk->stats->req_resp);
 		http_Teardown(req->resp);
 		return (REQ_FSM_DONE);
 	}
@@ -322,8 +339,8 @@ cnt_synth(struct worker *wrk, struct req *req)
 	if (szl < 0) {
 		VSLb(req->vsl, SLT_Error, "Could not get storage");
 		req->doclose = SC_OVERLOAD;
-		VSLb_ts_req(req, "Resp", W_TIM_real(wrk));
-		(void)HSH_DerefObjCore(wrk, &req->objcore, 1);
+		cnt_ts_hist(wrk, req, "Resp", wrk->stats->req_resp);
+		(void)HSH_DerefObjCore(wrk, &req->objcore);
 		http_Teardown(req->resp);
 		return (REQ_FSM_DONE);
 	}
@@ -407,7 +424,7 @@ cnt_transmit(struct worker *wrk, struct req *req)
 
 	req->transport->deliver(req, boc, sendbody);
 
-	VSLb_ts_req(req, "Resp", W_TIM_real(wrk));
+	cnt_ts_hist(wrk, req, "Resp", wrk->stats->req_resp);
 
 	if (req->objcore->flags & (OC_F_PRIVATE | OC_F_PASS)) {
 		if (boc != NULL) {
@@ -420,7 +437,7 @@ cnt_transmit(struct worker *wrk, struct req *req)
 	if (boc != NULL)
 		HSH_DerefBoc(wrk, req->objcore);
 
-	(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
+	(void)HSH_DerefObjCore(wrk, &req->objcore);
 	http_Teardown(req->resp);
 
 	return (REQ_FSM_DONE);
@@ -445,7 +462,7 @@ cnt_fetch(struct worker *wrk, struct req *req)
 	if (req->objcore->flags & OC_F_FAILED) {
 		req->err_code = 503;
 		req->req_step = R_STP_SYNTH;
-		(void)HSH_DerefObjCore(wrk, &req->objcore, 1);
+		(void)HSH_DerefObjCore(wrk, &req->objcore);
 		AZ(req->objcore);
 		return (REQ_FSM_MORE);
 	}
@@ -465,6 +482,7 @@ cnt_lookup(struct worker *wrk, struct req *req)
 	struct objcore *oc, *busy;
 	enum lookup_e lr;
 	int had_objhead = 0;
+	double now;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -483,13 +501,17 @@ cnt_lookup(struct worker *wrk, struct req *req)
 		/*
 		 * We lost the session to a busy object, disembark the
 		 * worker thread.   We return to STP_LOOKUP when the busy
-		 * object has been unbusied, and still have the objhead
-		 * around to restart the lookup with.
+		 * object is ready, and still have the objhead and the
+		 * busy objcore around to restart the lookup with.
 		 */
 		return (REQ_FSM_DISEMBARK);
 	}
-	if (had_objhead)
-		VSLb_ts_req(req, "Waitinglist", W_TIM_real(wrk));
+	if (had_objhead) {
+		now = W_TIM_real(wrk);
+		VRT_VSC_Hist(wrk->stats->req_waitinglist, now - req->t_prev);
+		VRT_VSC_Hist(wrk->stats->busy_wakeup_time, now - req->t_wake);
+		VSLb_ts_req(req, "Waitinglist", now);
+	}
 
 	if (busy == NULL) {
 		VRY_Finish(req, DISCARD);
@@ -546,8 +568,7 @@ cnt_lookup(struct worker *wrk, struct req *req)
 			req->stale_oc = oc;
 			req->req_step = R_STP_MISS;
 		} else {
-			(void)HSH_DerefObjCore(wrk, &req->objcore,
-			    HSH_RUSH_POLICY);
+			(void)HSH_DerefObjCore(wrk, &req->objcore);
 			/*
 			 * We don't have a busy object, so treat this
 			 * like a pass
@@ -577,10 +598,10 @@ cnt_lookup(struct worker *wrk, struct req *req)
 	}
 
 	/* Drop our object, we won't need it */
-	(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
+	(void)HSH_DerefObjCore(wrk, &req->objcore);
 
 	if (busy != NULL) {
-		(void)HSH_DerefObjCore(wrk, &busy, 0);
+		(void)HSH_Withdraw(wrk, &busy);
 		VRY_Clear(req);
 	}
 
@@ -607,7 +628,7 @@ cnt_miss(struct worker *wrk, struct req *req)
 		wrk->stats->cache_miss++;
 		VBF_Fetch(wrk, req, req->objcore, req->stale_oc, VBF_NORMAL);
 		if (req->stale_oc != NULL)
-			(void)HSH_DerefObjCore(wrk, &req->stale_oc, 0);
+			(void)HSH_DerefObjCore(wrk, &req->stale_oc);
 		req->req_step = R_STP_FETCH;
 		return (REQ_FSM_MORE);
 	case VCL_RET_FAIL:
@@ -627,8 +648,8 @@ cnt_miss(struct worker *wrk, struct req *req)
 	}
 	VRY_Clear(req);
 	if (req->stale_oc != NULL)
-		(void)HSH_DerefObjCore(wrk, &req->stale_oc, 0);
-	AZ(HSH_DerefObjCore(wrk, &req->objcore, 1));
+		(void)HSH_DerefObjCore(wrk, &req->stale_oc);
+	(void)HSH_Withdraw(wrk, &req->objcore);
 	return (REQ_FSM_MORE);
 }
 
@@ -973,7 +994,7 @@ cnt_purge(struct worker *wrk, struct req *req)
 
 	(void)HSH_Purge(wrk, boc->objhead, 0, 0, 0);
 
-	AZ(HSH_DerefObjCore(wrk, &boc, 1));
+	(void)HSH_Withdraw(wrk, &boc);
 
 	VCL_purge_method(req->vcl, wrk, req, NULL, NULL);
 	switch (wrk->handling) {
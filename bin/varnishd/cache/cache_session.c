@@ -380,6 +380,11 @@ SES_Reschedule_Req(struct req *req, enum task_prio prio)
 
 /*--------------------------------------------------------------------
  * Handle a session (from waiter)
+ *
+ * Stateful transports need a worker to tear their session down, so
+ * they are rescheduled for timeouts and remote closes as well, and
+ * rather than dropping them when the request queue is full, they go
+ * at the back of the line.
  */
 
 static void v_matchproto_(waiter_handle_f)
@@ -402,11 +407,13 @@ ses_handle(struct waited *wp, enum wait_event ev, double now)
 
 	switch (ev) {
 	case WAITER_TIMEOUT:
-		SES_Delete(sp, SC_RX_TIMEOUT, now);
-		break;
 	case WAITER_REMCLOSE:
-		SES_Delete(sp, SC_REM_CLOSE, now);
-		break;
+		if (!xp->stateful) {
+			SES_Delete(sp, ev == WAITER_TIMEOUT ?
+			    SC_RX_TIMEOUT : SC_REM_CLOSE, now);
+			break;
+		}
+		/* FALLTHROUGH */
 	case WAITER_ACTION:
 		pp = sp->pool;
 		CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
@@ -414,7 +421,11 @@ ses_handle(struct waited *wp, enum wait_event ev, double now)
 		tp = (void*)sp->ws->f;
 		tp->func = xp->unwait;
 		tp->priv = sp;
-		if (Pool_Task(pp, tp, TASK_QUEUE_REQ))
+		if (!Pool_Task(pp, tp, TASK_QUEUE_REQ))
+			break;
+		if (xp->stateful)
+			AZ(Pool_Task(pp, tp, TASK_QUEUE_VCA));
+		else
 			SES_Delete(sp, SC_OVERLOAD, now);
 		break;
 	case WAITER_CLOSE:
@@ -426,9 +437,11 @@ ses_handle(struct waited *wp, enum wait_event ev, double now)
 }
 
 /*--------------------------------------------------------------------
+ * Hand a session to the waiter.  If that fails, the reason is returned
+ * and it is up to the caller to close the session.
  */
 
-void
+enum sess_close
 SES_Wait(struct sess *sp, const struct transport *xp)
 {
 	struct pool *pp;
@@ -443,18 +456,17 @@ SES_Wait(struct sess *sp, const struct transport *xp)
 	 * XXX: waiter_epoll prevents us from zeroing the struct because
 	 * XXX: it keeps state across calls.
 	 */
-	if (VTCP_nonblocking(sp->fd)) {
-		SES_Delete(sp, SC_REM_CLOSE, NAN);
-		return;
-	}
+	if (VTCP_nonblocking(sp->fd))
+		return (SC_REM_CLOSE);
 
 	/*
 	 * put struct waited on the workspace
 	 */
 	if (WS_Reserve(sp->ws, sizeof(struct waited))
 	    < sizeof(struct waited)) {
-		SES_Delete(sp, SC_OVERLOAD, NAN);
-		return;
+		if (sp->ws->r != NULL)
+			WS_Release(sp->ws, 0);
+		return (SC_OVERLOAD);
 	}
 	wp = (void*)sp->ws->f;
 	INIT_OBJ(wp, WAITED_MAGIC);
@@ -464,8 +476,11 @@ SES_Wait(struct sess *sp, const struct transport *xp)
 	wp->idle = sp->t_idle;
 	wp->func = ses_handle;
 	wp->tmo = &cache_param->timeout_idle;
-	if (Wait_Enter(pp->waiter, wp))
-		SES_Delete(sp, SC_PIPE_OVERFLOW, NAN);
+	if (Wait_Enter(pp->waiter, wp)) {
+		WS_Release(sp->ws, 0);
+		return (SC_PIPE_OVERFLOW);
+	}
+	return (SC_NULL);
 }
 
 /*--------------------------------------------------------------------
@@ -49,11 +49,49 @@ static pthread_mutex_t vsm_mtx;
 
 static struct VSL_head		*vsl_head;
 static const uint32_t		*vsl_end;
-static uint32_t			*vsl_ptr;
 static unsigned			vsl_segment_n;
 static ssize_t			vsl_segsize;
 
+/*
+ * Space in the log is reserved by advancing vsl_pos with compare and
+ * swap.  The upper 32 bits of vsl_pos count laps through the log, the
+ * lower 32 bits are the offset of the next record.
+ *
+ * The log is cleared to VSL_ENDMARKER ahead of the reservations, so the
+ * word following a reservation always reads as an end marker until the
+ * next record is complete.  vsl_hzn is the end of the cleared log, in
+ * the same format as vsl_pos, and never extends past the end of the
+ * segment vsl_pos is in.
+ *
+ * Reservations which would cross vsl_hzn take vsl_mtx and clear more
+ * of the log, update the segment table or wrap.
+ */
+
+#define VSL_CLEAR_WORDS		(16U << 10)
+#define VSL_LAP(pos)		((pos) & ~(uint64_t)UINT32_MAX)
+#define VSL_OFF(pos)		((uint32_t)(pos))
+
+static uint64_t			vsl_pos;
+static uint64_t			vsl_hzn;
+static uint32_t			vsl_clr;	/* under vsl_mtx */
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#  define VSL_LOAD(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#  define VSL_STORE(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#  define VSL_CAS(p, o, n)						\
+	__atomic_compare_exchange_n(p, &(o), n, 0,			\
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#  define VSL_ADD(p, v)		(void)__atomic_add_fetch(p, v, __ATOMIC_RELAXED)
+#else
+/* Everything happens under vsl_mtx */
+#  define VSL_LOAD(p)		(*(p))
+#  define VSL_STORE(p, v)	(*(p) = (v))
+#  define VSL_CAS(p, o, n)	(*(p) = (n), 1)
+#  define VSL_ADD(p, v)		(*(p) += (v))
+#endif
+
 struct VSC_main *VSC_C_main;
+struct vsc_shards *VSC_S_main;
 
 static void
 vsl_sanity(const struct vsl_log *vsl)
@@ -68,8 +106,8 @@ vsl_sanity(const struct vsl_log *vsl)
  * Check if the VSL_tag is masked by parameter bitmap
  */
 
-static inline int
-vsl_tag_is_masked(enum VSL_tag_e tag)
+int
+VSL_tag_is_masked(enum VSL_tag_e tag)
 {
 	volatile uint8_t *bm = &cache_param->vsl_mask[0];
 	uint8_t b;
@@ -100,75 +138,142 @@ vsl_hdr(enum VSL_tag_e tag, uint32_t *p, unsigned len, uint32_t vxid)
 }
 
 /*--------------------------------------------------------------------
- * Wrap the VSL buffer
+ * Clear part of the log ahead of the reservations
  */
 
 static void
-vsl_wrap(void)
+vsl_clear(uint32_t b, uint32_t e)
 {
+	uint32_t *p;
 
-	assert(vsl_ptr >= vsl_head->log);
-	assert(vsl_ptr < vsl_end);
-	vsl_segment_n += VSL_SEGMENTS - (vsl_segment_n % VSL_SEGMENTS);
-	assert(vsl_segment_n % VSL_SEGMENTS == 0);
-	vsl_head->offset[0] = 0;
-	vsl_head->log[0] = VSL_ENDMARKER;
-	VWMB();
-	if (vsl_ptr != vsl_head->log) {
-		*vsl_ptr = VSL_WRAPMARKER;
-		vsl_ptr = vsl_head->log;
+	assert(b <= e);
+	assert(vsl_head->log + e <= vsl_end);
+	for (p = vsl_head->log + b; p < vsl_head->log + e; p++)
+		*p = VSL_ENDMARKER;
+}
+
+/*--------------------------------------------------------------------
+ * Reserve words the slow way, holding vsl_mtx.
+ *
+ * Clear enough log past the new reservation, wrap if necessary and
+ * update the segment table.
+ */
+
+static uint32_t *
+vsl_get_locked(uint32_t words)
+{
+	uint64_t pos, npos;
+	uint32_t p, q, c, e, end;
+	int wrap;
+
+	end = vsl_end - vsl_head->log;
+	pos = VSL_LOAD(&vsl_pos);
+	do {
+		p = VSL_OFF(pos);
+		assert(p < end);
+		wrap = (p + words >= end);
+		if (wrap) {
+			npos = VSL_LAP(pos) + ((uint64_t)1 << 32);
+			c = 0;
+		} else {
+			npos = pos;
+			c = vsl_clr;
+		}
+		q = VSL_OFF(npos) + words;
+		assert(q < end);
+		if (q >= c) {
+			/* Stay inside the segment q is in */
+			e = (q / vsl_segsize + 1) * vsl_segsize;
+			if (e > q + VSL_CLEAR_WORDS)
+				e = q + VSL_CLEAR_WORDS;
+			vsl_clear(c, e);
+			c = e;
+		}
+		assert(q < c);
+		/* Nobody writes past vsl_hzn in this lap */
+		if (!wrap)
+			vsl_clr = c;
+		npos += words;
+	} while (!VSL_CAS(&vsl_pos, pos, npos));
+
+	if (wrap) {
+		/* Wrap around not possible at front */
+		assert(p > 0);
+		vsl_clr = c;
+		vsl_segment_n += VSL_SEGMENTS - (vsl_segment_n % VSL_SEGMENTS);
+		assert(vsl_segment_n % VSL_SEGMENTS == 0);
+		vsl_head->offset[0] = 0;
+		VWMB();
+		vsl_head->segment_n = vsl_segment_n;
+		VWMB();
+		vsl_head->log[p] = VSL_WRAPMARKER;
+		VSC_C_main->shm_cycles++;
+	}
+
+	while (q / vsl_segsize > vsl_segment_n % VSL_SEGMENTS) {
+		vsl_segment_n++;
+		vsl_head->offset[vsl_segment_n % VSL_SEGMENTS] = q;
 	}
+	/* ENDMARKER and new table values must be seen before new
+	   segment number */
+	VWMB();
 	vsl_head->segment_n = vsl_segment_n;
-	VSC_C_main->shm_cycles++;
+
+	VSL_STORE(&vsl_hzn, VSL_LAP(npos) + vsl_clr);
+	return (vsl_head->log + q - words);
 }
 
 /*--------------------------------------------------------------------
- * Reserve bytes for a record, wrap if necessary
+ * Reserve bytes for a record
  */
 
+static void
+vsl_count(unsigned records, unsigned flushes)
+{
+
+	struct VSC_main *vsc;
+
+	vsc = VSC_main_Shard(VSC_S_main);
+	vsc->shm_writes++;
+	vsc->shm_flushes += flushes;
+	vsc->shm_records += records;
+}
+
 static uint32_t *
 vsl_get(unsigned len, unsigned records, unsigned flushes)
 {
 	uint32_t *p;
+	uint32_t words;
 	int err;
+#ifdef HAVE_ATOMIC_BUILTINS
+	uint64_t pos;
+#endif
+
+	words = 2 + VSL_WORDS(len);
+
+#ifdef HAVE_ATOMIC_BUILTINS
+	pos = VSL_LOAD(&vsl_pos);
+	while (pos + words < VSL_LOAD(&vsl_hzn)) {
+		if (VSL_CAS(&vsl_pos, pos, pos + words)) {
+			vsl_count(records, flushes);
+			return (vsl_head->log + VSL_OFF(pos));
+		}
+		VSC_main_Shard(VSC_S_main)->shm_cont++;
+	}
+#endif
 
 	err = pthread_mutex_trylock(&vsl_mtx);
 	if (err == EBUSY) {
 		AZ(pthread_mutex_lock(&vsl_mtx));
-		VSC_C_main->shm_cont++;
+		VSC_main_Shard(VSC_S_main)->shm_cont++;
 	} else {
 		AZ(err);
 	}
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
-
-	VSC_C_main->shm_writes++;
-	VSC_C_main->shm_flushes += flushes;
-	VSC_C_main->shm_records += records;
-
-	/* Wrap if necessary */
-	if (VSL_END(vsl_ptr, len) >= vsl_end)
-		vsl_wrap();
-
-	p = vsl_ptr;
-	vsl_ptr = VSL_END(vsl_ptr, len);
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
-
-	*vsl_ptr = VSL_ENDMARKER;
-
-	while ((vsl_ptr - vsl_head->log) / vsl_segsize >
-	    vsl_segment_n % VSL_SEGMENTS) {
-		vsl_segment_n++;
-		vsl_head->offset[vsl_segment_n % VSL_SEGMENTS] =
-		    vsl_ptr - vsl_head->log;
-	}
-
+	p = vsl_get_locked(words);
+	vsl_count(records, flushes);
 	AZ(pthread_mutex_unlock(&vsl_mtx));
-	/* Implicit VWMB() in mutex op ensures ENDMARKER and new table
-	   values are seen before new segment number */
-	vsl_head->segment_n = vsl_segment_n;
 
+	AZ((uintptr_t)p & 0x3);
 	return (p);
 }
 
@@ -215,7 +320,7 @@ VSLv(enum VSL_tag_e tag, uint32_t vxid, const char *fmt, va_list ap)
 	char buf[mlen];
 
 	AN(fmt);
-	if (vsl_tag_is_masked(tag))
+	if (VSL_tag_is_masked(tag))
 		return;
 
 	if (strchr(fmt, '%') == NULL) {
@@ -277,7 +382,7 @@ VSLbt(struct vsl_log *vsl, enum VSL_tag_e tag, txt t)
 
 	vsl_sanity(vsl);
 	Tcheck(t);
-	if (vsl_tag_is_masked(tag))
+	if (VSL_tag_is_masked(tag))
 		return;
 	mlen = cache_param->vsl_reclen;
 
@@ -317,7 +422,7 @@ VSLbv(struct vsl_log *vsl, enum VSL_tag_e tag, const char *fmt, va_list ap)
 
 	vsl_sanity(vsl);
 	AN(fmt);
-	if (vsl_tag_is_masked(tag))
+	if (VSL_tag_is_masked(tag))
 		return;
 
 	/*
@@ -398,7 +503,7 @@ VSLb_bin(struct vsl_log *vsl, enum VSL_tag_e tag, ssize_t len, const void *ptr)
 
 	assert(len >= 0);
 	AN(pp);
-	if (vsl_tag_is_masked(tag))
+	if (VSL_tag_is_masked(tag))
 		return;
 	vsl_sanity(vsl);
 	tl = len * 2 + 1;
@@ -507,6 +612,8 @@ VSM_Init(void)
 
 	VSC_C_main = VSC_main_New(NULL, NULL, "");
 	AN(VSC_C_main);
+	VSC_S_main = VSC_main_Shards_New(VSC_C_main);
+	AN(VSC_S_main);
 
 	AN(heritage.proc_vsmw);
 	vsl_head = VSMW_Allocf(heritage.proc_vsmw, NULL, VSL_CLASS,
@@ -519,8 +626,14 @@ VSM_Init(void)
 	   problems with regard to readers on that event visible */
 	vsl_segment_n = UINT_MAX - (VSL_SEGMENTS - 1);
 	AZ(vsl_segment_n % VSL_SEGMENTS);
-	vsl_ptr = vsl_head->log;
-	*vsl_ptr = VSL_ENDMARKER;
+	assert(vsl_end - vsl_head->log < UINT32_MAX);
+
+	vsl_clr = vsl_segsize;
+	if (vsl_clr > VSL_CLEAR_WORDS)
+		vsl_clr = VSL_CLEAR_WORDS;
+	vsl_clear(0, vsl_clr);
+	vsl_pos = 0;
+	vsl_hzn = vsl_clr;
 
 	memset(vsl_head, 0, sizeof *vsl_head);
 	vsl_head->segsize = vsl_segsize;
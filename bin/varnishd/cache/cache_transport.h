@@ -55,6 +55,7 @@ struct transport {
 
 	task_func_t			*new_session;
 	task_func_t			*unwait;
+	unsigned			stateful;	// see ses_handle()
 
 	vtr_req_fail_f			*req_fail;
 	vtr_req_body_f			*req_body;
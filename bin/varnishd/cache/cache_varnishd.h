@@ -89,6 +89,7 @@ void BAN_Shutdown(void);
 void BAN_NewObjCore(struct objcore *oc);
 void BAN_DestroyObj(struct objcore *oc);
 int BAN_CheckObject(struct worker *, struct objcore *, struct req *);
+int BAN_Fresh(const struct objcore *oc);
 
 /* cache_busyobj.c */
 void VBO_Init(void);
@@ -150,8 +151,6 @@ void Pool_Init(void);
 int Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio);
 int Pool_Task_Arg(struct worker *, enum task_prio, task_func_t *,
     const void *arg, size_t arg_len);
-void Pool_Sumstat(const struct worker *w);
-int Pool_TrySumstat(const struct worker *wrk);
 void Pool_PurgeStat(unsigned nobj);
 int Pool_Task_Any(struct pool_task *task, enum task_prio prio);
 
@@ -171,7 +170,7 @@ enum req_fsm_nxt CNT_Request(struct worker *, struct req *);
 /* cache_session.c */
 void SES_NewPool(struct pool *, unsigned pool_no);
 void SES_DestroyPool(struct pool *);
-void SES_Wait(struct sess *, const struct transport *);
+enum sess_close SES_Wait(struct sess *, const struct transport *);
 void SES_Ref(struct sess *sp);
 void SES_Rel(struct sess *sp);
 int SES_Reschedule_Req(struct req *, enum task_prio);
@@ -190,15 +189,19 @@ enum htc_status_e {
 
 /* cache_shmlog.c */
 extern struct VSC_main *VSC_C_main;
+extern struct vsc_shards *VSC_S_main;
 void VSM_Init(void);
 void VSL_Setup(struct vsl_log *vsl, void *ptr, size_t len);
 void VSL_ChgId(struct vsl_log *vsl, const char *typ, const char *why,
     uint32_t vxid);
 void VSL_End(struct vsl_log *vsl);
+int VSL_tag_is_masked(enum VSL_tag_e tag);
 
 /* cache_vary.c */
 int VRY_Create(struct busyobj *bo, struct vsb **psb);
 int VRY_Match(struct req *, const uint8_t *vary);
+uint32_t VRY_Hash(const struct http *, const uint8_t *vary);
+int VRY_SameHeaders(const uint8_t *, const uint8_t *);
 void VRY_Prep(struct req *);
 void VRY_Clear(struct req *);
 enum vry_finish_flag { KEEP, DISCARD };
@@ -234,9 +237,6 @@ void VMOD_Panic(struct vsb *);
 /* http1/cache_http1_pipe.c */
 void V1P_Init(void);
 
-/* cache_http2_deliver.c */
-void V2D_Init(void);
-
 /* stevedore.c */
 void STV_open(void);
 void STV_close(void);
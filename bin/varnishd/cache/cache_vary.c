@@ -367,6 +367,81 @@ VRY_Match(struct req *req, const uint8_t *vary)
 	}
 }
 
+/**********************************************************************
+ * Hash a Vary matching string, or, if hp is not NULL, the Vary matching
+ * string a request with the headers in hp would have for the same set of
+ * headers.  Equal strings give equal hashes, so the hash can be used to
+ * index objects by their Vary matching string.
+ *
+ * The value of Accept-Encoding is left out, since vry_cmp() may ignore
+ * it.
+ */
+
+#define VRY_FNV_INIT	0x811c9dc5U
+#define VRY_FNV(h, c)	(((h) ^ (c)) * 0x01000193U)
+
+static uint32_t
+vry_hash_bytes(uint32_t h, const void *ptr, unsigned len)
+{
+	const uint8_t *p = ptr;
+
+	while (len-- > 0)
+		h = VRY_FNV(h, *p++);
+	return (h);
+}
+
+uint32_t
+VRY_Hash(const struct http *hp, const uint8_t *vary)
+{
+	uint32_t h = VRY_FNV_INIT;
+	const char *v, *e;
+	unsigned l;
+
+	AN(vary);
+	while (vary[2]) {
+		h = vry_hash_bytes(h, vary + 2, vary[2] + 2);
+		if (!strcasecmp(H_Accept_Encoding, (const char*)vary + 2)) {
+			vary += VRY_Len(vary);
+			continue;
+		}
+		if (hp == NULL) {
+			l = vbe16dec(vary);
+			v = (const char *)vary + 2 + vary[2] + 2;
+		} else if (http_GetHdr(hp, (const char*)(vary + 2), &v)) {
+			e = strchr(v, '\0');
+			while (e > v && vct_issp(e[-1]))
+				e--;
+			l = e - v;
+		} else
+			l = 0xffff;
+		h = VRY_FNV(h, l >> 8);
+		h = VRY_FNV(h, l & 0xff);
+		if (l != 0xffff)
+			h = vry_hash_bytes(h, v, l);
+		vary += VRY_Len(vary);
+	}
+	return (h);
+}
+
+/*
+ * Check if two Vary matching strings are for the same headers
+ */
+
+int
+VRY_SameHeaders(const uint8_t *v1, const uint8_t *v2)
+{
+
+	AN(v1);
+	AN(v2);
+	while (v1[2] && v2[2]) {
+		if (memcmp(v1 + 2, v2 + 2, v1[2] + 2))
+			return (0);
+		v1 += VRY_Len(v1);
+		v2 += VRY_Len(v2);
+	}
+	return (v1[2] == v2[2]);
+}
+
 /*
  * Check the validity of a Vary string and return its total length
  */
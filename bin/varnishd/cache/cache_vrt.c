@@ -156,7 +156,7 @@ VRT_GetHdr(VRT_CTX, const struct gethdr_s *hs)
 	}
 	hp = VRT_selecthttp(ctx, hs->where);
 	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
-	if (!http_GetHdr(hp, hs->what, &p))
+	if (!http_GetHdrHash(hp, hs->what, hs->hash, &p))
 		return (NULL);
 	return (p);
 }
@@ -357,13 +357,13 @@ VRT_SetHdr(VRT_CTX , const struct gethdr_s *hs,
 	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
 	va_start(ap, p);
 	if (p == vrt_magic_string_unset) {
-		http_Unset(hp, hs->what);
+		http_UnsetHash(hp, hs->what, hs->hash);
 	} else {
 		b = VRT_String(hp->ws, hs->what + 1, p, ap);
 		if (b == NULL) {
 			VSLb(ctx->vsl, SLT_LostHeader, "%s", hs->what + 1);
 		} else {
-			http_Unset(hp, hs->what);
+			http_UnsetHash(hp, hs->what, hs->hash);
 			http_SetHeader(hp, b);
 		}
 	}
@@ -61,14 +61,12 @@ wrk_bgthread(void *arg)
 {
 	struct bgthread *bt;
 	struct worker wrk;
-	struct VSC_main ds;
 
 	CAST_OBJ_NOTNULL(bt, arg, BGTHREAD_MAGIC);
 	THR_SetName(bt->name);
 	THR_Init();
 	INIT_OBJ(&wrk, WORKER_MAGIC);
-	memset(&ds, 0, sizeof ds);
-	wrk.stats = &ds;
+	wrk.stats = VSC_main_Shard(VSC_S_main);
 
 	(void)bt->func(&wrk, bt->priv);
 
@@ -97,7 +95,6 @@ static void
 WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 {
 	struct worker *w, ww;
-	struct VSC_main ds;
 	unsigned char ws[thread_workspace];
 
 	AN(qp);
@@ -108,8 +105,7 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 	w = &ww;
 	INIT_OBJ(w, WORKER_MAGIC);
 	w->lastused = NAN;
-	memset(&ds, 0, sizeof ds);
-	w->stats = &ds;
+	w->stats = VSC_main_Shard(VSC_S_main);
 	AZ(pthread_cond_init(&w->cond, NULL));
 
 	WS_Init(w->aws, "wrk", ws, thread_workspace);
@@ -124,20 +120,6 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 		VCL_Rel(&w->vcl);
 	AZ(pthread_cond_destroy(&w->cond));
 	HSH_Cleanup(w);
-	Pool_Sumstat(w);
-}
-
-/*--------------------------------------------------------------------
- * Summing of stats into pool counters
- */
-
-static void
-pool_addstat(struct VSC_main *dst, struct VSC_main *src)
-{
-
-	dst->summs++;
-	VSC_main_Summ(dst, src);
-	memset(src, 0, sizeof *src);
 }
 
 static inline int
@@ -297,7 +279,7 @@ static void
 Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 {
 	struct pool_task *tp = NULL;
-	struct pool_task tpx, tps;
+	struct pool_task tpx;
 	int i, prio_lim;
 
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
@@ -324,20 +306,7 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 			}
 		}
 
-		if ((tp == NULL && wrk->stats->summs > 0) ||
-		    (wrk->stats->summs >= cache_param->wthread_stats_rate))
-			pool_addstat(pp->a_stat, wrk->stats);
-
-		if (tp != NULL) {
-			wrk->stats->summs++;
-		} else if (pp->b_stat != NULL && pp->a_stat->summs) {
-			/* Nothing to do, push pool stats into global pool */
-			tps.func = pool_stat_summ;
-			tps.priv = pp->a_stat;
-			pp->a_stat = pp->b_stat;
-			pp->b_stat = NULL;
-			tp = &tps;
-		} else {
+		if (tp == NULL) {
 			/* Nothing to do: To sleep, perchance to dream ... */
 			if (isnan(wrk->lastused))
 				wrk->lastused = VTIM_real();
@@ -353,7 +322,6 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 			} while (wrk->task.func == NULL);
 			tpx = wrk->task;
 			tp = &tpx;
-			wrk->stats->summs++;
 		}
 		Lck_Unlock(&pp->mtx);
 
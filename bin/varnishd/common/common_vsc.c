@@ -30,7 +30,9 @@
 #include "config.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -212,3 +214,158 @@ VRT_VSC_Destroy(const char *nm, struct vsc_seg *vsg)
 	if (vsc_unlock != NULL)
 		vsc_unlock();
 }
+
+/*--------------------------------------------------------------------
+ * Add a sample to a histogram counter, see vsc_priv.h for the layout.
+ *
+ * There is no locking, the histogram should be in a per thread shard.
+ */
+
+_Static_assert(VRT_VSC_HIST_WORDS == VSC_HIST_WORDS,
+    "VRT_VSC_HIST_WORDS does not match vsc_priv.h");
+
+void
+VRT_VSC_Hist(uint64_t *h, VCL_DURATION d)
+{
+	uint64_t us;
+
+	AN(h);
+	if (!(d > 0.))
+		us = 0;
+	else if (d < 1e9)
+		us = (uint64_t)(d * 1e6);
+	else
+		us = (uint64_t)1e15;
+	h[0]++;
+	h[1] += us;
+	h[2 + vsc_hist_bucket(us)]++;
+}
+
+/*--------------------------------------------------------------------
+ * Per thread shards of a counter segment
+ *
+ * Each thread gets its own copy of the counters on its own cache
+ * lines, which only it writes to.  VRT_VSC_Shards_Summ() adds what the
+ * shards counted since the last time to the segment, and only writes
+ * the counters which moved, so counters which are also updated
+ * directly are left alone.  The shards of threads which exit are
+ * retired into a common copy, which the next summing picks up.
+ */
+
+#define VSC_SHARD_ALIGN		64
+
+struct vsc_shard {
+	unsigned		magic;
+#define VSC_SHARD_MAGIC		0x3b5d4e1f
+	VTAILQ_ENTRY(vsc_shard)	list;
+	struct vsc_shards	*shards;
+	volatile uint64_t	*ctr;
+	uint64_t		*last;
+};
+
+struct vsc_shards {
+	unsigned		magic;
+#define VSC_SHARDS_MAGIC	0x8f0c2a67
+	pthread_key_t		key;
+	pthread_mutex_t		mtx;
+	VTAILQ_HEAD(,vsc_shard)	list;
+	uint64_t		*dst;
+	size_t			n;
+	size_t			len;
+	uint64_t		*retired;
+};
+
+static void
+vsc_shard_free(void *priv)
+{
+	struct vsc_shards *vss;
+	struct vsc_shard *vs;
+	size_t u;
+
+	CAST_OBJ_NOTNULL(vs, priv, VSC_SHARD_MAGIC);
+	vss = vs->shards;
+	CHECK_OBJ_NOTNULL(vss, VSC_SHARDS_MAGIC);
+	AZ(pthread_mutex_lock(&vss->mtx));
+	for (u = 0; u < vss->n; u++)
+		vss->retired[u] += vs->ctr[u] - vs->last[u];
+	VTAILQ_REMOVE(&vss->list, vs, list);
+	AZ(pthread_mutex_unlock(&vss->mtx));
+	free(TRUST_ME(vs->ctr));
+	free(vs->last);
+	FREE_OBJ(vs);
+}
+
+struct vsc_shards *
+VRT_VSC_Shards_New(void *dst, size_t size)
+{
+	struct vsc_shards *vss;
+
+	AN(dst);
+	assert(size > 0 && size % sizeof(uint64_t) == 0);
+	ALLOC_OBJ(vss, VSC_SHARDS_MAGIC);
+	AN(vss);
+	AZ(pthread_key_create(&vss->key, vsc_shard_free));
+	AZ(pthread_mutex_init(&vss->mtx, NULL));
+	VTAILQ_INIT(&vss->list);
+	vss->dst = dst;
+	vss->n = size / sizeof(uint64_t);
+	vss->len = RUP2(size, VSC_SHARD_ALIGN);
+	vss->retired = calloc(vss->n, sizeof *vss->retired);
+	AN(vss->retired);
+	return (vss);
+}
+
+void *
+VRT_VSC_Shard(struct vsc_shards *vss)
+{
+	struct vsc_shard *vs;
+	void *p;
+
+	CHECK_OBJ_NOTNULL(vss, VSC_SHARDS_MAGIC);
+	vs = pthread_getspecific(vss->key);
+	if (vs != NULL) {
+		CHECK_OBJ(vs, VSC_SHARD_MAGIC);
+		return (TRUST_ME(vs->ctr));
+	}
+	ALLOC_OBJ(vs, VSC_SHARD_MAGIC);
+	AN(vs);
+	vs->shards = vss;
+	AZ(posix_memalign(&p, VSC_SHARD_ALIGN, vss->len));
+	memset(p, 0, vss->len);
+	vs->ctr = p;
+	vs->last = calloc(vss->n, sizeof *vs->last);
+	AN(vs->last);
+	AZ(pthread_mutex_lock(&vss->mtx));
+	VTAILQ_INSERT_TAIL(&vss->list, vs, list);
+	AZ(pthread_mutex_unlock(&vss->mtx));
+	AZ(pthread_setspecific(vss->key, vs));
+	return (p);
+}
+
+void
+VRT_VSC_Shards_Summ(struct vsc_shards *vss)
+{
+	struct vsc_shard *vs;
+	uint64_t v;
+	size_t u;
+
+	CHECK_OBJ_NOTNULL(vss, VSC_SHARDS_MAGIC);
+	AZ(pthread_mutex_lock(&vss->mtx));
+	VTAILQ_FOREACH(vs, &vss->list, list) {
+		CHECK_OBJ_NOTNULL(vs, VSC_SHARD_MAGIC);
+		for (u = 0; u < vss->n; u++) {
+			v = vs->ctr[u];
+			if (v == vs->last[u])
+				continue;
+			vss->dst[u] += v - vs->last[u];
+			vs->last[u] = v;
+		}
+	}
+	for (u = 0; u < vss->n; u++) {
+		if (vss->retired[u] == 0)
+			continue;
+		vss->dst[u] += vss->retired[u];
+		vss->retired[u] = 0;
+	}
+	AZ(pthread_mutex_unlock(&vss->mtx));
+}
@@ -106,10 +106,44 @@ struct hcb_root {
 
 static struct hcb_root	hcb_root;
 
-static VSTAILQ_HEAD(, hcb_y)	cool_y = VSTAILQ_HEAD_INITIALIZER(cool_y);
-static VSTAILQ_HEAD(, hcb_y)	dead_y = VSTAILQ_HEAD_INITIALIZER(dead_y);
-static VTAILQ_HEAD(, objhead)	cool_h = VTAILQ_HEAD_INITIALIZER(cool_h);
-static VTAILQ_HEAD(, objhead)	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
+/*---------------------------------------------------------------------
+ * Epoch based reclamation
+ *
+ * Threads walking the tree without hcb_mtx announce the epoch they
+ * started in.  Things taken out of the tree are parked on the cool
+ * lists, and when the cleaner moves them to the dead lists it starts
+ * a new epoch.  Once no reader is left in an older epoch, nobody can
+ * hold a pointer to what is on the dead lists and it can be freed.
+ */
+
+struct hcb_rdr {
+	unsigned		magic;
+#define HCB_RDR_MAGIC		0x4e0d85b3
+	volatile unsigned	epoch;
+	VTAILQ_ENTRY(hcb_rdr)	list;
+};
+
+struct hcb_oc {
+	unsigned		magic;
+#define HCB_OC_MAGIC		0x0b1f72d4
+	struct objcore		*oc;
+	VSTAILQ_ENTRY(hcb_oc)	list;
+};
+
+VSTAILQ_HEAD(hcb_yhead, hcb_y);
+VTAILQ_HEAD(hcb_ohhead, objhead);
+VSTAILQ_HEAD(hcb_ochead, hcb_oc);
+
+static struct hcb_yhead		cool_y = VSTAILQ_HEAD_INITIALIZER(cool_y);
+static struct hcb_yhead		dead_y = VSTAILQ_HEAD_INITIALIZER(dead_y);
+static struct hcb_ohhead	cool_h = VTAILQ_HEAD_INITIALIZER(cool_h);
+static struct hcb_ohhead	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
+static struct hcb_ochead	cool_oc = VSTAILQ_HEAD_INITIALIZER(cool_oc);
+static struct hcb_ochead	dead_oc = VSTAILQ_HEAD_INITIALIZER(dead_oc);
+
+static VTAILQ_HEAD(, hcb_rdr)	hcb_rdrs = VTAILQ_HEAD_INITIALIZER(hcb_rdrs);
+static volatile unsigned	hcb_epoch = 1;
+static pthread_key_t		hcb_rdr_key;
 
 /*---------------------------------------------------------------------
  * Pointer accessor functions
@@ -163,6 +197,76 @@ hcb_l_y(uintptr_t u)
 	return ((struct hcb_y *)(u & ~HCB_BIT_Y));
 }
 
+/*---------------------------------------------------------------------
+ * Reader side of the epochs
+ */
+
+static void
+hcb_rdr_free(void *priv)
+{
+	struct hcb_rdr *rdr;
+
+	CAST_OBJ_NOTNULL(rdr, priv, HCB_RDR_MAGIC);
+	AZ(rdr->epoch);
+	Lck_Lock(&hcb_mtx);
+	VTAILQ_REMOVE(&hcb_rdrs, rdr, list);
+	Lck_Unlock(&hcb_mtx);
+	FREE_OBJ(rdr);
+}
+
+static struct hcb_rdr *
+hcb_enter(void)
+{
+	struct hcb_rdr *rdr;
+
+	rdr = pthread_getspecific(hcb_rdr_key);
+	if (rdr == NULL) {
+		ALLOC_OBJ(rdr, HCB_RDR_MAGIC);
+		AN(rdr);
+		Lck_Lock(&hcb_mtx);
+		VTAILQ_INSERT_TAIL(&hcb_rdrs, rdr, list);
+		Lck_Unlock(&hcb_mtx);
+		AZ(pthread_setspecific(hcb_rdr_key, rdr));
+	}
+	CHECK_OBJ_NOTNULL(rdr, HCB_RDR_MAGIC);
+	AZ(rdr->epoch);
+	rdr->epoch = hcb_epoch;
+	VMB();
+	return (rdr);
+}
+
+static void
+hcb_exit(struct hcb_rdr *rdr)
+{
+
+	CHECK_OBJ_NOTNULL(rdr, HCB_RDR_MAGIC);
+	AN(rdr->epoch);
+	VMB();
+	rdr->epoch = 0;
+}
+
+/*
+ * The dead lists were filled in the epoch before the current one, so
+ * they can go when every reader is either outside or in the current.
+ */
+
+static int
+hcb_quiescent(void)
+{
+	struct hcb_rdr *rdr;
+	unsigned e;
+
+	Lck_AssertHeld(&hcb_mtx);
+	VMB();
+	VTAILQ_FOREACH(rdr, &hcb_rdrs, list) {
+		CHECK_OBJ_NOTNULL(rdr, HCB_RDR_MAGIC);
+		e = rdr->epoch;
+		if (e != 0 && e != hcb_epoch)
+			return (0);
+	}
+	return (1);
+}
+
 /*---------------------------------------------------------------------
  * Find the "critical" bit that separates these two digests
  */
@@ -308,24 +412,41 @@ hcb_delete(struct hcb_root *r, const struct objhead *oh)
 static void * v_matchproto_(bgthread_t)
 hcb_cleaner(struct worker *wrk, void *priv)
 {
+	struct hcb_yhead free_y;
+	struct hcb_ohhead free_h;
+	struct hcb_ochead free_oc;
 	struct hcb_y *y, *y2;
 	struct objhead *oh, *oh2;
+	struct hcb_oc *hoc, *hoc2;
 
 	(void)priv;
 	while (1) {
-		VSTAILQ_FOREACH_SAFE(y, &dead_y, list, y2) {
-			VSTAILQ_REMOVE_HEAD(&dead_y, list);
-			FREE_OBJ(y);
+		VSTAILQ_INIT(&free_y);
+		VTAILQ_INIT(&free_h);
+		VSTAILQ_INIT(&free_oc);
+		Lck_Lock(&hcb_mtx);
+		if (hcb_quiescent()) {
+			VSTAILQ_CONCAT(&free_y, &dead_y);
+			VTAILQ_CONCAT(&free_h, &dead_h, hoh_list);
+			VSTAILQ_CONCAT(&free_oc, &dead_oc);
+			VSTAILQ_CONCAT(&dead_y, &cool_y);
+			VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
+			VSTAILQ_CONCAT(&dead_oc, &cool_oc);
+			if (++hcb_epoch == 0)
+				hcb_epoch = 1;
+			VMB();
 		}
-		VTAILQ_FOREACH_SAFE(oh, &dead_h, hoh_list, oh2) {
-			VTAILQ_REMOVE(&dead_h, oh, hoh_list);
+		Lck_Unlock(&hcb_mtx);
+
+		VSTAILQ_FOREACH_SAFE(y, &free_y, list, y2)
+			FREE_OBJ(y);
+		VTAILQ_FOREACH_SAFE(oh, &free_h, hoh_list, oh2)
 			HSH_DeleteObjHead(wrk, oh);
+		VSTAILQ_FOREACH_SAFE(hoc, &free_oc, list, hoc2) {
+			CHECK_OBJ_NOTNULL(hoc, HCB_OC_MAGIC);
+			(void)HSH_DerefRetired(wrk, &hoc->oc);
+			FREE_OBJ(hoc);
 		}
-		Lck_Lock(&hcb_mtx);
-		VSTAILQ_CONCAT(&dead_y, &cool_y);
-		VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
-		Lck_Unlock(&hcb_mtx);
-		Pool_Sumstat(wrk);
 		VTIM_sleep(cache_param->critbit_cooloff);
 	}
 	NEEDLESS(return NULL);
@@ -341,6 +462,7 @@ hcb_start(void)
 
 	(void)oh;
 	Lck_New(&hcb_mtx, lck_hcb);
+	AZ(pthread_key_create(&hcb_rdr_key, hcb_rdr_free));
 	WRK_BgThread(&tp, "hcb-cleaner", hcb_cleaner, NULL);
 	memset(&hcb_root, 0, sizeof hcb_root);
 	hcb_build_bittbl();
@@ -371,6 +493,7 @@ static struct objhead * v_matchproto_(hash_lookup_f)
 hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 {
 	struct objhead *oh;
+	struct hcb_rdr *rdr;
 	struct hcb_y *y;
 	unsigned u;
 
@@ -381,6 +504,12 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		assert((*noh)->refcnt == 1);
 	}
 
+	/*
+	 * Objheads we find may be taken out of the tree before we get
+	 * their mtx, the epoch keeps them from being freed meanwhile.
+	 */
+	rdr = hcb_enter();
+
 	/* First try in read-only mode without holding a lock */
 
 	wrk->stats->hcb_nolock++;
@@ -394,6 +523,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		u = oh->refcnt;
 		if (u > 0) {
 			oh->refcnt++;
+			hcb_exit(rdr);
 			return (oh);
 		}
 		Lck_Unlock(&oh->mtx);
@@ -407,8 +537,10 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		oh = hcb_insert(wrk, &hcb_root, digest, noh);
 		Lck_Unlock(&hcb_mtx);
 
-		if (oh == NULL)
+		if (oh == NULL) {
+			hcb_exit(rdr);
 			return (NULL);
+		}
 
 		Lck_Lock(&oh->mtx);
 
@@ -416,6 +548,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		if (noh != NULL && *noh == NULL) {
 			assert(oh->refcnt > 0);
 			VSC_C_main->hcb_insert++;
+			hcb_exit(rdr);
 			return (oh);
 		}
 		/*
@@ -425,12 +558,60 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		u = oh->refcnt;
 		if (u > 0) {
 			oh->refcnt++;
+			hcb_exit(rdr);
 			return (oh);
 		}
 		Lck_Unlock(&oh->mtx);
 	}
 }
 
+#ifdef HAVE_ATOMIC_BUILTINS
+
+/*
+ * Find the hot objcore without taking any locks.
+ */
+
+static struct objcore * v_matchproto_(hash_hit_f)
+hcb_hit(struct worker *wrk, const void *digest)
+{
+	struct objhead *oh;
+	struct objcore *oc = NULL;
+	struct hcb_rdr *rdr;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+
+	rdr = hcb_enter();
+	oh = hcb_insert(wrk, &hcb_root, digest, NULL);
+	if (oh != NULL)
+		oc = HSH_RefHot(oh);
+	hcb_exit(rdr);
+	if (oc != NULL)
+		wrk->stats->hcb_hot++;
+	return (oc);
+}
+
+/*
+ * Drop the objhead's ref on a former hot objcore, once no reader
+ * can still be about to take a ref through it.
+ */
+
+static void v_matchproto_(hash_retire_f)
+hcb_retire(struct objcore *oc)
+{
+	struct hcb_oc *hoc;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	ALLOC_OBJ(hoc, HCB_OC_MAGIC);
+	AN(hoc);
+	hoc->oc = oc;
+	Lck_Lock(&hcb_mtx);
+	VSTAILQ_INSERT_TAIL(&cool_oc, hoc, list);
+	Lck_Unlock(&hcb_mtx);
+}
+
+#endif
+
 static void v_matchproto_(hash_prep_f)
 hcb_prep(struct worker *wrk)
 {
@@ -450,4 +631,8 @@ const struct hash_slinger hcb_slinger = {
 	.lookup =	hcb_lookup,
 	.prep =		hcb_prep,
 	.deref  =	hcb_deref,
+#ifdef HAVE_ATOMIC_BUILTINS
+	.hit =		hcb_hit,
+	.retire =	hcb_retire,
+#endif
 };
@@ -30,6 +30,7 @@
 
 struct worker;
 struct objhead;
+struct objcore;
 
 typedef void hash_init_f(int ac, char * const *av);
 typedef void hash_start_f(void);
@@ -37,6 +38,8 @@ typedef void hash_prep_f(struct worker *);
 typedef struct objhead *hash_lookup_f(struct worker *, const void *digest,
     struct objhead **);
 typedef int hash_deref_f(struct objhead *);
+typedef struct objcore *hash_hit_f(struct worker *, const void *digest);
+typedef void hash_retire_f(struct objcore *);
 
 struct hash_slinger {
 	unsigned		magic;
@@ -47,6 +50,8 @@ struct hash_slinger {
 	hash_prep_f		*prep;
 	hash_lookup_f		*lookup;
 	hash_deref_f		*deref;
+	hash_hit_f		*hit;
+	hash_retire_f		*retire;
 };
 
 enum lookup_e {
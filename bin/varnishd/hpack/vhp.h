@@ -126,3 +126,14 @@ enum vhd_ret_e  VHD_Decode(struct vhd_decode *, struct vht_table *,
     const uint8_t *in, size_t inlen, size_t *p_inused,
     char *out, size_t outlen, size_t *p_outused);
 const char *VHD_Error(enum vhd_ret_e);
+
+/* VHE - Varnish HPACK Encoder */
+
+#define VHE_NO_INDEX		(1U << 0)	/* Literal without indexing */
+#define VHE_NEVER_INDEX		(1U << 1)	/* Literal never indexed */
+
+ssize_t VHE_TableSize(struct vht_table *, uint8_t *buf, size_t len,
+    size_t size);
+ssize_t VHE_Header(struct vht_table *, uint8_t *buf, size_t len,
+    const char *name, size_t namelen, const char *value, size_t valuelen,
+    unsigned flags);
@@ -0,0 +1,593 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HPACK encoder (RFC 7541)
+ *
+ * The encoder keeps its own copy of the dynamic table, which must
+ * track the table of the peer's decoder exactly.  The caller is
+ * responsible for putting every header block produced here on the
+ * wire, in the order they were encoded.
+ *
+ * A field which is not found in either table is sent as a literal with
+ * incremental indexing, unless the caller asks for it not to be indexed.
+ * Names are always sent in lower case.  Strings are Huffman coded
+ * whenever that makes them shorter.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vdef.h"
+#include "miniobj.h"
+#include "vas.h"
+
+#include "hpack/vhp.h"
+
+#define VHE_STATIC_MAX 61
+
+static const struct vhe_huffman {
+	uint32_t	code;
+	uint8_t		blen;
+} vhe_huffman[256] = {
+#define HPH(c, h, l) [c] = { h, l },
+#include "tbl/vhp_huffman.h"
+};
+
+/****************************************************************************/
+/* Primitives */
+
+static size_t
+vhe_intlen(unsigned pfx, size_t val)
+{
+	size_t mask, l = 1;
+
+	assert(pfx >= 1 && pfx <= 8);
+	mask = (1U << pfx) - 1;
+	if (val < mask)
+		return (l);
+	val -= mask;
+	do {
+		l++;
+		val >>= 7;
+	} while (val > 0);
+	return (l);
+}
+
+static uint8_t *
+vhe_integer(uint8_t *p, uint8_t first, unsigned pfx, size_t val)
+{
+	size_t mask;
+
+	assert(pfx >= 1 && pfx <= 8);
+	mask = (1U << pfx) - 1;
+	AZ(first & mask);
+	if (val < mask) {
+		*p++ = first | (uint8_t)val;
+		return (p);
+	}
+	*p++ = first | (uint8_t)mask;
+	val -= mask;
+	while (val >= 0x80) {
+		*p++ = 0x80 | (uint8_t)(val & 0x7f);
+		val >>= 7;
+	}
+	*p++ = (uint8_t)val;
+	return (p);
+}
+
+static inline uint8_t
+vhe_char(const char *s, size_t u, int lower)
+{
+
+	if (lower)
+		return ((uint8_t)tolower((uint8_t)s[u]));
+	return ((uint8_t)s[u]);
+}
+
+/* Length in bytes of the Huffman coding of s */
+static size_t
+vhe_huflen(const char *s, size_t l, int lower)
+{
+	size_t u, bits = 0;
+
+	for (u = 0; u < l; u++)
+		bits += vhe_huffman[vhe_char(s, u, lower)].blen;
+	return ((bits + 7) / 8);
+}
+
+static uint8_t *
+vhe_hufenc(uint8_t *p, const char *s, size_t l, int lower)
+{
+	const struct vhe_huffman *h;
+	uint64_t acc = 0;
+	unsigned nbits = 0;
+	size_t u;
+
+	for (u = 0; u < l; u++) {
+		h = &vhe_huffman[vhe_char(s, u, lower)];
+		AN(h->blen);
+		acc = (acc << h->blen) | h->code;
+		nbits += h->blen;
+		while (nbits >= 8) {
+			nbits -= 8;
+			*p++ = (uint8_t)(acc >> nbits);
+		}
+		acc &= (1U << nbits) - 1;
+	}
+	if (nbits > 0) {
+		/* Pad with the most significant bits of EOS */
+		*p++ = (uint8_t)(acc << (8 - nbits)) | (0xff >> nbits);
+	}
+	return (p);
+}
+
+/* Encoded size of a string, sets *huf if Huffman coding pays off */
+static size_t
+vhe_strlen(const char *s, size_t l, int lower, int *huf)
+{
+	size_t hl;
+
+	AN(huf);
+	hl = vhe_huflen(s, l, lower);
+	*huf = hl < l;
+	if (*huf)
+		l = hl;
+	return (vhe_intlen(7, l) + l);
+}
+
+static uint8_t *
+vhe_string(uint8_t *p, const char *s, size_t l, int lower, int huf)
+{
+	size_t u;
+
+	if (huf) {
+		p = vhe_integer(p, 0x80, 7, vhe_huflen(s, l, lower));
+		return (vhe_hufenc(p, s, l, lower));
+	}
+	p = vhe_integer(p, 0x00, 7, l);
+	for (u = 0; u < l; u++)
+		*p++ = vhe_char(s, u, lower);
+	return (p);
+}
+
+/****************************************************************************/
+/* Table search */
+
+/*
+ * Find the best index for a field. Returns the index of an entry
+ * matching both name and value and sets *full, or else the index of the
+ * first entry matching the name, or zero if there is none.
+ */
+static unsigned
+vhe_lookup(const struct vht_table *tbl, const char *name, size_t nl,
+    const char *value, size_t vl, int *full)
+{
+	unsigned u, n, idx = 0;
+	const char *b;
+	size_t l;
+
+	AN(full);
+	*full = 0;
+	n = VHE_STATIC_MAX + tbl->n;
+	for (u = 1; u <= n; u++) {
+		b = VHT_LookupName(tbl, u, &l);
+		AN(b);
+		if (l != nl || strncasecmp(b, name, nl))
+			continue;
+		if (idx == 0)
+			idx = u;
+		b = VHT_LookupValue(tbl, u, &l);
+		if (l == vl && (vl == 0 || !memcmp(b, value, vl))) {
+			*full = 1;
+			return (u);
+		}
+	}
+	return (idx);
+}
+
+static void
+vhe_index(struct vht_table *tbl, const char *name, size_t nl,
+    const char *value, size_t vl)
+{
+	char buf[64];
+	size_t u, l;
+
+	VHT_NewEntry(tbl);
+	while (nl > 0) {
+		l = nl < sizeof buf ? nl : sizeof buf;
+		for (u = 0; u < l; u++)
+			buf[u] = (char)tolower((uint8_t)name[u]);
+		VHT_AppendName(tbl, buf, l);
+		name += l;
+		nl -= l;
+	}
+	VHT_AppendValue(tbl, value, vl);
+}
+
+/****************************************************************************/
+/* Public interface */
+
+/*
+ * Emit a dynamic table size update and resize the table to match.
+ * Returns the number of bytes written, or -1 if len is too small.
+ */
+ssize_t
+VHE_TableSize(struct vht_table *tbl, uint8_t *buf, size_t len, size_t size)
+{
+	uint8_t *p;
+
+	CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+	AN(buf);
+	assert(size <= tbl->protomax);
+
+	if (vhe_intlen(5, size) > len)
+		return (-1);
+	AZ(VHT_SetMaxTableSize(tbl, size));
+	p = vhe_integer(buf, 0x20, 5, size);
+	return (p - buf);
+}
+
+/*
+ * Encode one header field. Returns the number of bytes written, or -1 if
+ * len is too small, in which case the table is left untouched.
+ */
+ssize_t
+VHE_Header(struct vht_table *tbl, uint8_t *buf, size_t len,
+    const char *name, size_t nl, const char *value, size_t vl,
+    unsigned flags)
+{
+	unsigned idx, pfx;
+	uint8_t first, *p;
+	int full, nhuf = 0, vhuf;
+	size_t l;
+
+	CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+	AN(buf);
+	AN(name);
+	AN(nl);
+	AN(value);
+
+	idx = vhe_lookup(tbl, name, nl, value, vl, &full);
+	if (full && !(flags & VHE_NEVER_INDEX)) {
+		if (vhe_intlen(7, idx) > len)
+			return (-1);
+		p = vhe_integer(buf, 0x80, 7, idx);
+		return (p - buf);
+	}
+
+	if (flags & VHE_NEVER_INDEX) {
+		first = 0x10;
+		pfx = 4;
+	} else if (!(flags & VHE_NO_INDEX) &&
+	    VHT_ENTRY_SIZE + nl + vl <= tbl->maxsize) {
+		first = 0x40;
+		pfx = 6;
+	} else {
+		first = 0x00;
+		pfx = 4;
+	}
+
+	l = vhe_intlen(pfx, idx);
+	if (idx == 0)
+		l += vhe_strlen(name, nl, 1, &nhuf);
+	l += vhe_strlen(value, vl, 0, &vhuf);
+	if (l > len)
+		return (-1);
+
+	p = vhe_integer(buf, first, pfx, idx);
+	if (idx == 0)
+		p = vhe_string(p, name, nl, 1, nhuf);
+	p = vhe_string(p, value, vl, 0, vhuf);
+	assert((size_t)(p - buf) == l);
+
+	if (first == 0x40)
+		vhe_index(tbl, name, nl, value, vl);
+	return (p - buf);
+}
+
+#ifdef ENCODE_TEST_DRIVER
+
+#include <stdarg.h>
+
+static int verbose = 0;
+
+static void
+hexdump(const uint8_t *buf, size_t l)
+{
+	size_t u;
+
+	for (u = 0; u < l; u++)
+		printf("%02x%s", buf[u], (u % 16 == 15 || u + 1 == l) ?
+		    "\n" : (u % 2 ? " " : ""));
+}
+
+static void
+expect(const uint8_t *buf, size_t l, const char *hex)
+{
+	char tmp[3];
+	size_t u = 0;
+
+	for (; *hex != '\0'; hex++) {
+		if (*hex == ' ')
+			continue;
+		assert(u < l);
+		bprintf(tmp, "%02x", buf[u]);
+		if (tmp[0] != hex[0] || tmp[1] != hex[1]) {
+			printf("Mismatch at byte %zu\n", u);
+			hexdump(buf, l);
+			WRONG("Encoding mismatch");
+		}
+		hex++;
+		u++;
+	}
+	if (u != l) {
+		printf("Length %zu != %zu\n", l, u);
+		hexdump(buf, l);
+		WRONG("Encoding length mismatch");
+	}
+	if (verbose)
+		hexdump(buf, l);
+}
+
+#define ENC(tbl, p, e, n, v, f)						\
+	do {								\
+		ssize_t _l;						\
+		_l = VHE_Header(tbl, p, e - p, n, strlen(n),		\
+		    v, strlen(v), f);					\
+		assert(_l > 0);						\
+		p += _l;						\
+	} while (0)
+
+/* Decode a block and compare it to a NULL terminated list of fields */
+static void
+roundtrip(struct vht_table *dtbl, const uint8_t *in, size_t in_l, ...)
+{
+	struct vhd_decode d[1];
+	char out[1024], *o;
+	const char *m;
+	size_t in_u = 0, out_u = 0;
+	enum vhd_ret_e r;
+	va_list ap;
+
+	VHD_Init(d);
+	va_start(ap, in_l);
+	o = out;
+	while (1) {
+		r = VHD_Decode(d, dtbl, in, in_l, &in_u,
+		    o, sizeof out - (o - out), &out_u);
+		if (r == VHD_OK)
+			break;
+		assert(r == VHD_NAME || r == VHD_VALUE ||
+		    r == VHD_NAME_SEC || r == VHD_VALUE_SEC);
+		m = va_arg(ap, const char *);
+		AN(m);
+		if (verbose)
+			printf("%s: '%.*s'\n", r == VHD_NAME ? "Name" : "Value",
+			    (int)out_u, o);
+		if (out_u != strlen(m) || memcmp(o, m, out_u)) {
+			printf("'%.*s' != '%s'\n", (int)out_u, o, m);
+			WRONG("Decode mismatch");
+		}
+		o += out_u;
+		out_u = 0;
+	}
+	AZ(va_arg(ap, const char *));
+	va_end(ap);
+	assert(in_u == in_l);
+}
+
+static void
+test_integer(void)
+{
+	uint8_t buf[8], *p;
+
+	/* See RFC 7541 Appendix C.1 */
+	p = vhe_integer(buf, 0x00, 5, 10);
+	expect(buf, p - buf, "0a");
+	assert(vhe_intlen(5, 10) == 1);
+
+	p = vhe_integer(buf, 0x00, 5, 1337);
+	expect(buf, p - buf, "1f9a0a");
+	assert(vhe_intlen(5, 1337) == 3);
+
+	p = vhe_integer(buf, 0x00, 8, 42);
+	expect(buf, p - buf, "2a");
+
+	p = vhe_integer(buf, 0x80, 7, 127);
+	expect(buf, p - buf, "ff00");
+	assert(vhe_intlen(7, 127) == 2);
+}
+
+static void
+test_huffman(void)
+{
+	uint8_t buf[64], *p;
+
+	/* See RFC 7541 Appendix C.4.1 */
+	p = vhe_hufenc(buf, "www.example.com", 15, 0);
+	expect(buf, p - buf, "f1e3 c2e5 f23a 6ba0 ab90 f4ff");
+	assert(vhe_huflen("www.example.com", 15, 0) == 12);
+
+	p = vhe_hufenc(buf, "no-cache", 8, 0);
+	expect(buf, p - buf, "a8eb 1064 9cbf");
+
+	/* Names are lowercased */
+	p = vhe_hufenc(buf, "Custom-Key", 10, 1);
+	expect(buf, p - buf, "25a8 49e9 5ba9 7d7f");
+}
+
+static void
+test_c6(void)
+{
+	struct vht_table etbl[1], dtbl[1];
+	uint8_t buf[256], *p, *e;
+
+	/* See RFC 7541 Appendix C.6 */
+
+	AZ(VHT_Init(etbl, 256));
+	AZ(VHT_Init(dtbl, 256));
+	e = buf + sizeof buf;
+
+	/* C.6.1 */
+	p = buf;
+	ENC(etbl, p, e, ":status", "302", 0);
+	ENC(etbl, p, e, "cache-control", "private", 0);
+	ENC(etbl, p, e, "date", "Mon, 21 Oct 2013 20:13:21 GMT", 0);
+	ENC(etbl, p, e, "location", "https://www.example.com", 0);
+	expect(buf, p - buf,
+	    "4882 6402 5885 aec3 771a 4b61 96d0 7abe"
+	    "9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+	    "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+	    "e9ae 82ae 43d3");
+	assert(etbl->size + etbl->n * VHT_ENTRY_SIZE == 222);
+	roundtrip(dtbl, buf, p - buf,
+	    ":status", "302",
+	    "cache-control", "private",
+	    "date", "Mon, 21 Oct 2013 20:13:21 GMT",
+	    "location", "https://www.example.com",
+	    NULL);
+
+	/* C.6.2 */
+	p = buf;
+	ENC(etbl, p, e, ":status", "307", 0);
+	ENC(etbl, p, e, "Cache-Control", "private", 0);
+	ENC(etbl, p, e, "date", "Mon, 21 Oct 2013 20:13:21 GMT", 0);
+	ENC(etbl, p, e, "Location", "https://www.example.com", 0);
+	/* The RFC Huffman codes "307", which saves nothing */
+	expect(buf, p - buf, "4803 3330 37c1 c0bf");
+	roundtrip(dtbl, buf, p - buf,
+	    ":status", "307",
+	    "cache-control", "private",
+	    "date", "Mon, 21 Oct 2013 20:13:21 GMT",
+	    "location", "https://www.example.com",
+	    NULL);
+
+	/* C.6.3 */
+	p = buf;
+	ENC(etbl, p, e, ":status", "200", 0);
+	ENC(etbl, p, e, "cache-control", "private", 0);
+	ENC(etbl, p, e, "date", "Mon, 21 Oct 2013 20:13:22 GMT", 0);
+	ENC(etbl, p, e, "location", "https://www.example.com", 0);
+	ENC(etbl, p, e, "content-encoding", "gzip", 0);
+	ENC(etbl, p, e, "set-cookie",
+	    "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1", 0);
+	expect(buf, p - buf,
+	    "88c1 6196 d07a be94 1054 d444 a820 0595"
+	    "040b 8166 e084 a62d 1bff c05a 839b d9ab"
+	    "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+	    "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+	    "9587 3160 65c0 03ed 4ee5 b106 3d50 07");
+	roundtrip(dtbl, buf, p - buf,
+	    ":status", "200",
+	    "cache-control", "private",
+	    "date", "Mon, 21 Oct 2013 20:13:22 GMT",
+	    "location", "https://www.example.com",
+	    "content-encoding", "gzip",
+	    "set-cookie",
+	    "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1",
+	    NULL);
+	assert(etbl->n == dtbl->n);
+	assert(etbl->size == dtbl->size);
+
+	VHT_Fini(etbl);
+	VHT_Fini(dtbl);
+}
+
+static void
+test_flags(void)
+{
+	struct vht_table etbl[1], dtbl[1];
+	uint8_t buf[256], *p, *e;
+
+	AZ(VHT_Init(etbl, 4096));
+	AZ(VHT_Init(dtbl, 4096));
+	e = buf + sizeof buf;
+
+	/* Never indexed fields are never looked up as a whole */
+	p = buf;
+	ENC(etbl, p, e, "x-a", "b", VHE_NEVER_INDEX);
+	ENC(etbl, p, e, "cache-control", "private", VHE_NO_INDEX);
+	AZ(etbl->n);
+	assert((buf[0] & 0xf0) == 0x10);
+	roundtrip(dtbl, buf, p - buf,
+	    "x-a", "b",
+	    "cache-control", "private",
+	    NULL);
+	AZ(dtbl->n);
+
+	/* Size update, then nothing fits */
+	p = buf;
+	p += VHE_TableSize(etbl, p, e - p, 0);
+	ENC(etbl, p, e, "x-a", "b", 0);
+	AZ(etbl->n);
+	roundtrip(dtbl, buf, p - buf,
+	    "x-a", "b",
+	    NULL);
+	AZ(dtbl->maxsize);
+
+	/* Out of space leaves the table alone */
+	p = buf;
+	p += VHE_TableSize(etbl, p, e - p, 4096);
+	assert(VHE_Header(etbl, p, 3, "x-abc", 5, "def", 3, 0) == -1);
+	AZ(etbl->n);
+	ENC(etbl, p, e, "x-abc", "def", 0);
+	assert(etbl->n == 1);
+	ENC(etbl, p, e, "X-ABC", "def", 0);
+	assert(p[-1] == 0x80 + VHE_STATIC_MAX + 1);
+	roundtrip(dtbl, buf, p - buf,
+	    "x-abc", "def",
+	    "x-abc", "def",
+	    NULL);
+	assert(dtbl->n == 1);
+
+	VHT_Fini(etbl);
+	VHT_Fini(dtbl);
+}
+
+int
+main(int argc, char **argv)
+{
+
+	if (argc == 2 && !strcmp(argv[1], "-v"))
+		verbose = 1;
+	else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+		return (1);
+	}
+
+	test_integer();
+	test_huffman();
+	test_c6();
+	test_flags();
+
+	return (0);
+}
+
+#endif	/* ENCODE_TEST_DRIVER */
@@ -61,3 +61,6 @@ void V1L_Open(struct worker *, struct ws *, int *fd, struct vsl_log *,
 unsigned V1L_Flush(const struct worker *w);
 unsigned V1L_Close(struct worker *w);
 size_t V1L_Write(const struct worker *w, const void *ptr, ssize_t len);
+#ifdef HAVE_SYS_SENDFILE_H
+ssize_t V1L_Sendfile(const struct worker *w, int fd, off_t off, ssize_t len);
+#endif
@@ -32,6 +32,7 @@
 #include "cache/cache_varnishd.h"
 #include "cache/cache_filter.h"
 #include "cache_http1.h"
+#include "storage/storage.h"
 
 /*--------------------------------------------------------------------*/
 
@@ -63,6 +64,45 @@ static const struct vdp v1d_vdp = {
 	.func =		v1d_bytes,
 };
 
+/*--------------------------------------------------------------------
+ * When nothing but V1B is on the VDP stack, complete objects whose
+ * stevedore keeps the body in a file are sent with sendfile(2).
+ */
+
+#ifdef HAVE_SYS_SENDFILE_H
+static int v_matchproto_(objsendfile_f)
+v1d_sendfile_func(void *priv, int fd, off_t off, ssize_t len)
+{
+	struct req *req;
+	ssize_t wl;
+
+	CAST_OBJ_NOTNULL(req, priv, REQ_MAGIC);
+	wl = V1L_Sendfile(req->wrk, fd, off, len);
+	req->acct.resp_bodybytes += wl;
+	return (wl != len);
+}
+
+static int
+v1d_sendfile(struct req *req, const struct boc *boc)
+{
+	struct vdp_entry *vdpe;
+	int r;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (boc != NULL || DO_DEBUG(DBG_NO_SENDFILE) ||
+	    (req->res_mode & (RES_ESI | RES_CHUNKED)))
+		return (1);
+	vdpe = VTAILQ_FIRST(&req->vdc->vdp);
+	CHECK_OBJ_NOTNULL(vdpe, VDP_ENTRY_MAGIC);
+	if (vdpe->vdp != &v1d_vdp)
+		return (1);
+	r = STV_Sendfile(req->wrk, req->objcore, req, v1d_sendfile_func);
+	if (r == 0)
+		req->wrk->stats->s_resp_sendfile++;
+	return (r);
+}
+#endif
+
 static void
 v1d_error(struct req *req, const char *msg)
 {
@@ -174,7 +214,11 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 
 	if (req->res_mode & RES_CHUNKED)
 		V1L_Chunked(req->wrk);
-	err = VDP_DeliverObj(req);
+#ifdef HAVE_SYS_SENDFILE_H
+	err = v1d_sendfile(req, boc);
+	if (err > 0)
+#endif
+		err = VDP_DeliverObj(req);
 	if (!err && (req->res_mode & RES_CHUNKED))
 		V1L_EndChunk(req->wrk);
 
@@ -194,6 +194,8 @@ http1_reembark(struct worker *wrk, struct req *req)
 	/* Couldn't schedule, ditch */
 	wrk->stats->busy_wakeup--;
 	wrk->stats->busy_killed++;
+	(void)HSH_DerefObjCore(wrk, &req->hash_objcore);
+	(void)HSH_DerefObjHead(wrk, &req->hash_objhead);
 	AN (req->vcl);
 	VCL_Rel(&req->vcl);
 	Req_AcctLogCharge(wrk->stats, req);
@@ -355,6 +357,7 @@ static void
 HTTP1_Session(struct worker *wrk, struct req *req)
 {
 	enum htc_status_e hs;
+	enum sess_close sc;
 	struct sess *sp;
 	const char *st;
 	int i;
@@ -424,7 +427,9 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 			if (hs == HTC_S_IDLE) {
 				wrk->stats->sess_herd++;
 				Req_Release(req);
-				SES_Wait(sp, &HTTP1_transport);
+				sc = SES_Wait(sp, &HTTP1_transport);
+				if (sc != SC_NULL)
+					SES_Delete(sp, sc, NAN);
 				return;
 			}
 			if (hs != HTC_S_COMPLETE)
@@ -480,6 +485,7 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 				AN(req->ws->r);
 				WS_Release(req->ws, 0);
 				AN(req->hash_objhead);
+				(void)HSH_DerefObjCore(wrk, &req->hash_objcore);
 				(void)HSH_DerefObjHead(wrk, &req->hash_objhead);
 				AZ(req->hash_objhead);
 				SES_Close(sp, SC_REM_CLOSE);
@@ -40,6 +40,9 @@
 #include "config.h"
 
 #include <sys/uio.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#  include <sys/sendfile.h>
+#endif
 #include "cache/cache_varnishd.h"
 
 #include <errno.h>
@@ -268,6 +271,53 @@ V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 	return (len);
 }
 
+/*--------------------------------------------------------------------
+ * Send len bytes of fd, starting at off, straight from the page cache
+ * after flushing what is queued.  Not for chunked mode.
+ */
+
+#ifdef HAVE_SYS_SENDFILE_H
+ssize_t
+V1L_Sendfile(const struct worker *wrk, int fd, off_t off, ssize_t len)
+{
+	struct v1l *v1l;
+	ssize_t i, l = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	v1l = wrk->v1l;
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(v1l->wfd);
+	assert(v1l->ciov == v1l->siov);
+	assert(fd >= 0);
+	assert(len > 0);
+
+	if (V1L_Flush(wrk) || *v1l->wfd < 0)
+		return (0);
+
+	while (l < len) {
+		i = sendfile(*v1l->wfd, fd, &off, len - l);
+		if (i <= 0) {
+			v1l->werr++;
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Sendfile error, retval = %zd, len = %zd, errno = %s",
+			    i, len - l, strerror(errno));
+			break;
+		}
+		v1l->cnt += i;
+		l += i;
+		if (l < len &&
+		    VTIM_real() - v1l->t0 > cache_param->send_timeout) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit total send timeout, "
+			    "wrote = %zd/%zd; not retrying", l, len);
+			v1l->werr++;
+			break;
+		}
+	}
+	return (l);
+}
+#endif
+
 void
 V1L_Chunked(const struct worker *wrk)
 {
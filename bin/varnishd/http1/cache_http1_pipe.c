@@ -33,32 +33,155 @@
 
 #include "cache/cache_varnishd.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
 
 #include "cache_http1.h"
 
+#include "vtcp.h"
+
 #include "VSC_vbe.h"
 
 static struct lock pipestat_mtx;
 
+/*--------------------------------------------------------------------
+ * One direction of a pipe.
+ *
+ * Both sockets are non-blocking while we pipe, and a direction is
+ * either reading from its source, or holding bytes it could not yet
+ * write to its destination.  In the latter case we poll the
+ * destination for POLLOUT rather than reading more.
+ *
+ * Where splice(2) is available the pending bytes live in a kernel
+ * pipe and never enter userland, otherwise they sit in buf.
+ */
+
+struct v1p_dir {
+	int			rfd;
+	int			wfd;
+	uint64_t		*pcnt;
+	int			pfd[2];
+	char			*buf;
+	size_t			bufsz;
+	char			*ptr;
+	size_t			len;
+};
+
+#define V1P_AGAIN(e)	((e) == EAGAIN || (e) == EINTR)
+
+#ifdef HAVE_SPLICE
+#  define V1P_SPLICE_CHUNK	(64 * 1024)
+#  define V1P_SPLICE_FLAGS	(SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+#endif
+
+static void
+v1p_dir_init(struct v1p_dir *d, int rfd, int wfd, uint64_t *pcnt,
+    char *buf, size_t bufsz)
+{
+
+	memset(d, 0, sizeof *d);
+	d->rfd = rfd;
+	d->wfd = wfd;
+	d->pcnt = pcnt;
+	d->pfd[0] = -1;
+	d->pfd[1] = -1;
+	d->buf = buf;
+	d->bufsz = bufsz;
+#ifdef HAVE_SPLICE
+	if (!DO_DEBUG(DBG_PIPE_COPY) &&
+	    pipe2(d->pfd, O_CLOEXEC | O_NONBLOCK) != 0) {
+		d->pfd[0] = -1;
+		d->pfd[1] = -1;
+	}
+#endif
+}
+
+static void
+v1p_dir_fini(struct v1p_dir *d)
+{
+
+	if (d->pfd[0] >= 0)
+		closefd(&d->pfd[0]);
+	if (d->pfd[1] >= 0)
+		closefd(&d->pfd[1]);
+}
+
+#ifdef HAVE_SPLICE
+static void
+v1p_dir_nosplice(struct v1p_dir *d)
+{
+
+	AZ(d->len);
+	v1p_dir_fini(d);
+}
+#endif
+
+/*--------------------------------------------------------------------
+ * Fill the direction from its source.
+ * Returns non-zero on EOF or error.
+ */
+
 static int
-rdf(int fd0, int fd1, uint64_t *pcnt)
+v1p_read(struct v1p_dir *d)
 {
-	int i, j;
-	char buf[BUFSIZ], *p;
+	ssize_t i;
 
-	i = read(fd0, buf, sizeof buf);
-	if (i <= 0)
-		return (1);
-	for (p = buf; i > 0; i -= j, p += j) {
-		j = write(fd1, p, i);
-		if (j <= 0)
+	AZ(d->len);
+#ifdef HAVE_SPLICE
+	if (d->pfd[0] >= 0) {
+		i = splice(d->rfd, NULL, d->pfd[1], NULL,
+		    V1P_SPLICE_CHUNK, V1P_SPLICE_FLAGS);
+		if (i < 0 && errno == EINVAL)
+			v1p_dir_nosplice(d);
+		else if (i < 0 && V1P_AGAIN(errno))
+			return (0);
+		else if (i <= 0)
 			return (1);
-		*pcnt += j;
-		if (i != j)
-			(void)usleep(100000);		/* XXX hack */
+		else {
+			d->len = i;
+			return (0);
+		}
 	}
+#endif
+	i = read(d->rfd, d->buf, d->bufsz);
+	if (i < 0 && V1P_AGAIN(errno))
+		return (0);
+	if (i <= 0)
+		return (1);
+	d->ptr = d->buf;
+	d->len = i;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Drain as much of the pending bytes as the destination will take.
+ * Returns non-zero on error.
+ */
+
+static int
+v1p_write(struct v1p_dir *d)
+{
+	ssize_t i;
+
+	AN(d->len);
+#ifdef HAVE_SPLICE
+	if (d->pfd[0] >= 0)
+		i = splice(d->pfd[0], NULL, d->wfd, NULL,
+		    d->len, V1P_SPLICE_FLAGS);
+	else
+#endif
+		i = write(d->wfd, d->ptr, d->len);
+	if (i < 0 && V1P_AGAIN(errno))
+		return (0);
+	if (i <= 0)
+		return (1);
+	assert((size_t)i <= d->len);
+	*d->pcnt += i;
+	d->len -= i;
+	if (d->ptr != NULL)
+		d->ptr += i;
 	return (0);
 }
 
@@ -87,7 +210,9 @@ void
 V1P_Process(struct req *req, int fd, struct v1p_acct *v1a)
 {
 	struct pollfd fds[2];
-	int i, j;
+	struct v1p_dir dir[2], *d;
+	char buf[BUFSIZ];
+	int i, j, n;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(req->sp, SESS_MAGIC);
@@ -102,38 +227,69 @@ V1P_Process(struct req *req, int fd, struct v1p_acct *v1a)
 		req->htc->pipeline_e = NULL;
 		v1a->in += j;
 	}
+
+	/* dir[0] is backend to client, dir[1] is client to backend */
+	v1p_dir_init(&dir[0], fd, req->sp->fd, &v1a->out,
+	    buf, sizeof buf / 2);
+	v1p_dir_init(&dir[1], req->sp->fd, fd, &v1a->in,
+	    buf + sizeof buf / 2, sizeof buf / 2);
+	(void)VTCP_nonblocking(fd);
+	(void)VTCP_nonblocking(req->sp->fd);
+
 	memset(fds, 0, sizeof fds);
-	fds[0].fd = fd;
-	fds[0].events = POLLIN | POLLERR;
-	fds[1].fd = req->sp->fd;
-	fds[1].events = POLLIN | POLLERR;
+	n = 2;
 
-	while (fds[0].fd > -1 || fds[1].fd > -1) {
+	while (n > 0) {
+		fds[0].events = 0;
+		fds[1].events = 0;
+		for (i = 0; i < 2; i++) {
+			d = &dir[i];
+			if (d->rfd < 0)
+				continue;
+			if (d->len > 0)
+				fds[1 - i].events |= POLLOUT;
+			else
+				fds[i].events |= POLLIN;
+		}
+		fds[0].fd = fds[0].events ? fd : -1;
+		fds[1].fd = fds[1].events ? req->sp->fd : -1;
 		fds[0].revents = 0;
 		fds[1].revents = 0;
-		i = poll(fds, 2,
-		    (int)(cache_param->pipe_timeout * 1e3));
-		if (i < 1)
+		j = poll(fds, 2, (int)(cache_param->pipe_timeout * 1e3));
+		if (j < 1)
 			break;
-		if (fds[0].revents &&
-		    rdf(fd, req->sp->fd, &v1a->out)) {
-			if (fds[1].fd == -1)
+		for (i = 0; i < 2 && n > 0; i++) {
+			d = &dir[i];
+			if (d->rfd < 0)
+				continue;
+			if (d->len > 0) {
+				if (!(fds[1 - i].revents &
+				    (POLLOUT | POLLERR | POLLHUP)))
+					continue;
+				j = v1p_write(d);
+			} else {
+				if (!(fds[i].revents &
+				    (POLLIN | POLLERR | POLLHUP)))
+					continue;
+				j = v1p_read(d);
+				if (!j && d->len > 0)
+					j = v1p_write(d);
+			}
+			if (!j)
+				continue;
+			if (--n == 0)
 				break;
-			(void)shutdown(fd, SHUT_RD);
-			(void)shutdown(req->sp->fd, SHUT_WR);
-			fds[0].events = 0;
-			fds[0].fd = -1;
-		}
-		if (fds[1].revents &&
-		    rdf(req->sp->fd, fd, &v1a->in)) {
-			if (fds[0].fd == -1)
-				break;
-			(void)shutdown(req->sp->fd, SHUT_RD);
-			(void)shutdown(fd, SHUT_WR);
-			fds[1].events = 0;
-			fds[1].fd = -1;
+			(void)shutdown(d->rfd, SHUT_RD);
+			(void)shutdown(d->wfd, SHUT_WR);
+			d->rfd = -1;
+			d->len = 0;
 		}
 	}
+
+	v1p_dir_fini(&dir[0]);
+	v1p_dir_fini(&dir[1]);
+	(void)VTCP_blocking(fd);
+	(void)VTCP_blocking(req->sp->fd);
 }
 
 /*--------------------------------------------------------------------*/
@@ -130,7 +130,19 @@ struct h2_req {
 	/* Where to wake this stream up */
 	struct worker			*wrk;
 
+	/* Priority (rfc7540 5.3), protected by sess->mtx */
+	struct h2_req			*parent;
+	unsigned			weight;
+#define H2_WEIGHT_DEFAULT		16
+#define H2_WEIGHT_MAX			256
+	unsigned			waiting;
+#define H2_WAIT_TX			(1U << 0)
+#define H2_WAIT_WINDOW			(1U << 1)
+	uint64_t			tx_vtime;
+	uint64_t			tx_pending;
+
 	VTAILQ_ENTRY(h2_req)		tx_list;
+	VTAILQ_ENTRY(h2_req)		win_list;
 	h2_error			error;
 };
 
@@ -158,6 +170,8 @@ struct h2_sess {
 	struct http_conn		*htc;
 	struct vsl_log			*vsl;
 	struct vht_table		dectbl[1];
+	struct vht_table		enctbl[1];
+	uint32_t			enc_size;	/* Peer's view */
 
 	unsigned			rxf_len;
 	unsigned			rxf_type;
@@ -172,8 +186,20 @@ struct h2_sess {
 	uint32_t			goaway_last_stream;
 
 	VTAILQ_HEAD(,h2_req)		txqueue;
+	VTAILQ_HEAD(,h2_req)		winqueue;	/* Connection window */
+	uint64_t			tx_vtime;
+
+	/* Frames waiting to be written, owned by the head of txqueue */
+	uint8_t				*tx_buf;
+	unsigned			tx_size;
+	unsigned			tx_len;
+	h2_error			tx_error;
+	uint64_t			tx_frames;
+	uint64_t			tx_writes;
 
 	h2_error			error;
+
+	unsigned			vsl_data;	/* for h2_log_sample */
 };
 
 #define ASSERT_RXTHR(h2) do {assert(h2->rxthr == pthread_self());} while(0)
@@ -211,9 +237,12 @@ h2_error h2h_decode_bytes(struct h2_sess *h2, struct h2h_decode *d,
 
 /* cache_http2_send.c */
 void H2_Send_Get(struct worker *, struct h2_sess *, struct h2_req *);
-void H2_Send_Rel(struct h2_sess *, const struct h2_req *);
+void H2_Send_Rel(struct h2_sess *, struct h2_req *);
+void H2_Send_Window(struct h2_sess *);
+void H2_Send_Init(struct h2_sess *);
+void H2_Send_Fini(struct h2_sess *);
 
-h2_error H2_Send_Frame(struct worker *, const struct h2_sess *,
+h2_error H2_Send_Frame(struct worker *, struct h2_sess *,
     h2_frame type, uint8_t flags, uint32_t len, uint32_t stream,
     const void *);
 
@@ -227,6 +256,8 @@ void h2_del_req(struct worker *, const struct h2_req *);
 void h2_kill_req(struct worker *, const struct h2_sess *,
     struct h2_req *, h2_error);
 int h2_rxframe(struct worker *, struct h2_sess *);
+void h2_vsl_frame(struct h2_sess *, int tx, const uint8_t *hdr,
+    const void *body);
 h2_error h2_set_setting(struct h2_sess *, const uint8_t *);
 void h2_req_body(struct req*);
 task_func_t h2_do_req;
@@ -33,7 +33,6 @@
 
 #include <netinet/in.h>
 
-#include <ctype.h>
 #include <stdio.h>
 
 #include "cache/cache_filter.h"
@@ -45,33 +44,6 @@
 
 /**********************************************************************/
 
-struct hpack_static {
-	uint8_t			idx;
-	const char *		name;
-	const char *		val;
-};
-
-static const struct hpack_static hp_static[] = {
-#define HPS(I,N,V) [I] = { I, N ":", V },
-#include "tbl/vhp_static.h"
-	{ 0, "\377:", ""}		// Terminator
-};
-
-static const struct hpack_static *hp_idx[256];
-
-void
-V2D_Init(void)
-{
-	int i;
-#define HPS(I,N,V)						\
-	i = hp_static[I].name[0];				\
-	if (hp_idx[i] == NULL) hp_idx[i] = &hp_static[I];
-#include "tbl/vhp_static.h"
-#undef HPS
-}
-
-/**********************************************************************/
-
 static int v_matchproto_(vdp_bytes)
 h2_bytes(struct req *req, enum vdp_action act, void **priv,
     const void *ptr, ssize_t len)
@@ -126,12 +98,41 @@ h2_status(uint8_t *p, uint16_t status) {
 	return (l);
 }
 
+/*
+ * Emit a dynamic table size update if the size we encode against has
+ * changed since the last header block.  RFC 7541 section 4.2 wants it
+ * at the start of the next header block, whichever path sends that, so
+ * this must be called with the txqueue held.  Returns the number of
+ * bytes written, or -1 if len is too small.
+ */
+
+static ssize_t
+h2_enc_tblsz(struct h2_sess *h2, uint8_t *buf, size_t len)
+{
+	uint32_t hts;
+	ssize_t l;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+
+	Lck_Lock(&h2->sess->mtx);
+	hts = h2->remote_settings.header_table_size;
+	Lck_Unlock(&h2->sess->mtx);
+	if (hts > h2->enctbl->protomax)
+		hts = h2->enctbl->protomax;
+	if (hts == h2->enc_size)
+		return (0);
+	l = VHE_TableSize(h2->enctbl, buf, len, hts);
+	if (l >= 0)
+		h2->enc_size = hts;
+	return (l);
+}
+
 int v_matchproto_(vtr_minimal_response_f)
 h2_minimal_response(struct req *req, uint16_t status)
 {
 	struct h2_req *r2;
-	size_t l;
-	uint8_t buf[6];
+	ssize_t l;
+	uint8_t buf[12];
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
@@ -139,9 +140,6 @@ h2_minimal_response(struct req *req, uint16_t status)
 	assert(status >= 100);
 	assert(status < 1000);
 
-	l = h2_status(buf, status);
-	assert(l < sizeof(buf));
-
 	VSLb(req->vsl, SLT_RespProtocol, "HTTP/2.0");
 	VSLb(req->vsl, SLT_RespStatus, "%03d", status);
 	VSLb(req->vsl, SLT_RespReason, "%s", http_Status2Reason(status, NULL));
@@ -151,6 +149,10 @@ h2_minimal_response(struct req *req, uint16_t status)
 
 	/* XXX return code checking once H2_Send returns anything but 0 */
 	H2_Send_Get(req->wrk, r2->h2sess, r2);
+	l = h2_enc_tblsz(r2->h2sess, buf, sizeof buf - 5);
+	assert(l >= 0);
+	l += h2_status(buf + l, status);
+	assert(l < sizeof buf);
 	H2_Send(req->wrk, r2,
 	    H2_F_HEADERS,
 	    H2FF_HEADERS_END_HEADERS |
@@ -160,36 +162,101 @@ h2_minimal_response(struct req *req, uint16_t status)
 	return (0);
 }
 
-static uint8_t *
-h2_enc_len(uint8_t *p, unsigned bits, unsigned val)
+/*
+ * Headers which rarely repeat verbatim are kept out of the dynamic
+ * table, so they do not push out the ones which do.
+ */
+
+static const struct h2_enc_hdr {
+	const char		*name;
+	size_t			len;
+	unsigned		flags;
+} h2_enc_hdrs[] = {
+#define H2_ENC_HDR(n, f)	{ n, sizeof n - 1, f }
+	H2_ENC_HDR("age",		VHE_NO_INDEX),
+	H2_ENC_HDR("content-length",	VHE_NO_INDEX),
+	H2_ENC_HDR("etag",		VHE_NO_INDEX),
+	H2_ENC_HDR("last-modified",	VHE_NO_INDEX),
+	H2_ENC_HDR("set-cookie",	VHE_NEVER_INDEX),
+	H2_ENC_HDR("x-varnish",		VHE_NO_INDEX),
+#undef H2_ENC_HDR
+	{ NULL, 0, 0 }
+};
+
+static unsigned
+h2_enc_flags(const char *name, size_t len)
+{
+	const struct h2_enc_hdr *eh;
+
+	for (eh = h2_enc_hdrs; eh->name != NULL; eh++)
+		if (eh->len == len && !strncasecmp(eh->name, name, len))
+			return (eh->flags);
+	return (0);
+}
+
+/*
+ * Encode the response header block.  This updates the dynamic table,
+ * so it must be called with the txqueue held and the result sent
+ * before it is released.  Headers which do not fit are dropped.
+ */
+
+static size_t
+h2_enc_resp(struct req *req, struct h2_sess *h2, uint8_t *buf, size_t len)
 {
-	assert(bits < 8);
-	unsigned mask = (1U << bits) - 1U;
-
-	if (val >= mask) {
-		*p++ |= (uint8_t)mask;
-		val -= mask;
-		while (val >= 128) {
-			*p++ = 0x80 | ((uint8_t)val & 0x7f);
-			val >>= 7;
-		}
+	const struct http *hp;
+	const char *b, *r;
+	char status[4];
+	ssize_t l;
+	size_t sz;
+	unsigned u;
+	uint8_t *p, *e;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	hp = req->resp;
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	p = buf;
+	e = buf + len;
+
+	l = h2_enc_tblsz(h2, p, e - p);
+	if (l >= 0)
+		p += l;
+
+	if (l >= 0) {
+		bprintf(status, "%03d", hp->status);
+		l = VHE_Header(h2->enctbl, p, e - p,
+		    ":status", 7, status, 3, 0);
+		if (l >= 0)
+			p += l;
 	}
-	*p++ = (uint8_t)val;
-	return (p);
+
+	for (u = HTTP_HDR_FIRST; l >= 0 && u < hp->nhd; u++) {
+		b = hp->hd[u].b;
+		r = strchr(b, ':');
+		AN(r);
+		sz = r - b;
+		while (vct_islws(*++r))
+			continue;
+		l = VHE_Header(h2->enctbl, p, e - p, b, sz,
+		    r, hp->hd[u].e - r, h2_enc_flags(b, sz));
+		if (l >= 0)
+			p += l;
+	}
+
+	if (l < 0)
+		VSLb(req->vsl, SLT_Error,
+		    "H2: Out of workspace for response headers");
+	return (p - buf);
 }
 
 void v_matchproto_(vtr_deliver_f)
 h2_deliver(struct req *req, struct boc *boc, int sendbody)
 {
-	ssize_t sz, sz1;
-	uint8_t *p;
-	unsigned u;
-	const char *r;
-	struct http *hp;
+	size_t sz;
 	struct sess *sp;
 	struct h2_req *r2;
-	int i, err;
-	const struct hpack_static *hps;
+	struct h2_sess *h2;
+	int err;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
@@ -197,69 +264,26 @@ h2_deliver(struct req *req, struct boc *boc, int sendbody)
 	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
 	sp = req->sp;
 	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
-
-	(void)WS_Reserve(req->ws, 0);
-	p = (void*)req->ws->f;
-
-	p += h2_status(p, req->resp->status);
-
-	hp = req->resp;
-	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
-		assert(WS_Inside(req->ws, p, NULL));
-
-		r = strchr(hp->hd[u].b, ':');
-		AN(r);
-
-		hps = hp_idx[tolower(*hp->hd[u].b)];
-		sz = 1 + r - hp->hd[u].b;
-		assert(sz > 0);
-		while (hps != NULL && hps->idx > 0) {
-			i = strncasecmp(hps->name, hp->hd[u].b, sz);
-			if (i < 0) {
-				hps++;
-				continue;
-			}
-			if (i > 0)
-				hps = NULL;
-			break;
-		}
-		if (hps != NULL) {
-			VSLb(req->vsl, SLT_Debug,
-			    "HP {%d, \"%s\", \"%s\"} <%s>",
-			    hps->idx, hps->name, hps->val, hp->hd[u].b);
-			*p = 0x10;
-			p = h2_enc_len(p, 4, hps->idx);
-		} else {
-
-			*p++ = 0x10;
-			sz--;
-			p = h2_enc_len(p, 7, sz);
-			for (sz1 = 0; sz1 < sz; sz1++)
-				*p++ = (uint8_t)tolower(hp->hd[u].b[sz1]);
-
-		}
-
-		while (vct_islws(*++r))
-			continue;
-		sz = hp->hd[u].e - r;
-		p = h2_enc_len(p, 7, sz);
-		memcpy(p, r, sz);
-		p += sz;
-		assert(WS_Inside(req->ws, p, NULL));
-	}
-	sz = (char*)p - req->ws->f;
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
 
 	AZ(req->wrk->v1l);
 
 	if (sendbody && req->resp_len == 0)
 		sendbody = 0;
 
-	H2_Send_Get(req->wrk, r2->h2sess, r2);
-	H2_Send(req->wrk, r2, H2_F_HEADERS,
-	    (sendbody ? 0 : H2FF_HEADERS_END_STREAM) | H2FF_HEADERS_END_HEADERS,
-	    sz, req->ws->f);
-	req->acct.resp_hdrbytes += sz;
-	H2_Send_Rel(r2->h2sess, r2);
+	(void)WS_Reserve(req->ws, 0);
+	H2_Send_Get(req->wrk, h2, r2);
+	if (r2->error == 0) {
+		sz = h2_enc_resp(req, h2, (void*)req->ws->f,
+		    req->ws->r - req->ws->f);
+		H2_Send(req->wrk, r2, H2_F_HEADERS,
+		    (sendbody ? 0 : H2FF_HEADERS_END_STREAM) |
+		    H2FF_HEADERS_END_HEADERS,
+		    sz, req->ws->f);
+		req->acct.resp_hdrbytes += sz;
+	}
+	H2_Send_Rel(h2, r2);
 
 	WS_Release(req->ws, 0);
 
@@ -159,6 +159,7 @@ h2h_addhdr(struct http *hp, char *b, size_t namelen, size_t len)
 
 	hp->hd[n].b = b;
 	hp->hd[n].e = b + len;
+	hp->hdf[n] = 0;
 
 	return (0);
 }
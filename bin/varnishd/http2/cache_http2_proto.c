@@ -152,6 +152,7 @@ h2_new_req(const struct worker *wrk, struct h2_sess *h2,
 	r2->req = req;
 	r2->r_window = h2->local_settings.initial_window_size;
 	r2->t_window = h2->remote_settings.initial_window_size;
+	r2->weight = H2_WEIGHT_DEFAULT;
 	req->transport_priv = r2;
 	Lck_Lock(&h2->sess->mtx);
 	VTAILQ_INSERT_TAIL(&h2->streams, r2, list);
@@ -164,6 +165,7 @@ void
 h2_del_req(struct worker *wrk, const struct h2_req *r2)
 {
 	struct h2_sess *h2;
+	struct h2_req *r22;
 	struct sess *sp;
 	struct req *req;
 	int r;
@@ -177,8 +179,12 @@ h2_del_req(struct worker *wrk, const struct h2_req *r2)
 	Lck_Lock(&sp->mtx);
 	assert(h2->refcnt > 0);
 	r = --h2->refcnt;
-	/* XXX: PRIORITY reshuffle */
+	AZ(r2->waiting);
 	VTAILQ_REMOVE(&h2->streams, r2, list);
+	/* Children move up to our parent, rfc7540 5.3.4 */
+	VTAILQ_FOREACH(r22, &h2->streams, list)
+		if (r22->parent == r2)
+			r22->parent = r2->parent;
 	Lck_Unlock(&sp->mtx);
 	AZ(r2->req->ws->r);
 	Req_Cleanup(sp, wrk, r2->req);
@@ -187,6 +193,10 @@ h2_del_req(struct worker *wrk, const struct h2_req *r2)
 		return;
 	/* All streams gone, including stream #0, clean up */
 	VHT_Fini(h2->dectbl);
+	VHT_Fini(h2->enctbl);
+	H2_Send_Fini(h2);
+	wrk->stats->h2_tx_frames += h2->tx_frames;
+	wrk->stats->h2_tx_writes += h2->tx_writes;
 	req = h2->srq;
 	AZ(req->ws->r);
 	Req_Cleanup(sp, wrk, req);
@@ -220,46 +230,59 @@ h2_kill_req(struct worker *wrk, const struct h2_sess *h2,
 		h2_del_req(wrk, r2);
 }
 
-/**********************************************************************/
+/**********************************************************************
+ * Log a frame in either direction.  The body is logged only up to
+ * h2_log_bytes, and for DATA frames only one in h2_log_sample.
+ * Caller holds the session mutex.
+ */
+
+void
+h2_vsl_frame(struct h2_sess *h2, int tx, const uint8_t *hdr,
+    const void *body)
+{
+	enum VSL_tag_e tag;
+	unsigned len;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AN(hdr);
+	Lck_AssertHeld(&h2->sess->mtx);
+	VSLb_bin(h2->vsl, tx ? SLT_H2TxHdr : SLT_H2RxHdr, 9, hdr);
+
+	tag = tx ? SLT_H2TxBody : SLT_H2RxBody;
+	len = vbe32dec(hdr) >> 8;
+	if (len == 0 || VSL_tag_is_masked(tag))
+		return;
+	if (hdr[3] == H2_F_DATA->type &&
+	    h2->vsl_data++ % cache_param->h2_log_sample)
+		return;
+	if (len > cache_param->h2_log_bytes)
+		len = cache_param->h2_log_bytes;
+	if (len > 0)
+		VSLb_bin(h2->vsl, tag, len, body);
+}
 
 static void
-h2_vsl_frame(const struct h2_sess *h2, const void *ptr, size_t len)
+h2_vsl_rxframe(struct h2_sess *h2)
 {
 	const uint8_t *b;
-	struct vsb *vsb;
 	const char *p;
-	unsigned u;
 
-	AN(ptr);
-	assert(len >= 9);
-	b = ptr;
+	if (VSL_tag_is_masked(SLT_H2RxHdr) &&
+	    VSL_tag_is_masked(SLT_H2RxBody) &&
+	    VSL_tag_is_masked(SLT_Debug))
+		return;
 
-	vsb = VSB_new_auto();
-	AN(vsb);
-	p = h2_framename((enum h2frame)b[3]);
+	b = (const void *)h2->htc->rxbuf_b;
+	p = h2_framename((enum h2frame)h2->rxf_type);
+	Lck_Lock(&h2->sess->mtx);
+	h2_vsl_frame(h2, 0, b, b + 9);
 	if (p != NULL)
-		VSB_cat(vsb, p);
+		VSLb(h2->vsl, SLT_Debug, "H2RXF %s[%u] 0x%02x 0x%08x",
+		    p, h2->rxf_len, h2->rxf_flags, vbe32dec(b + 5));
 	else
-		VSB_quote(vsb, b + 3, 1, VSB_QUOTE_HEX);
-
-	u = vbe32dec(b) >> 8;
-	VSB_printf(vsb, "[%u] ", u);
-	VSB_quote(vsb, b + 4, 1, VSB_QUOTE_HEX);
-	VSB_putc(vsb, ' ');
-	VSB_quote(vsb, b + 5, 4, VSB_QUOTE_HEX);
-	if (u > 0) {
-		VSB_putc(vsb, ' ');
-		VSB_quote(vsb, b + 9, len - 9, VSB_QUOTE_HEX);
-	}
-	AZ(VSB_finish(vsb));
-	Lck_Lock(&h2->sess->mtx);
-	VSLb_bin(h2->vsl, SLT_H2RxHdr, 9, b);
-	if (len > 9)
-		VSLb_bin(h2->vsl, SLT_H2RxBody, len - 9, b + 9);
-
-	VSLb(h2->vsl, SLT_Debug, "H2RXF %s", VSB_data(vsb));
+		VSLb(h2->vsl, SLT_Debug, "H2RXF 0x%02x[%u] 0x%02x 0x%08x",
+		    h2->rxf_type, h2->rxf_len, h2->rxf_flags, vbe32dec(b + 5));
 	Lck_Unlock(&h2->sess->mtx);
-	VSB_destroy(&vsb);
 }
 
 
@@ -354,7 +377,7 @@ h2_rx_window_update(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	Lck_Lock(&h2->sess->mtx);
 	r2->t_window += wu;
 	if (r2 == h2->req0)
-		AZ(pthread_cond_broadcast(h2->cond));
+		H2_Send_Window(h2);
 	else if (r2->cond != NULL)
 		AZ(pthread_cond_signal(r2->cond));
 	Lck_Unlock(&h2->sess->mtx);
@@ -367,6 +390,57 @@ h2_rx_window_update(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
  * Incoming PRIORITY, possibly an ACK of one we sent.
  */
 
+/*
+ * Set the priority of a stream from the five bytes of stream dependency
+ * and weight found in PRIORITY and HEADERS frames.
+ */
+
+static h2_error
+h2_set_priority(struct h2_sess *h2, struct h2_req *r2, const uint8_t *p)
+{
+	struct h2_req *parent, *r22;
+	uint32_t dep;
+	int excl;
+
+	ASSERT_RXTHR(h2);
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	AN(p);
+
+	dep = vbe32dec(p);
+	excl = dep >> 31;
+	dep &= ~(1U << 31);
+	if (dep == r2->stream)
+		return (H2SE_PROTOCOL_ERROR);	/* rfc7540 5.3.1 */
+
+	/* A dependency on a stream we do not know goes to the root */
+	parent = NULL;
+	if (dep != 0) {
+		VTAILQ_FOREACH(parent, &h2->streams, list)
+			if (parent->stream == dep)
+				break;
+	}
+
+	Lck_Lock(&h2->sess->mtx);
+	if (parent != NULL) {
+		/* Depending on a descendant, rfc7540 5.3.3 */
+		for (r22 = parent->parent; r22 != NULL; r22 = r22->parent)
+			if (r22 == r2)
+				break;
+		if (r22 != NULL)
+			parent->parent = r2->parent;
+	}
+	if (excl) {
+		VTAILQ_FOREACH(r22, &h2->streams, list)
+			if (r22 != r2 && r22 != h2->req0 &&
+			    r22->parent == parent)
+				r22->parent = r2;
+	}
+	r2->parent = parent;
+	r2->weight = p[4] + 1U;
+	Lck_Unlock(&h2->sess->mtx);
+	return (0);
+}
+
 static h2_error v_matchproto_(h2_frame_f)
 h2_rx_priority(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
@@ -374,7 +448,9 @@ h2_rx_priority(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	(void)wrk;
 	ASSERT_RXTHR(h2);
 	xxxassert(r2->stream & 1);
-	return (0);
+	if (h2->rxf_len != 5)
+		return (H2SE_FRAME_SIZE_ERROR);	/* rfc7540 6.3 */
+	return (h2_set_priority(h2, r2, h2->rxf_data));
 }
 
 /**********************************************************************
@@ -609,6 +685,9 @@ h2_rx_headers(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	if (h2->rxf_flags & H2FF_HEADERS_PRIORITY) {
 		if (l < 5)
 			return (H2CE_PROTOCOL_ERROR);
+		/* We treat this stream error as a connection error */
+		if (h2_set_priority(h2, r2, p) != NULL)
+			return (H2CE_PROTOCOL_ERROR);
 		l -= 5;
 		p += 5;
 	}
@@ -674,6 +753,9 @@ h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	ASSERT_RXTHR(h2);
 	if (r2 == NULL)
 		return (0);
+	/* Nobody is going to read it, rfc7540 5.1 */
+	if (r2->req->req_body_status == REQ_BODY_NONE)
+		return (H2SE_STREAM_CLOSED);
 	Lck_Lock(&h2->sess->mtx);
 	AZ(h2->mailcall);
 	h2->mailcall = r2;
@@ -793,6 +875,8 @@ h2_frame_complete(struct http_conn *htc)
 
 	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
 	l = htc->rxbuf_e - htc->rxbuf_b;
+	if (l == 0)
+		return (HTC_S_EMPTY);
 	if (l < 9)
 		return (HTC_S_MORE);
 	u = vbe32dec(htc->rxbuf_b) >> 8;
@@ -890,7 +974,33 @@ h2_procframe(struct worker *wrk, struct h2_sess *h2,
 }
 
 /***********************************************************************
- * Called in loop from h2_new_session()
+ * A session is idle when no stream has a worker which might write to
+ * the connection, which means it can be handed to the waiter.
+ */
+
+static int
+h2_sess_idle(struct h2_sess *h2)
+{
+	struct h2_req *r2;
+	int retval = 1;
+
+	Lck_Lock(&h2->sess->mtx);
+	VTAILQ_FOREACH(r2, &h2->streams, list) {
+		if (r2 != h2->req0 && r2->scheduled) {
+			retval = 0;
+			break;
+		}
+	}
+	Lck_Unlock(&h2->sess->mtx);
+	return (retval);
+}
+
+/***********************************************************************
+ * Called in loop from h2_rx_session()
+ *
+ * Streams finishing cannot interrupt our read, so every timeout_linger
+ * we come up for air to see if the session has gone idle, in which
+ * case -1 is returned.
  */
 
 #define H2_FRAME(l,U,...) const struct h2_frame_s H2_F_##U[1] = \
@@ -917,12 +1027,14 @@ h2_rxframe(struct worker *wrk, struct h2_sess *h2)
 	(void)VTCP_blocking(*h2->htc->rfd);
 	h2->sess->t_idle = VTIM_real();
 	hs = HTC_RxStuff(h2->htc, h2_frame_complete,
-	    NULL, NULL, NAN,
+	    NULL, NULL, h2->sess->t_idle + cache_param->timeout_linger,
 	    h2->sess->t_idle + cache_param->timeout_idle,
 	    16384 + 9);		// rfc7540,l,4228,4228
 	switch (hs) {
 	case HTC_S_COMPLETE:
 		break;
+	case HTC_S_IDLE:
+		return (h2_sess_idle(h2) ? -1 : 1);
 	case HTC_S_TIMEOUT:
 		VTAILQ_FOREACH_SAFE(r2, &h2->streams, list, r22) {
 			switch (r2->state) {
@@ -956,7 +1068,7 @@ h2_rxframe(struct worker *wrk, struct h2_sess *h2)
 	/* XXX: later full DATA will not be rx'ed yet. */
 	HTC_RxPipeline(h2->htc, h2->htc->rxbuf_b + h2->rxf_len + 9);
 
-	h2_vsl_frame(h2, h2->htc->rxbuf_b, 9L + h2->rxf_len);
+	h2_vsl_rxframe(h2);
 	h2->srq->acct.req_hdrbytes += 9;
 
 	if (h2->rxf_type >= H2FMAX) {
@@ -31,11 +31,141 @@
 
 #include "cache/cache_varnishd.h"
 
+#include <stdlib.h>
+#include <sys/uio.h>
+
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
 
 #include "vend.h"
 
+/*
+ * Stream scheduling
+ *
+ * Streams take turns at the txqueue, and when the stream at the head
+ * releases it, the one to go next is picked by priority (rfc7540 5.3):
+ *
+ * Stream zero carries control frames and always goes first.
+ *
+ * A stream waits while one of its ancestors in the dependency tree is
+ * in the same queue, so parents go before their children.
+ *
+ * Among the rest, the stream with the lowest virtual time goes next.
+ * A stream's virtual time advances by the bytes it sends, scaled down
+ * by its weight, so siblings share the connection in proportion to
+ * their weights.  A stream which starts waiting is brought up to the
+ * virtual time of the session, so it cannot cash in time spent idle.
+ *
+ * Streams waiting for the connection window are woken in the same
+ * order.  Dependencies on streams which have closed move to the parent
+ * of the closed stream, but its weight is not redistributed.
+ */
+
+static int
+h2_sched_blocked(const struct h2_req *r2, unsigned which)
+{
+	const struct h2_req *p;
+
+	for (p = r2->parent; p != NULL; p = p->parent)
+		if (p->waiting & which)
+			return (1);
+	return (0);
+}
+
+static struct h2_req *
+h2_sched_best(struct h2_req *best, struct h2_req *r2, unsigned which)
+{
+
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	assert(r2->waiting & which);
+	if (h2_sched_blocked(r2, which))
+		return (best);
+	if (best == NULL || r2->tx_vtime < best->tx_vtime)
+		return (r2);
+	return (best);
+}
+
+static void
+h2_sched_wait(struct h2_sess *h2, struct h2_req *r2, unsigned which)
+{
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	AZ(r2->waiting);
+	r2->waiting = which;
+	if (r2->tx_vtime < h2->tx_vtime)
+		r2->tx_vtime = h2->tx_vtime;
+}
+
+static void
+h2_sched_charge(struct h2_req *r2)
+{
+
+	assert(r2->weight > 0 && r2->weight <= H2_WEIGHT_MAX);
+	r2->tx_vtime += r2->tx_pending * H2_WEIGHT_MAX / r2->weight;
+	r2->tx_pending = 0;
+}
+
+/*
+ * Hand the txqueue to the next stream.  Called with the session mtx
+ * held, after the previous head has been removed.
+ */
+
+static void
+h2_sched_next(struct h2_sess *h2)
+{
+	struct h2_req *r2, *best = NULL;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	VTAILQ_FOREACH(r2, &h2->txqueue, tx_list) {
+		if (r2 == h2->req0) {
+			best = r2;
+			break;
+		}
+		best = h2_sched_best(best, r2, H2_WAIT_TX);
+	}
+	if (best == NULL)
+		best = VTAILQ_FIRST(&h2->txqueue);
+	if (best == NULL)
+		return;
+	if (best != VTAILQ_FIRST(&h2->txqueue)) {
+		VTAILQ_REMOVE(&h2->txqueue, best, tx_list);
+		VTAILQ_INSERT_HEAD(&h2->txqueue, best, tx_list);
+	}
+	if (best->tx_vtime > h2->tx_vtime)
+		h2->tx_vtime = best->tx_vtime;
+	CHECK_OBJ_NOTNULL(best->wrk, WORKER_MAGIC);
+	AZ(pthread_cond_signal(&best->wrk->cond));
+}
+
+/*
+ * Wake the stream which should have the connection window next.
+ * The session mtx must be held.
+ */
+
+static void
+h2_sched_window(const struct h2_sess *h2)
+{
+	struct h2_req *r2, *best = NULL;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	if (h2->req0->t_window <= 0)
+		return;
+	VTAILQ_FOREACH(r2, &h2->winqueue, win_list)
+		best = h2_sched_best(best, r2, H2_WAIT_WINDOW);
+	if (best == NULL)
+		best = VTAILQ_FIRST(&h2->winqueue);
+	if (best != NULL && best->cond != NULL)
+		AZ(pthread_cond_signal(best->cond));
+}
+
+void
+H2_Send_Window(struct h2_sess *h2)
+{
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	h2_sched_window(h2);
+}
+
 static void
 h2_send_get(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
@@ -45,6 +175,9 @@ h2_send_get(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 
 	Lck_AssertHeld(&h2->sess->mtx);
 	r2->wrk = wrk;
+	h2_sched_wait(h2, r2, H2_WAIT_TX);
+	if (VTAILQ_EMPTY(&h2->txqueue) && r2->tx_vtime > h2->tx_vtime)
+		h2->tx_vtime = r2->tx_vtime;
 	VTAILQ_INSERT_TAIL(&h2->txqueue, r2, tx_list);
 	while (VTAILQ_FIRST(&h2->txqueue) != r2)
 		AZ(Lck_CondWait(&wrk->cond, &h2->sess->mtx, 0));
@@ -64,7 +197,7 @@ H2_Send_Get(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 }
 
 static void
-h2_send_rel(struct h2_sess *h2, const struct h2_req *r2)
+h2_send_rel(struct h2_sess *h2, struct h2_req *r2)
 {
 	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
@@ -72,21 +205,112 @@ h2_send_rel(struct h2_sess *h2, const struct h2_req *r2)
 	Lck_AssertHeld(&h2->sess->mtx);
 	assert(VTAILQ_FIRST(&h2->txqueue) == r2);
 	VTAILQ_REMOVE(&h2->txqueue, r2, tx_list);
-	r2 = VTAILQ_FIRST(&h2->txqueue);
-	if (r2 != NULL) {
-		CHECK_OBJ_NOTNULL(r2->wrk, WORKER_MAGIC);
-		AZ(pthread_cond_signal(&r2->wrk->cond));
+	assert(r2->waiting == H2_WAIT_TX);
+	r2->waiting = 0;
+	h2_sched_charge(r2);
+	h2_sched_next(h2);
+}
+
+/*
+ * Frames are collected in the session's transmit buffer while streams
+ * hand the txqueue on to each other, and the last one out writes them.
+ */
+
+void
+H2_Send_Init(struct h2_sess *h2)
+{
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AZ(h2->tx_buf);
+
+	h2->tx_size = cache_param->h2_tx_buffer_size;
+	if (h2->tx_size > 0) {
+		h2->tx_buf = malloc(h2->tx_size);
+		if (h2->tx_buf == NULL)
+			h2->tx_size = 0;
 	}
+	h2->tx_len = 0;
 }
 
 void
-H2_Send_Rel(struct h2_sess *h2, const struct h2_req *r2)
+H2_Send_Fini(struct h2_sess *h2)
+{
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AZ(h2->tx_len);
+
+	free(h2->tx_buf);
+	h2->tx_buf = NULL;
+	h2->tx_size = 0;
+}
+
+static h2_error
+h2_tx_writev(struct h2_sess *h2, struct iovec *iov, int niov)
+{
+	ssize_t s;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	h2->tx_len = 0;
+	while (niov > 0 && h2->tx_error == NULL) {
+		s = writev(h2->sess->fd, iov, niov);
+		h2->tx_writes++;
+		if (s <= 0) {
+			h2->tx_error = H2CE_PROTOCOL_ERROR; // XXX Need private ?
+			break;
+		}
+		while (niov > 0 && (size_t)s >= iov->iov_len) {
+			s -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + s;
+			iov->iov_len -= s;
+		}
+	}
+	return (h2->tx_error);
+}
+
+static void
+h2_tx_flush(struct h2_sess *h2)
+{
+	struct iovec iov[1];
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	if (h2->tx_len == 0)
+		return;
+	iov[0].iov_base = h2->tx_buf;
+	iov[0].iov_len = h2->tx_len;
+	(void)h2_tx_writev(h2, iov, 1);
+}
+
+/*
+ * Release the txqueue, writing out the buffered frames unless somebody
+ * is lined up to add to them.  Called with the session mtx held.
+ */
+
+static void
+h2_send_rel_flush(struct h2_sess *h2, struct h2_req *r2)
 {
 	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
 	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
 
-	Lck_Lock(&h2->sess->mtx);
+	Lck_AssertHeld(&h2->sess->mtx);
+	assert(VTAILQ_FIRST(&h2->txqueue) == r2);
+	if (h2->tx_len > 0 && VTAILQ_NEXT(r2, tx_list) == NULL) {
+		Lck_Unlock(&h2->sess->mtx);
+		h2_tx_flush(h2);
+		Lck_Lock(&h2->sess->mtx);
+	}
 	h2_send_rel(h2, r2);
+}
+
+void
+H2_Send_Rel(struct h2_sess *h2, struct h2_req *r2)
+{
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+
+	Lck_Lock(&h2->sess->mtx);
+	h2_send_rel_flush(h2, r2);
 	Lck_Unlock(&h2->sess->mtx);
 }
 
@@ -106,16 +330,20 @@ h2_mk_hdr(uint8_t *hdr, h2_frame ftyp, uint8_t flags,
 /*
  * This is the "raw" frame sender, all per stream accounting and
  * prioritization must have happened before this is called, and
- * the session mtx must be held.
+ * the caller must be at the head of the txqueue.
+ *
+ * Frames which fit are appended to the transmit buffer, otherwise
+ * the buffer, the frame header and the payload go in one writev().
  */
 
 h2_error
-H2_Send_Frame(struct worker *wrk, const struct h2_sess *h2,
+H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
     h2_frame ftyp, uint8_t flags,
     uint32_t len, uint32_t stream, const void *ptr)
 {
 	uint8_t hdr[9];
-	ssize_t s;
+	struct iovec iov[3];
+	int niov = 0;
 
 	(void)wrk;
 
@@ -128,24 +356,37 @@ H2_Send_Frame(struct worker *wrk, const struct h2_sess *h2,
 
 	h2_mk_hdr(hdr, ftyp, flags, len, stream);
 	Lck_Lock(&h2->sess->mtx);
-	VSLb_bin(h2->vsl, SLT_H2TxHdr, 9, hdr);
+	h2_vsl_frame(h2, 1, hdr, ptr);
 	h2->srq->acct.resp_hdrbytes += 9;
 	if (ftyp->overhead)
 		h2->srq->acct.resp_bodybytes += len;
 	Lck_Unlock(&h2->sess->mtx);
 
-	s = write(h2->sess->fd, hdr, sizeof hdr);
-	if (s != sizeof hdr)
-		return (H2CE_PROTOCOL_ERROR);		// XXX Need private ?
+	if (h2->tx_error != NULL)
+		return (h2->tx_error);
+
+	h2->tx_frames++;
+	if ((uint64_t)h2->tx_len + sizeof hdr + len <= h2->tx_size) {
+		memcpy(h2->tx_buf + h2->tx_len, hdr, sizeof hdr);
+		h2->tx_len += sizeof hdr;
+		if (len > 0) {
+			memcpy(h2->tx_buf + h2->tx_len, ptr, len);
+			h2->tx_len += len;
+		}
+		return (0);
+	}
+
+	if (h2->tx_len > 0) {
+		iov[niov].iov_base = h2->tx_buf;
+		iov[niov++].iov_len = h2->tx_len;
+	}
+	iov[niov].iov_base = hdr;
+	iov[niov++].iov_len = sizeof hdr;
 	if (len > 0) {
-		s = write(h2->sess->fd, ptr, len);
-		if (s != len)
-			return (H2CE_PROTOCOL_ERROR);	// XXX Need private ?
-		Lck_Lock(&h2->sess->mtx);
-		VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
-		Lck_Unlock(&h2->sess->mtx);
+		iov[niov].iov_base = TRUST_ME(ptr);
+		iov[niov++].iov_len = len;
 	}
-	return (0);
+	return (h2_tx_writev(h2, iov, niov));
 }
 
 static int64_t
@@ -203,30 +444,32 @@ h2_do_window(struct worker *wrk, struct h2_req *r2,
 		return (0);
 
 	Lck_Lock(&h2->sess->mtx);
-	if (r2->t_window <= 0 || h2->req0->t_window <= 0) {
-		h2_send_rel(h2, r2);
+	while ((r2->t_window <= 0 || h2->req0->t_window <= 0) &&
+	    h2_errcheck(r2, h2) == 0) {
+		/* The peer must see what we have sent before we sleep */
+		h2_send_rel_flush(h2, r2);
+		r2->cond = &wrk->cond;
 		while (r2->t_window <= 0 && h2_errcheck(r2, h2) == 0) {
-			r2->cond = &wrk->cond;
 			// XXX: timeout handling (subject to send_timeout?)
 			AZ(Lck_CondWait(r2->cond, &h2->sess->mtx, 0));
-			r2->cond = NULL;
 		}
-		while (h2->req0->t_window <= 0 && h2_errcheck(r2, h2) == 0) {
-			// XXX: timeout handling
-			AZ(Lck_CondWait(h2->cond, &h2->sess->mtx, 0));
-		}
-
-		if (h2_errcheck(r2, h2) == 0) {
-			w = h2_win_limit(r2, h2);
-			if (w > wanted)
-				w = wanted;
-			h2_win_charge(r2, h2, w);
-			assert (w > 0);
+		if (h2->req0->t_window <= 0 && h2_errcheck(r2, h2) == 0) {
+			h2_sched_wait(h2, r2, H2_WAIT_WINDOW);
+			VTAILQ_INSERT_TAIL(&h2->winqueue, r2, win_list);
+			do {
+				// XXX: timeout handling
+				AZ(Lck_CondWait(r2->cond, &h2->sess->mtx, 0));
+			} while (h2->req0->t_window <= 0 &&
+			    h2_errcheck(r2, h2) == 0);
+			VTAILQ_REMOVE(&h2->winqueue, r2, win_list);
+			r2->waiting = 0;
 		}
+		r2->cond = NULL;
+		/* The window is granted in txqueue order */
 		h2_send_get(wrk, h2, r2);
 	}
 
-	if (w == 0 && h2_errcheck(r2, h2) == 0) {
+	if (h2_errcheck(r2, h2) == 0) {
 		assert(r2->t_window > 0);
 		assert(h2->req0->t_window > 0);
 		w = h2_win_limit(r2, h2);
@@ -235,13 +478,14 @@ h2_do_window(struct worker *wrk, struct h2_req *r2,
 		h2_win_charge(r2, h2, w);
 		assert (w > 0);
 	}
+	/* Pass on what is left of the connection window */
+	h2_sched_window(h2);
 	Lck_Unlock(&h2->sess->mtx);
 	return (w);
 }
 
 /*
  * This is the per-stream frame sender.
- * XXX: priority
  */
 
 h2_error
@@ -262,7 +506,16 @@ H2_Send(struct worker *wrk, struct h2_req *r2,
 
 	assert(VTAILQ_FIRST(&h2->txqueue) == r2);
 
-	retval = h2_errcheck(r2, h2);
+	/*
+	 * A header block has already updated the HPACK encoder table, so
+	 * it must go out even if the client reset the stream meanwhile.
+	 * Our own RST_STREAM cannot overtake it, it queues behind us.
+	 */
+	if (ftyp == H2_F_HEADERS)
+		retval = (h2->error && r2->stream > h2->goaway_last_stream) ?
+		    h2->error : 0;
+	else
+		retval = h2_errcheck(r2, h2);
 	if (retval)
 		return (retval);
 
@@ -273,6 +526,8 @@ H2_Send(struct worker *wrk, struct h2_req *r2,
 	else
 		AZ(ftyp->act_snonzero);
 
+	r2->tx_pending += len;
+
 	Lck_Lock(&h2->sess->mtx);
 	mfs = h2->remote_settings.max_frame_size;
 	Lck_Unlock(&h2->sess->mtx);
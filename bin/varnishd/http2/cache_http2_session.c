@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 
+#include "cache/cache_objhead.h"
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
 
@@ -125,11 +126,18 @@ h2_new_sess(const struct worker *wrk, struct sess *sp, struct req *srq)
 		h2->rxthr = pthread_self();
 		VTAILQ_INIT(&h2->streams);
 		VTAILQ_INIT(&h2->txqueue);
+		VTAILQ_INIT(&h2->winqueue);
 		h2_local_settings(&h2->local_settings);
 		h2->remote_settings = H2_proto_settings;
 
 		AZ(VHT_Init(h2->dectbl,
 			h2->local_settings.header_table_size));
+		AZ(VHT_Init(h2->enctbl,
+			cache_param->h2_tx_header_table_size));
+		h2->enc_size = h2->remote_settings.header_table_size;
+		if (h2->enctbl->maxsize > h2->enc_size)
+			AZ(VHT_SetMaxTableSize(h2->enctbl, h2->enc_size));
+		H2_Send_Init(h2);
 
 		SES_Reserve_proto_priv(sp, &up);
 		*up = (uintptr_t)h2;
@@ -294,15 +302,107 @@ H2_OU_Sess(struct worker *wrk, struct sess *sp, struct req *req)
 	SES_SetTransport(wrk, sp, req, &H2_transport);
 }
 
+/**********************************************************************
+ * Hand an idle session to the waiter, closed streams are deleted first
+ * so they do not tie up memory while we wait.
+ */
+
+static int
+h2_park(struct worker *wrk, struct h2_sess *h2)
+{
+	struct h2_req *r2, *r22;
+	enum sess_close sc;
+
+	VTAILQ_FOREACH_SAFE(r2, &h2->streams, list, r22)
+		if (r2->state == H2_S_CLOSED && !r2->scheduled)
+			h2_del_req(wrk, r2);
+	h2->cond = NULL;
+	VSL_Flush(h2->vsl, 0);
+	wrk->stats->sess_herd++;
+	sc = SES_Wait(h2->sess, &H2_transport);
+	if (sc == SC_NULL)
+		return (1);
+	h2->cond = &wrk->cond;
+	Lck_Lock(&h2->sess->mtx);
+	VSLb(h2->vsl, SLT_Debug, "H2: Cannot wait (%s)",
+	    sess_close_2str(sc, 0));
+	h2->error = H2CE_NO_ERROR;
+	Lck_Unlock(&h2->sess->mtx);
+	return (0);
+}
+
+/**********************************************************************
+ * Receive frames until the session is closed or goes idle.
+ */
+
+static void
+h2_rx_session(struct worker *wrk, struct h2_sess *h2, uintptr_t wsp)
+{
+	struct h2_req *r2, *r22;
+	int again, i;
+
+	h2->rxthr = pthread_self();
+	h2->cond = &wrk->cond;
+
+	while (h2->error == NULL) {
+		AN(h2->ws->r);
+		i = h2_rxframe(wrk, h2);
+		if (i < 0 && h2_park(wrk, h2))
+			return;
+		if (i <= 0)
+			break;
+		WS_Reset(h2->ws, wsp);
+		HTC_RxInit(h2->htc, h2->ws);
+		if (WS_Overflowed(h2->ws)) {
+			VSLb(h2->vsl, SLT_Debug, "H2: Empty Rx Workspace");
+			h2->error = H2CE_INTERNAL_ERROR;
+			break;
+		}
+	}
+
+	AN(h2->error);
+
+	/* Delete all idle streams */
+	VSLb(h2->vsl, SLT_Debug, "H2 CLEANUP %s", h2->error->name);
+	Lck_Lock(&h2->sess->mtx);
+	VTAILQ_FOREACH(r2, &h2->streams, list) {
+		if (r2->error == 0)
+			r2->error = h2->error;
+		if (r2->cond != NULL)
+			AZ(pthread_cond_signal(r2->cond));
+	}
+	AZ(pthread_cond_broadcast(h2->cond));
+	Lck_Unlock(&h2->sess->mtx);
+	while (1) {
+		again = 0;
+		VTAILQ_FOREACH_SAFE(r2, &h2->streams, list, r22) {
+			if (r2 != h2->req0) {
+				h2_kill_req(wrk, h2, r2, h2->error);
+				again++;
+			}
+		}
+		if (!again)
+			break;
+		Lck_Lock(&h2->sess->mtx);
+		VTAILQ_FOREACH(r2, &h2->streams, list)
+			VSLb(h2->vsl, SLT_Debug, "ST %u %d",
+			    r2->stream, r2->state);
+		(void)Lck_CondWait(h2->cond, &h2->sess->mtx, VTIM_real() + .1);
+		Lck_Unlock(&h2->sess->mtx);
+	}
+	h2->cond = NULL;
+	h2_del_req(wrk, h2->req0);
+}
+
+/**********************************************************************/
+
 static void v_matchproto_(task_func_t)
 h2_new_session(struct worker *wrk, void *arg)
 {
 	struct req *req;
 	struct sess *sp;
 	struct h2_sess *h2;
-	struct h2_req *r2, *r22;
 	uintptr_t wsp;
-	int again;
 	uint8_t settings[48];
 	size_t l;
 
@@ -343,51 +443,39 @@ h2_new_session(struct worker *wrk, void *arg)
 	AN(h2->ws->r);
 
 	/* and off we go... */
-	h2->cond = &wrk->cond;
+	h2_rx_session(wrk, h2, wsp);
+}
 
-	while (h2_rxframe(wrk, h2)) {
-		WS_Reset(h2->ws, wsp);
-		HTC_RxInit(h2->htc, h2->ws);
-		if (WS_Overflowed(h2->ws)) {
-			VSLb(h2->vsl, SLT_Debug, "H2: Empty Rx Workspace");
-			h2->error = H2CE_INTERNAL_ERROR;
-			break;
-		}
-		AN(h2->ws->r);
-	}
+/**********************************************************************
+ * Idle sessions come back here from the waiter, when there is something
+ * to read, the remote closed or the session timed out.
+ *
+ * Like for HTTP/1, the waiter leaves a struct pool_task reserved on
+ * the session workspace, which we release first.
+ */
 
-	AN(h2->error);
+static void v_matchproto_(task_func_t)
+h2_unwait(struct worker *wrk, void *arg)
+{
+	struct sess *sp;
+	struct h2_sess *h2;
+	uintptr_t *up, wsp;
 
-	/* Delete all idle streams */
-	VSLb(h2->vsl, SLT_Debug, "H2 CLEANUP %s", h2->error->name);
-	Lck_Lock(&h2->sess->mtx);
-	VTAILQ_FOREACH(r2, &h2->streams, list) {
-		if (r2->error == 0)
-			r2->error = h2->error;
-		if (r2->cond != NULL)
-			AZ(pthread_cond_signal(r2->cond));
-	}
-	AZ(pthread_cond_broadcast(h2->cond));
-	Lck_Unlock(&h2->sess->mtx);
-	while (1) {
-		again = 0;
-		VTAILQ_FOREACH_SAFE(r2, &h2->streams, list, r22) {
-			if (r2 != h2->req0) {
-				h2_kill_req(wrk, h2, r2, h2->error);
-				again++;
-			}
-		}
-		if (!again)
-			break;
-		Lck_Lock(&h2->sess->mtx);
-		VTAILQ_FOREACH(r2, &h2->streams, list)
-			VSLb(h2->vsl, SLT_Debug, "ST %u %d",
-			    r2->stream, r2->state);
-		(void)Lck_CondWait(h2->cond, &h2->sess->mtx, VTIM_real() + .1);
-		Lck_Unlock(&h2->sess->mtx);
-	}
-	h2->cond = NULL;
-	h2_del_req(wrk, h2->req0);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(sp, arg, SESS_MAGIC);
+	WS_Release(sp->ws, 0);
+	AZ(SES_Get_proto_priv(sp, &up));
+	CAST_OBJ_NOTNULL(h2, (void*)*up, H2_SESS_MAGIC);
+	THR_SetRequest(h2->srq);
+
+	wsp = WS_Snapshot(h2->ws);
+	if (VTIM_real() >= sp->t_idle + cache_param->timeout_idle) {
+		VSLb(h2->vsl, SLT_Debug, "H2: Idle timeout");
+		h2->error = H2CE_NO_ERROR;
+	} else
+		HTC_RxInit(h2->htc, h2->ws);
+	h2_rx_session(wrk, h2, wsp);
+	THR_SetRequest(NULL);
 }
 
 static void v_matchproto_(vtr_reembark_f)
@@ -405,6 +493,8 @@ h2_reembark(struct worker *wrk, struct req *req)
 	/* Couldn't schedule, ditch */
 	wrk->stats->busy_wakeup--;
 	wrk->stats->busy_killed++;
+	(void)HSH_DerefObjCore(wrk, &req->hash_objcore);
+	(void)HSH_DerefObjHead(wrk, &req->hash_objhead);
 	AN (req->vcl);
 	VCL_Rel(&req->vcl);
 	Req_AcctLogCharge(wrk->stats, req);
@@ -420,6 +510,8 @@ struct transport H2_transport = {
 	.deliver =		h2_deliver,
 	.minimal_response =	h2_minimal_response,
 	.new_session =		h2_new_session,
+	.unwait =		h2_unwait,
+	.stateful =		1,
 	.reembark =		h2_reembark,
 	.req_body =		h2_req_body,
 	.req_fail =		h2_req_fail,
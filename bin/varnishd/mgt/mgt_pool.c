@@ -191,12 +191,10 @@ struct parspec WRK_parspec[] = {
 	{ "thread_stats_rate",
 		tweak_uint, &mgt_param.wthread_stats_rate,
 		"0", NULL,
-		"Worker threads accumulate statistics, and dump these into "
-		"the global stats counters if the lock is free when they "
-		"finish a job (request/fetch etc.)\n"
-		"This parameters defines the maximum number of jobs "
-		"a worker thread may handle, before it is forced to dump "
-		"its accumulated stats into the global counters.",
+		"Obsolete: Worker threads now keep their statistics in "
+		"private shards, which are summed into the global stats "
+		"counters once per second regardless of this parameter.\n"
+		"It is retained for compatibility and has no effect.",
 		EXPERIMENTAL,
 		"10", "requests" },
 	{ "thread_queue_limit", tweak_uint, &mgt_param.wthread_queue_limit,
@@ -93,6 +93,28 @@ STV_NewObject(struct worker *wrk, struct objcore *oc,
 	return (1);
 }
 
+/*-------------------------------------------------------------------
+ * Hand the file extents holding the body of a complete object to func,
+ * for stevedores which keep bodies in a file.  Returns 1 without calling
+ * func if the stevedore does not, otherwise 0, or -1 if func failed.
+ */
+
+int
+STV_Sendfile(struct worker *wrk, struct objcore *oc, void *priv,
+    objsendfile_f *func)
+{
+	const struct stevedore *stv;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(func);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	if (stv->sendfile == NULL)
+		return (1);
+	return (stv->sendfile(wrk, oc, priv, func));
+}
+
 /*-------------------------------------------------------------------*/
 
 void
@@ -72,6 +72,9 @@ typedef int storage_baninfo_f(const struct stevedore *, enum baninfo event,
 typedef void storage_banexport_f(const struct stevedore *, const uint8_t *bans,
     unsigned len);
 typedef void storage_panic_f(struct vsb *vsb, const struct objcore *oc);
+typedef int objsendfile_f(void *priv, int fd, off_t off, ssize_t len);
+typedef int storage_sendfile_f(struct worker *, struct objcore *,
+    void *priv, objsendfile_f *func);
 
 
 typedef struct object *sml_getobj_f(struct worker *, struct objcore *);
@@ -100,6 +103,7 @@ struct stevedore {
 	storage_baninfo_f	*baninfo;
 	storage_banexport_f	*banexport;
 	storage_panic_f		*panic;
+	storage_sendfile_f	*sendfile;
 
 	/* Only if SML is used */
 	sml_alloc_f		*sml_alloc;
@@ -131,6 +135,10 @@ extern struct stevedore *stv_transient;
 
 int STV__iter(struct stevedore ** const );
 
+/*--------------------------------------------------------------------*/
+int STV_Sendfile(struct worker *, struct objcore *, void *priv,
+    objsendfile_f *func);
+
 /*--------------------------------------------------------------------*/
 int STV_GetFile(const char *fn, int *fdp, const char **fnp, const char *ctx);
 uintmax_t STV_FileSize(int fd, const char *size, unsigned *granularity,
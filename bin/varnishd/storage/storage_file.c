@@ -32,6 +32,8 @@
 #include "config.h"
 
 #include "cache/cache_varnishd.h"
+#include "cache/cache_obj.h"
+#include "cache/cache_objhead.h"
 #include "common/heritage.h"
 
 #include <sys/mman.h>
@@ -40,6 +42,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_ATOMIC_BUILTINS)
+#  include <linux/io_uring.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#  ifdef __NR_io_uring_setup
+#    define SMF_URING
+#  endif
+#endif
+
 #include "storage/storage.h"
 #include "storage/storage_simple.h"
 
@@ -104,8 +115,386 @@ struct smf_sc {
 	struct smfhead		order;
 	struct smfhead		free[NBUCKET];
 	struct smfhead		used;
+#ifdef SMF_URING
+	struct lock		uring_mtx;
+	unsigned		n_uring;
+	VTAILQ_HEAD(, smf_uring) uring_free;
+#endif
+};
+
+/*--------------------------------------------------------------------
+ * Delivery through io_uring
+ *
+ * With the "uring" io option, complete objects are delivered from
+ * buffers filled by asynchronous reads from the file, rather than by
+ * touching the mapping.  A few reads are kept in flight ahead of the
+ * one being delivered, and a worker which hits evicted pages waits
+ * for those reads instead of taking major faults one page at a time.
+ * Each stevedore has at most SMF_URING_RINGS rings with their buffers,
+ * which workers borrow for the duration of a delivery.  Objects still
+ * being fetched, and deliveries finding all rings in use, go through
+ * the mapping by the SML iterator.
+ */
+
+#ifdef SMF_URING
+
+#define SMF_URING_DEPTH		4
+#define SMF_URING_BUFSZ		(128 * 1024)
+#define SMF_URING_RINGS		16
+
+struct smf_uring_slot {
+	struct iovec		iov;
+	struct storage		*st;
+	ssize_t			off;
+	ssize_t			len;
+	int			res;
+	int			done;
+};
+
+struct smf_uring {
+	unsigned		magic;
+#define SMF_URING_MAGIC		0x2d84a9c1
+	int			fd;
+	unsigned		nsubmit;
+	VTAILQ_ENTRY(smf_uring)	list;
+
+	void			*sq_ring;
+	size_t			sq_ring_sz;
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		sq_mask;
+	unsigned		*sq_array;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_sz;
+
+	void			*cq_ring;
+	size_t			cq_ring_sz;
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	unsigned char		*buf;
+	struct smf_uring_slot	slot[SMF_URING_DEPTH];
 };
 
+static struct obj_methods smf_uring_methods;
+
+static void
+smf_uring_destroy(struct smf_uring *su)
+{
+
+	CHECK_OBJ_NOTNULL(su, SMF_URING_MAGIC);
+	if (su->sqes != NULL && su->sqes != MAP_FAILED)
+		(void)munmap(su->sqes, su->sqes_sz);
+	if (su->cq_ring != NULL && su->cq_ring != MAP_FAILED)
+		(void)munmap(su->cq_ring, su->cq_ring_sz);
+	if (su->sq_ring != NULL && su->sq_ring != MAP_FAILED)
+		(void)munmap(su->sq_ring, su->sq_ring_sz);
+	if (su->fd >= 0)
+		closefd(&su->fd);
+	free(su->buf);
+	FREE_OBJ(su);
+}
+
+static struct smf_uring *
+smf_uring_new(void)
+{
+	struct io_uring_params p;
+	struct smf_uring *su;
+	unsigned char *r;
+	unsigned u;
+
+	ALLOC_OBJ(su, SMF_URING_MAGIC);
+	AN(su);
+	memset(&p, 0, sizeof p);
+	su->fd = (int)syscall(__NR_io_uring_setup, SMF_URING_DEPTH, &p);
+	if (su->fd < 0) {
+		smf_uring_destroy(su);
+		return (NULL);
+	}
+
+	su->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	su->sq_ring = mmap(NULL, su->sq_ring_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, su->fd, IORING_OFF_SQ_RING);
+	su->cq_ring_sz = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	su->cq_ring = mmap(NULL, su->cq_ring_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, su->fd, IORING_OFF_CQ_RING);
+	su->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	su->sqes = mmap(NULL, su->sqes_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, su->fd, IORING_OFF_SQES);
+	su->buf = malloc(SMF_URING_DEPTH * SMF_URING_BUFSZ);
+	if (su->sq_ring == MAP_FAILED || su->cq_ring == MAP_FAILED ||
+	    su->sqes == MAP_FAILED || su->buf == NULL) {
+		smf_uring_destroy(su);
+		return (NULL);
+	}
+
+	r = su->sq_ring;
+	su->sq_head = (void*)(r + p.sq_off.head);
+	su->sq_tail = (void*)(r + p.sq_off.tail);
+	su->sq_mask = *(unsigned *)(void*)(r + p.sq_off.ring_mask);
+	su->sq_array = (void*)(r + p.sq_off.array);
+	r = su->cq_ring;
+	su->cq_head = (void*)(r + p.cq_off.head);
+	su->cq_tail = (void*)(r + p.cq_off.tail);
+	su->cq_mask = *(unsigned *)(void*)(r + p.cq_off.ring_mask);
+	su->cqes = (void*)(r + p.cq_off.cqes);
+
+	for (u = 0; u < SMF_URING_DEPTH; u++)
+		su->slot[u].iov.iov_base = su->buf + u * SMF_URING_BUFSZ;
+	return (su);
+}
+
+/* Borrow a ring, creating it if we are still below SMF_URING_RINGS */
+
+static struct smf_uring *
+smf_uring_get(struct smf_sc *sc)
+{
+	struct smf_uring *su;
+	int create = 0;
+
+	CHECK_OBJ_NOTNULL(sc, SMF_SC_MAGIC);
+	Lck_Lock(&sc->uring_mtx);
+	su = VTAILQ_FIRST(&sc->uring_free);
+	if (su != NULL) {
+		VTAILQ_REMOVE(&sc->uring_free, su, list);
+	} else if (sc->n_uring < SMF_URING_RINGS) {
+		sc->n_uring++;
+		create = 1;
+	} else {
+		sc->stats->c_uring_busy++;
+	}
+	Lck_Unlock(&sc->uring_mtx);
+	if (!create)
+		return (su);
+
+	su = smf_uring_new();
+	if (su == NULL) {
+		Lck_Lock(&sc->uring_mtx);
+		assert(sc->n_uring > 0);
+		sc->n_uring--;
+		Lck_Unlock(&sc->uring_mtx);
+	}
+	return (su);
+}
+
+static void
+smf_uring_put(struct smf_sc *sc, struct smf_uring *su)
+{
+
+	CHECK_OBJ_NOTNULL(sc, SMF_SC_MAGIC);
+	CHECK_OBJ_NOTNULL(su, SMF_URING_MAGIC);
+	AZ(su->nsubmit);
+	Lck_Lock(&sc->uring_mtx);
+	VTAILQ_INSERT_HEAD(&sc->uring_free, su, list);
+	Lck_Unlock(&sc->uring_mtx);
+}
+
+static void
+smf_uring_submit(struct smf_uring *su, int fd, unsigned n, off_t off)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	tail = *su->sq_tail;
+	idx = tail & su->sq_mask;
+	sqe = &su->sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->off = (uint64_t)off;
+	sqe->addr = (uintptr_t)&su->slot[n].iov;
+	sqe->len = 1;
+	sqe->user_data = n;
+	su->sq_array[idx] = idx;
+	__atomic_store_n(su->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	su->nsubmit++;
+	su->slot[n].done = 0;
+}
+
+/*
+ * Take back the queued reads the kernel did not accept, and do them
+ * synchronously instead.
+ */
+
+static void
+smf_uring_sync(struct smf_uring *su)
+{
+	struct io_uring_sqe *sqe;
+	struct smf_uring_slot *sl;
+	unsigned head, tail;
+
+	head = __atomic_load_n(su->sq_head, __ATOMIC_ACQUIRE);
+	for (tail = head; tail != *su->sq_tail; tail++) {
+		sqe = &su->sqes[su->sq_array[tail & su->sq_mask]];
+		assert(sqe->user_data < SMF_URING_DEPTH);
+		sl = &su->slot[sqe->user_data];
+		AZ(sl->done);
+		sl->res = (int)pread(sqe->fd, sl->iov.iov_base,
+		    sl->iov.iov_len, (off_t)sqe->off);
+		sl->done = 1;
+	}
+	__atomic_store_n(su->sq_tail, head, __ATOMIC_RELEASE);
+}
+
+/* Submit what is queued, and wait for at least 'wait' completions */
+
+static void
+smf_uring_enter(struct smf_uring *su, unsigned wait)
+{
+	struct io_uring_cqe *cqe;
+	struct smf_uring_slot *sl;
+	unsigned head, tail;
+	int i;
+
+	do {
+		i = (int)syscall(__NR_io_uring_enter, su->fd, su->nsubmit,
+		    wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (i < 0 && errno == EINTR);
+	if (i < 0) {
+		/* Out of kernel resources for now */
+		assert(errno == EAGAIN || errno == EBUSY || errno == ENOMEM);
+		i = 0;
+	}
+	assert((unsigned)i <= su->nsubmit);
+	if ((unsigned)i < su->nsubmit)
+		smf_uring_sync(su);
+	su->nsubmit = 0;
+
+	head = *su->cq_head;
+	tail = __atomic_load_n(su->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &su->cqes[head & su->cq_mask];
+		assert(cqe->user_data < SMF_URING_DEPTH);
+		sl = &su->slot[cqe->user_data];
+		AZ(sl->done);
+		sl->res = cqe->res;
+		sl->done = 1;
+	}
+	__atomic_store_n(su->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int v_matchproto_(objiterator_f)
+smf_uring_iterator(struct worker *wrk, struct objcore *oc,
+    void *priv, objiterate_f *func, int final)
+{
+	const struct stevedore *stv;
+	struct object *obj;
+	struct storage *st, *stn;
+	struct smf_uring *su;
+	struct smf_uring_slot *sl;
+	struct smf_sc *sc;
+	struct smf *smf;
+	struct boc *boc;
+	ssize_t off = 0;
+	unsigned head = 0, nslot = 0, nfail = 0, n;
+	int ret = 0;
+	const void *p;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMF_SC_MAGIC);
+	CAST_OBJ_NOTNULL(obj, oc->stobj->priv, OBJECT_MAGIC);
+
+	boc = HSH_RefBoc(oc);
+	if (boc != NULL)
+		HSH_DerefBoc(wrk, oc);
+	su = NULL;
+	if (boc == NULL)
+		su = smf_uring_get(sc);
+	if (su == NULL)
+		return (SML_methods.objiterator(wrk, oc, priv, func, final));
+
+	st = VTAILQ_FIRST(&obj->list);
+	while (1) {
+		/* Keep the pipeline full */
+		while (ret == 0 && st != NULL && nslot < SMF_URING_DEPTH) {
+			if (off == st->len) {
+				st = VTAILQ_NEXT(st, list);
+				off = 0;
+				continue;
+			}
+			CAST_OBJ_NOTNULL(smf, st->priv, SMF_MAGIC);
+			n = (head + nslot) % SMF_URING_DEPTH;
+			sl = &su->slot[n];
+			sl->st = st;
+			sl->off = off;
+			sl->len = st->len - off;
+			if (sl->len > SMF_URING_BUFSZ)
+				sl->len = SMF_URING_BUFSZ;
+			sl->iov.iov_len = sl->len;
+			smf_uring_submit(su, sc->fd, n, smf->offset + off);
+			off += sl->len;
+			nslot++;
+		}
+		if (nslot == 0)
+			break;
+
+		sl = &su->slot[head];
+		smf_uring_enter(su, sl->done ? 0 : 1);
+		if (!sl->done)
+			continue;
+		head = (head + 1) % SMF_URING_DEPTH;
+		nslot--;
+		if (ret != 0)
+			continue;
+
+		if (sl->res == sl->len) {
+			p = sl->iov.iov_base;
+		} else {
+			p = sl->st->ptr + sl->off;
+			nfail++;
+		}
+		ret = func(priv, 1, p, sl->len);
+	}
+	smf_uring_put(sc, su);
+
+	if (final) {
+		VTAILQ_FOREACH_SAFE(st, &obj->list, list, stn) {
+			VTAILQ_REMOVE(&obj->list, st, list);
+			stv->sml_free(st);
+		}
+	}
+
+	if (nfail > 0) {
+		Lck_Lock(&sc->mtx);
+		sc->stats->c_uring_fallback += nfail;
+		Lck_Unlock(&sc->mtx);
+	}
+	return (ret);
+}
+
+static void
+smf_uring_init(struct stevedore *parent)
+{
+	struct smf_uring *su;
+
+	su = smf_uring_new();
+	if (su == NULL)
+		ARGV_ERR("(-sfile) io_uring not available: %s\n",
+		    strerror(errno));
+	smf_uring_destroy(su);
+	smf_uring_methods = SML_methods;
+	smf_uring_methods.objiterator = smf_uring_iterator;
+	parent->methods = &smf_uring_methods;
+}
+
+#else
+
+static void
+smf_uring_init(struct stevedore *parent)
+{
+
+	(void)parent;
+	ARGV_ERR("(-sfile) io_uring not supported on this platform\n");
+}
+
+#endif
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -116,13 +505,14 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	unsigned u;
 	uintmax_t page_size;
 	int advice = MADV_RANDOM;
+	int uring = 0;
 
 	AZ(av[ac]);
 
 	size = NULL;
 	page_size = getpagesize();
 
-	if (ac > 4)
+	if (ac > 5)
 		ARGV_ERR("(-sfile) too many arguments\n");
 	if (ac < 1 || *av[0] == '\0')
 		ARGV_ERR("(-sfile) path is mandatory\n");
@@ -135,7 +525,7 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 		if (r != NULL)
 			ARGV_ERR("(-sfile) granularity \"%s\": %s\n", av[2], r);
 	}
-	if (ac > 3) {
+	if (ac > 3 && *av[3] != '\0') {
 		if (!strcmp(av[3], "normal"))
 			advice = MADV_NORMAL;
 		else if (!strcmp(av[3], "random"))
@@ -145,6 +535,12 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 		else
 			ARGV_ERR("(-s file) invalid advice: \"%s\"", av[3]);
 	}
+	if (ac > 4) {
+		if (!strcmp(av[4], "uring"))
+			uring = 1;
+		else if (strcmp(av[4], "mmap"))
+			ARGV_ERR("(-sfile) invalid io: \"%s\"\n", av[4]);
+	}
 
 	AN(fn);
 
@@ -158,6 +554,9 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	sc->advice = advice;
 	parent->priv = sc;
 
+	if (uring)
+		smf_uring_init(parent);
+
 	(void)STV_GetFile(fn, &sc->fd, &sc->filename, "-sfile");
 	MCH_Fd_Inherit(sc->fd, "storage_file");
 	sc->filesize = STV_FileSize(sc->fd, size, &sc->pagesize, "-sfile");
@@ -415,6 +814,10 @@ smf_open(struct stevedore *st)
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
 	sc->stats = VSC_smf_New(NULL, NULL, st->ident);
 	Lck_New(&sc->mtx, lck_smf);
+#ifdef SMF_URING
+	Lck_New(&sc->uring_mtx, lck_smf);
+	VTAILQ_INIT(&sc->uring_free);
+#endif
 	Lck_Lock(&sc->mtx);
 	smf_open_chunk(sc, sc->filesize, 0, &fail, &sum);
 	Lck_Unlock(&sc->mtx);
@@ -486,6 +889,52 @@ smf_free(struct storage *s)
 
 /*--------------------------------------------------------------------*/
 
+/*--------------------------------------------------------------------
+ * Hand out the file extents of an object body, merging segments which
+ * happen to be adjacent in the file.
+ */
+
+static int v_matchproto_(storage_sendfile_f)
+smf_sendfile(struct worker *wrk, struct objcore *oc, void *priv,
+    objsendfile_f *func)
+{
+	const struct stevedore *stv;
+	struct object *obj;
+	struct storage *st;
+	struct smf_sc *sc;
+	struct smf *smf;
+	off_t off = 0, o;
+	ssize_t len = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMF_SC_MAGIC);
+	CAST_OBJ_NOTNULL(obj, oc->stobj->priv, OBJECT_MAGIC);
+
+	VTAILQ_FOREACH(st, &obj->list, list) {
+		CAST_OBJ_NOTNULL(smf, st->priv, SMF_MAGIC);
+		if (st->len == 0)
+			continue;
+		assert(st->ptr >= smf->ptr);
+		o = smf->offset + (st->ptr - smf->ptr);
+		if (len > 0 && off + len == o) {
+			len += st->len;
+			continue;
+		}
+		if (len > 0 && func(priv, sc->fd, off, len))
+			return (-1);
+		off = o;
+		len = st->len;
+	}
+	if (len > 0 && func(priv, sc->fd, off, len))
+		return (-1);
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
 const struct stevedore smf_stevedore = {
 	.magic		=	STEVEDORE_MAGIC,
 	.name		=	"file",
@@ -495,6 +944,7 @@ const struct stevedore smf_stevedore = {
 	.sml_free	=	smf_free,
 	.allocobj	=	SML_allocobj,
 	.panic		=	SML_panic,
+	.sendfile	=	smf_sendfile,
 	.methods	=	&SML_methods,
 };
 
@@ -26,24 +26,44 @@
  * SUCH DAMAGE.
  *
  * Least-Recently-Used logic for freeing space in stevedores.
+ *
+ * Each stevedore's LRU is split into a number of shards, each with its
+ * own list and lock, and objects are assigned to a shard by hashing the
+ * objcore address.  When a shard lock is contended, LRU_Touch() does not
+ * wait but leaves the time of the touch in the objcore, and the move is
+ * applied when the shard is next walked by LRU_NukeOne().
  */
 
 #include "config.h"
 
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cache/cache_varnishd.h"
 #include "cache/cache_objhead.h"
 
 #include "storage/storage.h"
 
-struct lru {
+#define LRU_SHARDS_MAX		64	/* see lru_shards parameter */
+
+struct lru_shard {
 	unsigned		magic;
-#define LRU_MAGIC		0x3fec7bb0
+#define LRU_SHARD_MAGIC		0x5b1e0c8d
+	unsigned		n_obj;
+	double			oldest;
 	VTAILQ_HEAD(,objcore)	lru_head;
 	struct lock		mtx;
 };
 
+struct lru {
+	unsigned		magic;
+#define LRU_MAGIC		0x3fec7bb0
+	unsigned		nshard;
+	struct lru_shard	**shard;
+};
+
 static struct lru *
 lru_get(const struct objcore *oc)
 {
@@ -53,15 +73,72 @@ lru_get(const struct objcore *oc)
 	return (oc->stobj->stevedore->lru);
 }
 
+static struct lru_shard *
+lru_shard(const struct lru *lru, const struct objcore *oc)
+{
+	uint64_t u;
+	struct lru_shard *ls;
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	u = (uintptr_t)oc >> 4;
+	u *= 0x9e3779b97f4a7c15ULL;
+	ls = lru->shard[(u >> 32) % lru->nshard];
+	CHECK_OBJ_NOTNULL(ls, LRU_SHARD_MAGIC);
+	return (ls);
+}
+
+/*--------------------------------------------------------------------
+ * Shard list manipulation, all called with the shard lock held.
+ *
+ * ls->oldest tracks the timestamp of the head of the list, so that
+ * LRU_NukeOne() can pick a shard without taking every shard lock.
+ */
+
+static void
+lru_shard_head(struct lru_shard *ls)
+{
+	struct objcore *oc;
+
+	Lck_AssertHeld(&ls->mtx);
+	oc = VTAILQ_FIRST(&ls->lru_head);
+	ls->oldest = (oc == NULL) ? NAN : oc->last_lru;
+}
+
+static void
+lru_shard_totail(struct lru_shard *ls, struct objcore *oc, double now)
+{
+
+	Lck_AssertHeld(&ls->mtx);
+	VTAILQ_REMOVE(&ls->lru_head, oc, lru_list);
+	VTAILQ_INSERT_TAIL(&ls->lru_head, oc, lru_list);
+	oc->last_lru = now;
+	oc->lru_touch = 0.;
+	lru_shard_head(ls);
+}
+
+/*--------------------------------------------------------------------*/
+
 struct lru *
 LRU_Alloc(void)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
+	unsigned u;
 
 	ALLOC_OBJ(lru, LRU_MAGIC);
 	AN(lru);
-	VTAILQ_INIT(&lru->lru_head);
-	Lck_New(&lru->mtx, lck_lru);
+	lru->nshard = cache_param->lru_shards;
+	assert(lru->nshard > 0);
+	lru->shard = calloc(lru->nshard, sizeof *lru->shard);
+	AN(lru->shard);
+	for (u = 0; u < lru->nshard; u++) {
+		ALLOC_OBJ(ls, LRU_SHARD_MAGIC);
+		AN(ls);
+		VTAILQ_INIT(&ls->lru_head);
+		ls->oldest = NAN;
+		Lck_New(&ls->mtx, lck_lru);
+		lru->shard[u] = ls;
+	}
 	return (lru);
 }
 
@@ -69,19 +146,27 @@ void
 LRU_Free(struct lru **pp)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(lru, pp, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	AN(VTAILQ_EMPTY(&lru->lru_head));
-	Lck_Unlock(&lru->mtx);
-	Lck_Delete(&lru->mtx);
+	for (u = 0; u < lru->nshard; u++) {
+		TAKE_OBJ_NOTNULL(ls, &lru->shard[u], LRU_SHARD_MAGIC);
+		Lck_Lock(&ls->mtx);
+		AN(VTAILQ_EMPTY(&ls->lru_head));
+		AZ(ls->n_obj);
+		Lck_Unlock(&ls->mtx);
+		Lck_Delete(&ls->mtx);
+		FREE_OBJ(ls);
+	}
+	free(lru->shard);
 	FREE_OBJ(lru);
 }
 
 void
 LRU_Add(struct objcore *oc, double now)
 {
-	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -91,19 +176,21 @@ LRU_Add(struct objcore *oc, double now)
 	AZ(oc->boc);
 	AN(isnan(oc->last_lru));
 	AZ(isnan(now));
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	ls = lru_shard(lru_get(oc), oc);
+	Lck_Lock(&ls->mtx);
+	VTAILQ_INSERT_TAIL(&ls->lru_head, oc, lru_list);
+	ls->n_obj++;
 	oc->last_lru = now;
+	oc->lru_touch = 0.;
 	AZ(isnan(oc->last_lru));
-	Lck_Unlock(&lru->mtx);
+	lru_shard_head(ls);
+	Lck_Unlock(&ls->mtx);
 }
 
 void
 LRU_Remove(struct objcore *oc)
 {
-	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -111,19 +198,22 @@ LRU_Remove(struct objcore *oc)
 		return;
 
 	AZ(oc->boc);
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
+	ls = lru_shard(lru_get(oc), oc);
+	Lck_Lock(&ls->mtx);
 	AZ(isnan(oc->last_lru));
-	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+	VTAILQ_REMOVE(&ls->lru_head, oc, lru_list);
+	assert(ls->n_obj > 0);
+	ls->n_obj--;
 	oc->last_lru = NAN;
-	Lck_Unlock(&lru->mtx);
+	oc->lru_touch = 0.;
+	lru_shard_head(ls);
+	Lck_Unlock(&ls->mtx);
 }
 
 void v_matchproto_(objtouch_f)
 LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 {
-	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -132,7 +222,7 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 		return;
 
 	/*
-	 * To avoid the exphdl->mtx becoming a hotspot, we only
+	 * To avoid the shard mutexes becoming a hotspot, we only
 	 * attempt to move objects if they have not been moved
 	 * recently and if the lock is available.  This optimization
 	 * obviously leaves the LRU list imperfectly sorted.
@@ -141,19 +231,115 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 	if (now - oc->last_lru < cache_param->lru_interval)
 		return;
 
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-
-	if (Lck_Trylock(&lru->mtx))
+	ls = lru_shard(lru_get(oc), oc);
+
+	if (DO_DEBUG(DBG_LRU_DEFER) || Lck_Trylock(&ls->mtx)) {
+		/*
+		 * Somebody else holds the shard, record when we touched
+		 * the object and let LRU_NukeOne() move it.  We hold a
+		 * reference, so LRU_Remove() cannot race us here, and
+		 * losing a deferred touch to a concurrent move is
+		 * harmless.
+		 */
+		if (oc->lru_touch == 0.) {
+			oc->lru_touch = (float)(now - oc->last_lru);
+			wrk->stats->n_lru_deferred++;
+		}
 		return;
+	}
 
 	if (!isnan(oc->last_lru)) {
-		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-		VSC_C_main->n_lru_moved++;
-		oc->last_lru = now;
+		lru_shard_totail(ls, oc, now);
+		wrk->stats->n_lru_moved++;
+	}
+	Lck_Unlock(&ls->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Pick the shard with the oldest head which we have not tried yet.
+ *
+ * The timestamps and counts are read without holding the shard locks,
+ * so the merge across shards is only approximately in age order.
+ */
+
+static int
+lru_oldest(const struct lru *lru, const uint8_t *tried)
+{
+	const struct lru_shard *ls, *best = NULL;
+	unsigned u;
+	int i = -1;
+
+	for (u = 0; u < lru->nshard; u++) {
+		if (tried[u])
+			continue;
+		ls = lru->shard[u];
+		CHECK_OBJ_NOTNULL(ls, LRU_SHARD_MAGIC);
+		if (ls->n_obj == 0 || isnan(ls->oldest))
+			continue;
+		if (best == NULL || ls->oldest < best->oldest) {
+			best = ls;
+			i = (int)u;
+		}
+	}
+	return (i);
+}
+
+static void
+lru_imbalance(const struct lru *lru)
+{
+	unsigned u, n, lo, hi;
+
+	lo = UINT_MAX;
+	hi = 0;
+	for (u = 0; u < lru->nshard; u++) {
+		n = lru->shard[u]->n_obj;
+		if (n < lo)
+			lo = n;
+		if (n > hi)
+			hi = n;
+	}
+	VSC_C_main->lru_shard_imbalance = hi - lo;
+}
+
+/*--------------------------------------------------------------------
+ * Walk one shard from the head, applying deferred touches as we go, and
+ * snipe the first currently unused object.  Every object on the shard is
+ * visited at most once, even though deferred ones are moved to the tail.
+ */
+
+static struct objcore *
+lru_shard_nuke(struct worker *wrk, struct lru_shard *ls)
+{
+	struct objcore *oc, *oc2;
+	unsigned n;
+
+	Lck_Lock(&ls->mtx);
+	oc2 = VTAILQ_FIRST(&ls->lru_head);
+	for (n = ls->n_obj; n > 0; n--) {
+		oc = oc2;
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		AZ(isnan(oc->last_lru));
+		oc2 = VTAILQ_NEXT(oc, lru_list);
+
+		if (oc->lru_touch != 0.) {
+			lru_shard_totail(ls, oc, oc->last_lru + oc->lru_touch);
+			wrk->stats->n_lru_moved++;
+			continue;
+		}
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		if (HSH_Snipe(wrk, oc)) {
+			wrk->stats->n_lru_nuked++; // XXX per lru ?
+			lru_shard_totail(ls, oc, oc->last_lru);
+			break;
+		}
 	}
-	Lck_Unlock(&lru->mtx);
+	Lck_Unlock(&ls->mtx);
+	if (n == 0)
+		return (NULL);
+	return (oc);
 }
 
 /*--------------------------------------------------------------------
@@ -165,33 +351,30 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 int
 LRU_NukeOne(struct worker *wrk, struct lru *lru)
 {
-	struct objcore *oc, *oc2;
+	struct objcore *oc = NULL;
+	uint8_t tried[LRU_SHARDS_MAX];
+	int i;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	assert(lru->nshard <= LRU_SHARDS_MAX);
 
 	if (wrk->strangelove-- <= 0) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU reached nuke_limit");
 		return (0);
 	}
 
-	/* Find the first currently unused object on the LRU.  */
-	Lck_Lock(&lru->mtx);
-	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		AZ(isnan(oc->last_lru));
-
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
-		    oc, oc->flags, oc->refcnt);
+	lru_imbalance(lru);
 
-		if (HSH_Snipe(wrk, oc)) {
-			VSC_C_main->n_lru_nuked++; // XXX per lru ?
-			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	/* Find the first currently unused object, oldest shard first */
+	memset(tried, 0, sizeof tried);
+	while (oc == NULL) {
+		i = lru_oldest(lru, tried);
+		if (i < 0)
 			break;
-		}
+		tried[i] = 1;
+		oc = lru_shard_nuke(wrk, lru->shard[i]);
 	}
-	Lck_Unlock(&lru->mtx);
 
 	if (oc == NULL) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Fail");
@@ -202,6 +385,6 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 	ObjSlim(wrk, oc);
 
 	VSLb(wrk->vsl, SLT_ExpKill, "LRU x=%u", ObjGetXID(wrk, oc));
-	(void)HSH_DerefObjCore(wrk, &oc, 0);	// Ref from HSH_Snipe
+	(void)HSH_DerefObjCore(wrk, &oc);	// Ref from HSH_Snipe
 	return (1);
 }
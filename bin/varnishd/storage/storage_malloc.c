@@ -34,6 +34,7 @@
 #include "cache/cache_varnishd.h"
 #include "common/heritage.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -44,6 +45,21 @@
 
 #include "VSC_sma.h"
 
+/*
+ * Size classes for the slab mode: four per power of two, from 64 bytes
+ * to SMA_SLAB_MAX.  Larger allocations use malloc(3) directly.
+ */
+#define SMA_NCLASS		37
+#define SMA_SLAB_MAX		32768
+#define SMA_SLAB_BYTES		(256 * 1024)	/* data per slab, roughly */
+#define SMA_SLAB_MINSLOT	8
+#define SMA_SLAB_MAXSLOT	1024
+#define SMA_MAG_SIZE		16	/* per thread, per class */
+#define SMA_TC_FOLD		64	/* fold thread stats this often */
+
+struct sma_slab;
+struct sma_tc;
+
 struct sma_sc {
 	unsigned		magic;
 #define SMA_SC_MAGIC		0x1ac8a345
@@ -51,6 +67,12 @@ struct sma_sc {
 	size_t			sma_max;
 	size_t			sma_alloc;
 	struct VSC_sma		*stats;
+
+	/* Slab mode, under sma_mtx */
+	unsigned		slab;
+	pthread_key_t		tc_key;
+	VTAILQ_HEAD(, sma_slab)	partial[SMA_NCLASS];
+	VTAILQ_HEAD(, sma_tc)	tcs;
 };
 
 struct sma {
@@ -59,10 +81,377 @@ struct sma {
 	struct storage		s;
 	size_t			sz;
 	struct sma_sc		*sc;
+	struct sma_slab		*slab;	/* NULL if malloc'ed */
+	struct sma		*next;	/* on slab free list */
+};
+
+struct sma_slab {
+	unsigned		magic;
+#define SMA_SLAB_MAGIC		0x4f1e7d2a
+	unsigned		cls;
+	unsigned		nslot;
+	unsigned		nfree;
+	size_t			bytes;
+	struct sma		*free;
+	VTAILQ_ENTRY(sma_slab)	list;
+	struct sma		sma[];
+};
+
+/* Per thread cache of free slab slots and stats */
+
+struct sma_mag {
+	unsigned		n;
+	struct sma		*sma[SMA_MAG_SIZE];
+};
+
+struct sma_tc {
+	unsigned		magic;
+#define SMA_TC_MAGIC		0x7a3b0f61
+	struct sma_sc		*sc;
+	/* Only contended when another thread drains our magazines */
+	pthread_mutex_t		mtx;
+	VTAILQ_ENTRY(sma_tc)	list;	/* on sc->tcs, under sma_mtx */
+	unsigned		nops;
+	uint64_t		c_req;
+	uint64_t		c_fail;
+	uint64_t		c_bytes;
+	uint64_t		c_freed;
+	int64_t			g_alloc;
+	int64_t			g_bytes;
+	struct sma_mag		mag[SMA_NCLASS];
 };
 
 static struct VSC_lck *lck_sma;
 
+/*--------------------------------------------------------------------
+ * Slab mode
+ *
+ * Allocations up to SMA_SLAB_MAX are served from size classed slabs,
+ * with the struct sma headers for all slots in the slab header.  Each
+ * thread caches free slots in a magazine per class, and only takes
+ * sma_mtx to exchange half a magazine with the slabs.  A thread which
+ * runs out of space drains the magazines of all threads which are not
+ * busy with their own, before it gives up.  The allocation
+ * stats are kept in the thread cache and folded into the VSC when the
+ * lock is taken anyway, or every SMA_TC_FOLD operations.  g_space is
+ * accounted for whole slabs.
+ */
+
+static unsigned
+sma_class(size_t size)
+{
+	size_t s;
+	unsigned e;
+
+	assert(size <= SMA_SLAB_MAX);
+	if (size <= 64)
+		return (0);
+	s = size - 1;
+	for (e = 6; (s >> (e + 1)) != 0; e++)
+		continue;
+	return ((e - 6) * 4 + (unsigned)(s >> (e - 2)) - 3);
+}
+
+static size_t
+sma_class_size(unsigned cls)
+{
+
+	assert(cls < SMA_NCLASS);
+	return ((size_t)(4 + cls % 4) << (cls / 4 + 4));
+}
+
+static void
+sma_tc_fold(const struct sma_sc *sc, struct sma_tc *tc)
+{
+
+	Lck_AssertHeld(&sc->sma_mtx);
+	sc->stats->c_req += tc->c_req;
+	sc->stats->c_fail += tc->c_fail;
+	sc->stats->c_bytes += tc->c_bytes;
+	sc->stats->c_freed += tc->c_freed;
+	sc->stats->g_alloc += (uint64_t)tc->g_alloc;
+	sc->stats->g_bytes += (uint64_t)tc->g_bytes;
+	tc->c_req = 0;
+	tc->c_fail = 0;
+	tc->c_bytes = 0;
+	tc->c_freed = 0;
+	tc->g_alloc = 0;
+	tc->g_bytes = 0;
+	tc->nops = 0;
+}
+
+static void
+sma_slab_destroy(struct sma_sc *sc, struct sma_slab *slab)
+{
+
+	Lck_AssertHeld(&sc->sma_mtx);
+	CHECK_OBJ_NOTNULL(slab, SMA_SLAB_MAGIC);
+	assert(slab->nfree == slab->nslot);
+	VTAILQ_REMOVE(&sc->partial[slab->cls], slab, list);
+	sc->sma_alloc -= slab->bytes;
+	if (sc->sma_max != SIZE_MAX)
+		sc->stats->g_space += slab->bytes;
+	sc->stats->g_slabs--;
+	FREE_OBJ(slab);
+}
+
+static struct sma_slab *
+sma_slab_new(struct sma_sc *sc, unsigned cls)
+{
+	struct sma_slab *slab;
+	struct sma *sma;
+	unsigned char *p;
+	size_t sz, hdr;
+	unsigned u, n;
+
+	Lck_AssertHeld(&sc->sma_mtx);
+	sz = sma_class_size(cls);
+	n = SMA_SLAB_BYTES / sz;
+	if (n < SMA_SLAB_MINSLOT)
+		n = SMA_SLAB_MINSLOT;
+	if (n > SMA_SLAB_MAXSLOT)
+		n = SMA_SLAB_MAXSLOT;
+	if (sc->sma_alloc + n * sz > sc->sma_max)
+		return (NULL);
+
+	hdr = sizeof *slab + n * sizeof *sma;
+	hdr = RUP2(hdr, 64);
+	p = malloc(hdr + n * sz);
+	if (p == NULL)
+		return (NULL);
+	slab = (void*)p;
+	INIT_OBJ(slab, SMA_SLAB_MAGIC);
+	slab->cls = cls;
+	slab->nslot = n;
+	slab->bytes = n * sz;
+	p += hdr;
+	for (u = 0; u < n; u++) {
+		sma = &slab->sma[u];
+		INIT_OBJ(sma, SMA_MAGIC);
+		sma->s.magic = STORAGE_MAGIC;
+		sma->s.priv = sma;
+		sma->s.ptr = p;
+		sma->sz = sz;
+		sma->sc = sc;
+		sma->slab = slab;
+		sma->next = slab->free;
+		slab->free = sma;
+		p += sz;
+	}
+	slab->nfree = n;
+	VTAILQ_INSERT_HEAD(&sc->partial[cls], slab, list);
+
+	sc->sma_alloc += slab->bytes;
+	if (sc->sma_max != SIZE_MAX)
+		sc->stats->g_space -= slab->bytes;
+	sc->stats->g_slabs++;
+	return (slab);
+}
+
+static struct sma *
+sma_slab_get(struct sma_sc *sc, unsigned cls)
+{
+	struct sma_slab *slab;
+	struct sma *sma;
+
+	Lck_AssertHeld(&sc->sma_mtx);
+	slab = VTAILQ_FIRST(&sc->partial[cls]);
+	if (slab == NULL)
+		slab = sma_slab_new(sc, cls);
+	if (slab == NULL)
+		return (NULL);
+	CHECK_OBJ_NOTNULL(slab, SMA_SLAB_MAGIC);
+	AN(slab->nfree);
+	sma = slab->free;
+	CHECK_OBJ_NOTNULL(sma, SMA_MAGIC);
+	slab->free = sma->next;
+	sma->next = NULL;
+	if (--slab->nfree == 0)
+		VTAILQ_REMOVE(&sc->partial[cls], slab, list);
+	return (sma);
+}
+
+static void
+sma_slab_put(struct sma_sc *sc, struct sma *sma)
+{
+	struct sma_slab *slab;
+
+	Lck_AssertHeld(&sc->sma_mtx);
+	CHECK_OBJ_NOTNULL(sma, SMA_MAGIC);
+	slab = sma->slab;
+	CHECK_OBJ_NOTNULL(slab, SMA_SLAB_MAGIC);
+	AZ(sma->next);
+	sma->next = slab->free;
+	slab->free = sma;
+	if (slab->nfree++ == 0)
+		VTAILQ_INSERT_HEAD(&sc->partial[slab->cls], slab, list);
+	/* Keep one empty slab per class around */
+	if (slab->nfree == slab->nslot &&
+	    (VTAILQ_FIRST(&sc->partial[slab->cls]) != slab ||
+	    VTAILQ_NEXT(slab, list) != NULL))
+		sma_slab_destroy(sc, slab);
+}
+
+/* Return all cached slots of a thread, its mtx must be held */
+
+static void
+sma_tc_flush(struct sma_sc *sc, struct sma_tc *tc)
+{
+	struct sma_mag *m;
+	unsigned u;
+
+	Lck_AssertHeld(&sc->sma_mtx);
+	for (u = 0; u < SMA_NCLASS; u++) {
+		m = &tc->mag[u];
+		while (m->n > 0)
+			sma_slab_put(sc, m->sma[--m->n]);
+	}
+}
+
+/*
+ * Return the cached slots of all threads and the empty slabs, to make
+ * room.  We hold sma_mtx, and the other threads take it with their mtx
+ * held, so theirs can only be tried.  A thread which is busy will see
+ * the free slots soon enough.
+ */
+
+static void
+sma_slab_drain(struct sma_sc *sc, struct sma_tc *tc)
+{
+	struct sma_slab *slab, *slab2;
+	struct sma_tc *tc2;
+	unsigned u;
+
+	Lck_AssertHeld(&sc->sma_mtx);
+	sma_tc_flush(sc, tc);
+	VTAILQ_FOREACH(tc2, &sc->tcs, list) {
+		CHECK_OBJ_NOTNULL(tc2, SMA_TC_MAGIC);
+		if (tc2 == tc || pthread_mutex_trylock(&tc2->mtx))
+			continue;
+		sma_tc_flush(sc, tc2);
+		AZ(pthread_mutex_unlock(&tc2->mtx));
+	}
+	for (u = 0; u < SMA_NCLASS; u++)
+		VTAILQ_FOREACH_SAFE(slab, &sc->partial[u], list, slab2)
+			if (slab->nfree == slab->nslot)
+				sma_slab_destroy(sc, slab);
+}
+
+static void
+sma_tc_free(void *priv)
+{
+	struct sma_tc *tc;
+	struct sma_sc *sc;
+
+	CAST_OBJ_NOTNULL(tc, priv, SMA_TC_MAGIC);
+	sc = tc->sc;
+	CHECK_OBJ_NOTNULL(sc, SMA_SC_MAGIC);
+	Lck_Lock(&sc->sma_mtx);
+	VTAILQ_REMOVE(&sc->tcs, tc, list);
+	sma_tc_fold(sc, tc);
+	sma_tc_flush(sc, tc);
+	Lck_Unlock(&sc->sma_mtx);
+	AZ(pthread_mutex_destroy(&tc->mtx));
+	FREE_OBJ(tc);
+}
+
+/* Get the calling thread's cache, with its mtx held */
+
+static struct sma_tc *
+sma_tc_get(struct sma_sc *sc)
+{
+	struct sma_tc *tc;
+
+	tc = pthread_getspecific(sc->tc_key);
+	if (tc == NULL) {
+		ALLOC_OBJ(tc, SMA_TC_MAGIC);
+		AN(tc);
+		tc->sc = sc;
+		AZ(pthread_mutex_init(&tc->mtx, NULL));
+		Lck_Lock(&sc->sma_mtx);
+		VTAILQ_INSERT_TAIL(&sc->tcs, tc, list);
+		Lck_Unlock(&sc->sma_mtx);
+		AZ(pthread_setspecific(sc->tc_key, tc));
+	}
+	CHECK_OBJ(tc, SMA_TC_MAGIC);
+	assert(tc->sc == sc);
+	AZ(pthread_mutex_lock(&tc->mtx));
+	return (tc);
+}
+
+static struct storage *
+sma_slab_alloc(struct sma_sc *sc, size_t size)
+{
+	struct sma_tc *tc;
+	struct sma_mag *m;
+	struct sma *sma;
+	unsigned cls;
+
+	cls = sma_class(size);
+	tc = sma_tc_get(sc);
+	m = &tc->mag[cls];
+	tc->c_req++;
+	if (m->n == 0 || ++tc->nops >= SMA_TC_FOLD) {
+		Lck_Lock(&sc->sma_mtx);
+		sma_tc_fold(sc, tc);
+		while (m->n < SMA_MAG_SIZE / 2) {
+			sma = sma_slab_get(sc, cls);
+			if (sma == NULL && m->n == 0) {
+				sma_slab_drain(sc, tc);
+				sma = sma_slab_get(sc, cls);
+			}
+			if (sma == NULL)
+				break;
+			m->sma[m->n++] = sma;
+		}
+		Lck_Unlock(&sc->sma_mtx);
+	}
+	if (m->n == 0) {
+		tc->c_fail++;
+		AZ(pthread_mutex_unlock(&tc->mtx));
+		return (NULL);
+	}
+	sma = m->sma[--m->n];
+	CHECK_OBJ_NOTNULL(sma, SMA_MAGIC);
+	assert(sma->sz >= size);
+	tc->c_bytes += sma->sz;
+	tc->g_alloc++;
+	tc->g_bytes += sma->sz;
+	AZ(pthread_mutex_unlock(&tc->mtx));
+	sma->s.len = 0;
+	sma->s.space = sma->sz;
+	return (&sma->s);
+}
+
+static void
+sma_slab_free(struct sma *sma)
+{
+	struct sma_sc *sc;
+	struct sma_tc *tc;
+	struct sma_mag *m;
+	unsigned u;
+
+	sc = sma->sc;
+	tc = sma_tc_get(sc);
+	CHECK_OBJ_NOTNULL(sma->slab, SMA_SLAB_MAGIC);
+	m = &tc->mag[sma->slab->cls];
+	tc->g_alloc--;
+	tc->g_bytes -= sma->sz;
+	tc->c_freed += sma->sz;
+	if (m->n == SMA_MAG_SIZE || ++tc->nops >= SMA_TC_FOLD) {
+		Lck_Lock(&sc->sma_mtx);
+		sma_tc_fold(sc, tc);
+		if (m->n == SMA_MAG_SIZE)
+			for (u = 0; u < SMA_MAG_SIZE / 2; u++)
+				sma_slab_put(sc, m->sma[--m->n]);
+		Lck_Unlock(&sc->sma_mtx);
+	}
+	m->sma[m->n++] = sma;
+	AZ(pthread_mutex_unlock(&tc->mtx));
+}
+
+/*--------------------------------------------------------------------*/
+
 static struct storage * v_matchproto_(sml_alloc_f)
 sma_alloc(const struct stevedore *st, size_t size)
 {
@@ -71,6 +460,9 @@ sma_alloc(const struct stevedore *st, size_t size)
 	void *p;
 
 	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
+	if (sma_sc->slab && size <= SMA_SLAB_MAX)
+		return (sma_slab_alloc(sma_sc, size));
+
 	Lck_Lock(&sma_sc->sma_mtx);
 	sma_sc->stats->c_req++;
 	if (sma_sc->sma_alloc + size > sma_sc->sma_max) {
@@ -139,6 +531,10 @@ sma_free(struct storage *s)
 	CAST_OBJ_NOTNULL(sma, s->priv, SMA_MAGIC);
 	sma_sc = sma->sc;
 	assert(sma->sz == sma->s.space);
+	if (sma->slab != NULL) {
+		sma_slab_free(sma);
+		return;
+	}
 	Lck_Lock(&sma_sc->sma_mtx);
 	sma_sc->sma_alloc -= sma->sz;
 	sma_sc->stats->g_alloc--;
@@ -184,9 +580,16 @@ sma_init(struct stevedore *parent, int ac, char * const *av)
 	parent->priv = sc;
 
 	AZ(av[ac]);
-	if (ac > 1)
+	if (ac > 2)
 		ARGV_ERR("(-smalloc) too many arguments\n");
 
+	if (ac > 1) {
+		if (strcmp(av[1], "slab"))
+			ARGV_ERR("(-smalloc) unknown option \"%s\"\n",
+			    av[1]);
+		sc->slab = 1;
+	}
+
 	if (ac == 0 || *av[0] == '\0')
 		 return;
 
@@ -206,6 +609,7 @@ static void v_matchproto_(storage_open_f)
 sma_open(struct stevedore *st)
 {
 	struct sma_sc *sma_sc;
+	unsigned u;
 
 	ASSERT_CLI();
 	st->lru = LRU_Alloc();
@@ -216,6 +620,12 @@ sma_open(struct stevedore *st)
 	sma_sc->stats = VSC_sma_New(NULL, NULL, st->ident);
 	if (sma_sc->sma_max != SIZE_MAX)
 		sma_sc->stats->g_space = sma_sc->sma_max;
+	if (sma_sc->slab) {
+		AZ(pthread_key_create(&sma_sc->tc_key, sma_tc_free));
+		for (u = 0; u < SMA_NCLASS; u++)
+			VTAILQ_INIT(&sma_sc->partial[u]);
+		VTAILQ_INIT(&sma_sc->tcs);
+	}
 }
 
 const struct stevedore sma_stevedore = {
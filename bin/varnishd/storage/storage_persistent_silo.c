@@ -169,14 +169,13 @@ smp_load_seg(struct worker *wrk, const struct smp_sc *sc,
 		oc->stobj->priv2 |= NEED_FIXUP;
 		EXP_COPY(oc, so);
 		sg->nobj++;
-		oc->refcnt++;
+		(void)OC_REFCNT_ADD(oc, 1);
 		HSH_Insert(wrk, so->hash, oc, ban);
 		AN(oc->ban);
 		HSH_DerefBoc(wrk, oc);	// XXX Keep it an stream resurrection?
-		(void)HSH_DerefObjCore(wrk, &oc, HSH_RUSH_POLICY);
+		(void)HSH_DerefObjCore(wrk, &oc);
 		wrk->stats->n_vampireobject++;
 	}
-	Pool_Sumstat(wrk);
 	sg->flags |= SMP_SEG_LOADED;
 }
 
@@ -59,9 +59,13 @@ static struct log {
 	int		a_opt;
 	int		A_opt;
 	char		*w_arg;
+	char		*W_arg;
+	int		z_opt;
 
 	/* State */
 	FILE		*fo;
+	struct VSL_ring	*ring;
+	unsigned	ring_dropped;
 } LOG;
 
 static void v_noreturn_
@@ -82,6 +86,9 @@ openout(int append)
 	AN(LOG.w_arg);
 	if (LOG.A_opt)
 		LOG.fo = fopen(LOG.w_arg, append ? "a" : "w");
+	else if (LOG.z_opt)
+		LOG.fo = VSL_WriteOpenZ(vut->vsl, LOG.w_arg, append,
+		    vut->g_arg);
 	else
 		LOG.fo = VSL_WriteOpen(vut->vsl, LOG.w_arg, append, 0);
 	if (LOG.fo == NULL)
@@ -97,7 +104,7 @@ rotateout(struct VUT *v)
 	assert(v == vut);
 	AN(LOG.w_arg);
 	AN(LOG.fo);
-	fclose(LOG.fo);
+	(void)VSL_WriteClose(vut->vsl, LOG.fo);
 	openout(1);
 	AN(LOG.fo);
 	return (0);
@@ -107,11 +114,19 @@ static int v_matchproto_(VUT_cb_f)
 flushout(struct VUT *v)
 {
 
+	unsigned u;
+
 	assert(v == vut);
+	if (LOG.ring != NULL) {
+		u = VSL_RingDropped(LOG.ring);
+		if (u != LOG.ring_dropped)
+			fprintf(stderr, "Dropped %u transaction groups too"
+			    " large for the ring\n", u - LOG.ring_dropped);
+		LOG.ring_dropped = u;
+		return (0);
+	}
 	AN(LOG.fo);
-	if (fflush(LOG.fo))
-		return (-5);
-	return (0);
+	return (VSL_WriteFlush(vut->vsl, LOG.fo));
 }
 
 static int v_matchproto_(VUT_cb_f)
@@ -154,6 +169,14 @@ main(int argc, char * const *argv)
 			/* Write to file */
 			REPLACE(LOG.w_arg, optarg);
 			break;
+		case 'W':
+			/* Export to ring file */
+			REPLACE(LOG.W_arg, optarg);
+			break;
+		case 'z':
+			/* Compressed output */
+			LOG.z_opt = 1;
+			break;
 		default:
 			if (!VUT_Arg(vut, opt, optarg))
 				usage(1);
@@ -163,11 +186,27 @@ main(int argc, char * const *argv)
 	if (optind != argc)
 		usage(1);
 
-	if (vut->D_opt && !LOG.w_arg)
+	if (vut->D_opt && !LOG.w_arg && !LOG.W_arg)
 		VUT_Error(vut, 1, "Missing -w option");
 
+	if (LOG.W_arg && (LOG.w_arg || LOG.A_opt || LOG.z_opt))
+		VUT_Error(vut, 1, "The -W option excludes -w, -A and -z");
+	if (LOG.W_arg && vut->g_arg == VSL_g_raw)
+		VUT_Error(vut, 1, "The -W option requires -g grouping");
+
+	if (LOG.z_opt && (LOG.A_opt || !LOG.w_arg))
+		VUT_Error(vut, 1, "The -z option requires binary -w output");
+
 	/* Setup output */
-	if (LOG.A_opt || !LOG.w_arg)
+	if (LOG.W_arg) {
+		LOG.ring = VSL_RingOpen(vut->vsl, LOG.W_arg, 64 << 20,
+		    vut->g_arg);
+		if (LOG.ring == NULL)
+			VUT_Error(vut, 2, "Cannot open ring file (%s)",
+			    VSL_Error(vut->vsl));
+		vut->dispatch_f = VSL_RingWrite;
+		vut->dispatch_priv = LOG.ring;
+	} else if (LOG.A_opt || !LOG.w_arg)
 		vut->dispatch_f = VSL_PrintTransactions;
 	else
 		vut->dispatch_f = VSL_WriteTransactions;
@@ -177,16 +216,17 @@ main(int argc, char * const *argv)
 		AN(LOG.fo);
 		if (vut->D_opt)
 			vut->sighup_f = rotateout;
-	} else
+	} else if (LOG.W_arg == NULL)
 		LOG.fo = stdout;
 	vut->idle_f = flushout;
 
 	VUT_Signal(vut_sighandler);
 	VUT_Setup(vut);
 	VUT_Main(vut);
+	(void)flushout(vut);
+	if (LOG.ring != NULL)
+		VSL_RingClose(&LOG.ring);
 	VUT_Fini(&vut);
 
-	(void)flushout(NULL);
-
 	exit(0);
 }
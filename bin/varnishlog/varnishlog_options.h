@@ -53,6 +53,30 @@
 	    " option is required when running in daemon mode."		\
 	)
 
+#define LOG_OPT_W							\
+	VOPT("W:", "[-W <filename>]", "Ring file output",		\
+	    "Export the transactions to a shared ring file of 64MB"	\
+	    " instead of writing a log. Any number of readers can"	\
+	    " follow the ring with the -r option, and take the"		\
+	    " transactions as they were grouped by the -g option here"	\
+	    " when they group at the same or a lower level, without"	\
+	    " grouping the records again. The oldest transactions are"	\
+	    " overwritten when the ring is full, and groups larger"	\
+	    " than a quarter of the ring are dropped and reported on"	\
+	    " stderr."							\
+	)
+
+#define LOG_OPT_z							\
+	VOPT("z", "[-z]", "Compressed output",				\
+	    "When writing output to a file with the -w option, write"	\
+	    " it in compressed blocks. Each block holds whole"		\
+	    " transactions of the -g grouping, and is indexed by its"	\
+	    " tags and vxids, so that reading the file with the -r"	\
+	    " option and a -q query at the same or a lower grouping"	\
+	    " skips the blocks where the query can not match. Appending"	\
+	    " with the -a option requires a compressed file."		\
+	)
+
 LOG_OPT_a
 LOG_OPT_A
 VSL_OPT_b
@@ -64,6 +88,7 @@ VUT_OPT_g
 VUT_OPT_h
 VSL_OPT_i
 VSL_OPT_I
+VUT_OPT_j
 VUT_OPT_k
 VSL_OPT_L
 VUT_OPT_n
@@ -75,5 +100,7 @@ VSL_OPT_T
 VSL_OPT_v
 VUT_GLOBAL_OPT_V
 LOG_OPT_w
+LOG_OPT_W
 VSL_OPT_x
 VSL_OPT_X
+LOG_OPT_z
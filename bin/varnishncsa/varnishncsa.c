@@ -69,6 +69,7 @@
 #include "miniobj.h"
 
 #define TIME_FMT "[%d/%b/%Y:%T %z]"
+#define OUT_BATCH (64 * 1024)
 #define FORMAT "%h %l %u %t \"%r\" %s %b \"%{Referer}i\" \"%{User-agent}i\""
 
 static struct VUT *vut;
@@ -100,6 +101,12 @@ struct fragment {
 
 typedef int format_f(const struct format *format);
 
+/* The last second formatted by a strftime format */
+struct time_cache {
+	time_t			t;
+	char			buf[64];
+};
+
 struct format {
 	unsigned		magic;
 #define FORMAT_MAGIC		0xC3119CDA
@@ -112,6 +119,7 @@ struct format {
 	const char *const	*strptr;
 	char			*time_fmt;
 	int32_t			*int32;
+	struct time_cache	*time_cache;
 };
 
 struct watch {
@@ -147,14 +155,17 @@ static struct ctx {
 
 	FILE			*fo;
 	struct vsb		*vsb;
+	struct vsb		*out;	/* Lines not written yet */
 	unsigned		gen;
 	VTAILQ_HEAD(,format)	format;
+	uint8_t			esc[256];
 
 	/* State */
 	struct watch_head	watch_vcl_log;
 	struct watch_head	watch_reqhdr; /* also bereqhdr */
 	struct watch_head	watch_resphdr; /* also beresphdr */
 	struct vsl_watch_head	watch_vsl;
+	uint8_t			watch_vsl_tag[SLT__MAX];
 	struct fragment		frag[F__MAX];
 	const char		*hitmiss;
 	const char		*handling;
@@ -185,6 +196,22 @@ openout(int append)
 		    strerror(errno));
 }
 
+/* Write out the lines held in CTX.out */
+static int
+writeout(void)
+{
+	ssize_t l;
+
+	AZ(VSB_finish(CTX.out));
+	l = VSB_len(CTX.out);
+	if (l > 0 && fwrite(VSB_data(CTX.out), 1, l, CTX.fo) != l) {
+		VSB_clear(CTX.out);
+		return (-5);
+	}
+	VSB_clear(CTX.out);
+	return (0);
+}
+
 static int v_matchproto_(VUT_cb_f)
 rotateout(struct VUT *v)
 {
@@ -192,6 +219,7 @@ rotateout(struct VUT *v)
 	assert(v == vut);
 	AN(CTX.w_arg);
 	AN(CTX.fo);
+	(void)writeout();
 	fclose(CTX.fo);
 	openout(1);
 	AN(CTX.fo);
@@ -204,17 +232,37 @@ flushout(struct VUT *v)
 
 	assert(v == vut);
 	AN(CTX.fo);
-	if (fflush(CTX.fo))
+	if (writeout() || fflush(CTX.fo))
 		return (-5);
 	return (0);
 }
 
+/* Characters vsb_esc_cat() can not copy as they are */
+static void
+esc_init(void)
+{
+	int c;
+
+	for (c = 0; c < 256; c++)
+		CTX.esc[c] = !isprint(c) || c == '"' || c == '\\';
+}
+
 static int
 vsb_esc_cat(struct vsb *sb, const char *b, const char *e)
 {
+	const char *p;
+
 	AN(b);
 
 	for (; b < e; b++) {
+		for (p = b; p < e && !CTX.esc[(uint8_t)*p]; p++)
+			continue;
+		if (p > b) {
+			VSB_bcat(sb, b, p - b);
+			b = p;
+			if (b == e)
+				break;
+		}
 		if (isspace(*b)) {
 			switch (*b) {
 			case '\n':
@@ -320,7 +368,6 @@ format_time(const struct format *format)
 {
 	double t_start, t_end;
 	char *p;
-	char buf[64];
 	time_t t;
 	struct tm tm;
 
@@ -355,9 +402,17 @@ format_time(const struct format *format)
 	case 't':
 		AN(format->time_fmt);
 		t = t_start;
-		localtime_r(&t, &tm);
-		strftime(buf, sizeof buf, format->time_fmt, &tm);
-		AZ(VSB_cat(CTX.vsb, buf));
+		AN(format->time_cache);
+		if (t != format->time_cache->t) {
+			/* strftime has no finer resolution than seconds */
+			localtime_r(&t, &tm);
+			if (strftime(format->time_cache->buf,
+			    sizeof format->time_cache->buf, format->time_fmt,
+			    &tm) == 0)
+				format->time_cache->buf[0] = '\0';
+			format->time_cache->t = t;
+		}
+		AZ(VSB_cat(CTX.vsb, format->time_cache->buf));
 		break;
 	case 'T':
 		AZ(VSB_printf(CTX.vsb, "%d", (int)(t_end - t_start)));
@@ -427,9 +482,9 @@ print(void)
 	AZ(VSB_putc(CTX.vsb, '\n'));
 	AZ(VSB_finish(CTX.vsb));
 	if (r >= 0) {
-		i = fwrite(VSB_data(CTX.vsb), 1, VSB_len(CTX.vsb), CTX.fo);
-		if (i != VSB_len(CTX.vsb))
-			return (-5);
+		AZ(VSB_bcat(CTX.out, VSB_data(CTX.vsb), VSB_len(CTX.vsb)));
+		if (VSB_len(CTX.out) >= OUT_BATCH)
+			return (writeout());
 	}
 	return (0);
 }
@@ -503,6 +558,9 @@ addf_time(char type, const char *fmt)
 	if (fmt != NULL) {
 		f->time_fmt = strdup(fmt);
 		AN(f->time_fmt);
+		f->time_cache = calloc(1, sizeof *f->time_cache);
+		AN(f->time_cache);
+		f->time_cache->t = (time_t)-1;
 	}
 	VTAILQ_INSERT_TAIL(&CTX.format, f, list);
 }
@@ -578,6 +636,7 @@ addf_vsl(enum VSL_tag_e tag, long i, const char *prefix)
 		assert(w->prefixlen > 0);
 	}
 	VTAILQ_INSERT_TAIL(&CTX.watch_vsl, w, list);
+	CTX.watch_vsl_tag[tag] = 1;
 	addf_fragment(&w->frag, "-");
 }
 
@@ -895,6 +954,9 @@ process_hdr(const struct watch_head *head, const char *b, const char *e)
 
 	VTAILQ_FOREACH(w, head, list) {
 		CHECK_OBJ_NOTNULL(w, WATCH_MAGIC);
+		/* The key ends with the colon, check that one first */
+		if (e - b < w->keylen || b[w->keylen - 1] != ':')
+			continue;
 		if (!isprefix(w->key, w->keylen, b, e, &p))
 			continue;
 		frag_line(1, p, e, &w->frag);
@@ -908,6 +970,8 @@ process_vsl(const struct vsl_watch_head *head, enum VSL_tag_e tag,
 	struct vsl_watch *w;
 	const char *p;
 
+	if (!CTX.watch_vsl_tag[tag])
+		return;
 	VTAILQ_FOREACH(w, head, list) {
 		CHECK_OBJ_NOTNULL(w, VSL_WATCH_MAGIC);
 		if (tag != w->tag)
@@ -1166,6 +1230,9 @@ main(int argc, char * const *argv)
 	VTAILQ_INIT(&CTX.watch_vsl);
 	CTX.vsb = VSB_new_auto();
 	AN(CTX.vsb);
+	CTX.out = VSB_new_auto();
+	AN(CTX.out);
+	esc_init();
 	VB64_init();
 
 	while ((opt = getopt(argc, argv, vopt_spec.vopt_optstring)) != -1) {
@@ -1246,6 +1313,7 @@ main(int argc, char * const *argv)
 	VUT_Signal(vut_sighandler);
 	VUT_Setup(vut);
 	VUT_Main(vut);
+	(void)flushout(vut);
 	VUT_Fini(&vut);
 
 	exit(0);
@@ -83,6 +83,7 @@ NCSA_OPT_F
 NCSA_OPT_f
 NCSA_OPT_g
 VUT_OPT_h
+VUT_OPT_j
 VSL_OPT_L
 VUT_OPT_n
 VUT_GLOBAL_OPT_P
@@ -53,12 +53,25 @@
 
 static struct VUT *vut;
 
+static const struct quantile {
+	const char	*name;
+	double		q;
+} quantiles[] = {
+	{ "p50",	.5 },
+	{ "p90",	.9 },
+	{ "p99",	.99 },
+	{ "p999",	.999 },
+	{ NULL,		0. }
+};
+
 /*--------------------------------------------------------------------*/
 
 static int v_matchproto_(VSC_iter_f)
 do_xml_cb(void *priv, const struct VSC_point * const pt)
 {
+	const struct quantile *qp;
 	uint64_t val;
+	double t;
 
 	(void)priv;
 	if (pt == NULL)
@@ -71,6 +84,11 @@ do_xml_cb(void *priv, const struct VSC_point * const pt)
 	printf("\t\t<value>%ju</value>\n", (uintmax_t)val);
 	printf("\t\t<flag>%c</flag>\n", pt->semantics);
 	printf("\t\t<format>%c</format>\n", pt->format);
+	for (qp = quantiles; pt->semantics == 'h' && qp->name != NULL; qp++) {
+		t = VSC_Quantile(pt, qp->q);
+		if (t >= 0.)
+			printf("\t\t<%s>%.6f</%s>\n", qp->name, t, qp->name);
+	}
 	printf("\t\t<description>%s</description>\n", pt->sdesc);
 	printf("\t</stat>\n");
 	return (0);
@@ -96,7 +114,9 @@ do_xml(struct vsm *vsm, struct vsc *vsc)
 static int v_matchproto_(VSC_iter_f)
 do_json_cb(void *priv, const struct VSC_point * const pt)
 {
+	const struct quantile *qp;
 	uint64_t val;
+	double t;
 	int *jp;
 
 	if (pt == NULL)
@@ -119,6 +139,13 @@ do_json_cb(void *priv, const struct VSC_point * const pt)
 	printf("    \"flag\": \"%c\", ", pt->semantics);
 	printf("\"format\": \"%c\",\n", pt->format);
 	printf("    \"value\": %ju", (uintmax_t)val);
+	for (qp = quantiles; pt->semantics == 'h' && qp->name != NULL; qp++) {
+		t = VSC_Quantile(pt, qp->q);
+		if (t >= 0.)
+			printf(",\n    \"%s\": %.6f", qp->name, t);
+		else
+			printf(",\n    \"%s\": null", qp->name);
+	}
 	printf("\n  }");
 
 	if (*jp)
@@ -172,8 +199,10 @@ do_once_cb_first(void *priv, const struct VSC_point * const pt)
 static int v_matchproto_(VSC_iter_f)
 do_once_cb(void *priv, const struct VSC_point * const pt)
 {
+	const struct quantile *qp;
 	struct once_priv *op;
 	uint64_t val;
+	double t;
 	int i;
 
 	if (pt == NULL)
@@ -186,13 +215,23 @@ do_once_cb(void *priv, const struct VSC_point * const pt)
 	if (i >= op->pad)
 		op->pad = i + 1;
 	printf("%*.*s", op->pad - i, op->pad - i, "");
-	if (pt->semantics == 'c')
+	if (pt->semantics == 'c' || pt->semantics == 'h')
 		printf("%12ju %12.2f %s\n",
 		    (uintmax_t)val, op->up ? val / op->up : 0,
 		    pt->sdesc);
 	else
 		printf("%12ju %12s %s\n",
 		    (uintmax_t)val, ".  ", pt->sdesc);
+	for (qp = quantiles; pt->semantics == 'h' && qp->name != NULL; qp++) {
+		t = VSC_Quantile(pt, qp->q);
+		if (t < 0.)
+			continue;
+		i = printf("%s.%s", pt->name, qp->name);
+		if (i >= op->pad)
+			op->pad = i + 1;
+		printf("%*.*s", op->pad - i, op->pad - i, "");
+		printf("%12.6f %12s %s, %s\n", t, ".  ", pt->sdesc, qp->name);
+	}
 	return (0);
 }
 
@@ -255,7 +255,8 @@ sample_points(void)
 			update_ma(&pt->ma_10, (int64_t)pt->cur);
 			update_ma(&pt->ma_100, (int64_t)pt->cur);
 			update_ma(&pt->ma_1000, (int64_t)pt->cur);
-		} else if (pt->vpt->semantics == 'c') {
+		} else if (pt->vpt->semantics == 'c' ||
+		    pt->vpt->semantics == 'h') {
 			if (main_uptime != NULL && *main_uptime)
 				pt->avg = pt->cur / *main_uptime;
 			else
@@ -723,6 +724,72 @@ draw_line_duration(WINDOW *w, int y, int x, int X, const struct pt *pt)
 	}
 }
 
+static void
+print_quantile(WINDOW *w, const char *label, double t)
+{
+
+	if (t < 0.)
+		wprintw(w, " %4s %7s", label, ".  ");
+	else if (t < 1e-3)
+		wprintw(w, " %4s %5.0fus", label, t * 1e6);
+	else if (t < 1.)
+		wprintw(w, " %4s %5.1fms", label, t * 1e3);
+	else
+		wprintw(w, " %4s %6.2fs", label, t);
+}
+
+static void
+draw_line_histogram(WINDOW *w, int y, int x, int X, const struct pt *pt)
+{
+	enum {
+		COL_CUR,
+		COL_CHG,
+		COL_P50,
+		COL_P90,
+		COL_P99,
+		COL_P999,
+		COL_LAST
+	} col;
+
+	AN(w);
+	AN(pt);
+	assert(pt->vpt->semantics == 'h');
+
+	col = 0;
+	while (col < COL_LAST) {
+		if (X - x < COLW)
+			break;
+		wmove(w, y, x);
+		switch (col) {
+		case COL_CUR:
+			print_trunc(w, pt->cur);
+			break;
+		case COL_CHG:
+			if (pt->t_last)
+				wprintw(w, " %12.2f", pt->chg);
+			else
+				wprintw(w, " %12s", ".  ");
+			break;
+		case COL_P50:
+			print_quantile(w, "p50", VSC_Quantile(pt->vpt, .5));
+			break;
+		case COL_P90:
+			print_quantile(w, "p90", VSC_Quantile(pt->vpt, .9));
+			break;
+		case COL_P99:
+			print_quantile(w, "p99", VSC_Quantile(pt->vpt, .99));
+			break;
+		case COL_P999:
+			print_quantile(w, "p999", VSC_Quantile(pt->vpt, .999));
+			break;
+		default:
+			break;
+		}
+		x += COLW;
+		col++;
+	}
+}
+
 static void
 draw_line(WINDOW *w, int y, const struct pt *pt)
 {
@@ -737,6 +804,11 @@ draw_line(WINDOW *w, int y, const struct pt *pt)
 		mvwprintw(w, y, x, "%.*s", colw_name, pt->vpt->name);
 	x += colw_name;
 
+	if (pt->vpt->semantics == 'h') {
+		draw_line_histogram(w, y, x, X, pt);
+		return;
+	}
+
 	switch (pt->vpt->format) {
 	case 'b':
 		draw_line_bitmap(w, y, x, X, pt);
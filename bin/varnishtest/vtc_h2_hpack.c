@@ -307,6 +307,7 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 	const struct txt *t;
 	uint32_t num;
 	int must_index = 0;
+	enum hpk_result r;
 	assert(iter);
 	assert(iter->buf < iter->end);
 	/* Indexed Header Field */
@@ -356,9 +357,13 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 	/* Dynamic Table Size Update */
 	/* XXX if under max allowed value */
 	else if (*iter->buf >> 5 == 1) {
-		if (hpk_done != num_decode(&num, iter, 5))
+		r = num_decode(&num, iter, 5);
+		if (r == hpk_err || HPK_ResizeTbl(iter->ctx, num) != hpk_done)
 			return (hpk_err);
-		return HPK_ResizeTbl(iter->ctx, num);
+		/* The update precedes the first field of the block */
+		if (r == hpk_more)
+			return (HPK_DecHdr(iter, header));
+		return (hpk_done);
 	} else {
 		return (hpk_err);
 	}
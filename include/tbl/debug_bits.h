@@ -50,6 +50,9 @@ DEBUG_BIT(H2_NOCHECK,		h2_nocheck,	"Disable various H2 checks")
 DEBUG_BIT(VMOD_SO_KEEP,		vmod_so_keep,	"Keep copied VMOD libraries")
 DEBUG_BIT(PROCESSORS,		processors,	"Fetch/Deliver processors")
 DEBUG_BIT(PROTOCOL,		protocol,	"Protocol debugging")
+DEBUG_BIT(PIPE_COPY,		pipe_copy,	"Pipe through userland buffers")
+DEBUG_BIT(NO_SENDFILE,		no_sendfile,	"Deliver file bodies through VDPs")
+DEBUG_BIT(LRU_DEFER,		lru_defer,	"Defer all LRU moves (testing)")
 #undef DEBUG_BIT
 
 /*lint -restore */
@@ -366,14 +366,15 @@ PARAM(
 PARAM(
 	/* name */	critbit_cooloff,
 	/* typ */	timeout,
-	/* min */	"60.000",
-	/* max */	"254.000",
-	/* default */	"180.000",
+	/* min */	"0.010",
+	/* max */	"60.000",
+	/* default */	"1.000",
 	/* units */	"seconds",
 	/* flags */	WIZARD,
 	/* s-text */
-	"How long the critbit hasher keeps deleted objheads on the cooloff "
-	"list.",
+	"How often the critbit hasher reclaims objheads and hot object "
+	"references taken out of the tree.  Memory is released after "
+	"two runs, once no lockless lookup can still see it.",
 	/* l-text */	"",
 	/* func */	NULL
 )
@@ -473,6 +474,41 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	exp_threads,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* default */	"1",
+	/* units */	"threads",
+	/* flags */	MUST_RESTART | EXPERIMENTAL,
+	/* s-text */
+	"Number of expiry threads.\n"
+	"Objects are partitioned over the expiry threads, each with its "
+	"own inbox and timer structure.  More threads help when a single "
+	"thread cannot keep up with inserts and expiries of a very large "
+	"number of short lived objects.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	exp_wheel,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"on",
+	/* units */	"bool",
+	/* flags */	MUST_RESTART | EXPERIMENTAL,
+	/* s-text */
+	"Use a hierarchical timing wheel for object expiry.\n"
+	"The timing wheel has constant time insert and rearm, but may "
+	"expire objects up to 1/128 of a second late.  When off, a binary "
+	"heap is used instead.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 #if 0
 /* actual location mgt_param_bits.c*/
 /* See tbl/feature_bits.h */
@@ -763,6 +799,23 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	lru_shards,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* default */	"16",
+	/* units */	"shards",
+	/* flags */	MUST_RESTART | EXPERIMENTAL,
+	/* s-text */
+	"Number of LRU shards per stevedore.\n"
+	"Each shard has its own list and lock, which spreads LRU lock "
+	"contention over multiple mutexes.  When nuking, the shards are "
+	"tried in the approximate order of the age of their oldest object.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	max_esi_depth,
 	/* typ */	uint,
@@ -959,10 +1012,10 @@ PARAM(
 	/* units */	"requests per request",
 	/* flags */	EXPERIMENTAL,
 	/* s-text */
-	"How many parked request we start for each completed request on "
-	"the object.\n"
-	"NB: Even with the implict delay of delivery, this parameter "
-	"controls an exponential increase in number of worker threads.",
+	"Obsolete: All requests parked on a busy object are now started "
+	"at once, when the object starts streaming, is finished or "
+	"fails.\n"
+	"It is retained for compatibility and has no effect.",
 	/* l-text */	"",
 	/* func */	NULL
 )
@@ -1402,6 +1455,8 @@ PARAM(
 	/* s-text */
 	"How long the worker thread lingers on an idle session before "
 	"handing it over to the waiter.\n"
+	"HTTP/2 sessions are only handed over while none of their "
+	"streams are being processed.\n"
 	"When sessions are reused, as much as half of all reuses happen "
 	"within the first 100 msec of the previous request completing.\n"
 	"Setting this too high results in worker threads not doing "
@@ -1732,6 +1787,55 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	h2_tx_buffer_size,
+	/* typ */	bytes_u,
+	/* min */	"0b",
+	/* max */	"1M",
+	/* default */	"16k",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"HTTP2 transmit buffer size.\n"
+	"Frames from all streams on an HTTP2 connection are collected in "
+	"a buffer of this size and written with as few system calls as "
+	"possible.  Zero writes every frame as soon as it is sent.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	h2_log_bytes,
+	/* typ */	bytes_u,
+	/* min */	"0b",
+	/* max */	NULL,
+	/* default */	"128b",
+	/* units */	"bytes",
+	/* flags */	0,
+	/* s-text */
+	"Maximum number of bytes of an HTTP2 frame body logged in the "
+	"H2RxBody and H2TxBody records, which are masked by default.  "
+	"The records are further limited by vsl_reclen.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	h2_log_sample,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* default */	"1",
+	/* units */	"frames",
+	/* flags */	0,
+	/* s-text */
+	"Only log the body of one in this many HTTP2 DATA frames in the "
+	"H2RxBody and H2TxBody records.  The bodies of other frames and "
+	"the frame headers are always logged.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */      h2_header_table_size,
 	/* typ */       bytes_u,
@@ -1748,6 +1852,24 @@ PARAM(
 	/* func */      NULL
 )
 
+PARAM(
+	/* name */	h2_tx_header_table_size,
+	/* typ */	bytes_u,
+	/* min */	"0b",
+	/* max */	"64k",
+	/* default */	"4k",
+	/* units */	"bytes",
+	/* flags */	0,
+	/* s-text */
+	"HTTP2 response header table size.\n"
+	"This is the largest HPACK dynamic table used to encode response "
+	"headers.  The table actually used is the smaller of this and the "
+	"SETTINGS_HEADER_TABLE_SIZE sent by the client.  Zero disables "
+	"the dynamic table, but headers are still Huffman coded.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
        /* name */      h2_max_concurrent_streams,
        /* typ */       uint,
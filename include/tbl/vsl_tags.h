@@ -548,7 +548,8 @@ SLTM(H2RxHdr, 0, "Received HTTP2 frame header",
 )
 
 SLTM(H2RxBody, 0, "Received HTTP2 frame body",
-	"Binary data"
+	"Binary data, see the h2_log_bytes and h2_log_sample parameters.\n\n"
+	NODEF_NOTICE
 )
 
 SLTM(H2TxHdr, 0, "Transmitted HTTP2 frame header",
@@ -556,7 +557,8 @@ SLTM(H2TxHdr, 0, "Transmitted HTTP2 frame header",
 )
 
 SLTM(H2TxBody, 0, "Transmitted HTTP2 frame body",
-	"Binary data"
+	"Binary data, see the h2_log_bytes and h2_log_sample parameters.\n\n"
+	NODEF_NOTICE
 )
 
 SLTM(HitMiss, 0, "Hit for miss object in cache.",
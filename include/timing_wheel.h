@@ -0,0 +1,85 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Hierarchical Timing Wheel API
+ *
+ * Items are kept in buckets by the time they are due, with a resolution
+ * of one tick.  Insert and delete are O(1), and items migrate towards
+ * the finest level of the wheel as time advances.  Unlike the binary
+ * heap, the wheel does not keep items sorted within a tick, and an item
+ * is only returned once the tick it falls in has fully passed.
+ */
+
+/* Public Interface --------------------------------------------------*/
+
+struct twheel;
+
+typedef double twheel_when_t(void *priv, const void *a);
+	/*
+	 * When function.
+	 * Return the time the item is due.  The value must not change
+	 * while the item is in the wheel: delete it, change the time,
+	 * and insert it again.
+	 */
+
+typedef void twheel_update_t(void *priv, void *a, unsigned newidx);
+	/*
+	 * Update function.
+	 * When items move in the wheel, this function gets called to
+	 * notify the item of its new index.
+	 */
+
+struct twheel *twheel_new(void *priv, twheel_when_t, twheel_update_t,
+    double now, double hz);
+	/*
+	 * Create Timing Wheel
+	 * 'priv' is passed to when and update functions.
+	 * 'now' is the starting time, 'hz' is the number of ticks
+	 * per second.
+	 */
+
+void twheel_insert(struct twheel *, void *);
+	/*
+	 * Insert an item
+	 */
+
+void twheel_delete(struct twheel *, void *, unsigned idx);
+	/*
+	 * Delete an item
+	 */
+
+void *twheel_root(struct twheel *, double now);
+	/*
+	 * Advance the wheel to 'now' and return an item which is due,
+	 * or NULL if there is none.
+	 */
+
+double twheel_next(const struct twheel *);
+	/*
+	 * Return the earliest time at which twheel_root() may return
+	 * an item, or NAN if the wheel is empty.
+	 */
+
+#define TWHEEL_NOIDX	0
@@ -54,6 +54,7 @@ struct VSC_point {
 					 * 'c' = Counter
 					 * 'g' = Gauge
 					 * 'b' = bitmap
+					 * 'h' = histogram, see below
 					 * '?' = unknown
 					 */
 	int format;			/* display format
@@ -150,4 +151,21 @@ const struct VSC_level_desc *VSC_ChangeLevel(const struct VSC_level_desc*, int);
 	 * Change a level up or down.
 	 */
 
+double VSC_Quantile(const struct VSC_point *, double q);
+	/*
+	 * Estimate a quantile of a histogram point in seconds.
+	 *
+	 * For histogram points, ptr[0] is the number of samples and
+	 * ptr[1] their sum in microseconds, so ptr[0] can be read as
+	 * an ordinary counter.  The buckets follow and are only
+	 * accessible through this function.
+	 *
+	 * Arguments:
+	 *	 q: The quantile, 0 < q <= 1, for instance 0.99
+	 *
+	 * Returns:
+	 *	The estimate, or a negative value if the point is not a
+	 *	histogram or has no samples.
+	 */
+
 #endif /* VAPI_VSC_H_INCLUDED */
@@ -49,6 +49,7 @@ struct vsm;
 
 struct VSL_data;
 struct VSLQ;
+struct VSL_ring;
 
 struct VSLC_ptr {
 	const uint32_t		*ptr; /* Record pointer */
@@ -286,10 +287,16 @@ struct VSL_cursor *VSL_CursorFile(struct VSL_data *vsl, const char *name,
     unsigned options);
 	/*
 	 * Create a cursor pointing to the beginning of the binary VSL log
-	 * in file name. If name is '-' reads from stdin.
+	 * in file name. If name is '-' reads from stdin. Files written
+	 * with VSL_WriteOpenZ are decompressed as they are read.
+	 *
+	 * Ring files written with VSL_RingOpen are followed as they are
+	 * written, until the writer closes the ring. The options apply to
+	 * ring files only.
 	 *
 	 * Options:
-	 *   NONE
+	 *   VSL_COPT_TAIL	Start cursor at the ring tail
+	 *   VSL_COPT_TAILSTOP	Return EOF when reaching the ring tail
 	 *
 	 * Return values:
 	 * non-NULL: Pointer to cursor
@@ -434,6 +441,53 @@ FILE *VSL_WriteOpen(struct VSL_data *vsl, const char *name, int append,
 	 * non-NULL: Success
 	 */
 
+FILE *VSL_WriteOpenZ(struct VSL_data *vsl, const char *name, int append,
+    enum VSL_grouping_e grouping);
+	/*
+	 * Open file name for writing compressed output using the
+	 * VSL_Write* functions. The records are written in compressed
+	 * blocks, with an index of the tags and vxids of each block.
+	 *
+	 * Blocks are only cut between the transactions passed to
+	 * VSL_WriteTransactions, and grouping should be the grouping of
+	 * those. Reading the file with VSLQ_SetCursor and a query using
+	 * the same or a lower grouping then skips the blocks where the
+	 * query can not match.
+	 *
+	 * Only one compressed file can be open per VSL data context, and
+	 * it must be flushed and closed with VSL_WriteFlush and
+	 * VSL_WriteClose. A block still pending when the file is closed
+	 * some other way is lost by VSL_Delete.
+	 *
+	 * Arguments:
+	 *      vsl: The VSL data context
+	 *     name: The file name
+	 *   append: If true, the file will be appended instead of truncated
+	 * grouping: The grouping of the transactions written
+	 *
+	 * Return values:
+	 *     NULL: Error - see VSL_Error
+	 * non-NULL: Success
+	 */
+
+int VSL_WriteFlush(struct VSL_data *vsl, void *fo);
+	/*
+	 * Flush the FILE* fo, writing out any pending block if it was
+	 * opened with VSL_WriteOpenZ.
+	 *
+	 * Return values:
+	 *    0: Success
+	 *   -5: I/O error
+	 */
+
+int VSL_WriteClose(struct VSL_data *vsl, void *fo);
+	/*
+	 * Flush and close the FILE* fo.
+	 *
+	 * Return values:
+	 *    0: Success
+	 *   -5: I/O error
+	 */
 
 int VSL_Write(const struct VSL_data *vsl, const struct VSL_cursor *c, void *fo);
 	/*
@@ -462,6 +516,54 @@ VSLQ_dispatch_f VSL_WriteTransactions;
 	 *    !=0:	Return value from either VSL_Next or VSL_Write
 	 */
 
+struct VSL_ring *VSL_RingOpen(struct VSL_data *vsl, const char *name,
+    size_t size, enum VSL_grouping_e grouping);
+	/*
+	 * Create a ring file of size bytes, for publishing transaction
+	 * groups to other processes with VSL_RingWrite. The file is
+	 * memory mapped by the readers, which open it with
+	 * VSL_CursorFile. Their VSLQs hand out the groups as they were
+	 * written, without grouping the records again, when they group
+	 * at the same or a lower level than grouping. Groups split out
+	 * of a higher level come in the order of the ring.
+	 *
+	 * An existing file is replaced, and the readers of the old file
+	 * see it end when the old writer closes it or exits.
+	 *
+	 * Arguments:
+	 *      vsl: The VSL data context
+	 *     name: The file name
+	 *     size: The size of the ring in bytes, at least 64k
+	 * grouping: The grouping of the transactions written
+	 *
+	 * Return values:
+	 *     NULL: Error - see VSL_Error
+	 * non-NULL: Success
+	 */
+
+VSLQ_dispatch_f VSL_RingWrite;
+	/*
+	 * Write the transactions in ptrans to the struct VSL_ring *priv,
+	 * with the records where VSL_Match returns true. Groups larger
+	 * than a quarter of the ring are not written, and are counted by
+	 * VSL_RingDropped.
+	 *
+	 * Return values:
+	 *	0:	OK
+	 *    !=0:	Return value from VSL_Next
+	 */
+
+unsigned VSL_RingDropped(const struct VSL_ring *ring);
+	/*
+	 * Return the number of groups VSL_RingWrite did not write because
+	 * they were too large for the ring.
+	 */
+
+void VSL_RingClose(struct VSL_ring **ring);
+	/*
+	 * Close the ring. Readers get EOF when they reach its end.
+	 */
+
 struct VSLQ *VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
     enum VSL_grouping_e grouping, const char *query);
 	/*
@@ -532,4 +634,41 @@ int VSLQ_Flush(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv);
 	 *   !=0: The return value from func
 	 */
 
+int VSLQ_SetThreads(struct VSLQ *vslq, unsigned nthreads, int ordered);
+	/*
+	 * Start nthreads worker threads to run the query and the callbacks
+	 * on completed transactions. Grouping of the log records stays on
+	 * the thread calling VSLQ_Dispatch. Has no effect in raw grouping
+	 * mode.
+	 *
+	 * If ordered is non-zero, the callbacks are made one at a time and
+	 * in the order the transactions completed, otherwise the callback
+	 * function and its priv must be thread safe.
+	 *
+	 * A non-zero return value from a callback is returned from a
+	 * later VSLQ_Dispatch or VSLQ_Flush call. VSLQ_Flush, VSLQ_Delete
+	 * and VSLQ_SetCursor wait for all outstanding callbacks, as does
+	 * VSLQ_Dispatch before reporting end of log or an error.
+	 *
+	 * Arguments:
+	 *      vslq: The VSLQ query
+	 *  nthreads: Number of worker threads, 0 to dispatch on the
+	 *            calling thread
+	 *   ordered: Serialize the callbacks in transaction order
+	 *
+	 * Return values:
+	 *     0: OK
+	 *    -1: Error - see VSL_Error
+	 */
+
+int VSLQ_Wait(struct VSLQ *vslq);
+	/*
+	 * Wait for the worker threads to finish all outstanding callbacks.
+	 * Unlike VSLQ_Flush, incomplete transactions are left alone.
+	 *
+	 * Return values:
+	 *     0: OK
+	 *   !=0: The return value from a callback
+	 */
+
 #endif /* VAPI_VSL_H_INCLUDED */
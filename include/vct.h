@@ -50,6 +50,25 @@
 extern const uint16_t vct_typtab[256];
 
 const char *VCT_invalid_name(const char *b, const char *e);
+const char *VCT_find_ctl(const char *b, const char *e);
+const char *VCT_find_lwsctl(const char *b, const char *e);
+
+/*
+ * Case-insensitive hash of a header name, never zero, used by the
+ * header lookups in varnishd and precomputed by VCC.
+ */
+
+#define VCT_HDRHASH_MAX		127
+
+static inline unsigned
+vct_hdrhash(const char *b, unsigned l)
+{
+	unsigned h = 0;
+
+	while (l-- > 0)
+		h = h * 33 + (*(const unsigned char *)b++ | 0x20);
+	return (1 + h % VCT_HDRHASH_MAX);
+}
 
 static inline int
 vct_is(int x, uint16_t y)
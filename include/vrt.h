@@ -65,6 +65,11 @@
  *	VRT_l_beresp_storage_hint() removed - under discussion #2509
  *	VRT_blob() added
  *	VCL_STRANDS added
+ *	struct gethdr_s.hash added
+ *	VRT_VSC_Shards_New() added
+ *	VRT_VSC_Shard() added
+ *	VRT_VSC_Shards_Summ() added
+ *	VRT_VSC_Hist() added
  * 6.1 (2017-09-15 aka 5.2)
  *	http_CollectHdrSep added
  *	VRT_purge modified (may fail a transaction, signature changed)
@@ -116,6 +121,7 @@ struct vmod_priv;
 struct vrt_acl;
 struct vsb;
 struct vsc_seg;
+struct vsc_shards;
 struct vsmw_cluster;
 struct vsl_log;
 struct ws;
@@ -355,6 +361,7 @@ enum gethdr_e {
 struct gethdr_s {
 	enum gethdr_e	where;
 	const char	*what;
+	unsigned	hash;		/* vct_hdrhash() of what, or zero */
 };
 
 struct http *VRT_selecthttp(VRT_CTX, enum gethdr_e);
@@ -465,3 +472,8 @@ void VRT_VSC_Destroy(const char *, struct vsc_seg *);
 void VRT_VSC_Hide(const struct vsc_seg *);
 void VRT_VSC_Reveal(const struct vsc_seg *);
 size_t VRT_VSC_Overhead(size_t);
+struct vsc_shards *VRT_VSC_Shards_New(void *, size_t);
+void *VRT_VSC_Shard(struct vsc_shards *);
+void VRT_VSC_Shards_Summ(struct vsc_shards *);
+#define VRT_VSC_HIST_WORDS	114	/* uint64_t's in a histogram counter */
+void VRT_VSC_Hist(uint64_t *, VCL_DURATION);
@@ -44,3 +44,43 @@ struct vsc_head {
 	uint64_t		body_offset;
 	uintptr_t		doc_id;
 };
+
+/*
+ * Histogram counters are VSC_HIST_WORDS consecutive uint64_t:
+ *
+ *	[0]	number of samples
+ *	[1]	sum of the samples in microseconds
+ *	[2...]	VSC_HIST_BUCKETS log-linear buckets
+ *
+ * Bucket n < 4 counts samples of n microseconds, above that each
+ * power of two is split into four equal buckets, so the relative
+ * error stays below 25%.  The last bucket also takes everything
+ * from 7<<26 microseconds (~470s) and up.
+ */
+
+#define VSC_HIST_BUCKETS	112
+#define VSC_HIST_WORDS		(2 + VSC_HIST_BUCKETS)
+
+static inline unsigned
+vsc_hist_bucket(uint64_t us)
+{
+	unsigned k, b;
+
+	if (us < 4)
+		return (us);
+	for (k = 2; us >> (k + 1); k++)
+		continue;
+	b = 4 * (k - 1) + ((us >> (k - 2)) & 3);
+	if (b >= VSC_HIST_BUCKETS)
+		b = VSC_HIST_BUCKETS - 1;
+	return (b);
+}
+
+static inline uint64_t
+vsc_hist_lower(unsigned b)
+{
+
+	if (b < 4)
+		return (b);
+	return ((uint64_t)(4 + b % 4) << (b / 4 - 1));
+}
@@ -45,6 +45,7 @@ struct VUT {
 	int		d_opt;
 	int		D_opt;
 	int		g_arg;
+	int		j_arg;
 	int		k_arg;
 	char		*n_arg;
 	char		*P_arg;
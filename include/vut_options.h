@@ -60,6 +60,15 @@
 	    "Print program usage and exit"				\
 	)
 
+#define VUT_OPT_j							\
+	VOPT("j:", "[-j <threads>]", "Query worker threads",		\
+	    "Run the query and format the output of completed"		\
+	    " transactions on this number of worker threads, while"	\
+	    " the log records are grouped on the main thread. The"	\
+	    " output order is the same as without this option. Has"	\
+	    " no effect with raw grouping."				\
+	)
+
 #define VUT_OPT_k							\
 	VOPT("k:", "[-k <num>]", "Limit transactions",			\
 	    "Process this number of matching log transactions before"	\
@@ -81,7 +90,10 @@
 #define VUT_OPT_r							\
 	VOPT("r:", "[-r <filename>]", "Binary file input",		\
 	    "Read log in binary file format from this file. The file"	\
-	    " can be created with ``varnishlog -w filename``."		\
+	    " can be created with ``varnishlog -w filename``. Ring"	\
+	    " files created with ``varnishlog -W filename`` are"	\
+	    " followed like the live log, starting at the tail unless"	\
+	    " the -d option was specified."				\
 	)
 
 #define VUT_OPT_t							\
@@ -0,0 +1,614 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Implementation of a hierarchical timing wheel
+ *
+ * Time is counted in ticks, and the wheel has TW_LEVELS levels of
+ * TW_SLOTS buckets, each level indexed by one TW_BITS wide digit of the
+ * tick number.  The invariant is that an item lives on the level of the
+ * most significant digit in which its tick differs from the current
+ * tick, in the bucket given by its own digit on that level.  Since the
+ * current tick is known, the bucket of an item can always be recomputed
+ * from its due time, and the index we hand out is just the position in
+ * the bucket.
+ *
+ * When the current tick rolls over a digit, the bucket for the new digit
+ * on that level is redistributed to the finer levels.  Items too far in
+ * the future for the wheel live in the overflow bucket, and items whose
+ * tick has passed live in the due bucket.
+ *
+ * The current tick is the last one which is over, so an item in the due
+ * bucket is never ahead of its time.  If the clock steps backwards, the
+ * whole wheel is redistributed around the earlier tick.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "timing_wheel.h"
+
+/* Parameters --------------------------------------------------------*/
+
+#define TW_BITS			8
+#define TW_LEVELS		4
+
+/* Private definitions -----------------------------------------------*/
+
+#define TW_SLOTS		(1 << TW_BITS)
+#define TW_MASK			((uint64_t)TW_SLOTS - 1)
+#define TW_OVERFLOW		(TW_LEVELS * TW_SLOTS)
+#define TW_DUE			(TW_OVERFLOW + 1)
+#define TW_NBUCKET		(TW_DUE + 1)
+
+#define TW_DIGIT(t, l)		(((t) >> (TW_BITS * (l))) & TW_MASK)
+
+/* Ticks beyond this are clamped, keeps us clear of double overflow */
+#define TW_TICK_MAX		((uint64_t)1 << 62)
+
+struct twbucket {
+	void			**item;
+	unsigned		n;
+	unsigned		len;
+};
+
+struct twheel {
+	unsigned		magic;
+#define TWHEEL_MAGIC		0x3c5f2b1e
+	void			*priv;
+	twheel_when_t		*when;
+	twheel_update_t		*update;
+	double			hz;
+	uint64_t		cur;
+	unsigned		nlevel[TW_LEVELS];
+	struct twbucket		bucket[TW_NBUCKET];
+};
+
+/* Implementation ----------------------------------------------------*/
+
+static uint64_t
+twheel_tick(const struct twheel *tw, double when)
+{
+	double d;
+
+	d = when * tw->hz;
+	if (!(d > 0.))
+		return (0);
+	if (d >= (double)TW_TICK_MAX)
+		return (TW_TICK_MAX);
+	return ((uint64_t)d);
+}
+
+static unsigned
+twheel_bucket(const struct twheel *tw, uint64_t t)
+{
+	uint64_t x;
+	unsigned l;
+
+	if (t <= tw->cur)
+		return (TW_DUE);
+	x = t ^ tw->cur;
+	for (l = 0; l < TW_LEVELS; l++) {
+		if ((x >> (TW_BITS * (l + 1))) == 0)
+			return (l * TW_SLOTS + TW_DIGIT(t, l));
+	}
+	return (TW_OVERFLOW);
+}
+
+static void
+twheel_add(struct twheel *tw, unsigned b, void *p)
+{
+	struct twbucket *tb;
+
+	assert(b < TW_NBUCKET);
+	tb = &tw->bucket[b];
+	if (tb->n == tb->len) {
+		tb->len = tb->len ? tb->len * 2 : 16;
+		tb->item = realloc(tb->item, tb->len * sizeof *tb->item);
+		AN(tb->item);
+	}
+	tb->item[tb->n++] = p;
+	if (b < TW_OVERFLOW)
+		tw->nlevel[b / TW_SLOTS]++;
+	tw->update(tw->priv, p, tb->n);
+}
+
+static void
+twheel_remove(struct twheel *tw, unsigned b, unsigned idx)
+{
+	struct twbucket *tb;
+	void *p;
+
+	assert(b < TW_NBUCKET);
+	tb = &tw->bucket[b];
+	assert(idx > TWHEEL_NOIDX);
+	assert(idx <= tb->n);
+	p = tb->item[idx - 1];
+	tb->n--;
+	if (idx - 1 != tb->n) {
+		tb->item[idx - 1] = tb->item[tb->n];
+		tw->update(tw->priv, tb->item[idx - 1], idx);
+	}
+	if (b < TW_OVERFLOW) {
+		assert(tw->nlevel[b / TW_SLOTS] > 0);
+		tw->nlevel[b / TW_SLOTS]--;
+	}
+	tw->update(tw->priv, p, TWHEEL_NOIDX);
+}
+
+/*
+ * Redistribute a bucket after the current tick moved into it.
+ */
+
+static void
+twheel_cascade(struct twheel *tw, unsigned b)
+{
+	struct twbucket *tb, old;
+	unsigned u;
+	void *p;
+
+	tb = &tw->bucket[b];
+	if (tb->n == 0)
+		return;
+	if (b == TW_OVERFLOW) {
+		/* Items may stay here, so work from a copy */
+		old = *tb;
+		memset(tb, 0, sizeof *tb);
+		for (u = 0; u < old.n; u++)
+			twheel_add(tw, twheel_bucket(tw,
+			    twheel_tick(tw, tw->when(tw->priv, old.item[u]))),
+			    old.item[u]);
+		free(old.item);
+		return;
+	}
+	while (tb->n > 0) {
+		p = tb->item[--tb->n];
+		assert(tw->nlevel[b / TW_SLOTS] > 0);
+		tw->nlevel[b / TW_SLOTS]--;
+		u = twheel_bucket(tw, twheel_tick(tw, tw->when(tw->priv, p)));
+		assert(u < b || u == TW_DUE);
+		twheel_add(tw, u, p);
+	}
+}
+
+static void
+twheel_step(struct twheel *tw)
+{
+	uint64_t x;
+	unsigned l;
+
+	x = tw->cur ^ (tw->cur + 1);
+	tw->cur++;
+	if (x >> (TW_BITS * TW_LEVELS))
+		twheel_cascade(tw, TW_OVERFLOW);
+	for (l = TW_LEVELS - 1; l > 0; l--)
+		if (x >> (TW_BITS * l))
+			twheel_cascade(tw,
+			    l * TW_SLOTS + TW_DIGIT(tw->cur, l));
+	twheel_cascade(tw, TW_DIGIT(tw->cur, 0));
+}
+
+/*
+ * Find the next non-empty bucket on the finest level, returns TW_SLOTS
+ * if there is none.  Buckets at or below the current digit are empty.
+ */
+
+static unsigned
+twheel_next0(const struct twheel *tw)
+{
+	unsigned u;
+
+	if (tw->nlevel[0] == 0)
+		return (TW_SLOTS);
+	for (u = TW_DIGIT(tw->cur, 0) + 1; u < TW_SLOTS; u++)
+		if (tw->bucket[u].n > 0)
+			return (u);
+	WRONG("Timing wheel level 0 count");
+	NEEDLESS(return (TW_SLOTS));
+}
+
+static void
+twheel_advance(struct twheel *tw, uint64_t target)
+{
+	uint64_t skip, mask;
+	unsigned l, u;
+
+	while (tw->cur < target) {
+		/* Skip ahead over ticks where nothing happens */
+		for (l = 0; l < TW_LEVELS && tw->nlevel[l] == 0; l++)
+			continue;
+		if (l == 0) {
+			u = twheel_next0(tw);
+			skip = (tw->cur & ~TW_MASK) | (u - 1);
+		} else {
+			mask = ((uint64_t)1 << (TW_BITS * l)) - 1;
+			skip = tw->cur | mask;
+		}
+		if (skip >= target) {
+			tw->cur = target;
+			break;
+		}
+		tw->cur = skip;
+		twheel_step(tw);
+	}
+}
+
+/*
+ * Move the current tick backwards.  Nothing is cheap about this, but it
+ * only happens when the clock is stepped.
+ */
+
+static void
+twheel_rewind(struct twheel *tw, uint64_t target)
+{
+	struct twbucket *old;
+	unsigned b, u;
+
+	assert(target < tw->cur);
+	old = malloc(sizeof tw->bucket);
+	AN(old);
+	memcpy(old, tw->bucket, sizeof tw->bucket);
+	memset(tw->bucket, 0, sizeof tw->bucket);
+	memset(tw->nlevel, 0, sizeof tw->nlevel);
+	tw->cur = target;
+	for (b = 0; b < TW_NBUCKET; b++) {
+		for (u = 0; u < old[b].n; u++)
+			twheel_add(tw, twheel_bucket(tw,
+			    twheel_tick(tw, tw->when(tw->priv, old[b].item[u]))),
+			    old[b].item[u]);
+		free(old[b].item);
+	}
+	free(old);
+}
+
+/* Public functions --------------------------------------------------*/
+
+struct twheel *
+twheel_new(void *priv, twheel_when_t *when_f, twheel_update_t *update_f,
+    double now, double hz)
+{
+	struct twheel *tw;
+
+	AN(when_f);
+	AN(update_f);
+	assert(hz > 0.);
+	tw = calloc(1, sizeof *tw);
+	if (tw == NULL)
+		return (tw);
+	tw->magic = TWHEEL_MAGIC;
+	tw->priv = priv;
+	tw->when = when_f;
+	tw->update = update_f;
+	tw->hz = hz;
+	/* The tick we are in is not over yet */
+	tw->cur = twheel_tick(tw, now);
+	if (tw->cur > 0)
+		tw->cur--;
+	return (tw);
+}
+
+void
+twheel_insert(struct twheel *tw, void *p)
+{
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	AN(p);
+	twheel_add(tw,
+	    twheel_bucket(tw, twheel_tick(tw, tw->when(tw->priv, p))), p);
+}
+
+void
+twheel_delete(struct twheel *tw, void *p, unsigned idx)
+{
+	unsigned b;
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	AN(p);
+	b = twheel_bucket(tw, twheel_tick(tw, tw->when(tw->priv, p)));
+	assert(idx <= tw->bucket[b].n);
+	assert(tw->bucket[b].item[idx - 1] == p);
+	twheel_remove(tw, b, idx);
+}
+
+void *
+twheel_root(struct twheel *tw, double now)
+{
+	uint64_t t;
+	struct twbucket *tb;
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+
+	/*
+	 * A tick is only done once the next one has started, this way
+	 * we never return an item ahead of its time.
+	 */
+	t = twheel_tick(tw, now);
+	if (t > 0)
+		t--;
+	if (t < tw->cur)
+		twheel_rewind(tw, t);
+	else
+		twheel_advance(tw, t);
+
+	tb = &tw->bucket[TW_DUE];
+	if (tb->n == 0)
+		return (NULL);
+	return (tb->item[tb->n - 1]);
+}
+
+double
+twheel_next(const struct twheel *tw)
+{
+	unsigned l, u;
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+
+	if (tw->bucket[TW_DUE].n > 0)
+		return (tw->cur / tw->hz);
+	u = twheel_next0(tw);
+	if (u < TW_SLOTS)
+		return ((((tw->cur & ~TW_MASK) | u) + 1) / tw->hz);
+	for (l = 1; l < TW_LEVELS; l++)
+		if (tw->nlevel[l] > 0)
+			break;
+	if (l == TW_LEVELS && tw->bucket[TW_OVERFLOW].n == 0)
+		return (NAN);
+	/* Something will cascade down when this level 0 round is over */
+	return (((tw->cur | TW_MASK) + 2) / tw->hz);
+}
+
+#ifdef TWHEEL_TEST_DRIVER
+
+#include <stdio.h>
+
+#include "binary_heap.h"
+#include "miniobj.h"
+#include "vrnd.h"
+#include "vtim.h"
+
+/* Test driver -------------------------------------------------------*/
+
+/*
+ * Simulate an expiry workload on both the timing wheel and a binary
+ * heap: a population of items with short random TTLs which are
+ * expired, rearmed and replaced as simulated time moves on.
+ */
+
+struct foo {
+	unsigned	magic;
+#define FOO_MAGIC	0x5e1e3c0d
+	unsigned	idx;
+	double		when;
+	unsigned	n;
+};
+
+#define M 2000003	/* Number of operations */
+#define N 262147	/* Number of items */
+#define HZ 128.		/* Ticks per second */
+#define TTL 300.	/* Max TTL, seconds */
+
+static struct foo *ff[N];
+
+static double v_matchproto_(twheel_when_t)
+when(void *priv, const void *a)
+{
+	const struct foo *fa;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	return (fa->when);
+}
+
+static void v_matchproto_(twheel_update_t)
+update(void *priv, void *a, unsigned u)
+{
+	struct foo *fa;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	fa->idx = u;
+}
+
+static int v_matchproto_(binheap_cmp_t)
+cmp(void *priv, const void *a, const void *b)
+{
+	const struct foo *fa, *fb;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	CAST_OBJ_NOTNULL(fb, b, FOO_MAGIC);
+	return (fa->when < fb->when);
+}
+
+static double
+ttl(void)
+{
+	return (TTL * (VRND_RandomTestable() % 10000) / 10000.);
+}
+
+/* The wheel may be late by a tick, but never early */
+
+static void
+run_wheel(double t0)
+{
+	struct twheel *tw;
+	struct foo *fp;
+	unsigned u, v, nexp = 0;
+	double now = t0, t, tn;
+
+	tw = twheel_new(NULL, when, update, now, HZ);
+	AN(tw);
+	for (u = 0; u < N; u++) {
+		ALLOC_OBJ(ff[u], FOO_MAGIC);
+		AN(ff[u]);
+		ff[u]->n = u;
+		ff[u]->when = now + ttl();
+		twheel_insert(tw, ff[u]);
+		AN(ff[u]->idx);
+	}
+	t = VTIM_mono();
+	for (u = 0; u < M; u++) {
+		now += TTL / M * 4;
+		while ((fp = twheel_root(tw, now)) != NULL) {
+			CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+			assert(fp->when <= now);
+			assert(fp->when > now - 2. / HZ - TTL / M * 4);
+			twheel_delete(tw, fp, fp->idx);
+			AZ(fp->idx);
+			fp->when = now + ttl();
+			twheel_insert(tw, fp);
+			nexp++;
+		}
+		tn = twheel_next(tw);
+		assert(isnan(tn) || tn > now - 1. / HZ);
+		/* Rearm a random item */
+		v = VRND_RandomTestable() % N;
+		twheel_delete(tw, ff[v], ff[v]->idx);
+		ff[v]->when = now + ttl();
+		twheel_insert(tw, ff[v]);
+	}
+	t = VTIM_mono() - t;
+	printf("twheel:  %u ops %u expiries %.3f s (%.0f ns/op)\n",
+	    M, nexp, t, 1e9 * t / (M + nexp));
+
+	for (u = 0; u < N; u++) {
+		twheel_delete(tw, ff[u], ff[u]->idx);
+		AZ(ff[u]->idx);
+		FREE_OBJ(ff[u]);
+	}
+	AZ(twheel_root(tw, now + 2 * TTL));
+	assert(isnan(twheel_next(tw)));
+}
+
+/* Inserts in the first tick, and a clock which steps backwards */
+
+static void
+run_edges(double t0)
+{
+	struct twheel *tw;
+	struct foo a, b, c;
+	double now;
+
+	INIT_OBJ(&a, FOO_MAGIC);
+	INIT_OBJ(&b, FOO_MAGIC);
+	INIT_OBJ(&c, FOO_MAGIC);
+
+	now = t0 + .25 / HZ;
+	tw = twheel_new(NULL, when, update, now, HZ);
+	AN(tw);
+	a.when = now + .5 / HZ;
+	twheel_insert(tw, &a);
+	AZ(twheel_root(tw, now));
+	AZ(twheel_root(tw, a.when));
+	assert(twheel_root(tw, a.when + 1. / HZ) == &a);
+	twheel_delete(tw, &a, a.idx);
+
+	/* c is due at t0 + 10, then no longer once the clock steps back */
+	a.when = t0 + 20;
+	c.when = t0 + 8;
+	twheel_insert(tw, &a);
+	twheel_insert(tw, &c);
+	assert(twheel_root(tw, t0 + 10) == &c);
+	now = t0 + 5;
+	b.when = now + 1;
+	twheel_insert(tw, &b);
+	AZ(twheel_root(tw, now));
+	assert(twheel_next(tw) > now);
+	assert(twheel_root(tw, b.when + 1. / HZ) == &b);
+	twheel_delete(tw, &b, b.idx);
+	AZ(twheel_root(tw, c.when));
+	assert(twheel_root(tw, c.when + 1. / HZ) == &c);
+	twheel_delete(tw, &c, c.idx);
+	AZ(twheel_root(tw, a.when));
+	assert(twheel_root(tw, a.when + 1. / HZ) == &a);
+	twheel_delete(tw, &a, a.idx);
+	AZ(twheel_root(tw, t0 + 2 * TTL));
+	assert(isnan(twheel_next(tw)));
+	printf("twheel:  edge cases passed\n");
+}
+
+static void
+run_binheap(double t0)
+{
+	struct binheap *bh;
+	struct foo *fp;
+	unsigned u, v, nexp = 0;
+	double now = t0, t;
+
+	bh = binheap_new(NULL, cmp, update);
+	AN(bh);
+	for (u = 0; u < N; u++) {
+		ALLOC_OBJ(ff[u], FOO_MAGIC);
+		AN(ff[u]);
+		ff[u]->n = u;
+		ff[u]->when = now + ttl();
+		binheap_insert(bh, ff[u]);
+	}
+	t = VTIM_mono();
+	for (u = 0; u < M; u++) {
+		now += TTL / M * 4;
+		while ((fp = binheap_root(bh)) != NULL && fp->when <= now) {
+			binheap_delete(bh, fp->idx);
+			fp->when = now + ttl();
+			binheap_insert(bh, fp);
+			nexp++;
+		}
+		v = VRND_RandomTestable() % N;
+		ff[v]->when = now + ttl();
+		binheap_reorder(bh, ff[v]->idx);
+	}
+	t = VTIM_mono() - t;
+	printf("binheap: %u ops %u expiries %.3f s (%.0f ns/op)\n",
+	    M, nexp, t, 1e9 * t / (M + nexp));
+
+	for (u = 0; u < N; u++) {
+		binheap_delete(bh, ff[u]->idx);
+		FREE_OBJ(ff[u]);
+	}
+}
+
+int
+main(void)
+{
+	double t0 = 1.5e9;
+
+	VRND_SeedAll();
+	run_edges(t0);
+	VRND_SeedTestable(1);
+	run_wheel(t0);
+	VRND_SeedTestable(1);
+	run_binheap(t0);
+	return (0);
+}
+#endif
@@ -34,6 +34,10 @@
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 #include "vdef.h"
 
 #include "vas.h"
@@ -256,3 +260,209 @@ VCT_invalid_name(const char *b, const char *e)
 
 	return (NULL);
 }
+
+/*--------------------------------------------------------------------
+ * Scanners for the HTTP/1 dissector.
+ *
+ * VCT_find_ctl() returns the first CTL other than SP (HT) in [b, e),
+ * which is where a header line ends or has a bogus character.
+ * VCT_find_lwsctl() returns the first LWS or CTL in [b, e), which is
+ * where a field of the first line ends.  Both return e if there is
+ * none, and both look at 16 bytes at a time where SSE2 is available.
+ */
+
+#ifdef __SSE2__
+#  define VCT_VEC	16
+
+static inline unsigned
+vct_mask_ctl(__m128i x)
+{
+	__m128i m;
+
+	/* x <= 0x1f && x != HT, or x == DEL */
+	m = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x1f)), x);
+	m = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(0x09)), m);
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7f)));
+	return ((unsigned)_mm_movemask_epi8(m));
+}
+
+static inline unsigned
+vct_mask_lwsctl(__m128i x)
+{
+	__m128i m;
+
+	/* x <= 0x20 or x == DEL */
+	m = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x20)), x);
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7f)));
+	return ((unsigned)_mm_movemask_epi8(m));
+}
+#endif
+
+const char *
+VCT_find_ctl(const char *b, const char *e)
+{
+#ifdef __SSE2__
+	unsigned u;
+
+	for (; e - b >= VCT_VEC; b += VCT_VEC) {
+		u = vct_mask_ctl(_mm_loadu_si128((const void *)b));
+		if (u != 0)
+			return (b + __builtin_ctz(u));
+	}
+#endif
+	for (; b < e; b++)
+		if (vct_isctl(*b) && !vct_issp(*b))
+			return (b);
+	return (e);
+}
+
+const char *
+VCT_find_lwsctl(const char *b, const char *e)
+{
+#ifdef __SSE2__
+	unsigned u;
+
+	for (; e - b >= VCT_VEC; b += VCT_VEC) {
+		u = vct_mask_lwsctl(_mm_loadu_si128((const void *)b));
+		if (u != 0)
+			return (b + __builtin_ctz(u));
+	}
+#endif
+	for (; b < e; b++)
+		if (vct_islws(*b) || vct_isctl(*b))
+			return (b);
+	return (e);
+}
+
+#ifdef VCT_TEST_DRIVER
+
+#include <stdio.h>
+
+#include "vrnd.h"
+#include "vtim.h"
+
+/* Test driver -------------------------------------------------------*/
+
+/*
+ * Check the scanners against the byte at a time vct_* classes, then
+ * time both over a set of typical request headers.
+ */
+
+static const char *
+ref_ctl(const char *b, const char *e)
+{
+	for (; b < e; b++)
+		if (vct_isctl(*b) && !vct_issp(*b))
+			return (b);
+	return (e);
+}
+
+static const char *
+ref_lwsctl(const char *b, const char *e)
+{
+	for (; b < e; b++)
+		if (vct_islws(*b) || vct_isctl(*b))
+			return (b);
+	return (e);
+}
+
+static const char hdrs[] =
+    "GET /static/js/app.3f9c2a.js?v=20180315 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:59.0) "
+	"Gecko/20100101 Firefox/59.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example.com/articles/2018/03/some-story\r\n"
+    "Cookie: _ga=GA1.2.1234567890.1521000000; sessionid=0123456789abcdef"
+	"0123456789abcdef; consent=yes\r\n"
+    "Connection: keep-alive\r\n"
+    "If-None-Match: \"5aa9f3c2-1d4f\"\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+/* Bytes which matter to either scanner, and a few which do not */
+static const char alphabet[] = {
+	0x00, 0x01, 0x09, 0x0a, 0x0b, 0x0d, 0x1f, 0x20, 0x21, 0x3a,
+	0x41, 0x7e, 0x7f, (char)0x80, (char)0x9f, (char)0xa0, (char)0xff
+};
+
+#define NFUZZ	1000000
+#define NBENCH	200000
+
+static void
+fuzz(void)
+{
+	char buf[96];
+	unsigned u, i, l, o;
+
+	/* Every byte value at every position of every short span */
+	for (u = 0; u < 256; u++) {
+		for (o = 0; o < 40; o++) {
+			memset(buf, 'a', sizeof buf);
+			buf[o] = (char)u;
+			for (l = 0; l <= 40; l++) {
+				assert(VCT_find_ctl(buf, buf + l) ==
+				    ref_ctl(buf, buf + l));
+				assert(VCT_find_lwsctl(buf, buf + l) ==
+				    ref_lwsctl(buf, buf + l));
+			}
+		}
+	}
+
+	/* Random spans of mostly interesting bytes */
+	for (u = 0; u < NFUZZ; u++) {
+		for (i = 0; i < sizeof buf; i++) {
+			if (VRND_RandomTestable() % 16 == 0)
+				buf[i] = alphabet[VRND_RandomTestable() %
+				    sizeof alphabet];
+			else
+				buf[i] = 'a' + VRND_RandomTestable() % 26;
+		}
+		o = VRND_RandomTestable() % sizeof buf;
+		l = VRND_RandomTestable() % (sizeof buf - o + 1);
+		assert(VCT_find_ctl(buf + o, buf + o + l) ==
+		    ref_ctl(buf + o, buf + o + l));
+		assert(VCT_find_lwsctl(buf + o, buf + o + l) ==
+		    ref_lwsctl(buf + o, buf + o + l));
+	}
+	printf("fuzz:   %u spans OK\n", NFUZZ);
+}
+
+static void
+bench(const char *name, const char *(*f)(const char *, const char *))
+{
+	const char *p, *e = hdrs + sizeof hdrs - 1;
+	unsigned u, n = 0;
+	double t;
+
+	t = VTIM_mono();
+	for (u = 0; u < NBENCH; u++) {
+		for (p = hdrs; p < e; n++) {
+			p = f(p, e);
+			if (p < e)
+				p += vct_skipcrlf(p);
+		}
+	}
+	t = VTIM_mono() - t;
+	printf("%s %u scans %.3f s (%.1f ns/header set)\n",
+	    name, n, t, 1e9 * t / NBENCH);
+}
+
+int
+main(void)
+{
+
+	unsigned seed;
+
+	VRND_SeedAll();
+	seed = (unsigned)random();
+	printf("seed:   %u\n", seed);
+	VRND_SeedTestable(seed);
+	fuzz();
+	bench("simd:  ", VCT_find_ctl);
+	bench("scalar:", ref_ctl);
+	return (0);
+}
+#endif
@@ -241,6 +241,13 @@ vsc_fill_point(const struct vsc *vsc, const struct vsc_seg *seg,
 		point->point.semantics = 'g';
 	} else if (!strcmp(vt->value, "bitmap")) {
 		point->point.semantics = 'b';
+	} else if (!strcmp(vt->value, "histogram")) {
+		vt = vjsn_child(vv, "buckets");
+		AN(vt);
+		if (strtoul(vt->value, NULL, 0) == VSC_HIST_BUCKETS)
+			point->point.semantics = 'h';
+		else
+			point->point.semantics = '?';
 	} else {
 		point->point.semantics = '?';
 	}
@@ -505,6 +512,49 @@ VSC_ChangeLevel(const struct VSC_level_desc *old, int chg)
 	return (levels[i]);
 }
 
+/*--------------------------------------------------------------------
+ * Walk the buckets to the one holding the q'th sample and interpolate
+ * linearly inside it.
+ */
+
+double
+VSC_Quantile(const struct VSC_point *pt, double q)
+{
+	uint64_t b[VSC_HIST_BUCKETS], n, lo, hi;
+	double t, c;
+	unsigned u;
+
+	AN(pt);
+	assert(q > 0. && q <= 1.);
+	if (pt->semantics != 'h')
+		return (-1.);
+
+	/* The buckets are summed under our feet, take a snapshot */
+	n = 0;
+	for (u = 0; u < VSC_HIST_BUCKETS; u++) {
+		b[u] = pt->ptr[2 + u];
+		n += b[u];
+	}
+	if (n == 0)
+		return (-1.);
+
+	t = q * n;
+	c = 0.;
+	for (u = 0; u < VSC_HIST_BUCKETS - 1; u++) {
+		if (c + b[u] >= t)
+			break;
+		c += b[u];
+	}
+	lo = vsc_hist_lower(u);
+	if (u < VSC_HIST_BUCKETS - 1)
+		hi = vsc_hist_lower(u + 1);
+	else
+		hi = lo;
+	if (b[u] > 0)
+		return ((lo + (hi - lo) * (t - c) / b[u]) * 1e-6);
+	return (lo * 1e-6);
+}
+
 /*--------------------------------------------------------------------*/
 
 static void
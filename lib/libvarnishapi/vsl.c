@@ -31,9 +31,12 @@
 #include "config.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "vdef.h"
 #include "vas.h"
@@ -43,11 +46,34 @@
 #include "vqueue.h"
 #include "vre.h"
 #include "vsb.h"
+#include "vgz.h"
 
 #include "vapi/vsl.h"
 
 #include "vsl_api.h"
 
+/* Uncompressed size of the blocks in compressed files */
+#define VSLZ_BLOCK_WORDS	VSL_WORDS(256 * 1024)
+
+struct vslz_writer {
+	unsigned		magic;
+#define VSLZ_WRITER_MAGIC	0x1B0D7E35
+	FILE			*fo;
+	enum VSL_grouping_e	grouping;
+
+	/* Serializes the idle flushes against the dispatch threads */
+	pthread_mutex_t		mtx;
+	unsigned		ingroup;
+
+	z_stream		vz;
+	struct vslz_block	blk;
+	uint32_t		*buf;
+	size_t			len;
+	size_t			space;
+	unsigned char		*zbuf;
+	size_t			zspace;
+};
+
 /*--------------------------------------------------------------------*/
 
 const char * const VSL_tags[SLT__MAX] = {
@@ -117,12 +143,17 @@ vsl_IX_free(vslf_list *filters)
 	}
 }
 
+static void vslz_free(struct vslz_writer **);
+
 void
 VSL_Delete(struct VSL_data *vsl)
 {
 
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 
+	if (vsl->zw != NULL)
+		vslz_free(&vsl->zw);
+
 	vbit_destroy(vsl->vbm_select);
 	vbit_destroy(vsl->vbm_supress);
 	vsl_IX_free(&vsl->vslf_select);
@@ -419,16 +450,249 @@ VSL_WriteOpen(struct VSL_data *vsl, const char *name, int append, int unbuf)
 	return (f);
 }
 
+/*--------------------------------------------------------------------
+ * Compressed output
+ */
+
+static void
+vslz_reset(struct vslz_writer *zw)
+{
+
+	memset(&zw->blk, 0, sizeof zw->blk);
+	zw->blk.magic = VSLZ_BLOCK_MAGIC;
+	zw->blk.grouping = zw->grouping;
+	zw->len = 0;
+}
+
+/* Compress and write out the pending block */
+static int
+vslz_emit(struct vslz_writer *zw)
+{
+	size_t l, zlen;
+
+	CHECK_OBJ_NOTNULL(zw, VSLZ_WRITER_MAGIC);
+	if (zw->len == 0)
+		return (0);
+
+	l = VSL_BYTES(zw->len);
+	assert(l <= VSLZ_BLOCK_MAX);
+	AZ(deflateReset(&zw->vz));
+	zlen = VSLZ_ZBOUND(l);
+	if (zw->zspace < zlen) {
+		zw->zspace = zlen;
+		zw->zbuf = realloc(zw->zbuf, zw->zspace);
+		AN(zw->zbuf);
+	}
+	zw->vz.next_in = (const Bytef *)zw->buf;
+	zw->vz.avail_in = l;
+	zw->vz.next_out = zw->zbuf;
+	zw->vz.avail_out = zw->zspace;
+	if (deflate(&zw->vz, Z_FINISH) != Z_STREAM_END)
+		return (-5);
+	zlen = zw->vz.total_out;
+	zw->blk.zlen = zlen;
+	zw->blk.len = l;
+	if (fwrite(&zw->blk, sizeof zw->blk, 1, zw->fo) != 1 ||
+	    fwrite(zw->zbuf, zlen, 1, zw->fo) != 1)
+		return (-5);
+	vslz_reset(zw);
+	return (0);
+}
+
+static int
+vslz_append(struct vslz_writer *zw, const uint32_t *ptr)
+{
+	struct vslz_block *blk;
+	const char *p;
+	unsigned vxid;
+	size_t l;
+	double t;
+
+	CHECK_OBJ_NOTNULL(zw, VSLZ_WRITER_MAGIC);
+	blk = &zw->blk;
+
+	l = VSL_NEXT(ptr) - ptr;
+	if (VSL_BYTES(zw->len + l) > VSLZ_BLOCK_MAX) {
+		/* Cut a group too large for one block, readers can not
+		   skip the pieces */
+		assert(zw->ingroup);
+		blk->grouping = VSL_g_raw;
+		if (vslz_emit(zw))
+			return (-5);
+		blk->grouping = VSL_g_raw;
+	}
+	if (zw->space < zw->len + l) {
+		while (zw->space < zw->len + l)
+			zw->space = 2 * (zw->len + l);
+		zw->buf = realloc(zw->buf, VSL_BYTES(zw->space));
+		AN(zw->buf);
+	}
+	memcpy(zw->buf + zw->len, ptr, VSL_BYTES(l));
+
+	vxid = VSL_ID(ptr);
+	if (zw->len == 0 || vxid < blk->vxid_min)
+		blk->vxid_min = vxid;
+	if (zw->len == 0 || vxid > blk->vxid_max)
+		blk->vxid_max = vxid;
+	zw->len += l;
+	vslq_tagset_set(&blk->tags, VSL_TAG(ptr));
+	if (VSL_TAG(ptr) == SLT_Timestamp) {
+		p = strchr(VSL_CDATA(ptr), ':');
+		t = p != NULL ? strtod(p + 1, NULL) : 0.;
+		if (t > 0. && (blk->t_min == 0. || t < blk->t_min))
+			blk->t_min = t;
+		if (t > blk->t_max)
+			blk->t_max = t;
+	}
+
+	if (zw->ingroup)
+		return (0);
+	/* Records written outside of transactions can be cut anywhere */
+	blk->grouping = VSL_g_raw;
+	if (zw->len >= VSLZ_BLOCK_WORDS)
+		return (vslz_emit(zw));
+	return (0);
+}
+
+static struct vslz_writer *
+vslz_lookup(const struct VSL_data *vsl, const void *fo)
+{
+
+	if (vsl->zw == NULL || vsl->zw->fo != fo)
+		return (NULL);
+	CHECK_OBJ(vsl->zw, VSLZ_WRITER_MAGIC);
+	return (vsl->zw);
+}
+
+static void
+vslz_free(struct vslz_writer **pzw)
+{
+	struct vslz_writer *zw;
+
+	TAKE_OBJ_NOTNULL(zw, pzw, VSLZ_WRITER_MAGIC);
+	AZ(zw->ingroup);
+	/* A pending block is lost, zw->fo may be closed already */
+	(void)deflateEnd(&zw->vz);
+	AZ(pthread_mutex_destroy(&zw->mtx));
+	free(zw->buf);
+	free(zw->zbuf);
+	FREE_OBJ(zw);
+}
+
+FILE*
+VSL_WriteOpenZ(struct VSL_data *vsl, const char *name, int append,
+    enum VSL_grouping_e grouping)
+{
+	const char head[] = VSL_ZFILE_ID;
+	char buf[sizeof head];
+	struct vslz_writer *zw;
+	FILE* f;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	AN(name);
+	if (vsl->zw != NULL) {
+		vsl_diag(vsl, "Compressed output already open");
+		return (NULL);
+	}
+	if (grouping >= VSL_g__MAX) {
+		vsl_diag(vsl, "Illegal grouping");
+		return (NULL);
+	}
+	f = fopen(name, append ? "a+" : "w");
+	if (f == NULL) {
+		vsl_diag(vsl, "%s", strerror(errno));
+		return (NULL);
+	}
+	if (fseek(f, 0, SEEK_END)) {
+		vsl_diag(vsl, "%s", strerror(errno));
+		(void)fclose(f);
+		return (NULL);
+	}
+	if (0 == ftell(f)) {
+		if (fwrite(head, 1, sizeof head, f) != sizeof head) {
+			vsl_diag(vsl, "%s", strerror(errno));
+			(void)fclose(f);
+			return (NULL);
+		}
+	} else {
+		rewind(f);
+		if (fread(buf, 1, sizeof buf, f) != sizeof buf ||
+		    memcmp(buf, head, sizeof buf)) {
+			vsl_diag(vsl, "Not a compressed VSL file: %s", name);
+			(void)fclose(f);
+			return (NULL);
+		}
+		AZ(fseek(f, 0, SEEK_END));
+	}
+
+	ALLOC_OBJ(zw, VSLZ_WRITER_MAGIC);
+	AN(zw);
+	zw->fo = f;
+	zw->grouping = grouping;
+	AZ(deflateInit2(&zw->vz, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + 15,
+	    8, Z_DEFAULT_STRATEGY));
+	AZ(pthread_mutex_init(&zw->mtx, NULL));
+	vslz_reset(zw);
+	vsl->zw = zw;
+	return (f);
+}
+
+int
+VSL_WriteFlush(struct VSL_data *vsl, void *fo)
+{
+	struct vslz_writer *zw;
+	int i = 0;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	if (fo == NULL)
+		fo = stdout;
+	zw = vslz_lookup(vsl, fo);
+	if (zw != NULL) {
+		AZ(pthread_mutex_lock(&zw->mtx));
+		/* A transaction being written goes out with its block */
+		if (!zw->ingroup)
+			i = vslz_emit(zw);
+		AZ(pthread_mutex_unlock(&zw->mtx));
+	}
+	if (fflush(fo))
+		return (-5);
+	return (i);
+}
+
+int
+VSL_WriteClose(struct VSL_data *vsl, void *fo)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	AN(fo);
+	i = VSL_WriteFlush(vsl, fo);
+	if (vslz_lookup(vsl, fo) != NULL)
+		vslz_free(&vsl->zw);
+	if (fclose(fo))
+		return (-5);
+	return (i);
+}
+
 int
 VSL_Write(const struct VSL_data *vsl, const struct VSL_cursor *c, void *fo)
 {
+	struct vslz_writer *zw;
 	size_t r;
+	int i;
 
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 	if (c == NULL || c->rec.ptr == NULL)
 		return (0);
 	if (fo == NULL)
 		fo = stdout;
+	zw = vslz_lookup(vsl, fo);
+	if (zw != NULL) {
+		AZ(pthread_mutex_lock(&zw->mtx));
+		i = vslz_append(zw, c->rec.ptr);
+		AZ(pthread_mutex_unlock(&zw->mtx));
+		return (i);
+	}
 	r = fwrite(c->rec.ptr, sizeof *c->rec.ptr,
 	    VSL_NEXT(c->rec.ptr) - c->rec.ptr, fo);
 	if (r == 0)
@@ -459,12 +723,28 @@ int v_matchproto_(VSLQ_dispatch_f)
 VSL_WriteTransactions(struct VSL_data *vsl, struct VSL_transaction * const pt[],
     void *fo)
 {
+	struct vslz_writer *zw;
 	struct VSL_transaction *t;
 	int i;
 
 	if (pt == NULL)
 		return (0);
+	zw = vslz_lookup(vsl, fo != NULL ? fo : stdout);
+	if (zw != NULL) {
+		/* Cut the blocks between transactions only */
+		AZ(pthread_mutex_lock(&zw->mtx));
+		zw->ingroup++;
+		AZ(pthread_mutex_unlock(&zw->mtx));
+	}
 	for (i = 0, t = pt[0]; i == 0 && t != NULL; t = *++pt)
 		i = VSL_WriteAll(vsl, t->c, fo);
+	if (zw != NULL) {
+		AZ(pthread_mutex_lock(&zw->mtx));
+		AN(zw->ingroup);
+		zw->ingroup--;
+		if (i == 0 && !zw->ingroup && zw->len >= VSLZ_BLOCK_WORDS)
+			i = vslz_emit(zw);
+		AZ(pthread_mutex_unlock(&zw->mtx));
+	}
 	return (i);
 }
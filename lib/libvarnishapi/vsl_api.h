@@ -30,6 +30,8 @@
  */
 
 #define VSL_FILE_ID			"VSL"
+#define VSL_ZFILE_ID			"VSZ"
+#define VSL_RFILE_ID			"VSR"
 
 /*lint -esym(534, vsl_diag) */
 int vsl_diag(struct VSL_data *vsl, const char *fmt, ...) v_printflike_(2, 3);
@@ -40,6 +42,14 @@ typedef void vslc_delete_f(const struct VSL_cursor *);
 typedef int vslc_next_f(const struct VSL_cursor *);
 typedef int vslc_reset_f(const struct VSL_cursor *);
 typedef int vslc_check_f(const struct VSL_cursor *, const struct VSLC_ptr *);
+struct vslz_block;
+typedef int vslc_skip_f(void *priv, const struct vslz_block *);
+typedef void vslc_setskip_f(const struct VSL_cursor *, vslc_skip_f *,
+    void *priv);
+struct vsl_ring_frame;
+typedef int vslc_grouping_f(const struct VSL_cursor *);
+typedef int vslc_frame_f(const struct VSL_cursor *,
+    const struct vsl_ring_frame **);
 
 struct vslc_tbl {
 	unsigned			magic;
@@ -49,6 +59,11 @@ struct vslc_tbl {
 	vslc_next_f			*next;
 	vslc_reset_f			*reset;
 	vslc_check_f			*check;
+	vslc_setskip_f			*setskip;
+
+	/* Cursors of ring files hand out whole transaction groups */
+	vslc_grouping_f			*grouping;
+	vslc_frame_f			*frame;
 };
 
 struct vslf {
@@ -85,12 +100,117 @@ struct VSL_data {
 	int				L_opt;
 	double				T_opt;
 	int				v_opt;
+
+	/* Compressed output, see VSL_WriteOpenZ */
+	struct vslz_writer		*zw;
+};
+
+/* Set of record tags */
+struct vslq_tagset {
+	uint64_t			bits[SLT__MAX / 64];
+};
+
+static inline void
+vslq_tagset_set(struct vslq_tagset *ts, unsigned tag)
+{
+
+	assert(tag < SLT__MAX);
+	ts->bits[tag / 64] |= (uint64_t)1 << (tag % 64);
+}
+
+static inline int
+vslq_tagset_test(const struct vslq_tagset *ts, unsigned tag)
+{
+
+	assert(tag < SLT__MAX);
+	return ((ts->bits[tag / 64] >> (tag % 64)) & 1);
+}
+
+static inline void
+vslq_tagset_merge(struct vslq_tagset *ts, const struct vslq_tagset *o)
+{
+	unsigned u;
+
+	for (u = 0; u < SLT__MAX / 64; u++)
+		ts->bits[u] |= o->bits[u];
+}
+
+static inline int
+vslq_tagset_overlap(const struct vslq_tagset *a, const struct vslq_tagset *b)
+{
+	unsigned u;
+
+	for (u = 0; u < SLT__MAX / 64; u++)
+		if (a->bits[u] & b->bits[u])
+			return (1);
+	return (0);
+}
+
+/*
+ * Compressed VSL files start with VSL_ZFILE_ID, followed by blocks of
+ * records. Each block is a header with an index of its records,
+ * followed by zlen bytes of the records compressed with gzip. When
+ * grouping is not VSL_g_raw, the block holds only whole transactions
+ * of that grouping, which lets readers grouping at the same or a lower
+ * level skip it without decompressing when their query cannot match
+ * any of the tags or vxids in the index.
+ */
+/*
+ * Blocks hold at most VSLZ_BLOCK_MAX bytes of records. A transaction
+ * group which does not fit is cut, and its blocks are marked
+ * VSL_g_raw. VSLZ_ZBOUND is the compressBound() of zlib, which libvgz
+ * does not have, with the larger gzip header and trailer.
+ */
+#define VSLZ_BLOCK_MAX			(16 * 1024 * 1024)
+#define VSLZ_ZBOUND(l)			\
+	((l) + ((l) >> 12) + ((l) >> 14) + ((l) >> 25) + 13 + 12)
+
+struct vslz_block {
+	uint32_t			magic;
+#define VSLZ_BLOCK_MAGIC		0x5A4C4256
+	uint32_t			zlen;
+	uint32_t			len;
+	uint32_t			grouping;
+	uint32_t			vxid_min;
+	uint32_t			vxid_max;
+	/* First field of the SLT_Timestamp records, 0 if none */
+	double				t_min;
+	double				t_max;
+	struct vslq_tagset		tags;
+};
+
+/*
+ * A transaction group in a ring file: the descriptors of its
+ * transactions, followed by their records. All lengths are in words.
+ */
+struct vsl_ring_trans {
+	uint32_t			vxid;
+	uint32_t			vxid_parent;
+	uint32_t			level;
+	uint32_t			type;
+	uint32_t			reason;
+	uint32_t			len;
+};
+
+struct vsl_ring_frame {
+	uint32_t			len;
+	uint32_t			n_trans;
+	struct vsl_ring_trans		trans[];
 };
 
+/* Larger groups are dropped by the writer and rejected by readers */
+#define VSL_RING_MAXTRANS		65536
+
+/* vsl_ring.c */
+struct VSL_cursor *vslc_ring_new(struct VSL_data *vsl, int fd,
+    const char *name, unsigned options);
+
 /* vsl_query.c */
 struct vslq_query;
 struct vslq_query *vslq_newquery(struct VSL_data *vsl,
     enum VSL_grouping_e grouping, const char *query);
 void vslq_deletequery(struct vslq_query **pquery);
 int vslq_runquery(const struct vslq_query *query,
-    struct VSL_transaction * const ptrans[]);
+    struct VSL_transaction * const ptrans[], const struct vslq_tagset *tags);
+int vslq_prefilter(const struct vslq_query *query,
+    const struct vslq_tagset *tags, unsigned vxid_min, unsigned vxid_max);
@@ -43,6 +43,7 @@
 #include "vdef.h"
 #include "vas.h"
 #include "miniobj.h"
+#include "vgz.h"
 #include "vmb.h"
 
 #include "vqueue.h"
@@ -304,6 +305,16 @@ struct vslc_file {
 	ssize_t				buflen;
 	uint32_t			*buf;
 
+	/* Compressed files */
+	int				z;
+	z_stream			vz;
+	ssize_t				zpos;
+	ssize_t				zlen;
+	size_t				zbuflen;
+	unsigned char			*zbuf;
+	vslc_skip_f			*skip;
+	void				*skip_priv;
+
 	struct VSL_cursor		cursor;
 
 };
@@ -319,6 +330,9 @@ vslc_file_delete(const struct VSL_cursor *cursor)
 		(void)close(c->fd);
 	if (c->buf != NULL)
 		free(c->buf);
+	if (c->z)
+		(void)inflateEnd(&c->vz);
+	free(c->zbuf);
 	FREE_OBJ(c);
 }
 
@@ -338,6 +352,98 @@ vslc_file_readn(int fd, void *buf, size_t n)
 	return (t);
 }
 
+/* Skip n bytes of fd, by reading them if it does not seek */
+static ssize_t
+vslc_file_skipn(int fd, void *buf, size_t buflen, size_t n)
+{
+	ssize_t i;
+
+	if (lseek(fd, n, SEEK_CUR) >= 0)
+		return (n);
+	while (n > 0) {
+		i = vslc_file_readn(fd, buf, n < buflen ? n : buflen);
+		if (i <= 0)
+			return (i);
+		n -= i;
+	}
+	return (1);
+}
+
+/* Read the next block of a compressed file which is not skipped */
+static int
+vslc_file_block(struct vslc_file *c)
+{
+	struct vslz_block blk;
+	ssize_t i;
+
+	while (1) {
+		i = vslc_file_readn(c->fd, &blk, sizeof blk);
+		if (i < 0)
+			return (-4);	/* I/O error */
+		if (i == 0)
+			return (-1);	/* EOF */
+		if (i != sizeof blk || blk.magic != VSLZ_BLOCK_MAGIC ||
+		    blk.len % 4 != 0 || blk.len > VSLZ_BLOCK_MAX ||
+		    blk.zlen > VSLZ_ZBOUND(VSLZ_BLOCK_MAX))
+			return (-3);	/* Corrupt file */
+		if (c->skip == NULL || !c->skip(c->skip_priv, &blk))
+			break;
+		i = vslc_file_skipn(c->fd, c->buf, VSL_BYTES(c->buflen),
+		    blk.zlen);
+		if (i < 0)
+			return (-4);
+		if (i == 0)
+			return (-1);
+	}
+
+	if (c->zbuflen < blk.zlen) {
+		c->zbuflen = blk.zlen;
+		c->zbuf = realloc(c->zbuf, c->zbuflen);
+		AN(c->zbuf);
+	}
+	if (c->buflen < VSL_WORDS(blk.len)) {
+		c->buflen = VSL_WORDS(blk.len);
+		c->buf = realloc(c->buf, VSL_BYTES(c->buflen));
+		AN(c->buf);
+	}
+	i = vslc_file_readn(c->fd, c->zbuf, blk.zlen);
+	if (i < 0)
+		return (-4);
+	if (i != blk.zlen)
+		return (-1);
+	AZ(inflateReset(&c->vz));
+	c->vz.next_in = c->zbuf;
+	c->vz.avail_in = blk.zlen;
+	c->vz.next_out = (Bytef *)c->buf;
+	c->vz.avail_out = blk.len;
+	if (inflate(&c->vz, Z_FINISH) != Z_STREAM_END ||
+	    c->vz.total_out != blk.len)
+		return (-3);
+	c->zpos = 0;
+	c->zlen = VSL_WORDS(blk.len);
+	return (1);
+}
+
+static int
+vslc_file_znext(struct vslc_file *c)
+{
+	int i;
+
+	do {
+		c->cursor.rec.ptr = NULL;
+		while (c->zpos >= c->zlen) {
+			i = vslc_file_block(c);
+			if (i < 0)
+				return (i);
+		}
+		c->cursor.rec.ptr = c->buf + c->zpos;
+		c->zpos = VSL_NEXT(c->cursor.rec.ptr) - c->buf;
+		if (c->zpos > c->zlen)
+			return (-3);
+	} while (VSL_TAG(c->cursor.rec.ptr) == SLT__Batch);
+	return (1);
+}
+
 static int
 vslc_file_next(const struct VSL_cursor *cursor)
 {
@@ -351,6 +457,13 @@ vslc_file_next(const struct VSL_cursor *cursor)
 	if (c->error)
 		return (c->error);
 
+	if (c->z) {
+		i = vslc_file_znext(c);
+		if (i < -1)
+			c->error = i;
+		return (i);
+	}
+
 	do {
 		c->cursor.rec.ptr = NULL;
 		assert(c->buflen >= 2);
@@ -389,18 +502,32 @@ vslc_file_reset(const struct VSL_cursor *cursor)
 	return (-1);
 }
 
+static void
+vslc_file_setskip(const struct VSL_cursor *cursor, vslc_skip_f *func,
+    void *priv)
+{
+	struct vslc_file *c;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_FILE_MAGIC);
+	assert(&c->cursor == cursor);
+	c->skip = func;
+	c->skip_priv = priv;
+}
+
 static const struct vslc_tbl vslc_file_tbl = {
 	.magic		= VSLC_TBL_MAGIC,
 	.delete		= vslc_file_delete,
 	.next		= vslc_file_next,
 	.reset		= vslc_file_reset,
 	.check		= NULL,
+	.setskip	= vslc_file_setskip,
 };
 
 struct VSL_cursor *
 VSL_CursorFile(struct VSL_data *vsl, const char *name, unsigned options)
 {
 	struct vslc_file *c;
+	struct VSL_cursor *c_ring;
 	int fd;
 	int close_fd = 0;
 	char buf[] = VSL_FILE_ID;
@@ -408,7 +535,6 @@ VSL_CursorFile(struct VSL_data *vsl, const char *name, unsigned options)
 
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 	AN(name);
-	(void)options;
 
 	if (!strcmp(name, "-"))
 		fd = STDIN_FILENO;
@@ -431,7 +557,14 @@ VSL_CursorFile(struct VSL_data *vsl, const char *name, unsigned options)
 		return (NULL);
 	}
 	assert(i == sizeof buf);
-	if (memcmp(buf, VSL_FILE_ID, sizeof buf)) {
+	if (!memcmp(buf, VSL_RFILE_ID, sizeof buf)) {
+		c_ring = vslc_ring_new(vsl, fd, name, options);
+		if (close_fd)
+			(void)close(fd);
+		return (c_ring);
+	}
+	if (memcmp(buf, VSL_FILE_ID, sizeof buf) &&
+	    memcmp(buf, VSL_ZFILE_ID, sizeof buf)) {
 		if (close_fd)
 			(void)close(fd);
 		vsl_diag(vsl, "Not a VSL file: %s", name);
@@ -450,6 +583,9 @@ VSL_CursorFile(struct VSL_data *vsl, const char *name, unsigned options)
 
 	c->fd = fd;
 	c->close_fd = close_fd;
+	c->z = !memcmp(buf, VSL_ZFILE_ID, sizeof buf);
+	if (c->z)
+		AZ(inflateInit2(&c->vz, 31));
 	c->buflen = VSL_WORDS(BUFSIZ);
 	c->buf = malloc(VSL_BYTES(c->buflen));
 	AN(c->buf);
@@ -30,6 +30,7 @@
 
 #include "config.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -52,6 +53,7 @@
 #define VTX_CACHE 10
 #define VTX_BUFSIZE_MIN 64
 #define VTX_SHMCHUNKS 3
+#define VSLQ_MT_QUEUE 64	/* Queued transactions per worker thread */
 
 static const char * const vsl_t_names[VSL_t__MAX] = {
 	[VSL_t_unknown]	= "unknown",
@@ -84,6 +86,17 @@ struct vslc_raw {
 	const uint32_t		*ptr;
 };
 
+struct vslc_mem {
+	unsigned		magic;
+#define VSLC_MEM_MAGIC		0x6C2B0E37
+
+	struct VSL_cursor	cursor;
+
+	const uint32_t		*start;
+	const uint32_t		*next;
+	const uint32_t		*end;
+};
+
 struct synth {
 	unsigned		magic;
 #define SYNTH_MAGIC		0xC654479F
@@ -154,6 +167,8 @@ struct vtx {
 				       should be appended */
 #define VTX_F_READY		0x8 /* This vtx and all it's children are
 				       complete */
+#define VTX_F_DETACHED		0x10 /* Handed to a worker thread, no
+					longer in the tree */
 
 	enum VSL_transaction_e	type;
 	enum VSL_reason_e	reason;
@@ -171,8 +186,14 @@ struct vtx {
 
 	struct chunkhead	chunks;
 	size_t			len;
+	struct vslq_tagset	tags;
 
 	struct vslc_vtx		c;
+
+	/* Worker thread dispatch */
+	unsigned		seq;
+	VSLQ_dispatch_f		*func;
+	void			*priv;
 };
 
 struct VSLQ {
@@ -185,6 +206,9 @@ struct VSLQ {
 
 	enum VSL_grouping_e	grouping;
 
+	/* The cursor hands out whole groups, see vslq_ring() */
+	int			ring;
+
 	/* Structured mode */
 	struct vtx_tree		tree;
 	VTAILQ_HEAD(,vtx)	ready;
@@ -194,6 +218,23 @@ struct VSLQ {
 	VTAILQ_HEAD(,vtx)	cache;
 	unsigned		n_cache;
 
+	/* Worker threads, see VSLQ_SetThreads() */
+	struct {
+		unsigned		n_thread;
+		int			ordered;
+		pthread_t		*thread;
+		pthread_mutex_t		mtx;
+		pthread_cond_t		cond;
+		VTAILQ_HEAD(,vtx)	work;
+		unsigned		n_work;
+		VTAILQ_HEAD(,vtx)	done;
+		unsigned		n_busy;
+		unsigned		seq_next;
+		unsigned		seq_turn;
+		int			retval;
+		int			stop;
+	} mt;
+
 	/* Raw mode */
 	struct {
 		struct vslc_raw		c;
@@ -265,6 +306,46 @@ static const struct vslc_tbl vslc_raw_tbl = {
 	.check	= NULL,
 };
 
+static int
+vslc_mem_next(const struct VSL_cursor *cursor)
+{
+	struct vslc_mem *c;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_MEM_MAGIC);
+	assert(&c->cursor == cursor);
+
+	if (c->next >= c->end) {
+		c->cursor.rec.ptr = NULL;
+		return (0);
+	}
+	c->cursor.rec.ptr = c->next;
+	c->next = VSL_NEXT(c->next);
+	if (c->next > c->end)
+		return (-3);
+	return (1);
+}
+
+static int
+vslc_mem_reset(const struct VSL_cursor *cursor)
+{
+	struct vslc_mem *c;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_MEM_MAGIC);
+	assert(&c->cursor == cursor);
+
+	c->cursor.rec.ptr = NULL;
+	c->next = c->start;
+	return (0);
+}
+
+static const struct vslc_tbl vslc_mem_tbl = {
+	.magic	= VSLC_TBL_MAGIC,
+	.delete	= NULL,
+	.next	= vslc_mem_next,
+	.reset	= vslc_mem_reset,
+	.check	= NULL,
+};
+
 static int
 vslc_vtx_next(const struct VSL_cursor *cursor)
 {
@@ -435,6 +516,10 @@ vtx_append(struct VSLQ *vslq, struct vtx *vtx, const struct VSLC_ptr *start,
 		return;
 	AN(start);
 
+	if (vtx->flags & VTX_F_COMPLETE)
+		/* Will not be scanned, assume any tag */
+		memset(&vtx->tags, 0xff, sizeof vtx->tags);
+
 	if (VSL_Check(vslq->c, start) == 2 &&
 	    !VTAILQ_EMPTY(&vtx->shmchunks_free)) {
 		/* Shmref it */
@@ -511,6 +596,7 @@ vtx_new(struct VSLQ *vslq)
 	vtx->n_childready = 0;
 	vtx->n_descend = 0;
 	vtx->len = 0;
+	memset(&vtx->tags, 0, sizeof vtx->tags);
 	(void)vslc_vtx_reset(&vtx->c.cursor);
 
 	return (vtx);
@@ -525,6 +611,7 @@ vtx_retire(struct VSLQ *vslq, struct vtx **pvtx)
 	struct vtx *child;
 	struct synth *synth;
 	struct chunk *chunk;
+	unsigned detached;
 
 	AN(vslq);
 	TAKE_OBJ_NOTNULL(vtx, pvtx, VTX_MAGIC);
@@ -532,6 +619,7 @@ vtx_retire(struct VSLQ *vslq, struct vtx **pvtx)
 	AN(vtx->flags & VTX_F_COMPLETE);
 	AN(vtx->flags & VTX_F_READY);
 	AZ(vtx->parent);
+	detached = vtx->flags & VTX_F_DETACHED;
 
 	while (!VTAILQ_EMPTY(&vtx->child)) {
 		child = VTAILQ_FIRST(&vtx->child);
@@ -548,7 +636,8 @@ vtx_retire(struct VSLQ *vslq, struct vtx **pvtx)
 	AZ(vtx->n_child);
 	AZ(vtx->n_descend);
 	vtx->n_childready = 0;
-	AN(VRB_REMOVE(vtx_tree, &vslq->tree, &vtx->key));
+	if (!detached)
+		AN(VRB_REMOVE(vtx_tree, &vslq->tree, &vtx->key));
 	vtx->key.vxid = 0;
 	vtx->flags = 0;
 
@@ -573,8 +662,10 @@ vtx_retire(struct VSLQ *vslq, struct vtx **pvtx)
 		}
 	}
 	vtx->len = 0;
-	AN(vslq->n_outstanding);
-	vslq->n_outstanding--;
+	if (!detached) {
+		AN(vslq->n_outstanding);
+		vslq->n_outstanding--;
+	}
 
 	if (vslq->n_cache < VTX_CACHE) {
 		VTAILQ_INSERT_HEAD(&vslq->cache, vtx, list_child);
@@ -585,6 +676,32 @@ vtx_retire(struct VSLQ *vslq, struct vtx **pvtx)
 	}
 }
 
+/* Detach a ready vtx and all it's children from the managed list so it
+   can be handed to a worker thread. Shm references are buffered, as the
+   cursor moves on without them */
+static void
+vtx_detach(struct VSLQ *vslq, struct vtx *vtx)
+{
+	struct vtx *child;
+	struct chunk *chunk, *chunk2;
+
+	CHECK_OBJ_NOTNULL(vtx, VTX_MAGIC);
+	AN(vtx->flags & VTX_F_READY);
+	AZ(vtx->flags & VTX_F_DETACHED);
+
+	VTAILQ_FOREACH(child, &vtx->child, list_child)
+		vtx_detach(vslq, child);
+	VTAILQ_FOREACH_SAFE(chunk, &vtx->chunks, list, chunk2) {
+		CHECK_OBJ_NOTNULL(chunk, CHUNK_MAGIC);
+		if (chunk->type == chunk_t_shm)
+			chunk_shm_to_buf(vslq, chunk);
+	}
+	AN(VRB_REMOVE(vtx_tree, &vslq->tree, &vtx->key));
+	vtx->flags |= VTX_F_DETACHED;
+	AN(vslq->n_outstanding);
+	vslq->n_outstanding--;
+}
+
 /* Lookup a vtx by vxid from the managed list */
 static struct vtx *
 vtx_lookup(const struct VSLQ *vslq, unsigned vxid)
@@ -855,6 +972,7 @@ vtx_scan(struct VSLQ *vslq, struct vtx *vtx)
 	while (!(vtx->flags & VTX_F_COMPLETE) &&
 	    vslc_vtx_next(&vtx->c.cursor) == 1) {
 		ptr = vtx->c.cursor.rec.ptr;
+		vslq_tagset_set(&vtx->tags, VSL_TAG(ptr));
 		if (VSL_ID(ptr) != vtx->key.vxid) {
 			(void)vtx_diag_tag(vtx, ptr, "vxid mismatch");
 			continue;
@@ -887,6 +1005,10 @@ vtx_scan(struct VSLQ *vslq, struct vtx *vtx)
 			break;
 		}
 	}
+
+	if ((vtx->flags & VTX_F_COMPLETE) && vtx->c.offset < vtx->len)
+		/* Records after the end will not be scanned */
+		memset(&vtx->tags, 0xff, sizeof vtx->tags);
 }
 
 /* Force a vtx into complete status by synthing the necessary outstanding
@@ -915,10 +1037,12 @@ vslq_callback(const struct VSLQ *vslq, struct vtx *vtx, VSLQ_dispatch_f *func,
     void *priv)
 {
 	unsigned n = vtx->n_descend + 1;
-	struct vtx *vtxs[n];
-	struct VSL_transaction trans[n];
-	struct VSL_transaction *ptrans[n + 1];
+	struct vtx **vtxs;
+	struct VSL_transaction *trans;
+	struct VSL_transaction **ptrans;
+	struct vslq_tagset tags;
 	unsigned i, j;
+	int match, r;
 
 	AN(vslq);
 	CHECK_OBJ_NOTNULL(vtx, VTX_MAGIC);
@@ -932,6 +1056,15 @@ vslq_callback(const struct VSLQ *vslq, struct vtx *vtx, VSLQ_dispatch_f *func,
 	    vtx->type != VSL_t_req)
 		return (0);
 
+	/* Sessions can have any number of descendants, so keep these off
+	   the stack */
+	vtxs = calloc(n, sizeof *vtxs);
+	trans = calloc(n, sizeof *trans);
+	ptrans = calloc(n + 1, sizeof *ptrans);
+	AN(vtxs);
+	AN(trans);
+	AN(ptrans);
+
 	/* Build transaction array */
 	(void)vslc_vtx_reset(&vtx->c.cursor);
 	vtxs[0] = vtx;
@@ -970,11 +1103,23 @@ vslq_callback(const struct VSLQ *vslq, struct vtx *vtx, VSLQ_dispatch_f *func,
 	ptrans[i] = NULL;
 
 	/* Query test goes here */
-	if (vslq->query != NULL && !vslq_runquery(vslq->query, ptrans))
-		return (0);
+	match = 1;
+	if (vslq->query != NULL) {
+		tags = vtxs[0]->tags;
+		for (i = 1; i < n; i++)
+			vslq_tagset_merge(&tags, &vtxs[i]->tags);
+		match = vslq_runquery(vslq->query, ptrans, &tags);
+	}
 
 	/* Callback */
-	return ((func)(vslq->vsl, ptrans, priv));
+	r = 0;
+	if (match)
+		r = (func)(vslq->vsl, ptrans, priv);
+
+	free(vtxs);
+	free(trans);
+	free(ptrans);
+	return (r);
 }
 
 /* Create a synthetic log record. The record will be inserted at the
@@ -1012,6 +1157,7 @@ vtx_synth_rec(struct vtx *vtx, unsigned tag, const char *fmt, ...)
 	}
 	synth->data[0] = (((tag & 0xff) << 24) | l);
 	synth->offset = vtx->c.offset;
+	vslq_tagset_set(&vtx->tags, tag & 0xff);
 
 	VTAILQ_FOREACH_REVERSE(it, &vtx->synth, synthhead, list) {
 		/* Make sure the synth list is sorted on offset */
@@ -1050,6 +1196,53 @@ vtx_diag_tag(struct vtx *vtx, const uint32_t *ptr, const char *reason)
 	return (-1);
 }
 
+/* Skip the blocks of compressed files where the query cannot match any
+   of our transactions, which must then be whole within the block */
+static int v_matchproto_(vslc_skip_f)
+vslq_skip(void *priv, const struct vslz_block *blk)
+{
+	struct VSLQ *vslq;
+
+	CAST_OBJ_NOTNULL(vslq, priv, VSLQ_MAGIC);
+	AN(blk);
+	if (vslq->query == NULL)
+		return (0);
+	if (vslq->grouping != VSL_g_raw &&
+	    (blk->grouping == VSL_g_raw || blk->grouping >= VSL_g__MAX ||
+	    vslq->grouping > blk->grouping))
+		return (0);
+	return (!vslq_prefilter(vslq->query, &blk->tags, blk->vxid_min,
+	    blk->vxid_max));
+}
+
+static void
+vslq_setskip(struct VSLQ *vslq)
+{
+	const struct vslc_tbl *tbl;
+
+	if (vslq->c == NULL || vslq->query == NULL)
+		return;
+	CAST_OBJ_NOTNULL(tbl, vslq->c->priv_tbl, VSLC_TBL_MAGIC);
+	if (tbl->setskip != NULL)
+		tbl->setskip(vslq->c, vslq_skip, vslq);
+}
+
+/* Take the groups from cursors of ring files as they are, when they
+   hold our groups whole */
+static void
+vslq_setring(struct VSLQ *vslq)
+{
+	const struct vslc_tbl *tbl;
+
+	vslq->ring = 0;
+	if (vslq->c == NULL || vslq->grouping == VSL_g_raw)
+		return;
+	CAST_OBJ_NOTNULL(tbl, vslq->c->priv_tbl, VSLC_TBL_MAGIC);
+	if (tbl->grouping != NULL && tbl->frame != NULL &&
+	    (int)vslq->grouping <= tbl->grouping(vslq->c))
+		vslq->ring = 1;
+}
+
 struct VSLQ *
 VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
     enum VSL_grouping_e grouping, const char *querystring)
@@ -1078,6 +1271,8 @@ VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
 	}
 	vslq->grouping = grouping;
 	vslq->query = query;
+	vslq_setskip(vslq);
+	vslq_setring(vslq);
 
 	/* Setup normal mode */
 	VRB_INIT(&vslq->tree);
@@ -1086,6 +1281,12 @@ VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
 	VTAILQ_INIT(&vslq->shmrefs);
 	VTAILQ_INIT(&vslq->cache);
 
+	/* Setup worker threads */
+	AZ(pthread_mutex_init(&vslq->mt.mtx, NULL));
+	AZ(pthread_cond_init(&vslq->mt.cond, NULL));
+	VTAILQ_INIT(&vslq->mt.work);
+	VTAILQ_INIT(&vslq->mt.done);
+
 	/* Setup raw mode */
 	vslq->raw.c.magic = VSLC_RAW_MAGIC;
 	vslq->raw.c.cursor.priv_tbl = &vslc_raw_tbl;
@@ -1105,12 +1306,26 @@ VSLQ_Delete(struct VSLQ **pvslq)
 {
 	struct VSLQ *vslq;
 	struct vtx *vtx;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(vslq, pvslq, VSLQ_MAGIC);
 
 	(void)VSLQ_Flush(vslq, NULL, NULL);
 	AZ(vslq->n_outstanding);
 
+	if (vslq->mt.n_thread > 0) {
+		AZ(pthread_mutex_lock(&vslq->mt.mtx));
+		AZ(vslq->mt.n_busy);
+		vslq->mt.stop = 1;
+		AZ(pthread_cond_broadcast(&vslq->mt.cond));
+		AZ(pthread_mutex_unlock(&vslq->mt.mtx));
+		for (u = 0; u < vslq->mt.n_thread; u++)
+			AZ(pthread_join(vslq->mt.thread[u], NULL));
+		free(vslq->mt.thread);
+	}
+	AZ(pthread_cond_destroy(&vslq->mt.cond));
+	AZ(pthread_mutex_destroy(&vslq->mt.mtx));
+
 	if (vslq->c != NULL) {
 		VSL_DeleteCursor(vslq->c);
 		vslq->c = NULL;
@@ -1148,7 +1363,9 @@ VSLQ_SetCursor(struct VSLQ *vslq, struct VSL_cursor **cp)
 		AN(*cp);
 		vslq->c = *cp;
 		*cp = NULL;
+		vslq_setskip(vslq);
 	}
+	vslq_setring(vslq);
 }
 
 /* Regard each log line as a single transaction, feed it through the query
@@ -1190,7 +1407,7 @@ vslq_raw(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
 		return (i);
 
 	if (vslq->query != NULL &&
-	    !vslq_runquery(vslq->query, vslq->raw.ptrans))
+	    !vslq_runquery(vslq->query, vslq->raw.ptrans, NULL))
 		return (i);
 
 	r = (func)(vslq->vsl, vslq->raw.ptrans, priv);
@@ -1200,6 +1417,209 @@ vslq_raw(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
 	return (i);
 }
 
+/* Scratch arrays for splitting a ring frame, n entries each, n + 1 for
+   ptrans */
+struct vslq_ring_split {
+	unsigned		n;
+	struct vslc_mem		*mem;
+	struct VSL_transaction	*trans;
+	struct VSL_transaction	*sub;
+	struct VSL_transaction	**ptrans;
+	unsigned		*root;
+	unsigned		*link;
+	unsigned		*tail;
+};
+
+/* Query and callback on the n transactions of trans, which are in the
+   order vslq_callback() would give them */
+static int
+vslq_ring_callback(const struct VSLQ *vslq, struct VSL_transaction *trans,
+    unsigned n, struct VSL_transaction **ptrans, VSLQ_dispatch_f *func,
+    void *priv)
+{
+	unsigned u;
+
+	for (u = 0; u < n; u++)
+		ptrans[u] = &trans[u];
+	ptrans[u] = NULL;
+
+	if (vslq->query != NULL &&
+	    !vslq_runquery(vslq->query, ptrans, NULL))
+		return (0);
+	return ((func)(vslq->vsl, ptrans, priv));
+}
+
+/* Split the transactions in rs->trans into our groups and dispatch
+   them. Returns 0, -3 if they do not form a tree, or the return value
+   from func */
+static int
+vslq_ring_split(const struct VSLQ *vslq, enum VSL_grouping_e grouping,
+    const struct vslq_ring_split *rs, VSLQ_dispatch_f *func, void *priv)
+{
+	struct VSL_transaction *trans, *sub;
+	unsigned *root, *link, *tail;
+	unsigned n, u, j, r0;
+	int r;
+
+	n = rs->n;
+	trans = rs->trans;
+	sub = rs->sub;
+	root = rs->root;
+	link = rs->link;
+	tail = rs->tail;
+
+	if (vslq->grouping == grouping)
+		return (vslq_ring_callback(vslq, trans, n, rs->ptrans,
+		    func, priv));
+
+	if (vslq->grouping == VSL_g_vxid) {
+		for (u = 0; u < n; u++) {
+			trans[u].level = 1;
+			trans[u].vxid_parent = 0;
+			r = vslq_ring_callback(vslq, &trans[u], 1, rs->ptrans,
+			    func, priv);
+			if (r)
+				return (r);
+		}
+		return (0);
+	}
+
+	/* Requests out of sessions. The parents come before their
+	   children, in the order of the children, so each subtree is
+	   found by following the parents forward */
+	assert(vslq->grouping == VSL_g_request);
+	j = 0;
+	for (u = 0; u < n; u++) {
+		link[u] = n;
+		root[u] = n;
+		if (trans[u].type == VSL_t_req &&
+		    trans[u].reason == VSL_r_rxreq) {
+			root[u] = tail[u] = u;
+			continue;
+		}
+		if (u == 0)
+			continue;
+		while (j < u && trans[j].vxid != trans[u].vxid_parent)
+			j++;
+		if (j == u)
+			return (-3);
+		r0 = root[j];
+		if (r0 == n)
+			continue;
+		root[u] = r0;
+		link[tail[r0]] = u;
+		tail[r0] = u;
+	}
+	for (u = 0; u < n; u++) {
+		if (root[u] != u)
+			continue;
+		for (j = 0, r0 = u; r0 < n; j++, r0 = link[r0]) {
+			sub[j] = trans[r0];
+			sub[j].level -= trans[u].level - 1;
+		}
+		sub[0].vxid_parent = 0;
+		r = vslq_ring_callback(vslq, sub, j, rs->ptrans, func, priv);
+		if (r)
+			return (r);
+	}
+	return (0);
+}
+
+/* Dispatch a group from a ring file, split into our groups when the ring
+   groups at a higher level. The frame comes from a file another process
+   writes, so it is checked before we trust it. Returns 0, -3 for a
+   corrupt frame, or the return value from func */
+static int
+vslq_ring_frame(const struct VSLQ *vslq, enum VSL_grouping_e grouping,
+    const struct vsl_ring_frame *f, VSLQ_dispatch_f *func, void *priv)
+{
+	struct vslq_ring_split rs;
+	const uint32_t *p, *e;
+	unsigned n, u;
+	size_t l;
+	int r;
+
+	n = f->n_trans;
+	if (n == 0)
+		return (0);
+	l = VSL_WORDS(sizeof *f);
+	if (n > VSL_RING_MAXTRANS || f->len < l ||
+	    n > (f->len - l) / VSL_WORDS(sizeof f->trans[0]))
+		return (-3);
+	p = (const void *)f;
+	e = p + f->len;
+	p += VSL_WORDS(sizeof *f + n * sizeof f->trans[0]);
+
+	memset(&rs, 0, sizeof rs);
+	rs.n = n;
+	rs.mem = calloc(n, sizeof *rs.mem);
+	rs.trans = calloc(n, sizeof *rs.trans);
+	rs.sub = calloc(n, sizeof *rs.sub);
+	rs.ptrans = calloc(n + 1, sizeof *rs.ptrans);
+	rs.root = calloc(3 * n, sizeof *rs.root);
+	AN(rs.mem);
+	AN(rs.trans);
+	AN(rs.sub);
+	AN(rs.ptrans);
+	AN(rs.root);
+	rs.link = rs.root + n;
+	rs.tail = rs.link + n;
+
+	r = 0;
+	for (u = 0; u < n; u++) {
+		if (f->trans[u].len > e - p) {
+			r = -3;
+			break;
+		}
+		INIT_OBJ(&rs.mem[u], VSLC_MEM_MAGIC);
+		rs.mem[u].cursor.priv_tbl = &vslc_mem_tbl;
+		rs.mem[u].cursor.priv_data = &rs.mem[u];
+		rs.mem[u].start = rs.mem[u].next = p;
+		p += f->trans[u].len;
+		rs.mem[u].end = p;
+		rs.trans[u].vxid = f->trans[u].vxid;
+		rs.trans[u].vxid_parent = f->trans[u].vxid_parent;
+		rs.trans[u].level = f->trans[u].level;
+		rs.trans[u].type = (enum VSL_transaction_e)f->trans[u].type;
+		rs.trans[u].reason = (enum VSL_reason_e)f->trans[u].reason;
+		rs.trans[u].c = &rs.mem[u].cursor;
+	}
+	if (r == 0)
+		r = vslq_ring_split(vslq, grouping, &rs, func, priv);
+
+	free(rs.mem);
+	free(rs.trans);
+	free(rs.sub);
+	free(rs.ptrans);
+	free(rs.root);
+	return (r);
+}
+
+/* Take the next group from a ring file */
+static int
+vslq_ring(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
+{
+	const struct vslc_tbl *tbl;
+	const struct vsl_ring_frame *f;
+	int i, r;
+
+	AN(vslq->ring);
+	CAST_OBJ_NOTNULL(tbl, vslq->c->priv_tbl, VSLC_TBL_MAGIC);
+	AN(tbl->frame);
+	AN(tbl->grouping);
+	i = tbl->frame(vslq->c, &f);
+	if (i <= 0 || func == NULL)
+		return (i);
+	AN(f);
+	if (f->n_trans == 0)
+		return (i);
+	r = vslq_ring_frame(vslq, (enum VSL_grouping_e)tbl->grouping(vslq->c),
+	    f, func, priv);
+	if (r)
+		return (r);
+	return (i);
+}
+
 /* Check the beginning of the shmref list, and buffer refs that are at
  * warning level.
  *
@@ -1278,6 +1698,151 @@ vslq_next(struct VSLQ *vslq)
 	return (i);
 }
 
+/*--------------------------------------------------------------------
+ * Worker threads
+ *
+ * Grouping stays on the dispatching thread. Ready transactions are
+ * detached and queued to the workers, which run the query and the
+ * callback, and put them on the done list for the dispatching thread to
+ * retire. In ordered mode the callbacks are serialized in the order the
+ * transactions became ready.
+ */
+
+struct vslq_turn {
+	unsigned		magic;
+#define VSLQ_TURN_MAGIC		0x5A4F2B1D
+	struct VSLQ		*vslq;
+	struct vtx		*vtx;
+};
+
+/* Wait until it is this vtx' turn. Called with the mutex held */
+static void
+vslq_mt_wait(struct VSLQ *vslq, const struct vtx *vtx)
+{
+
+	while (vslq->mt.seq_turn != vtx->seq)
+		AZ(pthread_cond_wait(&vslq->mt.cond, &vslq->mt.mtx));
+}
+
+static int v_matchproto_(VSLQ_dispatch_f)
+vslq_mt_ordered(struct VSL_data *vsl, struct VSL_transaction * const trans[],
+    void *priv)
+{
+	struct vslq_turn *turn;
+
+	CAST_OBJ_NOTNULL(turn, priv, VSLQ_TURN_MAGIC);
+	AZ(pthread_mutex_lock(&turn->vslq->mt.mtx));
+	vslq_mt_wait(turn->vslq, turn->vtx);
+	AZ(pthread_mutex_unlock(&turn->vslq->mt.mtx));
+	return (turn->vtx->func(vsl, trans, turn->vtx->priv));
+}
+
+static void *
+vslq_mt_thread(void *priv)
+{
+	struct VSLQ *vslq;
+	struct vslq_turn turn;
+	struct vtx *vtx;
+	int r;
+
+	CAST_OBJ_NOTNULL(vslq, priv, VSLQ_MAGIC);
+	INIT_OBJ(&turn, VSLQ_TURN_MAGIC);
+	turn.vslq = vslq;
+
+	AZ(pthread_mutex_lock(&vslq->mt.mtx));
+	while (1) {
+		vtx = VTAILQ_FIRST(&vslq->mt.work);
+		if (vtx == NULL) {
+			if (vslq->mt.stop)
+				break;
+			AZ(pthread_cond_wait(&vslq->mt.cond, &vslq->mt.mtx));
+			continue;
+		}
+		CHECK_OBJ(vtx, VTX_MAGIC);
+		VTAILQ_REMOVE(&vslq->mt.work, vtx, list_vtx);
+		AN(vslq->mt.n_work);
+		vslq->mt.n_work--;
+		AZ(pthread_cond_broadcast(&vslq->mt.cond));
+		AZ(pthread_mutex_unlock(&vslq->mt.mtx));
+
+		AN(vtx->func);
+		if (vslq->mt.ordered) {
+			turn.vtx = vtx;
+			r = vslq_callback(vslq, vtx, vslq_mt_ordered, &turn);
+		} else
+			r = vslq_callback(vslq, vtx, vtx->func, vtx->priv);
+
+		AZ(pthread_mutex_lock(&vslq->mt.mtx));
+		if (vslq->mt.ordered) {
+			/* Take our turn even if the query did not match */
+			vslq_mt_wait(vslq, vtx);
+			vslq->mt.seq_turn++;
+		}
+		if (r != 0 && vslq->mt.retval == 0)
+			vslq->mt.retval = r;
+		VTAILQ_INSERT_TAIL(&vslq->mt.done, vtx, list_vtx);
+		AN(vslq->mt.n_busy);
+		vslq->mt.n_busy--;
+		AZ(pthread_cond_broadcast(&vslq->mt.cond));
+	}
+	AZ(pthread_mutex_unlock(&vslq->mt.mtx));
+	return (NULL);
+}
+
+/* Hand a ready vtx to the worker threads */
+static void
+vslq_mt_queue(struct VSLQ *vslq, struct vtx *vtx, VSLQ_dispatch_f *func,
+    void *priv)
+{
+
+	AN(vslq->mt.n_thread);
+	AN(func);
+	vtx_detach(vslq, vtx);
+	vtx->func = func;
+	vtx->priv = priv;
+
+	AZ(pthread_mutex_lock(&vslq->mt.mtx));
+	while (vslq->mt.n_work >= VSLQ_MT_QUEUE * vslq->mt.n_thread)
+		AZ(pthread_cond_wait(&vslq->mt.cond, &vslq->mt.mtx));
+	vtx->seq = vslq->mt.seq_next++;
+	VTAILQ_INSERT_TAIL(&vslq->mt.work, vtx, list_vtx);
+	vslq->mt.n_work++;
+	vslq->mt.n_busy++;
+	AZ(pthread_cond_broadcast(&vslq->mt.cond));
+	AZ(pthread_mutex_unlock(&vslq->mt.mtx));
+}
+
+/* Retire the vtxs the worker threads are done with, waiting for all of
+   them if wait is set. Returns the first non-zero callback return value
+   since the last call */
+static int
+vslq_mt_reap(struct VSLQ *vslq, int wait)
+{
+	VTAILQ_HEAD(,vtx) done;
+	struct vtx *vtx;
+	int r;
+
+	if (vslq->mt.n_thread == 0)
+		return (0);
+
+	VTAILQ_INIT(&done);
+	AZ(pthread_mutex_lock(&vslq->mt.mtx));
+	while (wait && vslq->mt.n_busy > 0)
+		AZ(pthread_cond_wait(&vslq->mt.cond, &vslq->mt.mtx));
+	VTAILQ_CONCAT(&done, &vslq->mt.done, list_vtx);
+	r = vslq->mt.retval;
+	vslq->mt.retval = 0;
+	AZ(pthread_mutex_unlock(&vslq->mt.mtx));
+
+	while (!VTAILQ_EMPTY(&done)) {
+		vtx = VTAILQ_FIRST(&done);
+		VTAILQ_REMOVE(&done, vtx, list_vtx);
+		vtx_retire(vslq, &vtx);
+		AZ(vtx);
+	}
+	return (r);
+}
+
 /* Test query and report any ready transactions */
 static int
 vslq_process_ready(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
@@ -1292,6 +1857,10 @@ vslq_process_ready(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
 		CHECK_OBJ_NOTNULL(vtx, VTX_MAGIC);
 		VTAILQ_REMOVE(&vslq->ready, vtx, list_vtx);
 		AN(vtx->flags & VTX_F_READY);
+		if (func != NULL && vslq->mt.n_thread > 0) {
+			vslq_mt_queue(vslq, vtx, func, priv);
+			continue;
+		}
 		if (func != NULL)
 			i = vslq_callback(vslq, vtx, func, priv);
 		vtx_retire(vslq, &vtx);
@@ -1320,9 +1889,24 @@ VSLQ_Dispatch(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
 
 	if (vslq->grouping == VSL_g_raw)
 		return (vslq_raw(vslq, func, priv));
+	if (vslq->ring)
+		return (vslq_ring(vslq, func, priv));
+
+	/* Retire what the worker threads are done with */
+	r = vslq_mt_reap(vslq, 0);
+	if (r)
+		/* User return code */
+		return (r);
 
 	/* Process next cursor input */
 	i = vslq_next(vslq);
+	if (i < 0) {
+		/* Let the worker threads finish before reporting the end of
+		   log or error condition */
+		r = vslq_mt_reap(vslq, 1);
+		if (r)
+			return (r);
+	}
 	if (i <= 0)
 		/* At end of log or cursor reports error condition */
 		return (i);
@@ -1374,6 +1958,7 @@ int
 VSLQ_Flush(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
 {
 	struct vtx *vtx;
+	int i, r;
 
 	CHECK_OBJ_NOTNULL(vslq, VSLQ_MAGIC);
 
@@ -1384,5 +1969,37 @@ VSLQ_Flush(struct VSLQ *vslq, VSLQ_dispatch_f *func, void *priv)
 		vtx_force(vslq, vtx, "flush");
 	}
 
-	return (vslq_process_ready(vslq, func, priv));
+	i = vslq_process_ready(vslq, func, priv);
+	r = vslq_mt_reap(vslq, 1);
+	return (i ? i : r);
+}
+
+int
+VSLQ_Wait(struct VSLQ *vslq)
+{
+
+	CHECK_OBJ_NOTNULL(vslq, VSLQ_MAGIC);
+	return (vslq_mt_reap(vslq, 1));
+}
+
+int
+VSLQ_SetThreads(struct VSLQ *vslq, unsigned nthreads, int ordered)
+{
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(vslq, VSLQ_MAGIC);
+
+	if (vslq->mt.n_thread > 0)
+		return (vsl_diag(vslq->vsl, "Worker threads already started"));
+	if (nthreads == 0 || vslq->grouping == VSL_g_raw)
+		return (0);
+
+	vslq->mt.thread = calloc(nthreads, sizeof *vslq->mt.thread);
+	AN(vslq->mt.thread);
+	vslq->mt.ordered = ordered;
+	vslq->mt.n_thread = nthreads;
+	for (u = 0; u < nthreads; u++)
+		AZ(pthread_create(&vslq->mt.thread[u], NULL, vslq_mt_thread,
+		    vslq));
+	return (0);
 }
@@ -49,11 +49,62 @@
 #include "vsl_api.h"
 #include "vxp.h"
 
+/*--------------------------------------------------------------------
+ * Queries are compiled from the vex tree into a postfix program over
+ * the leaf tests. The tests are decided in a single pass over the
+ * records, looking only at the tests that apply to the tag of each
+ * record, and the program is evaluated in three-valued logic as the
+ * tests turn true, so the pass stops as soon as the outcome is known.
+ * Tests on tags which are not present in the transactions are false up
+ * front, which can decide a query without looking at any records.
+ *
+ * Tests with the same prefix and field share a slot, which holds the
+ * part of the record to test and its numerical values, so those are
+ * located and parsed once per record.
+ */
+
+#define VSLQ_UNKNOWN	2
+
+struct vslq_test {
+	const struct vex	*vex;
+	unsigned		slot;
+	struct vslq_tagset	tags;
+};
+
+struct vslq_op {
+	unsigned		tok;	/* T_AND, T_OR, T_NOT or 0 for a test */
+	unsigned		test;
+};
+
+struct vslq_slot {
+	const uint32_t		*ptr;
+	unsigned		flags;
+#define SLOT_F_FOUND		(1 << 0)
+#define SLOT_F_INT		(1 << 1)
+#define SLOT_F_INT_OK		(1 << 2)
+#define SLOT_F_FLOAT		(1 << 3)
+#define SLOT_F_FLOAT_OK		(1 << 4)
+	const char		*b;
+	const char		*e;
+	long long		val_int;
+	double			val_float;
+};
+
 struct vslq_query {
 	unsigned		magic;
 #define VSLQ_QUERY_MAGIC	0x122322A5
 
 	struct vex		*vex;
+
+	unsigned		n_test;
+	struct vslq_test	*test;
+	unsigned		n_op;
+	struct vslq_op		*op;
+	unsigned		n_slot;
+
+	/* Tests on records of tag t are tagtest[tagidx[t]..tagidx[t+1]] */
+	unsigned		tagidx[SLT__MAX + 1];
+	unsigned		*tagtest;
 };
 
 #define VSLQ_TEST_NUMOP(TYPE, PRE_LHS, OP, PRE_RHS)		\
@@ -114,37 +165,113 @@ vslq_test_vxid(const struct vex *vex, const struct VSL_transaction *trans)
 	NEEDLESS(return (0));
 }
 
-static int
-vslq_test_rec(const struct vex *vex, const struct VSLC_ptr *rec)
+/* Test a range of vxids. Returns 1 or 0 if the test is true or false
+   for all of them, VSLQ_UNKNOWN otherwise */
+static unsigned
+vslq_test_vxid_range(const struct vex *vex, long long lo, long long hi)
 {
 	const struct vex_rhs *rhs;
-	long long lhs_int = 0;
-	double lhs_float = 0.;
-	const char *b, *e, *q;
-	char *p;
-	int i;
+	long long v;
 
 	AN(vex);
-	AN(rec);
+	rhs = vex->rhs;
+	CHECK_OBJ_NOTNULL(rhs, VEX_RHS_MAGIC);
+	if (rhs->type != VEX_INT)
+		WRONG("Wrong RHS type for vxid");
+	v = rhs->val_int;
+	assert(lo <= hi);
+
+	switch (vex->tok) {
+	case T_EQ:
+		if (v < lo || v > hi)
+			return (0);
+		if (lo == hi)
+			return (1);
+		break;
+	case T_NEQ:
+		if (v < lo || v > hi)
+			return (1);
+		if (lo == hi)
+			return (0);
+		break;
+	case '<':
+		if (hi < v)
+			return (1);
+		if (lo >= v)
+			return (0);
+		break;
+	case '>':
+		if (lo > v)
+			return (1);
+		if (hi <= v)
+			return (0);
+		break;
+	case T_LEQ:
+		if (hi <= v)
+			return (1);
+		if (lo > v)
+			return (0);
+		break;
+	case T_GEQ:
+		if (lo >= v)
+			return (1);
+		if (hi < v)
+			return (0);
+		break;
+	default:
+		WRONG("Bad vxid expression token");
+	}
+	return (VSLQ_UNKNOWN);
+}
+
+static int
+vslq_test_level(const struct vex_lhs *lhs, const struct VSL_transaction *t)
+{
+
+	if (lhs->level < 0)
+		return (1);
+	if (lhs->level_pm < 0)
+		/* OK if less than or equal */
+		return (t->level <= lhs->level);
+	if (lhs->level_pm > 0)
+		/* OK if greater than or equal */
+		return (t->level >= lhs->level);
+	/* OK if equal */
+	return (t->level == lhs->level);
+}
 
-	b = VSL_CDATA(rec->ptr);
-	e = b + VSL_LEN(rec->ptr) - 1;
+/* Locate the prefix and field of the record in the slot. Returns zero if
+   the record does not have them */
+static int
+vslq_slot_fill(struct vslq_slot *slot, const struct vex_lhs *lhs,
+    const uint32_t *ptr)
+{
+	const char *b, *e;
+	int i;
+
+	if (slot->ptr == ptr)
+		return (slot->flags & SLOT_F_FOUND);
+	slot->ptr = ptr;
+	slot->flags = 0;
+
+	b = VSL_CDATA(ptr);
+	e = b + VSL_LEN(ptr) - 1;
 
 	/* Prefix */
-	if (vex->lhs->prefix != NULL) {
-		if (strncasecmp(b, vex->lhs->prefix, vex->lhs->prefixlen))
+	if (lhs->prefix != NULL) {
+		if (strncasecmp(b, lhs->prefix, lhs->prefixlen))
 			return (0);
-		if (b[vex->lhs->prefixlen] != ':')
+		if (b[lhs->prefixlen] != ':')
 			return (0);
-		b += vex->lhs->prefixlen + 1;
+		b += lhs->prefixlen + 1;
 		/* Skip ws */
 		while (*b && isspace(*b))
 			b++;
 	}
 
 	/* Field */
-	if (vex->lhs->field > 0) {
-		for (e = b, i = 0; *e && i < vex->lhs->field; i++) {
+	if (lhs->field > 0) {
+		for (e = b, i = 0; *e && i < lhs->field; i++) {
 			b = e;
 			/* Skip ws */
 			while (*b && isspace(*b))
@@ -155,11 +282,72 @@ vslq_test_rec(const struct vex *vex, const struct VSLC_ptr *rec)
 				e++;
 		}
 		assert(b <= e);
-		if (*b == '\0' || i < vex->lhs->field)
+		if (*b == '\0' || i < lhs->field)
 			/* Missing field - no match */
 			return (0);
 	}
 
+	slot->b = b;
+	slot->e = e;
+	slot->flags = SLOT_F_FOUND;
+	return (1);
+}
+
+static int
+vslq_slot_int(struct vslq_slot *slot)
+{
+	char *p;
+
+	if (!(slot->flags & SLOT_F_INT)) {
+		slot->flags |= SLOT_F_INT;
+		if (*slot->b == '\0')
+			/* Empty string doesn't match */
+			return (0);
+		slot->val_int = strtoll(slot->b, &p, 0);
+		if (*p == '\0' || isspace(*p))
+			slot->flags |= SLOT_F_INT_OK;
+	}
+	return (slot->flags & SLOT_F_INT_OK);
+}
+
+static int
+vslq_slot_float(struct vslq_slot *slot)
+{
+	const char *q;
+
+	if (!(slot->flags & SLOT_F_FLOAT)) {
+		slot->flags |= SLOT_F_FLOAT;
+		if (*slot->b == '\0')
+			/* Empty string doesn't match */
+			return (0);
+		slot->val_float = VNUMpfx(slot->b, &q);
+		if (isnan(slot->val_float))
+			return (0);
+		if (q != NULL && q > slot->b && !isspace(q[-1]))
+			return (0);
+		slot->flags |= SLOT_F_FLOAT_OK;
+	}
+	return (slot->flags & SLOT_F_FLOAT_OK);
+}
+
+static int
+vslq_test_rec(const struct vex *vex, struct vslq_slot *slot,
+    const uint32_t *ptr)
+{
+	const struct vex_rhs *rhs;
+	long long lhs_int = 0;
+	double lhs_float = 0.;
+	const char *b, *e;
+	int i;
+
+	AN(vex);
+	AN(ptr);
+
+	if (!vslq_slot_fill(slot, vex->lhs, ptr))
+		return (0);
+	b = slot->b;
+	e = slot->e;
+
 	if (vex->tok == T_TRUE)
 		/* Always true */
 		return (1);
@@ -176,21 +364,16 @@ vslq_test_rec(const struct vex *vex, const struct VSLC_ptr *rec)
 	case T_LEQ:		/* <= */
 	case T_GEQ:		/* >= */
 		/* Numerical comparison */
-		if (*b == '\0')
-			/* Empty string doesn't match */
-			return (0);
 		switch (rhs->type) {
 		case VEX_INT:
-			lhs_int = strtoll(b, &p, 0);
-			if (*p != '\0' && !isspace(*p))
+			if (!vslq_slot_int(slot))
 				return (0); /* Can't parse - no match */
+			lhs_int = slot->val_int;
 			break;
 		case VEX_FLOAT:
-			lhs_float = VNUMpfx(b, &q);
-			if (isnan(lhs_float))
-				return (0);
-			if (q != NULL && q > b && !isspace(q[-1]))
+			if (!vslq_slot_float(slot))
 				return (0);
+			lhs_float = slot->val_float;
 			break;
 		default:
 			WRONG("Wrong RHS type");
@@ -256,44 +439,76 @@ vslq_test_rec(const struct vex *vex, const struct VSLC_ptr *rec)
 	NEEDLESS(return (0));
 }
 
+/* Evaluate the program on the test values. Returns VSLQ_UNKNOWN if
+   the outcome depends on tests not yet decided */
+static unsigned
+vslq_eval(const struct vslq_query *query, const unsigned char *val)
+{
+	unsigned char stack[query->n_op];
+	const struct vslq_op *op;
+	unsigned a, b, sp = 0, u;
+
+	for (u = 0; u < query->n_op; u++) {
+		op = &query->op[u];
+		switch (op->tok) {
+		case T_AND:
+			assert(sp >= 2);
+			b = stack[--sp];
+			a = stack[sp - 1];
+			if (a == 0 || b == 0)
+				stack[sp - 1] = 0;
+			else if (a == 1 && b == 1)
+				stack[sp - 1] = 1;
+			else
+				stack[sp - 1] = VSLQ_UNKNOWN;
+			break;
+		case T_OR:
+			assert(sp >= 2);
+			b = stack[--sp];
+			a = stack[sp - 1];
+			if (a == 1 || b == 1)
+				stack[sp - 1] = 1;
+			else if (a == 0 && b == 0)
+				stack[sp - 1] = 0;
+			else
+				stack[sp - 1] = VSLQ_UNKNOWN;
+			break;
+		case T_NOT:
+			assert(sp >= 1);
+			if (stack[sp - 1] != VSLQ_UNKNOWN)
+				stack[sp - 1] = !stack[sp - 1];
+			break;
+		default:
+			assert(op->test < query->n_test);
+			stack[sp++] = val[op->test];
+			break;
+		}
+	}
+	assert(sp == 1);
+	return (stack[0]);
+}
+
+/* Decide the tests on the records, until the outcome is known */
 static int
-vslq_test(const struct vex *vex, struct VSL_transaction * const ptrans[])
+vslq_scan(const struct vslq_query *query,
+    struct VSL_transaction * const ptrans[], unsigned char *val)
 {
+	struct vslq_slot slot[query->n_slot];
+	const struct vslq_test *test;
 	struct VSL_transaction *t;
+	const uint32_t *ptr;
+	unsigned u, v, tag;
 	int i;
 
-	CHECK_OBJ_NOTNULL(vex, VEX_MAGIC);
-	CHECK_OBJ_NOTNULL(vex->lhs, VEX_LHS_MAGIC);
-	AN(vex->lhs->tags);
-	assert(vex->lhs->vxid <= 1);
-
-	if (vex->lhs->vxid) {
-		AZ(vex->lhs->taglist);
-		for (t = ptrans[0]; t != NULL; t = *++ptrans)
-			if (vslq_test_vxid(vex, t))
-				return (1);
-		return (0);
-	}
-
-	AN(vex->lhs->taglist);
-
+	memset(slot, 0, sizeof slot);
 	for (t = ptrans[0]; t != NULL; t = *++ptrans) {
-		if (vex->lhs->level >= 0) {
-			if (vex->lhs->level_pm < 0) {
-				/* OK if less than or equal */
-				if (t->level > vex->lhs->level)
-					continue;
-			} else if (vex->lhs->level_pm > 0) {
-				/* OK if greater than or equal */
-				if (t->level < vex->lhs->level)
-					continue;
-			} else {
-				/* OK if equal */
-				if (t->level != vex->lhs->level)
-					continue;
-			}
-		}
-
+		for (u = 0; u < query->n_test; u++)
+			if (val[u] == VSLQ_UNKNOWN &&
+			    vslq_test_level(query->test[u].vex->lhs, t))
+				break;
+		if (u == query->n_test)
+			/* No undecided tests at this level */
+			continue;
 		AZ(VSL_ResetCursor(t->c));
 		while (1) {
 			i = VSL_Next(t->c);
@@ -302,53 +517,152 @@ vslq_test(const struct vex *vex, struct VSL_transaction * const ptrans[])
 			if (i == 0)
 				break;
 			assert(i == 1);
-			AN(t->c->rec.ptr);
-
-			if (!vbit_test(vex->lhs->tags, VSL_TAG(t->c->rec.ptr)))
-				continue;
-
-			i = vslq_test_rec(vex, &t->c->rec);
-			if (i)
-				return (i);
+			ptr = t->c->rec.ptr;
+			AN(ptr);
+			tag = VSL_TAG(ptr);
+			for (u = query->tagidx[tag]; u < query->tagidx[tag + 1];
+			    u++) {
+				v = query->tagtest[u];
+				if (val[v] != VSLQ_UNKNOWN)
+					continue;
+				test = &query->test[v];
+				if (!vslq_test_level(test->vex->lhs, t))
+					continue;
+				assert(test->slot < query->n_slot);
+				if (!vslq_test_rec(test->vex, &slot[test->slot],
+				    ptr))
+					continue;
+				val[v] = 1;
+				i = vslq_eval(query, val);
+				if (i != VSLQ_UNKNOWN)
+					return (i);
+			}
 		}
 	}
 
-	return (0);
+	/* Undecided tests did not match */
+	for (u = 0; u < query->n_test; u++)
+		if (val[u] == VSLQ_UNKNOWN)
+			val[u] = 0;
+	i = vslq_eval(query, val);
+	assert(i != VSLQ_UNKNOWN);
+	return (i);
 }
 
-static int
-vslq_exec(const struct vex *vex, struct VSL_transaction * const ptrans[])
+static void
+vslq_compile(struct vslq_query *query, const struct vex *vex)
 {
-	int r;
+	struct vslq_test *test;
+	const struct vex_lhs *lhs;
+	unsigned u;
+	int tag;
 
 	CHECK_OBJ_NOTNULL(vex, VEX_MAGIC);
 
 	switch (vex->tok) {
 	case T_OR:
-		AN(vex->a);
-		AN(vex->b);
-		r = vslq_exec(vex->a, ptrans);
-		if (r != 0)
-			return (r);
-		return (vslq_exec(vex->b, ptrans));
 	case T_AND:
-		AN(vex->a);
-		AN(vex->b);
-		r = vslq_exec(vex->a, ptrans);
-		if (r <= 0)
-			return (r);
-		return (vslq_exec(vex->b, ptrans));
+		vslq_compile(query, vex->a);
+		vslq_compile(query, vex->b);
+		query->op[query->n_op++].tok = vex->tok;
+		break;
 	case T_NOT:
-		AN(vex->a);
 		AZ(vex->b);
-		r = vslq_exec(vex->a, ptrans);
-		if (r < 0)
-			return (r);
-		return (!r);
+		vslq_compile(query, vex->a);
+		query->op[query->n_op++].tok = vex->tok;
+		break;
+	default:
+		lhs = vex->lhs;
+		CHECK_OBJ_NOTNULL(lhs, VEX_LHS_MAGIC);
+		AN(lhs->tags);
+		assert(lhs->vxid <= 1);
+		test = &query->test[query->n_test];
+		test->vex = vex;
+		if (lhs->vxid)
+			AZ(lhs->taglist);
+		else
+			AN(lhs->taglist);
+		for (tag = 0; tag < SLT__MAX; tag++)
+			if (vbit_test(lhs->tags, tag))
+				vslq_tagset_set(&test->tags, tag);
+
+		/* Share the slot of a test with the same prefix and field */
+		for (u = 0; u < query->n_test; u++) {
+			if (query->test[u].vex->lhs->field != lhs->field)
+				continue;
+			if (query->test[u].vex->lhs->prefix == NULL &&
+			    lhs->prefix == NULL)
+				break;
+			if (query->test[u].vex->lhs->prefix != NULL &&
+			    lhs->prefix != NULL &&
+			    !strcasecmp(query->test[u].vex->lhs->prefix,
+			    lhs->prefix))
+				break;
+		}
+		if (u < query->n_test)
+			test->slot = query->test[u].slot;
+		else
+			test->slot = query->n_slot++;
+
+		query->op[query->n_op].tok = 0;
+		query->op[query->n_op++].test = query->n_test++;
+		break;
+	}
+}
+
+static void
+vslq_count(const struct vex *vex, unsigned *n_op, unsigned *n_test)
+{
+
+	CHECK_OBJ_NOTNULL(vex, VEX_MAGIC);
+	(*n_op)++;
+	switch (vex->tok) {
+	case T_OR:
+	case T_AND:
+		vslq_count(vex->a, n_op, n_test);
+		vslq_count(vex->b, n_op, n_test);
+		break;
+	case T_NOT:
+		vslq_count(vex->a, n_op, n_test);
+		break;
 	default:
-		return (vslq_test(vex, ptrans));
+		(*n_test)++;
+		break;
+	}
+}
+
+static void
+vslq_setup(struct vslq_query *query)
+{
+	unsigned n_op = 0, n_test = 0, n, u;
+	int tag;
+
+	CHECK_OBJ_NOTNULL(query, VSLQ_QUERY_MAGIC);
+	vslq_count(query->vex, &n_op, &n_test);
+	query->op = calloc(n_op, sizeof *query->op);
+	AN(query->op);
+	query->test = calloc(n_test, sizeof *query->test);
+	AN(query->test);
+	vslq_compile(query, query->vex);
+	assert(query->n_op == n_op);
+	assert(query->n_test == n_test);
+
+	/* Index the tests by tag */
+	n = 0;
+	for (tag = 0; tag < SLT__MAX; tag++)
+		for (u = 0; u < n_test; u++)
+			if (vslq_tagset_test(&query->test[u].tags, tag))
+				n++;
+	query->tagtest = calloc(n + 1, sizeof *query->tagtest);
+	AN(query->tagtest);
+	n = 0;
+	for (tag = 0; tag < SLT__MAX; tag++) {
+		query->tagidx[tag] = n;
+		for (u = 0; u < n_test; u++)
+			if (vslq_tagset_test(&query->test[u].tags, tag))
+				query->tagtest[n++] = u;
 	}
-	NEEDLESS(return 0);
+	query->tagidx[SLT__MAX] = n;
 }
 
 struct vslq_query *
@@ -372,6 +686,7 @@ vslq_newquery(struct VSL_data *vsl, enum VSL_grouping_e grouping,
 		ALLOC_OBJ(query, VSLQ_QUERY_MAGIC);
 		XXXAN(query);
 		query->vex = vex;
+		vslq_setup(query);
 	}
 	VSB_destroy(&vsb);
 	return (query);
@@ -388,20 +703,76 @@ vslq_deletequery(struct vslq_query **pquery)
 	vex_Free(&query->vex);
 	AZ(query->vex);
 
+	free(query->test);
+	free(query->op);
+	free(query->tagtest);
 	FREE_OBJ(query);
 }
 
 int
 vslq_runquery(const struct vslq_query *query,
-    struct VSL_transaction * const ptrans[])
+    struct VSL_transaction * const ptrans[], const struct vslq_tagset *tags)
 {
+	unsigned char val[query->n_test];
+	const struct vslq_test *test;
 	struct VSL_transaction *t;
-	int r;
+	unsigned u;
+	int i, r;
 
 	CHECK_OBJ_NOTNULL(query, VSLQ_QUERY_MAGIC);
 
-	r = vslq_exec(query->vex, ptrans);
+	/* Decide what we can without looking at the records */
+	for (u = 0; u < query->n_test; u++) {
+		test = &query->test[u];
+		val[u] = VSLQ_UNKNOWN;
+		if (test->vex->lhs->vxid) {
+			val[u] = 0;
+			for (i = 0; ptrans[i] != NULL && !val[u]; i++)
+				val[u] = vslq_test_vxid(test->vex, ptrans[i]);
+		} else if (tags != NULL &&
+		    !vslq_tagset_overlap(tags, &test->tags))
+			val[u] = 0;
+		else {
+			for (i = 0; ptrans[i] != NULL; i++)
+				if (vslq_test_level(test->vex->lhs, ptrans[i]))
+					break;
+			if (ptrans[i] == NULL)
+				/* No transaction at the level */
+				val[u] = 0;
+		}
+	}
+	r = vslq_eval(query, val);
+	if (r != VSLQ_UNKNOWN)
+		return (r);
+
+	r = vslq_scan(query, ptrans, val);
 	for (t = ptrans[0]; t != NULL; t = *++ptrans)
 		AZ(VSL_ResetCursor(t->c));
 	return (r);
 }
+
+/* Returns zero if the query cannot match any transaction made of records
+   with tags in the set and vxids in the range */
+int
+vslq_prefilter(const struct vslq_query *query,
+    const struct vslq_tagset *tags, unsigned vxid_min, unsigned vxid_max)
+{
+	unsigned char val[query->n_test];
+	const struct vslq_test *test;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(query, VSLQ_QUERY_MAGIC);
+	AN(tags);
+
+	for (u = 0; u < query->n_test; u++) {
+		test = &query->test[u];
+		if (test->vex->lhs->vxid)
+			val[u] = vslq_test_vxid_range(test->vex, vxid_min,
+			    vxid_max);
+		else if (!vslq_tagset_overlap(tags, &test->tags))
+			val[u] = 0;
+		else
+			val[u] = VSLQ_UNKNOWN;
+	}
+	return (vslq_eval(query, val) != 0);
+}
@@ -0,0 +1,499 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Shared memory rings of completed transactions
+ *
+ * A single writer publishes the transaction groups it gets from its
+ * VSLQ into a memory mapped file, and any number of readers attach to
+ * the file with VSL_CursorFile.  Each group is written as one frame
+ * holding the transaction descriptors followed by their records, so
+ * the readers' VSLQs hand out the groups without building them again.
+ *
+ * Positions in the ring count words since it was created.  The writer
+ * advances reserve past the space it is about to overwrite before
+ * writing a frame, and commit past the frame when it is complete.  The
+ * readers copy a frame out, and check that reserve did not move past
+ * it by a lap while they were copying.  A frame does not wrap around the
+ * end of the ring; a zero word there sends the readers to the start.
+ */
+
+#include "config.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "miniobj.h"
+#include "vmb.h"
+#include "vqueue.h"
+#include "vre.h"
+#include "vsb.h"
+
+#include "vapi/vsl.h"
+
+#include "vsl_api.h"
+
+struct vsl_ring_head {
+	char			id[4];
+	uint32_t		grouping;
+	uint64_t		size;
+	uint64_t		reserve;
+	uint64_t		commit;
+	uint64_t		pid;
+	uint32_t		closed;
+	uint32_t		pad[5];
+	uint32_t		log[];
+};
+
+/*--------------------------------------------------------------------
+ * Writer
+ */
+
+struct VSL_ring {
+	unsigned		magic;
+#define VSL_RING_MAGIC		0x2F0C7A4B
+	struct vsl_ring_head	*head;
+	size_t			len;
+	uint32_t		*buf;
+	size_t			buflen;
+	unsigned		dropped;
+};
+
+struct VSL_ring *
+VSL_RingOpen(struct VSL_data *vsl, const char *name, size_t size,
+    enum VSL_grouping_e grouping)
+{
+	struct VSL_ring *ring;
+	struct vsl_ring_head *head;
+	struct vsb *vsb;
+	size_t len;
+	int fd;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	AN(name);
+	if (grouping == VSL_g_raw || grouping >= VSL_g__MAX) {
+		(void)vsl_diag(vsl, "Illegal ring grouping");
+		return (NULL);
+	}
+	size = VSL_WORDS(size);
+	if (size < VSL_WORDS(64 * 1024)) {
+		(void)vsl_diag(vsl, "Ring size too small");
+		return (NULL);
+	}
+	len = sizeof *head + VSL_BYTES(size);
+
+	/* Readers of a previous ring keep their file until it is closed */
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_printf(vsb, "%s.%jd", name, (intmax_t)getpid());
+	AZ(VSB_finish(vsb));
+	fd = open(VSB_data(vsb), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		(void)vsl_diag(vsl, "Cannot create %s: %s", VSB_data(vsb),
+		    strerror(errno));
+		VSB_destroy(&vsb);
+		return (NULL);
+	}
+	head = MAP_FAILED;
+	if (ftruncate(fd, len) == 0)
+		head = (void *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (head == MAP_FAILED) {
+		(void)vsl_diag(vsl, "Cannot map %s: %s", VSB_data(vsb),
+		    strerror(errno));
+		(void)close(fd);
+		(void)unlink(VSB_data(vsb));
+		VSB_destroy(&vsb);
+		return (NULL);
+	}
+	(void)close(fd);
+
+	head->grouping = grouping;
+	head->size = size;
+	head->pid = getpid();
+	memcpy(head->id, VSL_RFILE_ID, sizeof head->id);
+
+	if (rename(VSB_data(vsb), name)) {
+		(void)vsl_diag(vsl, "Cannot rename %s: %s", VSB_data(vsb),
+		    strerror(errno));
+		AZ(munmap((void *)head, len));
+		(void)unlink(VSB_data(vsb));
+		VSB_destroy(&vsb);
+		return (NULL);
+	}
+	VSB_destroy(&vsb);
+
+	ALLOC_OBJ(ring, VSL_RING_MAGIC);
+	AN(ring);
+	ring->head = head;
+	ring->len = len;
+	return (ring);
+}
+
+void
+VSL_RingClose(struct VSL_ring **pring)
+{
+	struct VSL_ring *ring;
+
+	TAKE_OBJ_NOTNULL(ring, pring, VSL_RING_MAGIC);
+	VWMB();
+	ring->head->closed = 1;
+	AZ(munmap((void *)ring->head, ring->len));
+	free(ring->buf);
+	FREE_OBJ(ring);
+}
+
+unsigned
+VSL_RingDropped(const struct VSL_ring *ring)
+{
+
+	CHECK_OBJ_NOTNULL(ring, VSL_RING_MAGIC);
+	return (ring->dropped);
+}
+
+/* Copy the records of t which pass the VSL_data filters to the frame
+   buffer */
+static int
+vsl_ring_copy(struct VSL_ring *ring, struct VSL_data *vsl,
+    const struct VSL_transaction *t, size_t *plen)
+{
+	const uint32_t *p;
+	size_t l;
+	int i;
+
+	while (1) {
+		i = VSL_Next(t->c);
+		if (i <= 0)
+			return (i);
+		if (!VSL_Match(vsl, t->c))
+			continue;
+		p = t->c->rec.ptr;
+		l = VSL_NEXT(p) - p;
+		if (ring->buflen < *plen + l) {
+			while (ring->buflen < *plen + l)
+				ring->buflen = 2 * (*plen + l);
+			ring->buf = realloc(ring->buf,
+			    VSL_BYTES(ring->buflen));
+			AN(ring->buf);
+		}
+		memcpy(ring->buf + *plen, p, VSL_BYTES(l));
+		*plen += l;
+	}
+}
+
+int v_matchproto_(VSLQ_dispatch_f)
+VSL_RingWrite(struct VSL_data *vsl, struct VSL_transaction * const pt[],
+    void *priv)
+{
+	struct VSL_ring *ring;
+	struct vsl_ring_head *head;
+	struct vsl_ring_frame *f;
+	struct vsl_ring_trans *rt;
+	uint64_t pos;
+	size_t len, off;
+	unsigned n, u;
+	int i;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	CAST_OBJ_NOTNULL(ring, priv, VSL_RING_MAGIC);
+	head = ring->head;
+	if (pt == NULL || pt[0] == NULL)
+		return (0);
+
+	/* Build the frame */
+	for (n = 0; pt[n] != NULL; n++)
+		continue;
+	if (n > VSL_RING_MAXTRANS) {
+		ring->dropped++;
+		return (0);
+	}
+	len = VSL_WORDS(sizeof *f + n * sizeof *rt);
+	if (ring->buflen < len) {
+		ring->buflen = 2 * len;
+		ring->buf = realloc(ring->buf, VSL_BYTES(ring->buflen));
+		AN(ring->buf);
+	}
+	for (u = 0; u < n; u++) {
+		off = len;
+		i = vsl_ring_copy(ring, vsl, pt[u], &len);
+		if (i < 0)
+			return (i);
+		rt = &((struct vsl_ring_frame *)ring->buf)->trans[u];
+		rt->vxid = pt[u]->vxid;
+		rt->vxid_parent = pt[u]->vxid_parent;
+		rt->level = pt[u]->level;
+		rt->type = pt[u]->type;
+		rt->reason = pt[u]->reason;
+		rt->len = len - off;
+	}
+	f = (void *)ring->buf;
+	f->len = len;
+	f->n_trans = n;
+	if (len > head->size / 4) {
+		/* Do not let one group push out much of the ring */
+		ring->dropped++;
+		return (0);
+	}
+
+	/* Place it in the ring */
+	pos = head->commit;
+	off = pos % head->size;
+	if (off + len > head->size)
+		pos += head->size - off;
+	head->reserve = pos + len;
+	VWMB();
+	if (pos != head->commit)
+		head->log[off] = 0;
+	memcpy(head->log + pos % head->size, ring->buf, VSL_BYTES(len));
+	VWMB();
+	head->commit = pos + len;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Reader
+ */
+
+struct vslc_ring {
+	unsigned			magic;
+#define VSLC_RING_MAGIC			0x0E4D9A61
+
+	struct VSL_cursor		cursor;
+
+	unsigned			options;
+	const struct vsl_ring_head	*head;
+	size_t				maplen;
+	uint64_t			pos;
+
+	uint32_t			*buf;
+	size_t				buflen;
+	const uint32_t			*next;
+	const uint32_t			*end;
+};
+
+static void
+vslc_ring_delete(const struct VSL_cursor *cursor)
+{
+	struct vslc_ring *c;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_RING_MAGIC);
+	assert(&c->cursor == cursor);
+	AZ(munmap((void *)TRUST_ME(c->head), c->maplen));
+	free(c->buf);
+	FREE_OBJ(c);
+}
+
+/* Check that the frame descriptors add up */
+static int
+vslc_ring_check(const struct vsl_ring_frame *f)
+{
+	size_t l;
+	unsigned u;
+
+	l = VSL_WORDS(sizeof *f);
+	if (f->n_trans > VSL_RING_MAXTRANS || f->len < l ||
+	    f->n_trans > (f->len - l) / VSL_WORDS(sizeof f->trans[0]))
+		return (0);
+	l = VSL_WORDS(sizeof *f + f->n_trans * sizeof f->trans[0]);
+	for (u = 0; u < f->n_trans; u++) {
+		if (f->trans[u].len > f->len - l)
+			return (0);
+		l += f->trans[u].len;
+	}
+	return (l == f->len);
+}
+
+/* Copy the next frame out of the ring */
+static int
+vslc_ring_frame(const struct VSL_cursor *cursor,
+    const struct vsl_ring_frame **pf)
+{
+	struct vslc_ring *c;
+	const struct vsl_ring_head *head;
+	uint64_t commit, reserve;
+	size_t off, len;
+	int bad;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_RING_MAGIC);
+	assert(&c->cursor == cursor);
+	head = c->head;
+	c->cursor.rec.ptr = NULL;
+	c->next = c->end = NULL;
+
+	while (1) {
+		commit = head->commit;
+		VRMB();
+		if (c->pos == commit) {
+			if (head->closed || (c->options & VSL_COPT_TAILSTOP))
+				return (-1);	/* EOF */
+			if (kill((pid_t)head->pid, 0) && errno == ESRCH)
+				return (-1);	/* Writer died */
+			return (0);
+		}
+		if (commit - c->pos > head->size)
+			/* Lapped by the writer, lose what we missed */
+			c->pos = commit - commit % head->size;
+		off = c->pos % head->size;
+		len = head->log[off];
+		if (len == 0) {
+			c->pos += head->size - off;
+			continue;
+		}
+		bad = len < VSL_WORDS(sizeof **pf) || off + len > head->size;
+		if (!bad) {
+			if (c->buflen < len) {
+				c->buflen = len;
+				c->buf = realloc(c->buf, VSL_BYTES(c->buflen));
+				AN(c->buf);
+			}
+			memcpy(c->buf, head->log + off, VSL_BYTES(len));
+		}
+		VRMB();
+		reserve = head->reserve;
+		if (reserve - c->pos > head->size) {
+			/* Overwritten while we copied it */
+			c->pos = commit;
+			continue;
+		}
+		if (bad || !vslc_ring_check((const void *)c->buf))
+			return (-3);	/* Corrupt ring */
+		c->pos += len;
+		break;
+	}
+	*pf = (const void *)c->buf;
+	return (1);
+}
+
+static int
+vslc_ring_next(const struct VSL_cursor *cursor)
+{
+	struct vslc_ring *c;
+	const struct vsl_ring_frame *f;
+	int i;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_RING_MAGIC);
+	assert(&c->cursor == cursor);
+
+	while (c->next == c->end) {
+		i = vslc_ring_frame(cursor, &f);
+		if (i <= 0)
+			return (i);
+		c->next = c->buf + VSL_WORDS(sizeof *f +
+		    f->n_trans * sizeof f->trans[0]);
+		c->end = c->buf + f->len;
+	}
+	c->cursor.rec.ptr = c->next;
+	c->next = VSL_NEXT(c->next);
+	if (c->next > c->end)
+		return (-3);
+	return (1);
+}
+
+static int
+vslc_ring_reset(const struct VSL_cursor *cursor)
+{
+	(void)cursor;
+	return (-1);
+}
+
+static int
+vslc_ring_grouping(const struct VSL_cursor *cursor)
+{
+	struct vslc_ring *c;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_RING_MAGIC);
+	assert(&c->cursor == cursor);
+	return (c->head->grouping);
+}
+
+static const struct vslc_tbl vslc_ring_tbl = {
+	.magic		= VSLC_TBL_MAGIC,
+	.delete		= vslc_ring_delete,
+	.next		= vslc_ring_next,
+	.reset		= vslc_ring_reset,
+	.check		= NULL,
+	.grouping	= vslc_ring_grouping,
+	.frame		= vslc_ring_frame,
+};
+
+struct VSL_cursor *
+vslc_ring_new(struct VSL_data *vsl, int fd, const char *name,
+    unsigned options)
+{
+	struct vslc_ring *c;
+	const struct vsl_ring_head *head;
+	struct stat st;
+	uint64_t commit;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof *head) {
+		(void)vsl_diag(vsl, "Cannot map ring %s", name);
+		return (NULL);
+	}
+	head = (void *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (head == MAP_FAILED) {
+		(void)vsl_diag(vsl, "Cannot map ring %s: %s", name,
+		    strerror(errno));
+		return (NULL);
+	}
+	if (sizeof *head + VSL_BYTES(head->size) != (size_t)st.st_size ||
+	    head->grouping == VSL_g_raw || head->grouping >= VSL_g__MAX) {
+		AZ(munmap((void *)TRUST_ME(head), st.st_size));
+		(void)vsl_diag(vsl, "Corrupt ring %s", name);
+		return (NULL);
+	}
+
+	ALLOC_OBJ(c, VSLC_RING_MAGIC);
+	if (c == NULL) {
+		AZ(munmap((void *)TRUST_ME(head), st.st_size));
+		(void)vsl_diag(vsl, "Out of memory");
+		return (NULL);
+	}
+	c->cursor.priv_tbl = &vslc_ring_tbl;
+	c->cursor.priv_data = c;
+	c->options = options;
+	c->head = head;
+	c->maplen = st.st_size;
+
+	/* Frames start at the beginning of each lap */
+	commit = head->commit;
+	if (options & VSL_COPT_TAIL)
+		c->pos = commit;
+	else
+		c->pos = commit - commit % head->size;
+
+	return (&c->cursor);
+}
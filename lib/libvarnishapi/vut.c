@@ -150,6 +150,13 @@ VUT_Arg(struct VUT *vut, int opt, const char *arg)
 		else if (vut->g_arg < 0)
 			VUT_Error(vut, 1, "Unknown grouping type: %s", arg);
 		return (1);
+	case 'j':
+		/* Query worker threads */
+		AN(arg);
+		vut->j_arg = (int)strtol(arg, &p, 10);
+		if (*p != '\0' || vut->j_arg <= 0)
+			VUT_Error(vut, 1, "-j: Invalid number '%s'", arg);
+		return (1);
 	case 'k':
 		/* Log transaction limit */
 		AN(arg);
@@ -267,10 +274,14 @@ VUT_Setup(struct VUT *vut)
 	if (vut->vslq == NULL)
 		VUT_Error(vut, 1, "Query expression error:\n%s",
 		    VSL_Error(vut->vsl));
+	if (vut->j_arg > 0 &&
+	    VSLQ_SetThreads(vut->vslq, (unsigned)vut->j_arg, 1))
+		VUT_Error(vut, 1, "%s", VSL_Error(vut->vsl));
 
 	/* Setup input */
 	if (vut->r_arg) {
-		c = VSL_CursorFile(vut->vsl, vut->r_arg, 0);
+		c = VSL_CursorFile(vut->vsl, vut->r_arg,
+		    vut->d_opt ? VSL_COPT_TAILSTOP : VSL_COPT_TAIL);
 		if (c == NULL)
 			VUT_Error(vut, 1, "%s", VSL_Error(vut->vsl));
 		VSLQ_SetCursor(vut->vslq, &c);
@@ -350,6 +361,9 @@ VUT_Main(struct VUT *vut)
 		if (vut->sighup && vut->sighup_f) {
 			/* sighup callback */
 			vut->sighup = 0;
+			i = VSLQ_Wait(vut->vslq);
+			if (i)
+				break;
 			i = vut->sighup_f(vut);
 			if (i)
 				break;
@@ -396,6 +410,10 @@ VUT_Main(struct VUT *vut)
 		else if (i == 0) {
 			/* Nothing to do but wait */
 			if (vut->idle_f) {
+				/* Quiesce the worker threads for the callback */
+				i = VSLQ_Wait(vut->vslq);
+				if (i)
+					break;
 				i = vut->idle_f(vut);
 				if (i)
 					break;
@@ -424,6 +442,8 @@ VUT_Main(struct VUT *vut)
 			fprintf(stderr, "Log overrun\n");
 	}
 
+	/* The caller may flush its output when we return */
+	(void)VSLQ_Wait(vut->vslq);
 	return (i);
 }
 
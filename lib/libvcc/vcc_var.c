@@ -34,6 +34,8 @@
 
 #include "vcc_compile.h"
 
+#include "vct.h"
+
 /*--------------------------------------------------------------------*/
 
 void v_matchproto_(sym_wildcard_t)
@@ -68,8 +70,9 @@ vcc_Var_Wildcard(struct vcc *tl, struct symbol *parent, struct symbol *sym)
 
 	/* Create the static identifier */
 	Fh(tl, 0, "static const struct gethdr_s %s =\n", VSB_data(vsb) + 1);
-	Fh(tl, 0, "    { %s, \"\\%03o%s:\"};\n",
-	    parent->rname, sym->nlen + 1, sym->name);
+	Fh(tl, 0, "    { %s, \"\\%03o%s:\", %u};\n",
+	    parent->rname, sym->nlen + 1, sym->name,
+	    vct_hdrhash(sym->name, sym->nlen));
 
 	/* Create the symbol r/l values */
 	sym->rname = TlDup(tl, VSB_data(vsb));
@@ -39,7 +39,7 @@ import sys
 import collections
 import struct
 
-TYPES = [ "counter", "gauge", "bitmap" ]
+TYPES = [ "counter", "gauge", "bitmap", "histogram" ]
 CTYPES = [ "uint64_t" ]
 LEVELS = [ "info", "diag", "debug" ]
 FORMATS = [ "integer", "bytes", "bitmap", "duration" ]
@@ -52,6 +52,10 @@ PARAMS = {
 	"format":	[ "integer", FORMATS],
 }
 
+# Must match VSC_HIST_BUCKETS and VSC_HIST_WORDS in include/vsc_priv.h
+HIST_BUCKETS = 112
+HIST_WORDS = 2 + HIST_BUCKETS
+
 # http://python3porting.com/problems.html#bytes-strings-and-unicode
 if sys.version_info < (3,):
 	def b(x):
@@ -85,7 +89,7 @@ class vscset(object):
 		assert not self.completed
 		self.mbrs.append(m)
 		m.param["index"] = self.off
-		self.off += 8
+		self.off += 8 * m.words()
 
 	def complete(self):
 		self.completed = True
@@ -107,6 +111,8 @@ class vscset(object):
 				if j in i.param:
 					ed[j] = i.param[j]
 			ed["index"] = i.param["index"]
+			if i.param["type"] == "histogram":
+				ed["buckets"] = HIST_BUCKETS
 			ed["name"] = i.arg
 			ed["docs"] = "\n".join(i.getdoc())
 		s=json.dumps(dd, separators=(",",":")) + "\0"
@@ -139,7 +145,11 @@ class vscset(object):
 		genhdr(fo, self.name)
 		fo.write(self.struct + " {\n")
 		for i in self.mbrs:
-			fo.write("\tuint64_t\t%s;\n" % i.arg)
+			if i.words() > 1:
+				fo.write("\tuint64_t\t%s[%d];\n" %
+				    (i.arg, i.words()))
+			else:
+				fo.write("\tuint64_t\t%s;\n" % i.arg)
 		fo.write("};\n")
 		fo.write("\n")
 
@@ -157,6 +167,10 @@ class vscset(object):
 			fo.write("void VSC_" + self.name + "_Summ")
 			fo.write("(" + self.struct + " *, ")
 			fo.write("const " + self.struct + " *);\n")
+			fo.write("struct vsc_shards *VSC_" + self.name)
+			fo.write("_Shards_New(" + self.struct + " *);\n")
+			fo.write(self.struct + " *VSC_" + self.name)
+			fo.write("_Shard(struct vsc_shards *);\n")
 
 	def emit_c(self):
 		fon="VSC_" + self.name + ".c"
@@ -185,6 +199,14 @@ class vscset(object):
 
 		fo.write("#undef PARANOIA\n")
 
+		for i in self.mbrs:
+			if i.param["type"] != "histogram":
+				continue
+			fo.write("\n_Static_assert(%d == VRT_VSC_HIST_WORDS,\n" %
+			    i.words())
+			fo.write("    \"VSC histogram '%s' has wrong size\");\n" %
+			    i.arg)
+
 		self.emit_json(fo)
 
 		fo.write("\n")
@@ -226,10 +248,18 @@ class vscset(object):
 			fo.write("(" + self.struct + " *dst, ")
 			fo.write("const " + self.struct + " *src)\n")
 			fo.write("{\n")
+			if max([i.words() for i in self.mbrs]) > 1:
+				fo.write("\tunsigned u;\n")
 			fo.write("\n")
 			fo.write("\tAN(dst);\n")
 			fo.write("\tAN(src);\n")
 			for i in self.mbrs:
+				if i.words() > 1:
+					fo.write("\tfor (u = 0; u < %d; u++)\n" %
+					    i.words())
+					fo.write("\t\tdst->%s[u] += src->%s[u];\n" %
+					    (i.arg, i.arg))
+					continue
 				s1 = "\tdst->" + i.arg + " +="
 				s2 = "src->" + i.arg + ";"
 				if len((s1 + " " + s2).expandtabs()) < 79:
@@ -238,6 +268,25 @@ class vscset(object):
 					fo.write(s1 + "\n\t    " + s2 + "\n")
 			fo.write("}\n")
 
+			fo.write("\n")
+			fo.write("struct vsc_shards *\n")
+			fo.write("VSC_" + self.name + "_Shards_New")
+			fo.write("(" + self.struct + " *dst)\n")
+			fo.write("{\n")
+			fo.write("\n")
+			fo.write("\treturn (VRT_VSC_Shards_New(dst, ")
+			fo.write("sizeof *dst));\n")
+			fo.write("}\n")
+
+			fo.write("\n")
+			fo.write(self.struct + " *\n")
+			fo.write("VSC_" + self.name + "_Shard")
+			fo.write("(struct vsc_shards *vss)\n")
+			fo.write("{\n")
+			fo.write("\n")
+			fo.write("\treturn (VRT_VSC_Shard(vss));\n")
+			fo.write("}\n")
+
 #######################################################################
 
 class directive(object):
@@ -320,6 +369,11 @@ class rst_vsc(directive):
 			exit(2)
 
 
+	def words(self):
+		if self.param["type"] == "histogram":
+			return HIST_WORDS
+		return 1
+
 	def emit_rst(self, fo):
 		fo.write("\n``%s`` – " % self.arg)
 		fo.write("`%s` - " % self.param["type"])
@@ -600,3 +600,61 @@ xyzzy_vsc_destroy(VRT_CTX)
 	AZ(vsc);
 	AZ(pthread_mutex_unlock(&vsc_mtx));
 }
+
+struct vsl_flood {
+	unsigned		magic;
+#define VSL_FLOOD_MAGIC		0x1d9a4b3e
+	pthread_t		thread;
+	unsigned		n;
+	VCL_INT			records;
+};
+
+static void *
+vsl_flood_thread(void *priv)
+{
+	struct vsl_flood *vf;
+	struct vsl_log vsl;
+	uint32_t buf[256];
+	VCL_INT i;
+
+	CAST_OBJ_NOTNULL(vf, priv, VSL_FLOOD_MAGIC);
+	memset(&vsl, 0, sizeof vsl);
+	vsl.wlb = buf;
+	vsl.wlp = buf;
+	vsl.wle = buf + 256;
+	for (i = 0; i < vf->records; i++) {
+		VSLb(&vsl, SLT_Debug, "vsl_flood %u %jd", vf->n, (intmax_t)i);
+		VSL_Flush(&vsl, 0);
+	}
+	return (NULL);
+}
+
+VCL_STRING v_matchproto_(td_debug_vsl_flood)
+xyzzy_vsl_flood(VRT_CTX, VCL_INT threads, VCL_INT records)
+{
+	struct vsl_flood *vf;
+	double t0, t1;
+	VCL_INT u;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	if (threads < 1 || records < 1) {
+		VRT_fail(ctx, "debug.vsl_flood: Invalid argument");
+		return (NULL);
+	}
+	vf = calloc(threads, sizeof *vf);
+	AN(vf);
+	t0 = VTIM_mono();
+	for (u = 0; u < threads; u++) {
+		vf[u].magic = VSL_FLOOD_MAGIC;
+		vf[u].n = u;
+		vf[u].records = records;
+		AZ(pthread_create(&vf[u].thread, NULL,
+		    vsl_flood_thread, &vf[u]));
+	}
+	for (u = 0; u < threads; u++)
+		AZ(pthread_join(vf[u].thread, NULL));
+	t1 = VTIM_mono();
+	free(vf);
+	return (WS_Printf(ctx->ws, "%.0f",
+	    threads * records / (t1 - t0)));
+}